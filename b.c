@@ -1,11 +1,15 @@
 #include "b.h"
 
 #define OBJ_DIR "obj"
+#define BENCH_DIR "bench"
 #define PROG_NAME "nojs"
 #define GCC "gcc"
 #define FLAGS "-Wall -Wextra -g -O2"
+#define LIBS "-lpthread -lm"
+
+int main(int argc, char **argv) {
+  bool build_bench = has_arg(argc, argv, "bench");
 
-int main(void) {
   INFO("Start building Nojs\n");
   
   if (!dir_exists(OBJ_DIR))
@@ -16,28 +20,50 @@ int main(void) {
   char *current_dir = pwd();
   char *obj_dir = pathjoin(current_dir, OBJ_DIR);
   Array *o_files = array_new(c_files->count);
+  char *lib_objs = NULL;
   
-  for (size_t i = 0; i < c_files->count; i++) {
+  for (int i = 0; i < c_files->count; i++) {
     char* name = path_basename((char *)c_files->items[i]);
     char* obj_file_path = pathjoin(obj_dir, name);
     obj_file_path = change_extension(obj_file_path, "o");
     
     RUN(GCC, "-c", (char *)c_files->items[i], "-o", obj_file_path, "-I./src", FLAGS);
     array_add(o_files, obj_file_path);
+
+    // Benchmarks bring their own main, so they link everything except main.o
+    if (strcmp(name, "main.c") != 0)
+      lib_objs = lib_objs ? strcat_with_space(lib_objs, obj_file_path) : strdup(obj_file_path);
   }
   
   char *objs = o_files->items[0];
-  for(size_t i = 1; i < o_files->count; i++){
+  for(int i = 1; i < o_files->count; i++){
     objs = strcat_new(objs, " ");
     objs = strcat_new(objs, o_files->items[i]); 
   }
   
-  RUN(GCC, objs, "-o", PROG_NAME);
+  RUN(GCC, objs, "-o", PROG_NAME, LIBS);
+
+  if (build_bench) {
+    Array *bench_files = find_all_files("./" BENCH_DIR, "c");
+    for (int i = 0; i < bench_files->count; i++) {
+      char* name = path_basename((char *)bench_files->items[i]);
+      char* bench_path = pathjoin(obj_dir, name);
+      char* ext = strrchr(bench_path, '.');
+      if (ext)
+        *ext = '\0';
+
+      RUN(GCC, (char *)bench_files->items[i], lib_objs, "-o", bench_path, "-I./src", FLAGS, LIBS);
+      INFO("Benchmark ready: %s", bench_path);
+      free(bench_path);
+    }
+    array_free(bench_files);
+  }
   
   INFO("Building completed successfully\n");
   
   array_free(c_files);
   array_free(o_files);
+  free(lib_objs);
   free(current_dir);
   free(obj_dir);
   
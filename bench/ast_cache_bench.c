@@ -0,0 +1,133 @@
+#include "ast/ast.h"
+#include "ast/ast_cache.h"
+#include "ast/ast_parser.h"
+#include "ast/flat_ast.h"
+#include "lexer/lexer.h"
+#include "utils/logger.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define DEFAULT_SIZE_MB 4
+#define DEFAULT_CACHE_DIR "/tmp/nojs_ast_cache"
+#define RUNS 5
+
+static const char *lines[] = {
+    "let total = price * count - discount / 2;\n",
+    "const label = \"item\";\n",
+    "if (total > limit) { let capped = limit; } else { let capped = total + 1; }\n",
+    "function scale(value, factor) { return value * factor + offset; }\n",
+    "let items = [1, 2.5, 3e2, scale(total, 4)];\n",
+    "loop (i < items.length) { let step = items[i] + 1; }\n",
+};
+
+#define LINES_COUNT (sizeof(lines) / sizeof(lines[0]))
+
+static char *generate_source(size_t size) {
+    char *source = (char *)malloc(size + 1);
+    if (!source)
+        elog("Error allocation memory for benchmark source");
+
+    size_t len = 0;
+    for (size_t line = 0;; line++) {
+        const char *text = lines[line % LINES_COUNT];
+        size_t text_len = strlen(text);
+        if (len + text_len > size)
+            break;
+        memcpy(source + len, text, text_len);
+        len += text_len;
+    }
+    source[len] = '\0';
+    return source;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static flat_ast_t *parse_flat(const char *source) {
+    lexer_t *lexer = tokenize(source);
+    arena_t *arena = new_arena(64 * 1024);
+    parser_t *parser = new_parser(lexer, arena);
+    flat_ast_t *ast = flat_ast_from_tree(parse_program(parser));
+    free_parser(parser);
+    free_arena(arena);
+    free_lexer(lexer);
+    return ast;
+}
+
+static void check_same(flat_ast_t *a, flat_ast_t *b) {
+    if (a->count != b->count || a->extra_count != b->extra_count
+        || a->numbers_count != b->numbers_count || a->strings_count != b->strings_count
+        || a->atoms_count != b->atoms_count)
+        elog("Cached ast differs from the parsed one in size");
+
+    if (memcmp(a->kinds, b->kinds, a->count) != 0 || memcmp(a->ops, b->ops, a->count) != 0
+        || memcmp(a->data, b->data, a->count * sizeof(flat_data_t)) != 0
+        || memcmp(a->extra, b->extra, a->extra_count * sizeof(uint32_t)) != 0
+        || memcmp(a->numbers, b->numbers, a->numbers_count * sizeof(double)) != 0)
+        elog("Cached ast differs from the parsed one");
+
+    for (size_t i = 0; i < a->strings_count; i++)
+        if (!sv_eq(a->strings[i], b->strings[i]))
+            elog("Cached ast string %zu differs", i);
+    for (size_t i = 0; i < a->atoms_count; i++)
+        if (a->atoms[i] != b->atoms[i])
+            elog("Cached ast atom %zu differs", i);
+}
+
+int main(int argc, char **argv) {
+    size_t size_mb = argc > 1 ? (size_t)atoi(argv[1]) : DEFAULT_SIZE_MB;
+    const char *dir = argc > 2 ? argv[2] : DEFAULT_CACHE_DIR;
+    char *source = generate_source(size_mb * 1024 * 1024);
+    size_t length = strlen(source);
+
+    double parse = 0, hit = 0, key = 0;
+    flat_ast_t *parsed = NULL;
+    for (int run = 0; run < RUNS; run++) {
+        double start = now_seconds();
+        flat_ast_t *ast = parse_flat(source);
+        double elapsed = now_seconds() - start;
+        if (run == 0 || elapsed < parse)
+            parse = elapsed;
+
+        if (parsed)
+            free_flat_ast(ast);
+        else
+            parsed = ast;
+    }
+
+    if (!ast_cache_store(dir, source, length, parsed))
+        elog("Can't store the benchmark ast in %s", dir);
+
+    for (int run = 0; run < RUNS; run++) {
+        double start = now_seconds();
+        volatile uint64_t hash = ast_cache_key(source, length);
+        double elapsed = now_seconds() - start;
+        (void)hash;
+        if (run == 0 || elapsed < key)
+            key = elapsed;
+
+        start = now_seconds();
+        ast_cache_t *cache = ast_cache_open(dir, source, length);
+        elapsed = now_seconds() - start;
+        if (!cache)
+            elog("Ast cache miss right after storing it in %s", dir);
+        if (run == 0 || elapsed < hit)
+            hit = elapsed;
+
+        check_same(parsed, &cache->ast);
+        ast_cache_close(cache);
+    }
+
+    printf("ast cache: %zu bytes, %zu nodes, lex + parse + flatten %.2f ms, cache hit %.2f ms (key %.2f ms), %.1fx faster\n",
+           length, parsed->count, parse * 1e3, hit * 1e3, key * 1e3, parse / hit);
+
+    free_flat_ast(parsed);
+    free(source);
+    return 0;
+}
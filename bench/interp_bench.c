@@ -0,0 +1,231 @@
+#include "ast/ast.h"
+#include "ast/ast_parser.h"
+#include "envr/envr.h"
+#include "interp/closure_compiler.h"
+#include "interp/interp.h"
+#include "lexer/lexer.h"
+#include "utils/logger.h"
+#include "vm/bc_compiler.h"
+#include "vm/bytecode.h"
+#include "vm/reg_compiler.h"
+#include "vm/reg_vm.h"
+#include "vm/stack_vm.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define DEFAULT_RUNS 5
+#define BYTECODE_PATH "/tmp/nojs_interp_bench" BC_FILE_EXTENSION
+
+typedef struct bench_case {
+    const char *name;
+    const char *source;
+    double expected;
+} bench_case;
+
+static const bench_case cases[] = {
+    {
+        "fib(27)",
+        "function fib(n) {\n"
+        "    if (n < 2) { return n; }\n"
+        "    return fib(n - 1) + fib(n - 2);\n"
+        "}\n"
+        "return fib(27);\n",
+        196418,
+    },
+    {
+        "nested loops 1000x1000",
+        "let total = 0;\n"
+        "let i = 0;\n"
+        "loop (i < 1000) {\n"
+        "    let j = 0;\n"
+        "    loop (j < 1000) {\n"
+        "        total = total + i * j;\n"
+        "        j = j + 1;\n"
+        "    }\n"
+        "    i = i + 1;\n"
+        "}\n"
+        "return total;\n",
+        249500250000.0,
+    },
+    {
+        "struct fields 1M updates",
+        "let p = struct(\"Point\");\n"
+        "p.x = 0;\n"
+        "p.y = 0;\n"
+        "let i = 0;\n"
+        "loop (i < 1000000) {\n"
+        "    p.x = p.x + 1;\n"
+        "    p.y = p.y + p.x;\n"
+        "    i = i + 1;\n"
+        "}\n"
+        "return p.y;\n",
+        500000500000.0,
+    },
+};
+
+#define CASES_COUNT (sizeof(cases) / sizeof(cases[0]))
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void check_result(const bench_case *bench, value_t result, const char *engine) {
+    if (!value_is_number(result) || value_as_number(result) != bench->expected)
+        elog("%s returned a wrong result on the %s", bench->name, engine);
+}
+
+// Best of runs, parsing and resolving are not timed
+static double bench_tree(const bench_case *bench, int runs) {
+    double best = 0;
+    for (int run = 0; run < runs; run++) {
+        lexer_t *lexer = tokenize(bench->source);
+        arena_t *arena = new_arena(0);
+        parser_t *parser = new_parser(lexer, arena);
+        ast_node *program = parse_program(parser);
+        interp_t *interp = new_interp(arena);
+
+        double start = now_seconds();
+        value_t result = interp_run(interp, program);
+        double elapsed = now_seconds() - start;
+        if (run == 0 || elapsed < best)
+            best = elapsed;
+
+        check_result(bench, result, "tree walker");
+
+        free_interp(interp);
+        free_parser(parser);
+        free_arena(arena);
+        free_lexer(lexer);
+    }
+    return best;
+}
+
+// Compiled once and round-tripped through a .njb file, the loaded module
+// is the one timed
+static double bench_stack_vm(const bench_case *bench, int runs, double *compile, size_t *instructions) {
+    lexer_t *lexer = tokenize(bench->source);
+    arena_t *arena = new_arena(0);
+    parser_t *parser = new_parser(lexer, arena);
+    ast_node *program = parse_program(parser);
+
+    double start = now_seconds();
+    bc_module_t *compiled = bc_compile(program, arena);
+    *compile = now_seconds() - start;
+    *instructions = compiled->code_count;
+
+    if (!bc_module_save(compiled, BYTECODE_PATH))
+        elog("Can't save the bytecode of %s", bench->name);
+    bc_module_t *module = bc_module_load(BYTECODE_PATH);
+    if (!module)
+        elog("Can't load back the bytecode of %s", bench->name);
+
+    double best = 0;
+    for (int run = 0; run < runs; run++) {
+        interp_t *interp = new_interp(arena);
+
+        start = now_seconds();
+        value_t result = vm_run(interp, module);
+        double elapsed = now_seconds() - start;
+        if (run == 0 || elapsed < best)
+            best = elapsed;
+
+        check_result(bench, result, "stack VM");
+        free_interp(interp);
+    }
+
+    free_bc_module(module);
+    free_bc_module(compiled);
+    free_parser(parser);
+    free_arena(arena);
+    free_lexer(lexer);
+    return best;
+}
+
+static double bench_register_vm(const bench_case *bench, int runs, size_t *instructions) {
+    lexer_t *lexer = tokenize(bench->source);
+    arena_t *arena = new_arena(0);
+    parser_t *parser = new_parser(lexer, arena);
+    ast_node *program = parse_program(parser);
+    rg_module_t *module = rg_compile(program, arena);
+
+    *instructions = 0;
+    for (size_t i = 0; i < module->functions_count; i++)
+        *instructions += module->functions[i].instruction_count;
+
+    double best = 0;
+    for (int run = 0; run < runs; run++) {
+        interp_t *interp = new_interp(arena);
+
+        double start = now_seconds();
+        value_t result = rg_run(interp, module);
+        double elapsed = now_seconds() - start;
+        if (run == 0 || elapsed < best)
+            best = elapsed;
+
+        check_result(bench, result, "register VM");
+        free_interp(interp);
+    }
+
+    free_rg_module(module);
+    free_parser(parser);
+    free_arena(arena);
+    free_lexer(lexer);
+    return best;
+}
+
+static double bench_closures(const bench_case *bench, int runs, size_t *nodes) {
+    lexer_t *lexer = tokenize(bench->source);
+    arena_t *arena = new_arena(0);
+    parser_t *parser = new_parser(lexer, arena);
+    ast_node *program = parse_program(parser);
+    cl_program_t *compiled = cl_compile(program, arena);
+    *nodes = compiled->node_count;
+
+    double best = 0;
+    for (int run = 0; run < runs; run++) {
+        interp_t *interp = new_interp(arena);
+
+        double start = now_seconds();
+        value_t result = cl_run(interp, compiled);
+        double elapsed = now_seconds() - start;
+        if (run == 0 || elapsed < best)
+            best = elapsed;
+
+        check_result(bench, result, "closure engine");
+        free_interp(interp);
+    }
+
+    free_cl_program(compiled);
+    free_parser(parser);
+    free_arena(arena);
+    free_lexer(lexer);
+    return best;
+}
+
+int main(int argc, char **argv) {
+    int runs = argc > 1 ? atoi(argv[1]) : DEFAULT_RUNS;
+    if (runs < 1)
+        runs = 1;
+
+    for (size_t i = 0; i < CASES_COUNT; i++) {
+        double compile;
+        size_t stack_code, register_code, closure_nodes;
+        double tree = bench_tree(&cases[i], runs);
+        double stack = bench_stack_vm(&cases[i], runs, &compile, &stack_code);
+        double registers = bench_register_vm(&cases[i], runs, &register_code);
+        double closures = bench_closures(&cases[i], runs, &closure_nodes);
+        printf("%s\n", cases[i].name);
+        printf("    tree walker %8.2f ms\n", tree * 1e3);
+        printf("    stack VM    %8.2f ms (%.2fx, compile %.3f ms, %zu instructions)\n",
+               stack * 1e3, tree / stack, compile * 1e3, stack_code);
+        printf("    register VM %8.2f ms (%.2fx, %zu instructions)\n",
+               registers * 1e3, tree / registers, register_code);
+        printf("    closures    %8.2f ms (%.2fx, %zu nodes)\n", closures * 1e3, tree / closures, closure_nodes);
+    }
+    return 0;
+}
@@ -0,0 +1,127 @@
+#include "lexer/lexer.h"
+#include "lexer/scan.h"
+#include "lexer/token.h"
+#include "utils/logger.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+
+#define DEFAULT_SIZE_MB 8
+#define RUNS 5
+
+static const char *mixed_lines[] = {
+    "let counter_value = 12345;\n",
+    "const ratio = 3.14159 * (radius + 2.5) / 7;\n",
+    "// generated helper, keeps the bundle stable between builds\n",
+    "if (counter_value >= 10 && ratio != 0) {\n",
+    "    let message = \"value is greater than ten, keep going\";\n",
+    "} else {\n",
+    "    let fallback = [1, 2, 3, 4, 5];\n",
+    "}\n",
+    "loop (index < 100) { next; }\n",
+    "function compute_total(a, b) { return a + b * 2; }\n",
+    "let item = items[index].name;\n",
+    NULL,
+};
+
+// Heavily commented, deeply indented output with long string tables
+static const char *commented_lines[] = {
+    "// ------------------------------------------------------------------------------\n",
+    "// This block was generated from the localisation tables, do not edit by hand.\n",
+    "// Every entry maps a message key to the text shown in the user interface.\n",
+    "                        let title = \"Welcome back, your settings were restored from the cloud\";\n",
+    "                        let details = \"The previous session ended unexpectedly, nothing was lost\";\n",
+    "                                // keep in sync with the server side message catalogue\n",
+    "                        print(title);\n",
+    NULL,
+};
+
+static const char **profile_lines(const char *profile) {
+    if (strcmp(profile, "mixed") == 0)
+        return mixed_lines;
+    if (strcmp(profile, "commented") == 0)
+        return commented_lines;
+    elog("Unknown benchmark profile '%s', expected 'mixed' or 'commented'", profile);
+    return NULL;
+}
+
+static char *generate_source(size_t size, const char **lines) {
+    char *source = (char *)malloc(size + 1);
+    if (!source)
+        elog("Error allocation memory for benchmark source");
+
+    size_t len = 0;
+    size_t line = 0;
+    size_t lines_count = 0;
+    while (lines[lines_count])
+        lines_count++;
+
+    while (1) {
+        const char *text = lines[line++ % lines_count];
+        size_t text_len = strlen(text);
+        if (len + text_len > size)
+            break;
+        memcpy(source + len, text, text_len);
+        len += text_len;
+    }
+    source[len] = '\0';
+    return source;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Best of RUNS wall time for one tokenize call, threads == 0 is the plain serial lexer
+static double time_tokenize(const char *source, size_t threads, size_t *tokens) {
+    double best = 0;
+    for (int run = 0; run < RUNS; run++) {
+        double start = now_seconds();
+        lexer_t *lexer = threads ? tokenize_parallel(source, threads) : tokenize(source);
+        double elapsed = now_seconds() - start;
+
+        *tokens = lexer->tokens->count;
+        free_lexer(lexer);
+
+        if (run == 0 || elapsed < best)
+            best = elapsed;
+    }
+    return best;
+}
+
+int main(int argc, char **argv) {
+    size_t size_mb = argc > 1 ? (size_t)atoi(argv[1]) : DEFAULT_SIZE_MB;
+    const char *profile = argc > 2 ? argv[2] : "mixed";
+    size_t max_threads = argc > 3 ? (size_t)atoi(argv[3]) : 0;
+    char *source = generate_source(size_mb * 1024 * 1024, profile_lines(profile));
+    size_t length = strlen(source);
+
+    size_t tokens = 0;
+    double best = time_tokenize(source, 0, &tokens);
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    printf("lexer (%s, %s kernels): %zu bytes, %zu tokens, best of %d: %.3f s, %.1f MB/s, peak RSS %ld MB\n",
+           profile, scan_kernel_name(), length, tokens, RUNS, best, length / best / (1024 * 1024), usage.ru_maxrss / 1024);
+
+    // Scaling of the chunked parallel lexer, relative to the serial run above
+    for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+        size_t parallel_tokens = 0;
+        double elapsed = time_tokenize(source, threads, &parallel_tokens);
+        if (parallel_tokens != tokens)
+            elog("Parallel lexer with %zu threads produced %zu tokens, serial produced %zu",
+                 threads, parallel_tokens, tokens);
+
+        printf("  %2zu threads: %.3f s, %.1f MB/s, speedup %.2fx\n",
+               threads, elapsed, length / elapsed / (1024 * 1024), best / elapsed);
+    }
+
+    free(source);
+    return 0;
+}
@@ -0,0 +1,234 @@
+#include "ast/ast.h"
+#include "ast/ast_fold.h"
+#include "ast/ast_parser.h"
+#include "ast/ast_resolve.h"
+#include "ast/flat_ast.h"
+#include "lexer/lexer.h"
+#include "utils/logger.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define DEFAULT_SIZE_MB 4
+#define RUNS 5
+
+// Expression-heavy statements, every line is a separate declaration
+static const char *lines[] = {
+    "let a = b + c * 2 - d / 4 >= e * 3 == f;\n",
+    "let g = -h * i + j - k * l / m != n < o;\n",
+    "let p = q[r + 1] * s.t - u(v, w + 2, 3) / 7 <= 8;\n",
+    "let x = 1 + 2 + 3 + 4 + 5 + 6 + 7 + 8 * 9;\n",
+    "let y = !ready == false != done > limit - 1;\n",
+    "let z = [a * 2, b - 1, c / 3, d + e * f];\n",
+    "let w = (a + b) * c > 0 && d != e || !f && (g - 1) / 2 == h;\n",
+};
+
+#define LINES_COUNT (sizeof(lines) / sizeof(lines[0]))
+
+static char *generate_source(size_t size) {
+    char *source = (char *)malloc(size + 1);
+    if (!source)
+        elog("Error allocation memory for benchmark source");
+
+    size_t len = 0;
+    for (size_t line = 0;; line++) {
+        const char *text = lines[line % LINES_COUNT];
+        size_t text_len = strlen(text);
+        if (len + text_len > size)
+            break;
+        memcpy(source + len, text, text_len);
+        len += text_len;
+    }
+    source[len] = '\0';
+    return source;
+}
+
+// A script bundle, every FUNCTION_LINES statements are wrapped in a function
+#define FUNCTION_LINES 16
+
+static char *generate_bundle(size_t size, size_t *functions) {
+    char *source = (char *)malloc(size + 1);
+    if (!source)
+        elog("Error allocation memory for benchmark source");
+
+    size_t len = 0;
+    size_t count = 0;
+    for (;; count++) {
+        char header[64];
+        int header_len = snprintf(header, sizeof(header), "function f%zu(a, b, c) {\n", count);
+        size_t body_len = 0;
+        for (size_t line = 0; line < FUNCTION_LINES; line++)
+            body_len += strlen(lines[(count + line) % LINES_COUNT]);
+        if (len + header_len + body_len + 2 > size)
+            break;
+
+        memcpy(source + len, header, header_len);
+        len += header_len;
+        for (size_t line = 0; line < FUNCTION_LINES; line++) {
+            const char *text = lines[(count + line) % LINES_COUNT];
+            memcpy(source + len, text, strlen(text));
+            len += strlen(text);
+        }
+        memcpy(source + len, "}\n", 2);
+        len += 2;
+    }
+    source[len] = '\0';
+    *functions = count;
+    return source;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Sums every number literal, walking the pointer tree recursively
+static double tree_sum_numbers(ast_node *node) {
+    if (!node)
+        return 0;
+
+    switch (node->type) {
+    case AST_NUMBER:
+        return node->number.value;
+    case AST_VAR_DECLARATION:
+    case AST_CONST_DECLARATION:
+        return tree_sum_numbers(node->var_declaration.initializer);
+    case AST_BINARY_OP:
+        return tree_sum_numbers(node->binary_op.left) + tree_sum_numbers(node->binary_op.right);
+    case AST_UNARY_OP:
+        return tree_sum_numbers(node->unary_op.operand);
+    case AST_ARRAY_ACCESS:
+        return tree_sum_numbers(node->array_access.array) + tree_sum_numbers(node->array_access.index);
+    case AST_PROPERTY_ACCESS:
+        return tree_sum_numbers(node->property_access.object);
+    case AST_FUNCTION_CALL: {
+        double sum = tree_sum_numbers(node->function_call.callee);
+        for (size_t i = 0; i < node->function_call.argument_count; i++)
+            sum += tree_sum_numbers(node->function_call.arguments[i]);
+        return sum;
+    }
+    case AST_ARRAY: {
+        double sum = 0;
+        for (size_t i = 0; i < node->array.element_count; i++)
+            sum += tree_sum_numbers(node->array.elements[i]);
+        return sum;
+    }
+    case AST_PROGRAM: {
+        double sum = 0;
+        for (size_t i = 0; i < node->program.statement_count; i++)
+            sum += tree_sum_numbers(node->program.statements[i]);
+        return sum;
+    }
+    default:
+        return 0;
+    }
+}
+
+// Same pass over the flat encoding, a linear scan of the kinds column
+static double flat_sum_numbers(flat_ast_t *ast) {
+    double sum = 0;
+    for (size_t i = 0; i < ast->count; i++)
+        if (ast->kinds[i] == AST_NUMBER)
+            sum += flat_number(ast, (flat_ref_t)i);
+    return sum;
+}
+
+int main(int argc, char **argv) {
+    size_t size_mb = argc > 1 ? (size_t)atoi(argv[1]) : DEFAULT_SIZE_MB;
+    char *source = generate_source(size_mb * 1024 * 1024);
+    size_t length = strlen(source);
+
+    lexer_t *lexer = tokenize(source);
+
+    double best = 0;
+    for (int run = 0; run < RUNS; run++) {
+        double start = now_seconds();
+        arena_t *arena = new_arena(64 * 1024);
+        parser_t *parser = new_parser(lexer, arena);
+        parse_program(parser);
+        free_parser(parser);
+        free_arena(arena);
+        double elapsed = now_seconds() - start;
+
+        if (run == 0 || elapsed < best)
+            best = elapsed;
+    }
+
+    size_t tokens = lexer->tokens->count;
+    printf("parser: %zu bytes, %zu tokens, best of %d: %.3f s, %.1f MB/s, %.1f ns per token\n",
+           length, tokens, RUNS, best, length / best / (1024 * 1024), best * 1e9 / tokens);
+
+    // Memory and walk speed of the pointer tree against the flat encoding
+    arena_t *arena = new_arena(64 * 1024);
+    parser_t *parser = new_parser(lexer, arena);
+    ast_node *program = parse_program(parser);
+    flat_ast_t *flat = flat_ast_from_tree(program);
+
+    double start = now_seconds();
+    double tree_sum = tree_sum_numbers(program);
+    double tree_walk = now_seconds() - start;
+
+    start = now_seconds();
+    double flat_sum = flat_sum_numbers(flat);
+    double flat_walk = now_seconds() - start;
+
+    if (tree_sum != flat_sum)
+        elog("Flat ast walk found %f, tree walk %f", flat_sum, tree_sum);
+
+    printf("ast: %zu nodes, tree %zu KB, flat %zu KB (%.1fx smaller), number pass tree %.2f ms, flat %.2f ms\n",
+           flat->count, arena->allocated / 1024, flat_ast_bytes(flat) / 1024,
+           (double)arena->allocated / flat_ast_bytes(flat), tree_walk * 1e3, flat_walk * 1e3);
+
+    free_flat_ast(flat);
+
+    fold_stats_t stats;
+    start = now_seconds();
+    fold_constants(program, arena, &stats);
+    double fold = now_seconds() - start;
+    printf("fold: %zu nodes -> %zu, %zu folded, %zu propagated, %zu pruned, %.2f ms\n",
+           stats.nodes_before, stats.nodes_after, stats.folded, stats.propagated, stats.pruned, fold * 1e3);
+
+    free_parser(parser);
+    free_arena(arena);
+    free_lexer(lexer);
+    free(source);
+
+    // Startup on a bundle of functions: eager parse and resolve against
+    // pre-parse and resolve with one in ten functions materialized, as if
+    // only those were called
+    size_t functions;
+    source = generate_bundle(size_mb * 1024 * 1024, &functions);
+    lexer = tokenize(source);
+
+    double eager = 0, lazy = 0;
+    for (int run = 0; run < RUNS; run++) {
+        for (int mode = 0; mode < 2; mode++) {
+            start = now_seconds();
+            arena = new_arena(64 * 1024);
+            parser = new_parser(lexer, arena);
+            parser->lazy_functions = mode;
+            program = parse_program(parser);
+            resolve_scopes(program, arena);
+            if (mode)
+                for (size_t i = 0; i < program->program.statement_count; i += 10)
+                    function_body(program->program.statements[i], arena);
+            free_parser(parser);
+            free_arena(arena);
+            double elapsed = now_seconds() - start;
+
+            double *best_mode = mode ? &lazy : &eager;
+            if (run == 0 || elapsed < *best_mode)
+                *best_mode = elapsed;
+        }
+    }
+
+    printf("startup: %zu functions, parse + resolve eager %.2f ms, pre-parse + 10%% called %.2f ms (%.1fx faster)\n",
+           functions, eager * 1e3, lazy * 1e3, eager / lazy);
+
+    free_lexer(lexer);
+    free(source);
+    return 0;
+}
@@ -0,0 +1,155 @@
+#include "lexer/lexer.h"
+#include "utils/error.h"
+#include "utils/logger.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define DEFAULT_LINES 50000
+#define KEYSTROKES 2000
+
+static const char *lines[] = {
+    "let counter_value = 12345;\n",
+    "const ratio = 3.14159 * (radius + 2.5) / 7;\n",
+    "// generated helper, keeps the bundle stable between builds\n",
+    "if (counter_value >= 10 && ratio != 0) {\n",
+    "    let message = \"value is greater than ten, keep going\";\n",
+    "} else {\n",
+    "    let fallback = [1, 2, 3, 4, 5];\n",
+    "}\n",
+    "let item = items[index].name;\n",
+};
+
+#define LINES_COUNT (sizeof(lines) / sizeof(lines[0]))
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Editor buffer with the text of the next state written into a second buffer,
+// the lexer always points at the current one
+typedef struct buffer_t {
+    char *data[2];
+    size_t current;
+    size_t length;
+    size_t capacity;
+} buffer_t;
+
+static const char *buffer_edit(buffer_t *buffer, size_t offset, size_t deleted, const char *inserted) {
+    size_t inserted_length = strlen(inserted);
+    const char *old = buffer->data[buffer->current];
+    char *new = buffer->data[!buffer->current];
+
+    memcpy(new, old, offset);
+    memcpy(new + offset, inserted, inserted_length);
+    memcpy(new + offset + inserted_length, old + offset + deleted, buffer->length - offset - deleted + 1);
+
+    buffer->length = buffer->length - deleted + inserted_length;
+    buffer->current = !buffer->current;
+    return new;
+}
+
+typedef struct relex_call_t {
+    lexer_t *lexer;
+    const char *source;
+    lexer_edit_t edit;
+} relex_call_t;
+
+static void relex_call(void *arg) {
+    relex_call_t *call = (relex_call_t *)arg;
+    relex(call->lexer, call->source, call->edit);
+}
+
+// Types "1e" in front of an identifier, a lexer error, then "5 ", which
+// makes it a number again. The failed relex must leave the lexer on the
+// last good source, and the second keystroke, passed as one edit from
+// there, must give the tokens of a full tokenize.
+static void check_invalid_edit(lexer_t *lexer, buffer_t *buffer) {
+    size_t token = 0;
+    while (lexer->tokens->types[token] != IDENTIFIER)
+        token++;
+    size_t offset = lexer->tokens->offsets[token];
+    const char *good = lexer->source;
+    size_t count = lexer->tokens->count;
+
+    relex_call_t call = { lexer, buffer_edit(buffer, offset, 0, "1e"), { offset, 0, 2 } };
+    nojs_error_t error;
+    if (nojs_protect(relex_call, &call, &error))
+        elog("relex accepted a number with an empty exponent");
+    if (lexer->source != good || lexer->tokens->count != count)
+        elog("A failed relex changed the lexer");
+
+    const char *source = buffer_edit(buffer, offset + 2, 0, "5 ");
+    relex(lexer, source, (lexer_edit_t){ offset, 0, 4 });
+
+    lexer_t *full = tokenize(source);
+    if (full->tokens->count != lexer->tokens->count
+        || memcmp(full->tokens->offsets, lexer->tokens->offsets, full->tokens->count * sizeof(uint32_t)) != 0
+        || memcmp(full->tokens->types, lexer->tokens->types, full->tokens->count * sizeof(lexer->tokens->types[0])) != 0)
+        elog("relex after a failed edit differs from a full tokenize");
+    free_lexer(full);
+    printf("  invalid edit: \"%s\" raised, lexer kept its %zu tokens\n", error.message, count);
+}
+
+int main(int argc, char **argv) {
+    size_t lines_count = argc > 1 ? (size_t)atoi(argv[1]) : DEFAULT_LINES;
+
+    buffer_t buffer = {0};
+    buffer.capacity = lines_count * 64 + KEYSTROKES + 1;
+    buffer.data[0] = (char *)malloc(buffer.capacity);
+    buffer.data[1] = (char *)malloc(buffer.capacity);
+    if (!buffer.data[0] || !buffer.data[1])
+        elog("Error allocation memory for benchmark buffer");
+
+    for (size_t i = 0; i < lines_count; i++) {
+        size_t length = strlen(lines[i % LINES_COUNT]);
+        memcpy(buffer.data[0] + buffer.length, lines[i % LINES_COUNT], length);
+        buffer.length += length;
+    }
+    buffer.data[0][buffer.length] = '\0';
+
+    double start = now_seconds();
+    lexer_t *lexer = tokenize(buffer.data[0]);
+    double full = now_seconds() - start;
+
+    // Type a character into, and then erase it from, identifiers all over the file
+    srand(1);
+    double total = 0;
+    double worst = 0;
+    size_t changed = 0;
+    for (size_t i = 0; i < KEYSTROKES; i++) {
+        size_t token;
+        do
+            token = (size_t)rand() % lexer->tokens->count;
+        while (lexer->tokens->types[token] != IDENTIFIER);
+
+        size_t offset = lexer->tokens->offsets[token] + 1;
+        bool erase = i % 2;
+        const char *source = erase ? buffer_edit(&buffer, offset, 1, "") : buffer_edit(&buffer, offset, 0, "x");
+        lexer_edit_t edit = { offset, erase ? 1 : 0, erase ? 0 : 1 };
+
+        start = now_seconds();
+        token_range_t range = relex(lexer, source, edit);
+        double elapsed = now_seconds() - start;
+
+        changed += range.new_end - range.first;
+        total += elapsed;
+        if (elapsed > worst)
+            worst = elapsed;
+    }
+
+    printf("relex: %zu lines, %zu bytes, %zu tokens\n", lines_count, buffer.length, lexer->tokens->count);
+    printf("  full tokenize: %.3f ms\n", full * 1e3);
+    printf("  relex per keystroke: avg %.1f us, worst %.1f us, %.1f tokens relexed on average\n",
+           total / KEYSTROKES * 1e6, worst * 1e6, (double)changed / KEYSTROKES);
+    check_invalid_edit(lexer, &buffer);
+
+    free_lexer(lexer);
+    free(buffer.data[0]);
+    free(buffer.data[1]);
+    return 0;
+}
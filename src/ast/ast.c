@@ -2,319 +2,207 @@
 #include "stdbool.h"
 #include "stdlib.h"
 #include "string.h"
-#include "utils/logger.h"
+#include "utils/arena.h"
 
-ast_node* create_ast_node(ast_type type) {
-    ast_node *node = (ast_node*)malloc(sizeof(ast_node));
-    if(!node) elog("Error allocation memory for ast node with type %d", type);
+ast_node* create_ast_node(arena_t *arena, ast_type type) {
+    ast_node *node = (ast_node*)arena_alloc(arena, sizeof(ast_node));
     node->type = type;
+    node->slot = 0;
     return node;
 }
 
-ast_node* create_number_node(double value) {
-    ast_node* node = create_ast_node(AST_NUMBER);
+// Child lists are copied into the arena, callers can reuse their buffers
+static ast_node** copy_nodes(arena_t *arena, ast_node** nodes, size_t count) {
+    if(count == 0) return NULL;
+
+    ast_node** copy = (ast_node**)arena_alloc(arena, count * sizeof(ast_node*));
+    memcpy(copy, nodes, count * sizeof(ast_node*));
+    return copy;
+}
+
+static arr_t* copy_node_arr(arena_t *arena, ast_node** nodes, size_t count) {
+    arr_t *arr = (arr_t*)arena_alloc(arena, sizeof(arr_t));
+    arr->items = (void**)copy_nodes(arena, nodes, count);
+    arr->count = count;
+    arr->capacity = count;
+    return arr;
+}
+
+ast_node* create_number_node(arena_t *arena, double value, bool integral) {
+    ast_node* node = create_ast_node(arena, AST_NUMBER);
     node->number.value = value;
+    node->number.integral = integral;
     return node;
 }
 
-ast_node* create_string_node(const char* value) {
-    ast_node* node = create_ast_node(AST_STRING);
-    node->string.value = strdup(value);
-    if(!node->string.value) elog("Error allocating memory for string value");
+ast_node* create_string_node(arena_t *arena, str_view_t value) {
+    ast_node* node = create_ast_node(arena, AST_STRING);
+    node->string.value = value;
     return node;
 }
 
-ast_node* create_boolean_node(bool value) {
-    ast_node* node = create_ast_node(AST_BOOLEAN);
+ast_node* create_boolean_node(arena_t *arena, bool value) {
+    ast_node* node = create_ast_node(arena, AST_BOOLEAN);
     node->boolean.value = value;
     return node;
 }
 
-ast_node* create_null_node() {
-    return create_ast_node(AST_NULL);
+ast_node* create_null_node(arena_t *arena) {
+    return create_ast_node(arena, AST_NULL);
 }
 
-ast_node* create_identifier_node(const char* name) {
-    ast_node* node = create_ast_node(AST_IDENTIFIER);
-    node->identifier.name = strdup(name);
-    if(!node->identifier.name) elog("Error allocating memory for identifier name");
+ast_node* create_identifier_node(arena_t *arena, const atom_t* name) {
+    ast_node* node = create_ast_node(arena, AST_IDENTIFIER);
+    node->identifier.name = name;
+    node->identifier.depth = SCOPE_UNRESOLVED;
     return node;
 }
 
-ast_node* create_var_declaration_node(const char* name, ast_node* initializer) {
-    ast_node* node = create_ast_node(AST_VAR_DECLARATION);
-    node->var_declaration.name = strdup(name);
-    if(!node->var_declaration.name) elog("Error allocating memory for variable declaration name");
+ast_node* create_var_declaration_node(arena_t *arena, const atom_t* name, ast_node* initializer) {
+    ast_node* node = create_ast_node(arena, AST_VAR_DECLARATION);
+    node->var_declaration.name = name;
     node->var_declaration.initializer = initializer;
     return node;
 }
 
-ast_node* create_const_declaration_node(const char* name, ast_node* initializer) {
-    ast_node* node = create_ast_node(AST_CONST_DECLARATION);
-    node->var_declaration.name = strdup(name);
-    if(!node->var_declaration.name) elog("Error allocating memory for constant declaration name");
+ast_node* create_const_declaration_node(arena_t *arena, const atom_t* name, ast_node* initializer) {
+    ast_node* node = create_ast_node(arena, AST_CONST_DECLARATION);
+    node->var_declaration.name = name;
     node->var_declaration.initializer = initializer;
     return node;
 }
 
-ast_node* create_assignment_node(ast_node* left, ast_node* right) {
-    ast_node* node = create_ast_node(AST_ASSIGNMENT);
+ast_node* create_assignment_node(arena_t *arena, ast_node* left, ast_node* right) {
+    ast_node* node = create_ast_node(arena, AST_ASSIGNMENT);
     node->assignment.left = left;
     node->assignment.right = right;
     return node;
 }
 
-ast_node* create_binary_op_node(binary_op_type op, ast_node* left, ast_node* right) {
-    ast_node* node = create_ast_node(AST_BINARY_OP);
+ast_node* create_binary_op_node(arena_t *arena, binary_op_type op, ast_node* left, ast_node* right) {
+    ast_node* node = create_ast_node(arena, AST_BINARY_OP);
     node->binary_op.op = op;
     node->binary_op.left = left;
     node->binary_op.right = right;
     return node;
 }
 
-ast_node* create_unary_op_node(unary_op_type op, ast_node* operand) {
-    ast_node* node = create_ast_node(AST_UNARY_OP);
+ast_node* create_unary_op_node(arena_t *arena, unary_op_type op, ast_node* operand) {
+    ast_node* node = create_ast_node(arena, AST_UNARY_OP);
     node->unary_op.op = op;
     node->unary_op.operand = operand;
     return node;
 }
 
-ast_node* create_if_node(ast_node* condition, ast_node* body) {
-    ast_node* node = create_ast_node(AST_IF);
+ast_node* create_if_node(arena_t *arena, ast_node* condition, ast_node* body) {
+    ast_node* node = create_ast_node(arena, AST_IF);
     node->if_statement.condition = condition;
     node->if_statement.body = body;
     return node;
 }
 
-ast_node* create_if_else_node(ast_node* condition, ast_node* if_body, ast_node* else_body) {
-    ast_node* node = create_ast_node(AST_IF_ELSE);
+ast_node* create_if_else_node(arena_t *arena, ast_node* condition, ast_node* if_body, ast_node* else_body) {
+    ast_node* node = create_ast_node(arena, AST_IF_ELSE);
     node->if_else_statement.condition = condition;
     node->if_else_statement.if_body = if_body;
     node->if_else_statement.else_body = else_body;
     return node;
 }
 
-ast_node* create_loop_node(ast_node* condition, ast_node* body) {
-    ast_node* node = create_ast_node(AST_LOOP);
+ast_node* create_loop_node(arena_t *arena, ast_node* condition, ast_node* body) {
+    ast_node* node = create_ast_node(arena, AST_LOOP);
     node->loop.condition = condition;
     node->loop.body = body;
     return node;
 }
 
-ast_node* create_next_node() {
-    return create_ast_node(AST_NEXT);
+ast_node* create_next_node(arena_t *arena) {
+    return create_ast_node(arena, AST_NEXT);
 }
 
-ast_node* create_stop_node() {
-    return create_ast_node(AST_STOP);
+ast_node* create_stop_node(arena_t *arena) {
+    return create_ast_node(arena, AST_STOP);
 }
 
-ast_node* create_function_declaration_node(const char* name, arr_t *params, ast_node* body) {
-    ast_node* node = create_ast_node(AST_FUNCTION_DECLARATION);
-    node->function_declaration.name = strdup(name);
-    if(!node->function_declaration.name) elog("Error allocating memory for function name");
-    node->function_declaration.parameters = params;
+ast_node* create_function_declaration_node(arena_t *arena, const atom_t* name, ast_node** params, size_t param_count, ast_node* body) {
+    ast_node* node = create_ast_node(arena, AST_FUNCTION_DECLARATION);
+    node->function_declaration.name = name;
+    node->function_declaration.parameters = copy_node_arr(arena, params, param_count);
     node->function_declaration.body = body;
     return node;
 }
 
-ast_node* create_function_call_node(ast_node* callee, ast_node** arguments, size_t argument_count) {
-    ast_node* node = create_ast_node(AST_FUNCTION_CALL);
+ast_node* create_function_call_node(arena_t *arena, ast_node* callee, ast_node** arguments, size_t argument_count) {
+    ast_node* node = create_ast_node(arena, AST_FUNCTION_CALL);
     node->function_call.callee = callee;
     
-    node->function_call.arguments = (ast_node**)malloc(argument_count * sizeof(ast_node*));
-    if(!node->function_call.arguments && argument_count > 0) 
-        elog("Error allocating memory for function call arguments");
-    
-    for(size_t i = 0; i < argument_count; i++) {
-        node->function_call.arguments[i] = arguments[i];
-    }
+    node->function_call.arguments = copy_nodes(arena, arguments, argument_count);
     
     node->function_call.argument_count = argument_count;
     return node;
 }
 
-ast_node* create_return_node(ast_node* value) {
-    ast_node* node = create_ast_node(AST_RETURN);
+ast_node* create_return_node(arena_t *arena, ast_node* value) {
+    ast_node* node = create_ast_node(arena, AST_RETURN);
     node->return_statement.value = value;
     return node;
 }
 
-ast_node* create_print_node(ast_node** arguments, size_t argument_count) {
-    ast_node* identifier = create_identifier_node("print");
-    return create_function_call_node(identifier, arguments, argument_count);
+ast_node* create_print_node(arena_t *arena, ast_node** arguments, size_t argument_count) {
+    ast_node* identifier = create_identifier_node(arena, atom_from_cstr("print"));
+    return create_function_call_node(arena, identifier, arguments, argument_count);
 }
 
-ast_node* create_take_node(ast_node** arguments, size_t argument_count) {
-    ast_node* identifier = create_identifier_node("take");
-    return create_function_call_node(identifier, arguments, argument_count);
+ast_node* create_take_node(arena_t *arena, ast_node** arguments, size_t argument_count) {
+    ast_node* identifier = create_identifier_node(arena, atom_from_cstr("take"));
+    return create_function_call_node(arena, identifier, arguments, argument_count);
 }
 
-ast_node* create_block_node(arr_t *stmts) {
-    ast_node* node = create_ast_node(AST_BLOCK);
-    node->block.stmts = stmts;
+ast_node* create_block_node(arena_t *arena, ast_node** stmts, size_t stmt_count) {
+    ast_node* node = create_ast_node(arena, AST_BLOCK);
+    node->block.stmts = copy_node_arr(arena, stmts, stmt_count);
+    node->block.frame_size = 0;
     return node;
 }
 
-ast_node* create_array_node(ast_node** elements, size_t element_count) {
-    ast_node* node = create_ast_node(AST_ARRAY);
-    
-    node->array.elements = (ast_node**)malloc(element_count * sizeof(ast_node*));
-    if(!node->array.elements && element_count > 0) 
-        elog("Error allocating memory for array elements");
+ast_node* create_lazy_block_node(arena_t *arena, struct lexer_t *lexer, size_t start, size_t end) {
+    ast_node* node = create_ast_node(arena, AST_LAZY_BLOCK);
+    node->lazy_block.lexer = lexer;
+    node->lazy_block.start = (uint32_t)start;
+    node->lazy_block.end = (uint32_t)end;
+    node->lazy_block.scope = NULL;
+    return node;
+}
+
+ast_node* create_array_node(arena_t *arena, ast_node** elements, size_t element_count) {
+    ast_node* node = create_ast_node(arena, AST_ARRAY);
     
-    for(size_t i = 0; i < element_count; i++) {
-        node->array.elements[i] = elements[i];
-    }
+    node->array.elements = copy_nodes(arena, elements, element_count);
     
     node->array.element_count = element_count;
     return node;
 }
 
-ast_node* create_array_access_node(ast_node* array, ast_node* index) {
-    ast_node* node = create_ast_node(AST_ARRAY_ACCESS);
+ast_node* create_array_access_node(arena_t *arena, ast_node* array, ast_node* index) {
+    ast_node* node = create_ast_node(arena, AST_ARRAY_ACCESS);
     node->array_access.array = array;
     node->array_access.index = index;
     return node;
 }
 
-ast_node* create_property_access_node(ast_node* object, const char* property) {
-    ast_node* node = create_ast_node(AST_PROPERTY_ACCESS);
+ast_node* create_property_access_node(arena_t *arena, ast_node* object, const atom_t* property) {
+    ast_node* node = create_ast_node(arena, AST_PROPERTY_ACCESS);
     node->property_access.object = object;
-    
-    node->property_access.property = strdup(property);
-    if(!node->property_access.property) 
-        elog("Error allocating memory for property name");
-    
+    node->property_access.property = property;
     return node;
 }
 
-ast_node* create_program_node(ast_node** statements, size_t statement_count) {
-    ast_node* node = create_ast_node(AST_PROGRAM);
-    
-    node->program.statements = (ast_node**)malloc(statement_count * sizeof(ast_node*));
-    if(!node->program.statements && statement_count > 0) 
-        elog("Error allocating memory for program statements");
+ast_node* create_program_node(arena_t *arena, ast_node** statements, size_t statement_count) {
+    ast_node* node = create_ast_node(arena, AST_PROGRAM);
     
-    for(size_t i = 0; i < statement_count; i++) {
-        node->program.statements[i] = statements[i];
-    }
+    node->program.statements = copy_nodes(arena, statements, statement_count);
     
     node->program.statement_count = statement_count;
+    node->program.frame_size = 0;
     return node;
 }
-
-void free_ast_node(ast_node* node) {
-    if(!node) return;
-    
-    switch(node->type) {
-        case AST_STRING:
-            free(node->string.value);
-            break;
-        
-        case AST_IDENTIFIER:
-            free(node->identifier.name);
-            break;
-        
-        case AST_VAR_DECLARATION:
-        case AST_CONST_DECLARATION:
-            free(node->var_declaration.name);
-            if(node->var_declaration.initializer) 
-                free_ast_node(node->var_declaration.initializer);
-            break;
-        
-        case AST_ASSIGNMENT:
-            free_ast_node(node->assignment.left);
-            free_ast_node(node->assignment.right);
-            break;
-        
-        case AST_BINARY_OP:
-            free_ast_node(node->binary_op.left);
-            free_ast_node(node->binary_op.right);
-            break;
-        
-        case AST_UNARY_OP:
-            free_ast_node(node->unary_op.operand);
-            break;
-        
-        case AST_IF:
-            free_ast_node(node->if_statement.condition);
-            free_ast_node(node->if_statement.body);
-            break;
-        
-        case AST_IF_ELSE:
-            free_ast_node(node->if_else_statement.condition);
-            free_ast_node(node->if_else_statement.if_body);
-            free_ast_node(node->if_else_statement.else_body);
-            break;
-        
-        case AST_LOOP:
-            if(node->loop.condition) 
-                free_ast_node(node->loop.condition);
-            free_ast_node(node->loop.body);
-            break;
-        
-        case AST_FUNCTION_DECLARATION:
-            free(node->function_declaration.name);
-            for(size_t i = 0; i < node->function_declaration.parameters->count; i++) {
-                free_ast_node(node->function_declaration.parameters->items[i]);
-            }
-            free(node->function_declaration.parameters);
-            free_ast_node(node->function_declaration.body);
-            break;
-        
-        case AST_FUNCTION_CALL:
-            free_ast_node(node->function_call.callee);
-            for(size_t i = 0; i < node->function_call.argument_count; i++) {
-                free_ast_node(node->function_call.arguments[i]);
-            }
-            free(node->function_call.arguments);
-            break;
-        
-        case AST_RETURN:
-            if(node->return_statement.value) 
-                free_ast_node(node->return_statement.value);
-            break;
-        
-        case AST_BLOCK:
-            for(size_t i = 0; i < node->block.stmts->count; i++) {
-                free_ast_node(node->block.stmts->items[i]);
-            }
-            free(node->block.stmts);
-            break;
-        
-        case AST_ARRAY:
-            for(size_t i = 0; i < node->array.element_count; i++) {
-                free_ast_node(node->array.elements[i]);
-            }
-            free(node->array.elements);
-            break;
-        
-        case AST_ARRAY_ACCESS:
-            free_ast_node(node->array_access.array);
-            free_ast_node(node->array_access.index);
-            break;
-        
-        case AST_PROPERTY_ACCESS:
-            free_ast_node(node->property_access.object);
-            free(node->property_access.property);
-            break;
-        
-        case AST_PROGRAM:
-            for(size_t i = 0; i < node->program.statement_count; i++) {
-                free_ast_node(node->program.statements[i]);
-            }
-            free(node->program.statements);
-            break;
-            
-        // Cases that don't require additional cleanup
-        case AST_NUMBER:
-        case AST_BOOLEAN:
-        case AST_NULL:
-        case AST_NEXT:
-        case AST_STOP:
-            break;
-    }
-    
-    free(node);
-}
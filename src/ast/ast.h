@@ -3,7 +3,11 @@
 
 #include <stddef.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include "../utils/arr.h"
+#include "../utils/str_view.h"
+#include "../utils/atom.h"
+#include "../utils/arena.h"
 
 typedef enum ast_type {
     // Literal values
@@ -42,6 +46,7 @@ typedef enum ast_type {
     
     // Compound structures
     AST_BLOCK,           // Block of statements
+    AST_LAZY_BLOCK,      // Function body not parsed yet, see function_body
     AST_ARRAY,           // Array literal
     AST_ARRAY_ACCESS,    // Array element access
     AST_PROPERTY_ACCESS, // Object property access
@@ -75,18 +80,25 @@ typedef enum unary_op_type {
     OP_NOT           // !
 } unary_op_type;
 
+// Frame depth of an identifier left to a lookup by name (globals, natives)
+#define SCOPE_UNRESOLVED UINT32_MAX
+
 typedef struct ast_node {
     ast_type type;
+    // Frame slot of the variable a declaration (let, const, function,
+    // parameter) defines or an identifier refers to, set by resolve_scopes
+    uint32_t slot;
     
     union {
         // For AST_NUMBER
         struct {
             double value;
+            bool integral; // whole number no larger than 2^53
         } number;
         
         // For AST_STRING
         struct {
-            char* value;
+            str_view_t value;
         } string;
         
         // For AST_BOOLEAN
@@ -96,12 +108,13 @@ typedef struct ast_node {
         
         // For AST_IDENTIFIER
         struct {
-            char* name;
+            const atom_t* name;
+            uint32_t depth; // function frames between use and declaration
         } identifier;
         
         // For AST_VAR_DECLARATION, AST_CONST_DECLARATION
         struct {
-            char* name;
+            const atom_t* name;
             struct ast_node* initializer; // Can be NULL
         } var_declaration;
         
@@ -145,7 +158,7 @@ typedef struct ast_node {
         
         // For AST_FUNCTION_DECLARATION
         struct {
-            char* name;
+            const atom_t* name;
             arr_t *parameters; // Array of AST_IDENTIFIER nodes
             struct ast_node* body;
         } function_declaration;
@@ -165,8 +178,17 @@ typedef struct ast_node {
         // For AST_BLOCK
         struct {
             arr_t *stmts;
+            uint32_t frame_size; // slots of the frame, for a function body
         } block;
         
+        // For AST_LAZY_BLOCK, tokens [start, end) of the body, '{' to '}'
+        struct {
+            struct lexer_t* lexer;
+            uint32_t start;
+            uint32_t end;
+            const struct lazy_scope_t* scope; // set by resolve_scopes, see ast_resolve.h
+        } lazy_block;
+        
         // For AST_ARRAY
         struct {
             struct ast_node** elements;
@@ -182,44 +204,47 @@ typedef struct ast_node {
         // For AST_PROPERTY_ACCESS
         struct {
             struct ast_node* object;
-            char* property;
+            const atom_t* property;
         } property_access;
         
         // For AST_PROGRAM
         struct {
             struct ast_node** statements;
             size_t statement_count;
+            uint32_t frame_size; // slots of the global frame
         } program;
     };
 } ast_node;
 
-ast_node* create_ast_node(ast_type type);
-ast_node* create_number_node(double value);
-ast_node* create_string_node(const char* value);
-ast_node* create_boolean_node(bool value);
-ast_node* create_null_node();
-ast_node* create_identifier_node(const char* name);
-ast_node* create_var_declaration_node(const char* name, ast_node* initializer);
-ast_node* create_const_declaration_node(const char* name, ast_node* initializer);
-ast_node* create_assignment_node(ast_node* left, ast_node* right);
-ast_node* create_binary_op_node(binary_op_type op, ast_node* left, ast_node* right);
-ast_node* create_unary_op_node(unary_op_type op, ast_node* operand);
-ast_node* create_if_node(ast_node* condition, ast_node* body);
-ast_node* create_if_else_node(ast_node* condition, ast_node* if_body, ast_node* else_body);
-ast_node* create_loop_node(ast_node* condition, ast_node* body);
-ast_node* create_next_node();
-ast_node* create_stop_node();
-ast_node* create_function_declaration_node(const char* name, arr_t *params, ast_node* body);
-ast_node* create_function_call_node(ast_node* callee, ast_node** arguments, size_t argument_count);
-ast_node* create_return_node(ast_node* value);
-ast_node* create_print_node(ast_node** arguments, size_t argument_count);
-ast_node* create_take_node(ast_node** arguments, size_t argument_count);
-ast_node* create_block_node(arr_t *stmts);
-ast_node* create_array_node(ast_node** elements, size_t element_count);
-ast_node* create_array_access_node(ast_node* array, ast_node* index);
-ast_node* create_property_access_node(ast_node* object, const char* property);
-ast_node* create_program_node(ast_node** statements, size_t statement_count);
-
-void free_ast_node(ast_node* node);
+// Nodes, child lists and arr_t's all live in the arena passed to create_*,
+// the whole tree is released with free_arena. arr_t's in a tree are
+// read-only, arr_push would realloc arena memory.
+ast_node* create_ast_node(arena_t *arena, ast_type type);
+ast_node* create_number_node(arena_t *arena, double value, bool integral);
+ast_node* create_string_node(arena_t *arena, str_view_t value);
+ast_node* create_boolean_node(arena_t *arena, bool value);
+ast_node* create_null_node(arena_t *arena);
+ast_node* create_identifier_node(arena_t *arena, const atom_t* name);
+ast_node* create_var_declaration_node(arena_t *arena, const atom_t* name, ast_node* initializer);
+ast_node* create_const_declaration_node(arena_t *arena, const atom_t* name, ast_node* initializer);
+ast_node* create_assignment_node(arena_t *arena, ast_node* left, ast_node* right);
+ast_node* create_binary_op_node(arena_t *arena, binary_op_type op, ast_node* left, ast_node* right);
+ast_node* create_unary_op_node(arena_t *arena, unary_op_type op, ast_node* operand);
+ast_node* create_if_node(arena_t *arena, ast_node* condition, ast_node* body);
+ast_node* create_if_else_node(arena_t *arena, ast_node* condition, ast_node* if_body, ast_node* else_body);
+ast_node* create_loop_node(arena_t *arena, ast_node* condition, ast_node* body);
+ast_node* create_next_node(arena_t *arena);
+ast_node* create_stop_node(arena_t *arena);
+ast_node* create_function_declaration_node(arena_t *arena, const atom_t* name, ast_node** params, size_t param_count, ast_node* body);
+ast_node* create_function_call_node(arena_t *arena, ast_node* callee, ast_node** arguments, size_t argument_count);
+ast_node* create_return_node(arena_t *arena, ast_node* value);
+ast_node* create_print_node(arena_t *arena, ast_node** arguments, size_t argument_count);
+ast_node* create_take_node(arena_t *arena, ast_node** arguments, size_t argument_count);
+ast_node* create_block_node(arena_t *arena, ast_node** stmts, size_t stmt_count);
+ast_node* create_lazy_block_node(arena_t *arena, struct lexer_t *lexer, size_t start, size_t end);
+ast_node* create_array_node(arena_t *arena, ast_node** elements, size_t element_count);
+ast_node* create_array_access_node(arena_t *arena, ast_node* array, ast_node* index);
+ast_node* create_property_access_node(arena_t *arena, ast_node* object, const atom_t* property);
+ast_node* create_program_node(arena_t *arena, ast_node** statements, size_t statement_count);
 
 #endif
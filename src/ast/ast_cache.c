@@ -0,0 +1,321 @@
+#include "ast_cache.h"
+#include "../utils/atom.h"
+#include "../utils/logger.h"
+#include "../version.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define CACHE_PATH_MAX 4096
+#define CACHE_ALIGN 8
+
+static inline uint64_t rotl64(uint64_t value, int bits) {
+    return (value << bits) | (value >> (64 - bits));
+}
+
+static inline uint64_t mix64(uint64_t value) {
+    value ^= value >> 33;
+    value *= 0xff51afd7ed558ccdULL;
+    value ^= value >> 33;
+    value *= 0xc4ceb9fe1a85ec53ULL;
+    value ^= value >> 33;
+    return value;
+}
+
+static inline uint64_t load64(const unsigned char *bytes) {
+    uint64_t value;
+    memcpy(&value, bytes, sizeof(value));
+    return value;
+}
+
+/*
+ * Four independent multiply-rotate lanes over 32 byte blocks, so the hash
+ * runs at memory speed instead of one dependent multiply per byte like the
+ * atom table's FNV. The tail is folded in 8 bytes at a time, then bytewise.
+ */
+static uint64_t hash_bytes(const void *data, size_t length, uint64_t seed) {
+    const uint64_t prime1 = 0x9e3779b185ebca87ULL;
+    const uint64_t prime2 = 0xc2b2ae3d27d4eb4fULL;
+    const unsigned char *bytes = (const unsigned char *)data;
+    const unsigned char *end = bytes + length;
+
+    uint64_t lanes[4] = { seed + prime1, seed + prime2, seed, seed - prime1 };
+    while (end - bytes >= 32) {
+        for (int lane = 0; lane < 4; lane++)
+            lanes[lane] = rotl64(lanes[lane] + load64(bytes + lane * 8) * prime2, 31) * prime1;
+        bytes += 32;
+    }
+
+    uint64_t hash = rotl64(lanes[0], 1) + rotl64(lanes[1], 7) + rotl64(lanes[2], 12) + rotl64(lanes[3], 18);
+    hash += length;
+    while (end - bytes >= 8) {
+        hash = rotl64(hash ^ (load64(bytes) * prime2), 27) * prime1;
+        bytes += 8;
+    }
+    while (bytes < end)
+        hash = rotl64(hash ^ (*bytes++ * prime1), 11) * prime2;
+    return mix64(hash);
+}
+
+uint64_t ast_cache_key(const char *source, size_t length) {
+    static const char version[] = NOJS_VERSION;
+    uint64_t seed = hash_bytes(version, sizeof(version) - 1, AST_CACHE_FORMAT);
+    return hash_bytes(source, length, seed);
+}
+
+static void cache_path(char *path, const char *dir, uint64_t key) {
+    int written = snprintf(path, CACHE_PATH_MAX, "%s/%016llx" AST_CACHE_EXTENSION, dir, (unsigned long long)key);
+    if (written < 0 || written >= CACHE_PATH_MAX)
+        elog("AST cache path in %s is too long", dir);
+}
+
+static size_t align_offset(size_t offset) {
+    return (offset + CACHE_ALIGN - 1) & ~(size_t)(CACHE_ALIGN - 1);
+}
+
+// Section [offset, offset + bytes) lies inside the file and is aligned
+static bool section_fits(uint64_t offset, uint64_t bytes, uint64_t size) {
+    return offset % CACHE_ALIGN == 0 && offset <= size && bytes <= size - offset;
+}
+
+static bool header_valid(const ast_cache_header_t *header, size_t size, uint64_t key, size_t length) {
+    char version[sizeof(header->version)] = { 0 };
+    strncpy(version, NOJS_VERSION, sizeof(version));
+
+    if (memcmp(header->magic, AST_CACHE_MAGIC, sizeof(header->magic)) != 0
+        || header->format != AST_CACHE_FORMAT
+        || memcmp(header->version, version, sizeof(version)) != 0
+        || header->key != key
+        || header->source_length != length
+        || header->size != size)
+        return false;
+
+    return section_fits(header->kinds, header->count, size)
+        && section_fits(header->ops, header->count, size)
+        && section_fits(header->data, (uint64_t)header->count * sizeof(flat_data_t), size)
+        && section_fits(header->extra, (uint64_t)header->extra_count * sizeof(uint32_t), size)
+        && section_fits(header->numbers, (uint64_t)header->numbers_count * sizeof(double), size)
+        && section_fits(header->strings, (uint64_t)header->strings_count * sizeof(ast_cache_span_t), size)
+        && section_fits(header->atoms, (uint64_t)header->atoms_count * sizeof(ast_cache_span_t), size)
+        && section_fits(header->blob, header->blob_length, size);
+}
+
+static bool span_valid(ast_cache_span_t span, uint32_t blob_length) {
+    return span.offset <= blob_length && span.length <= blob_length - span.offset;
+}
+
+ast_cache_t *ast_cache_open(const char *dir, const char *source, size_t length) {
+    if (!dir || !source)
+        elog("Can't open ast cache, NULL ptr on dir or source");
+
+    uint64_t key = ast_cache_key(source, length);
+    char path[CACHE_PATH_MAX];
+    cache_path(path, dir, key);
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(ast_cache_header_t)) {
+        close(fd);
+        return NULL;
+    }
+
+    size_t size = (size_t)st.st_size;
+    void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return NULL;
+
+    const ast_cache_header_t *header = (const ast_cache_header_t *)map;
+    if (!header_valid(header, size, key, length)) {
+        munmap(map, size);
+        return NULL;
+    }
+
+    ast_cache_t *cache = (ast_cache_t *)calloc(1, sizeof(ast_cache_t));
+    if (!cache)
+        elog("Error allocation memory for ast_cache_t struct");
+    cache->map = map;
+    cache->map_size = size;
+
+    const char *base = (const char *)map;
+    flat_ast_t *ast = &cache->ast;
+    ast->kinds = (uint8_t *)(base + header->kinds);
+    ast->ops = (uint8_t *)(base + header->ops);
+    ast->data = (flat_data_t *)(base + header->data);
+    ast->count = header->count;
+    ast->extra = (uint32_t *)(base + header->extra);
+    ast->extra_count = header->extra_count;
+    ast->numbers = (double *)(base + header->numbers);
+    ast->numbers_count = header->numbers_count;
+
+    // Relocation, the only tables that hold pointers
+    const char *blob = base + header->blob;
+    const ast_cache_span_t *strings = (const ast_cache_span_t *)(base + header->strings);
+    const ast_cache_span_t *atoms = (const ast_cache_span_t *)(base + header->atoms);
+
+    ast->strings = (str_view_t *)malloc((header->strings_count + 1) * sizeof(str_view_t));
+    ast->atoms = (const atom_t **)malloc((header->atoms_count + 1) * sizeof(const atom_t *));
+    if (!ast->strings || !ast->atoms)
+        elog("Error allocation memory for ast cache string tables");
+
+    for (uint32_t i = 0; i < header->strings_count; i++) {
+        if (!span_valid(strings[i], header->blob_length)) {
+            ast_cache_close(cache);
+            return NULL;
+        }
+        ast->strings[i] = sv_make(blob + strings[i].offset, strings[i].length);
+    }
+    ast->strings_count = header->strings_count;
+
+    for (uint32_t i = 0; i < header->atoms_count; i++) {
+        if (!span_valid(atoms[i], header->blob_length)) {
+            ast_cache_close(cache);
+            return NULL;
+        }
+        ast->atoms[i] = atom_intern(blob + atoms[i].offset, atoms[i].length);
+    }
+    ast->atoms_count = header->atoms_count;
+
+    return cache;
+}
+
+void ast_cache_close(ast_cache_t *cache) {
+    if (!cache)
+        return;
+
+    free(cache->ast.strings);
+    free((void *)cache->ast.atoms);
+    munmap(cache->map, cache->map_size);
+    free(cache);
+}
+
+// Places a section of bytes at the next aligned offset, returns the offset
+static uint64_t put_section(char *file, size_t *size, const void *data, size_t bytes) {
+    size_t offset = align_offset(*size);
+    memset(file + *size, 0, offset - *size);
+    if (bytes)
+        memcpy(file + offset, data, bytes);
+    *size = offset + bytes;
+    return offset;
+}
+
+static bool write_all(int fd, const char *data, size_t size) {
+    while (size) {
+        ssize_t written = write(fd, data, size);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        data += written;
+        size -= (size_t)written;
+    }
+    return true;
+}
+
+bool ast_cache_store(const char *dir, const char *source, size_t length, flat_ast_t *ast) {
+    if (!dir || !source || !ast)
+        elog("Can't store ast cache, NULL ptr on dir, source or ast");
+
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+        wlog("Can't create ast cache directory %s: %s", dir, strerror(errno));
+        return false;
+    }
+
+    size_t blob_length = 0;
+    for (size_t i = 0; i < ast->strings_count; i++)
+        blob_length += ast->strings[i].length;
+    for (size_t i = 0; i < ast->atoms_count; i++)
+        blob_length += ast->atoms[i]->length;
+    if (blob_length > UINT32_MAX || ast->count > UINT32_MAX || ast->extra_count > UINT32_MAX
+        || ast->numbers_count > UINT32_MAX) {
+        wlog("Program is too large for the ast cache");
+        return false;
+    }
+
+    ast_cache_span_t *spans = (ast_cache_span_t *)malloc((ast->strings_count + ast->atoms_count + 1) * sizeof(ast_cache_span_t));
+    char *blob = (char *)malloc(blob_length + 1);
+    if (!spans || !blob)
+        elog("Error allocation memory for ast cache string tables");
+
+    size_t blob_used = 0;
+    for (size_t i = 0; i < ast->strings_count; i++) {
+        spans[i] = (ast_cache_span_t){ (uint32_t)blob_used, (uint32_t)ast->strings[i].length };
+        memcpy(blob + blob_used, ast->strings[i].data, ast->strings[i].length);
+        blob_used += ast->strings[i].length;
+    }
+    ast_cache_span_t *atom_spans = spans + ast->strings_count;
+    for (size_t i = 0; i < ast->atoms_count; i++) {
+        atom_spans[i] = (ast_cache_span_t){ (uint32_t)blob_used, ast->atoms[i]->length };
+        memcpy(blob + blob_used, ast->atoms[i]->text, ast->atoms[i]->length);
+        blob_used += ast->atoms[i]->length;
+    }
+
+    // Upper bound, every section may need CACHE_ALIGN - 1 bytes of padding
+    size_t capacity = sizeof(ast_cache_header_t) + 8 * CACHE_ALIGN
+                    + ast->count * (2 * sizeof(uint8_t) + sizeof(flat_data_t))
+                    + ast->extra_count * sizeof(uint32_t)
+                    + ast->numbers_count * sizeof(double)
+                    + (ast->strings_count + ast->atoms_count) * sizeof(ast_cache_span_t)
+                    + blob_length;
+    char *file = (char *)malloc(capacity);
+    if (!file)
+        elog("Error allocation memory for ast cache file");
+
+    ast_cache_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, AST_CACHE_MAGIC, sizeof(header.magic));
+    header.format = AST_CACHE_FORMAT;
+    strncpy(header.version, NOJS_VERSION, sizeof(header.version));
+    header.key = ast_cache_key(source, length);
+    header.source_length = length;
+    header.count = (uint32_t)ast->count;
+    header.extra_count = (uint32_t)ast->extra_count;
+    header.numbers_count = (uint32_t)ast->numbers_count;
+    header.strings_count = (uint32_t)ast->strings_count;
+    header.atoms_count = (uint32_t)ast->atoms_count;
+    header.blob_length = (uint32_t)blob_length;
+
+    size_t size = sizeof(header);
+    header.kinds = put_section(file, &size, ast->kinds, ast->count);
+    header.ops = put_section(file, &size, ast->ops, ast->count);
+    header.data = put_section(file, &size, ast->data, ast->count * sizeof(flat_data_t));
+    header.extra = put_section(file, &size, ast->extra, ast->extra_count * sizeof(uint32_t));
+    header.numbers = put_section(file, &size, ast->numbers, ast->numbers_count * sizeof(double));
+    header.strings = put_section(file, &size, spans, ast->strings_count * sizeof(ast_cache_span_t));
+    header.atoms = put_section(file, &size, atom_spans, ast->atoms_count * sizeof(ast_cache_span_t));
+    header.blob = put_section(file, &size, blob, blob_length);
+    header.size = size;
+    memcpy(file, &header, sizeof(header));
+
+    char path[CACHE_PATH_MAX];
+    char temp[CACHE_PATH_MAX + 32];
+    cache_path(path, dir, header.key);
+    snprintf(temp, sizeof(temp), "%s.%ld.tmp", path, (long)getpid());
+
+    bool stored = false;
+    int fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd >= 0) {
+        stored = write_all(fd, file, size);
+        stored = close(fd) == 0 && stored;
+        stored = stored && rename(temp, path) == 0;
+        if (!stored)
+            unlink(temp);
+    }
+    if (!stored)
+        wlog("Can't write ast cache file %s: %s", path, strerror(errno));
+
+    free(file);
+    free(blob);
+    free(spans);
+    return stored;
+}
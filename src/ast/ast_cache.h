@@ -0,0 +1,82 @@
+#ifndef AST_CACHE_H
+#define AST_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "flat_ast.h"
+
+/*
+ * On-disk cache of parsed programs in their flat encoding, one file per
+ * source named after ast_cache_key, a hash of the source, the Nojs version
+ * and the file format. A hit costs a hash of the source and an mmap: the
+ * node columns, extra and numbers are used in place, only the string and
+ * atom tables are relocated, from (offset, length) spans into the blob.
+ *
+ *   header       ast_cache_header_t
+ *   kinds, ops   count bytes each
+ *   data         count flat_data_t
+ *   extra        extra_count uint32_t
+ *   numbers      numbers_count double
+ *   strings      strings_count ast_cache_span_t
+ *   atoms        atoms_count ast_cache_span_t
+ *   blob         string and atom bytes
+ *
+ * Sections start on 8 byte boundaries and are addressed by file offsets in
+ * the header. Values are in host byte order, a cache is not portable between
+ * machines. Files are written to a temporary name and renamed into place, so
+ * readers never see a partial one, and the cache directory is trusted: node
+ * references in a file are not validated.
+ */
+
+#define AST_CACHE_MAGIC "NJAC"
+#define AST_CACHE_FORMAT 1
+#define AST_CACHE_EXTENSION ".njac"
+
+typedef struct ast_cache_span_t {
+    uint32_t offset; // into the blob
+    uint32_t length;
+} ast_cache_span_t;
+
+typedef struct ast_cache_header_t {
+    char magic[4];
+    uint32_t format;
+    char version[16]; // NOJS_VERSION, NUL padded
+    uint64_t key;
+    uint64_t source_length;
+    uint64_t size; // of the whole file
+
+    uint32_t count;
+    uint32_t extra_count;
+    uint32_t numbers_count;
+    uint32_t strings_count;
+    uint32_t atoms_count;
+    uint32_t blob_length;
+
+    uint64_t kinds;
+    uint64_t ops;
+    uint64_t data;
+    uint64_t extra;
+    uint64_t numbers;
+    uint64_t strings;
+    uint64_t atoms;
+    uint64_t blob;
+} ast_cache_header_t;
+
+// A mapped cache file, ast stays valid until ast_cache_close
+typedef struct ast_cache_t {
+    flat_ast_t ast;
+    void *map;
+    size_t map_size;
+} ast_cache_t;
+
+uint64_t ast_cache_key(const char *source, size_t length);
+
+// NULL on a miss, a stale or a malformed file
+ast_cache_t *ast_cache_open(const char *dir, const char *source, size_t length);
+void ast_cache_close(ast_cache_t *cache);
+
+// Creates dir if needed, false (with a warning) if the file can't be written
+bool ast_cache_store(const char *dir, const char *source, size_t length, flat_ast_t *ast);
+
+#endif
@@ -0,0 +1,383 @@
+#include "ast_fold.h"
+#include "../utils/logger.h"
+#include "../utils/scope_map.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_SAFE_INTEGER 9007199254740992.0 // 2^53
+
+/*
+ * Names visible at the current point of the walk. A const with a literal
+ * value maps to it, any other declaration (let, function, parameter) maps
+ * to NULL, which only needs recording when it hides an outer const.
+ *
+ * Only consts of the function being folded are seen. Functions are hoisted,
+ * one declared after a const can run before the const is initialized, so
+ * its body must read the variable: print(f()); const k = 3; function f() {
+ * return k; } prints null.
+ */
+typedef struct folder_t {
+    arena_t *arena;
+    fold_stats_t *stats;
+    scope_map_t scopes;
+    size_t frame; // scope mark taken on entering the current function
+} folder_t;
+
+static ast_node *lookup(folder_t *folder, const atom_t *name) {
+    uintptr_t value;
+    return scope_lookup_since(&folder->scopes, name, folder->frame, &value) ? (ast_node *)value : NULL;
+}
+
+static void bind(folder_t *folder, const atom_t *name, ast_node *value) {
+    if (value || lookup(folder, name))
+        scope_bind(&folder->scopes, name, (uintptr_t)value);
+}
+
+bool ast_is_literal(ast_node *node) {
+    if (!node)
+        return false;
+    return node->type == AST_NUMBER || node->type == AST_STRING
+        || node->type == AST_BOOLEAN || node->type == AST_NULL;
+}
+
+bool ast_literal_truthy(ast_node *node) {
+    switch (node->type) {
+    case AST_NUMBER: return node->number.value != 0 && !isnan(node->number.value);
+    case AST_STRING: return node->string.value.length != 0;
+    case AST_BOOLEAN: return node->boolean.value;
+    case AST_NULL: return false;
+    default:
+        elog("ast_literal_truthy expects a literal node, got type %d", node->type);
+        return false;
+    }
+}
+
+static bool literals_equal(ast_node *left, ast_node *right) {
+    switch (left->type) {
+    case AST_NUMBER: return left->number.value == right->number.value;
+    case AST_STRING: return sv_eq(left->string.value, right->string.value);
+    case AST_BOOLEAN: return left->boolean.value == right->boolean.value;
+    default: return true; // both null
+    }
+}
+
+static ast_node *copy_literal(arena_t *arena, ast_node *literal) {
+    ast_node *copy = create_ast_node(arena, literal->type);
+    *copy = *literal;
+    return copy;
+}
+
+static ast_node *folded_number(folder_t *folder, double value) {
+    folder->stats->folded++;
+    bool integral = value == trunc(value) && fabs(value) <= MAX_SAFE_INTEGER;
+    return create_number_node(folder->arena, value, integral);
+}
+
+static ast_node *folded_boolean(folder_t *folder, bool value) {
+    folder->stats->folded++;
+    return create_boolean_node(folder->arena, value);
+}
+
+static ast_node *fold_binary(folder_t *folder, ast_node *node) {
+    binary_op_type op = node->binary_op.op;
+    ast_node *left = node->binary_op.left;
+    ast_node *right = node->binary_op.right;
+
+    if (op == OP_AND || op == OP_OR) {
+        if (!ast_is_literal(left))
+            return node;
+        bool truthy = ast_literal_truthy(left);
+        if (truthy == (op == OP_OR)) // false && x, true || x
+            return folded_boolean(folder, truthy);
+        if (ast_is_literal(right))
+            return folded_boolean(folder, ast_literal_truthy(right));
+        return node;
+    }
+
+    if (!ast_is_literal(left) || !ast_is_literal(right) || left->type != right->type)
+        return node;
+
+    if (left->type == AST_NUMBER) {
+        double a = left->number.value;
+        double b = right->number.value;
+        double result;
+        switch (op) {
+        case OP_ADD: result = a + b; break;
+        case OP_SUBTRACT: result = a - b; break;
+        case OP_MULTIPLY: result = a * b; break;
+        case OP_DIVIDE: result = a / b; break;
+        case OP_EQUALS: return folded_boolean(folder, a == b);
+        case OP_NOT_EQUALS: return folded_boolean(folder, a != b);
+        case OP_GREATER: return folded_boolean(folder, a > b);
+        case OP_LESS: return folded_boolean(folder, a < b);
+        case OP_GREATER_EQUAL: return folded_boolean(folder, a >= b);
+        case OP_LESS_EQUAL: return folded_boolean(folder, a <= b);
+        default: return node;
+        }
+        return isfinite(result) ? folded_number(folder, result) : node;
+    }
+
+    switch (op) {
+    case OP_EQUALS: return folded_boolean(folder, literals_equal(left, right));
+    case OP_NOT_EQUALS: return folded_boolean(folder, !literals_equal(left, right));
+    case OP_ADD:
+        if (left->type == AST_STRING) {
+            str_view_t a = left->string.value;
+            str_view_t b = right->string.value;
+            char *data = (char *)arena_alloc(folder->arena, a.length + b.length + 1);
+            memcpy(data, a.data, a.length);
+            memcpy(data + a.length, b.data, b.length);
+            folder->stats->folded++;
+            return create_string_node(folder->arena, sv_make(data, a.length + b.length));
+        }
+        return node;
+    default:
+        return node;
+    }
+}
+
+static ast_node *fold_unary(folder_t *folder, ast_node *node) {
+    ast_node *operand = node->unary_op.operand;
+    if (!ast_is_literal(operand))
+        return node;
+
+    if (node->unary_op.op == OP_NOT)
+        return folded_boolean(folder, !ast_literal_truthy(operand));
+    if (operand->type == AST_NUMBER)
+        return folded_number(folder, -operand->number.value);
+    return node;
+}
+
+static ast_node *fold(folder_t *folder, ast_node *node);
+
+// Folds a statement list in place, dropping statements that fold away
+static void fold_list(folder_t *folder, ast_node **items, size_t *count) {
+    size_t kept = 0;
+    for (size_t i = 0; i < *count; i++) {
+        ast_node *item = fold(folder, items[i]);
+        if (item)
+            items[kept++] = item;
+    }
+    *count = kept;
+}
+
+static ast_node *fold_block(folder_t *folder, ast_node *node) {
+    size_t scope = scope_mark(&folder->scopes);
+    fold_list(folder, (ast_node **)node->block.stmts->items, &node->block.stmts->count);
+    scope_pop(&folder->scopes, scope);
+    return node;
+}
+
+// A dead branch becomes NULL, the statement is removed from its list
+static ast_node *fold(folder_t *folder, ast_node *node) {
+    if (!node)
+        return NULL;
+
+    switch (node->type) {
+    case AST_NUMBER:
+    case AST_STRING:
+    case AST_BOOLEAN:
+    case AST_NULL:
+    case AST_NEXT:
+    case AST_STOP:
+    case AST_LAZY_BLOCK:
+        return node;
+
+    case AST_IDENTIFIER: {
+        ast_node *value = lookup(folder, node->identifier.name);
+        if (!value)
+            return node;
+        folder->stats->propagated++;
+        return copy_literal(folder->arena, value);
+    }
+    case AST_VAR_DECLARATION:
+    case AST_CONST_DECLARATION: {
+        ast_node *initializer = fold(folder, node->var_declaration.initializer);
+        node->var_declaration.initializer = initializer;
+        bool constant = node->type == AST_CONST_DECLARATION && ast_is_literal(initializer);
+        bind(folder, node->var_declaration.name, constant ? initializer : NULL);
+        return node;
+    }
+    case AST_ASSIGNMENT:
+        // The target names a variable, it is never replaced by a value
+        if (node->assignment.left->type != AST_IDENTIFIER)
+            node->assignment.left = fold(folder, node->assignment.left);
+        node->assignment.right = fold(folder, node->assignment.right);
+        return node;
+
+    case AST_BINARY_OP:
+        node->binary_op.left = fold(folder, node->binary_op.left);
+        node->binary_op.right = fold(folder, node->binary_op.right);
+        return fold_binary(folder, node);
+    case AST_UNARY_OP:
+        node->unary_op.operand = fold(folder, node->unary_op.operand);
+        return fold_unary(folder, node);
+
+    case AST_IF: {
+        ast_node *condition = fold(folder, node->if_statement.condition);
+        if (ast_is_literal(condition)) {
+            folder->stats->pruned++;
+            return ast_literal_truthy(condition) ? fold(folder, node->if_statement.body) : NULL;
+        }
+        node->if_statement.condition = condition;
+        node->if_statement.body = fold(folder, node->if_statement.body);
+        return node;
+    }
+    case AST_IF_ELSE: {
+        ast_node *condition = fold(folder, node->if_else_statement.condition);
+        if (ast_is_literal(condition)) {
+            folder->stats->pruned++;
+            return fold(folder, ast_literal_truthy(condition)
+                ? node->if_else_statement.if_body
+                : node->if_else_statement.else_body);
+        }
+        node->if_else_statement.condition = condition;
+        node->if_else_statement.if_body = fold(folder, node->if_else_statement.if_body);
+        node->if_else_statement.else_body = fold(folder, node->if_else_statement.else_body);
+        return node;
+    }
+    case AST_LOOP: {
+        ast_node *condition = fold(folder, node->loop.condition);
+        if (ast_is_literal(condition) && !ast_literal_truthy(condition)) {
+            folder->stats->pruned++;
+            return NULL;
+        }
+        node->loop.condition = condition;
+        node->loop.body = fold(folder, node->loop.body);
+        return node;
+    }
+
+    case AST_FUNCTION_DECLARATION: {
+        bind(folder, node->function_declaration.name, NULL);
+        size_t scope = scope_mark(&folder->scopes);
+        size_t frame = folder->frame;
+        folder->frame = scope;
+        node->function_declaration.body = fold(folder, node->function_declaration.body);
+        folder->frame = frame;
+        scope_pop(&folder->scopes, scope);
+        return node;
+    }
+    case AST_FUNCTION_CALL:
+    case AST_PRINT:
+    case AST_TAKE:
+        // The callee stays a name, calling a literal fails the same at runtime
+        if (node->function_call.callee->type != AST_IDENTIFIER)
+            node->function_call.callee = fold(folder, node->function_call.callee);
+        for (size_t i = 0; i < node->function_call.argument_count; i++)
+            node->function_call.arguments[i] = fold(folder, node->function_call.arguments[i]);
+        return node;
+    case AST_RETURN:
+        node->return_statement.value = fold(folder, node->return_statement.value);
+        return node;
+
+    case AST_BLOCK:
+        return fold_block(folder, node);
+    case AST_ARRAY:
+        for (size_t i = 0; i < node->array.element_count; i++)
+            node->array.elements[i] = fold(folder, node->array.elements[i]);
+        return node;
+    case AST_ARRAY_ACCESS:
+        node->array_access.array = fold(folder, node->array_access.array);
+        node->array_access.index = fold(folder, node->array_access.index);
+        return node;
+    case AST_PROPERTY_ACCESS:
+        node->property_access.object = fold(folder, node->property_access.object);
+        return node;
+    case AST_PROGRAM:
+        fold_list(folder, node->program.statements, &node->program.statement_count);
+        return node;
+    }
+
+    elog("Can't fold ast node with unknown type %d", node->type);
+    return NULL;
+}
+
+ast_node *fold_constants(ast_node *root, arena_t *arena, fold_stats_t *stats) {
+    if (!root || !arena)
+        elog("Can't fold constants, NULL ptr on root or arena");
+
+    fold_stats_t local;
+    if (!stats)
+        stats = &local;
+    memset(stats, 0, sizeof(*stats));
+    stats->nodes_before = ast_node_count(root);
+
+    folder_t folder = { .arena = arena, .stats = stats };
+    scope_map_init(&folder.scopes);
+    root = fold(&folder, root);
+    scope_map_free(&folder.scopes);
+
+    stats->nodes_after = ast_node_count(root);
+    return root;
+}
+
+size_t ast_node_count(ast_node *node) {
+    if (!node)
+        return 0;
+
+    size_t count = 1;
+    switch (node->type) {
+    case AST_VAR_DECLARATION:
+    case AST_CONST_DECLARATION:
+        count += ast_node_count(node->var_declaration.initializer);
+        break;
+    case AST_ASSIGNMENT:
+        count += ast_node_count(node->assignment.left) + ast_node_count(node->assignment.right);
+        break;
+    case AST_BINARY_OP:
+        count += ast_node_count(node->binary_op.left) + ast_node_count(node->binary_op.right);
+        break;
+    case AST_UNARY_OP:
+        count += ast_node_count(node->unary_op.operand);
+        break;
+    case AST_IF:
+        count += ast_node_count(node->if_statement.condition) + ast_node_count(node->if_statement.body);
+        break;
+    case AST_IF_ELSE:
+        count += ast_node_count(node->if_else_statement.condition)
+               + ast_node_count(node->if_else_statement.if_body)
+               + ast_node_count(node->if_else_statement.else_body);
+        break;
+    case AST_LOOP:
+        count += ast_node_count(node->loop.condition) + ast_node_count(node->loop.body);
+        break;
+    case AST_FUNCTION_DECLARATION:
+        for (size_t i = 0; i < node->function_declaration.parameters->count; i++)
+            count += ast_node_count(node->function_declaration.parameters->items[i]);
+        count += ast_node_count(node->function_declaration.body);
+        break;
+    case AST_FUNCTION_CALL:
+    case AST_PRINT:
+    case AST_TAKE:
+        count += ast_node_count(node->function_call.callee);
+        for (size_t i = 0; i < node->function_call.argument_count; i++)
+            count += ast_node_count(node->function_call.arguments[i]);
+        break;
+    case AST_RETURN:
+        count += ast_node_count(node->return_statement.value);
+        break;
+    case AST_BLOCK:
+        for (size_t i = 0; i < node->block.stmts->count; i++)
+            count += ast_node_count(node->block.stmts->items[i]);
+        break;
+    case AST_ARRAY:
+        for (size_t i = 0; i < node->array.element_count; i++)
+            count += ast_node_count(node->array.elements[i]);
+        break;
+    case AST_ARRAY_ACCESS:
+        count += ast_node_count(node->array_access.array) + ast_node_count(node->array_access.index);
+        break;
+    case AST_PROPERTY_ACCESS:
+        count += ast_node_count(node->property_access.object);
+        break;
+    case AST_PROGRAM:
+        for (size_t i = 0; i < node->program.statement_count; i++)
+            count += ast_node_count(node->program.statements[i]);
+        break;
+    default:
+        break;
+    }
+    return count;
+}
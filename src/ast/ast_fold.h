@@ -0,0 +1,43 @@
+#ifndef AST_FOLD_H
+#define AST_FOLD_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "ast.h"
+#include "../utils/arena.h"
+
+/*
+ * Optimization pass run between parse_program and execution, rewriting the
+ * tree in place. New nodes come from arena, the arena of the tree.
+ *   - arithmetic and comparison on number literals, == and != on literals
+ *     of the same kind, + on two strings
+ *   - ! and unary - on literals, && and || once the left literal decides
+ *     or both sides are literals
+ *   - uses of a const whose folded initializer is a literal are replaced by
+ *     a copy of it, as long as no inner declaration shadows the name; only
+ *     in the function declaring the const, a hoisted inner function may run
+ *     before the initializer
+ *   - if, if-else and loop with a literal condition lose the dead branch
+ * Truthiness is JavaScript's: false, null, 0, NaN and "" are falsy. Logical
+ * and comparison operators always produce booleans. Divisions by zero and
+ * other non-finite results are left to the runtime. Function bodies that
+ * are still AST_LAZY_BLOCK are not visited.
+ */
+
+typedef struct fold_stats_t {
+    size_t nodes_before;
+    size_t nodes_after;
+    size_t folded;     // operators replaced by their literal result
+    size_t propagated; // const uses replaced by their value
+    size_t pruned;     // if and loop statements with a constant condition
+} fold_stats_t;
+
+// Returns the new root, stats is optional
+ast_node *fold_constants(ast_node *root, arena_t *arena, fold_stats_t *stats);
+
+size_t ast_node_count(ast_node *node);
+
+bool ast_is_literal(ast_node *node);
+bool ast_literal_truthy(ast_node *node);
+
+#endif
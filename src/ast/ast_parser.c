@@ -1,481 +1,636 @@
 #include <stdbool.h>
+#include <stdint.h>
 #include <string.h>
 #include "ast.h"
 #include "ast_parser.h"
+#include "ast_resolve.h"
 #include "../lexer/lexer.h"
 #include "../lexer/token.h"
 #include "../utils/logger.h"
 
-lexer_t *lexer_g = NULL;
-size_t current_token = 0;
+parser_t *new_parser(lexer_t *lexer, arena_t *arena){
+    if(!lexer) elog("Can't create parser_t struct with NULL ptr on lexer");
+    if(!arena) elog("Can't create parser_t struct with NULL ptr on arena");
+    if(!lexer->tokens && !lexer->window)
+        elog("Can't create parser_t struct, lexer was not tokenized");
+
+    parser_t *parser = (parser_t*)malloc(sizeof(parser_t));
+    if(!parser) elog("Error allocation memory for parser_t struct");
+
+    parser->lexer = lexer;
+    parser->current = 0;
+    parser->arena = arena;
+    parser->lazy_functions = false;
+    parser->scratch = new_arr(64);
+    if(!parser->scratch) elog("Error allocation memory for parser scratch list");
+    return parser;
+}
+
+void free_parser(parser_t *parser){
+    if(!parser) return;
+    free_arr(parser->scratch);
+    free(parser);
+}
+
+/*
+ * Child lists (statements, arguments, ...) are collected on one scratch
+ * stack shared by the whole parse and copied into the arena once complete.
+ * A nested list just stacks on top of the one being built around it.
+ * Items must only be taken once the list is complete, a push can move them.
+ */
+static inline size_t scratch_mark(parser_t *parser){
+    return parser->scratch->count;
+}
+
+static inline void scratch_push(parser_t *parser, ast_node *node){
+    if(!arr_push(parser->scratch , node))
+        elog("Error allocation memory for parser scratch list");
+}
+
+static inline ast_node **scratch_items(parser_t *parser, size_t mark){
+    return (ast_node**)parser->scratch->items + mark;
+}
+
+static inline size_t scratch_count(parser_t *parser, size_t mark){
+    return parser->scratch->count - mark;
+}
+
+static inline void scratch_release(parser_t *parser, size_t mark){
+    parser->scratch->count = mark;
+}
 
-void syntax_error(const char* format, ...) {
+void syntax_error(parser_t *parser, const char* format, ...) {
     char msg[256];
     va_list args;
     va_start(args, format);
     vsnprintf(msg, sizeof(msg), format, args);
     va_end(args);
     
-    elog("[%zu:%zu] Syntax error : %s", lexer_g->line, lexer_g->column, msg);
+    token_t token = lexer_token_at(parser->lexer, parser->current);
+    source_location_t location = lexer_location(parser->lexer, token.offset);
+    nojs_raise(__FILE__, __LINE__, NOJS_ERROR_SYNTAX, location.line, location.column, "%s", msg);
 }
 
-bool current_token_is(ttype type){
-    if(!lexer_g) elog("Can't check what type of current token , global lexer is null");    
-     if(current_token >= lexer_g->tokens->count)
-        elog("Global current token index was out of range in global tokens arr");
-    token_t* token = (token_t*)lexer_g->tokens->items[current_token];
-    return token->type == type;
+bool current_token_is(parser_t *parser, ttype type){
+    return lexer_type_at(parser->lexer , parser->current) == type;
 }
 
-bool next_token_is(ttype type){
-    if(!lexer_g) elog("Can't check what type of current token , global lexer is null");    
-    if(current_token >= lexer_g->tokens->count)
-        elog("Global current token index was out of range in global tokens arr");
-    
-    if(current_token + 1 >= lexer_g->tokens->count)
-        elog("Can't get next token in global lexer, is end");
+bool next_token_is(parser_t *parser, ttype type){
+    if(lexer_type_at(parser->lexer , parser->current) == END)
+        elog("Can't get next token in parser, is end");
 
-    token_t* token = (token_t*)lexer_g->tokens->items[current_token+1];
-    return token->type == type;
+    return lexer_type_at(parser->lexer , parser->current + 1) == type;
 }
 
-bool prev_token_is(ttype type){
-    if(!lexer_g) elog("Can't check what type of current token , global lexer is null");    
-    if(current_token >= lexer_g->tokens->count)
-        elog("Global current token index was out of range in global tokens arr");
-    
-    if(current_token == 0)
-        elog("Global current token index point on first element , can't get prev type");
+bool prev_token_is(parser_t *parser, ttype type){
+    if(parser->current == 0)
+        elog("Parser current token index point on first element , can't get prev type");
 
-    token_t* token = (token_t*)lexer_g->tokens->items[current_token-1];
-    return token->type == type;
+    return lexer_type_at(parser->lexer , parser->current - 1) == type;
 }
 
-token_t *peek_current_token(){
-     if(!lexer_g) elog("Can't check what type of current token , global lexer is null");    
-     if(current_token >= lexer_g->tokens->count)
-        elog("Global current token index was out of range in global tokens arr");
-
-    return lexer_g->tokens->items[current_token];
+token_t peek_current_token(parser_t *parser){
+    return lexer_token_at(parser->lexer , parser->current);
 }
 
-token_t *peek_next_token(){
-  if(!lexer_g) elog("Can't check what type of current token , global lexer is null");    
-    if(current_token >= lexer_g->tokens->count)
-        elog("Global current token index was out of range in global tokens arr");
-    
-    if(current_token + 1 >= lexer_g->tokens->count)
-        elog("Can't get next token in global lexer, is end");
+token_t peek_next_token(parser_t *parser){
+    if(lexer_type_at(parser->lexer , parser->current) == END)
+        elog("Can't get next token in parser, is end");
 
-    return lexer_g->tokens->items[current_token+1];
+    return lexer_token_at(parser->lexer , parser->current + 1);
 }
 
-token_t *peek_prev_token(){
-    if(!lexer_g) elog("Can't check what type of current token , global lexer is null");    
-    if(current_token >= lexer_g->tokens->count)
-        elog("Global current token index was out of range in global tokens arr");
-    
-    if(current_token == 0)
-        elog("Global current token index point on first element , can't get prev type");
-
-    return lexer_g->tokens->items[current_token-1];
+token_t peek_prev_token(parser_t *parser){
+    if(parser->current == 0)
+        elog("Parser current token index point on first element , can't get prev type");
 
+    return lexer_token_at(parser->lexer , parser->current - 1);
 }
 
-void tskip(){
-    if (current_token + 1 >= lexer_g->tokens->count)
+void tskip(parser_t *parser){
+    if (lexer_type_at(parser->lexer , parser->current) == END)
         elog("Cannot skip token - would go out of range");
-    current_token++;
+    parser->current++;
 }
 
-ast_node *parse_program(){
-    arr_t *statments = new_arr(1);
-    while(!current_token_is(END)){
-        ast_node* stmt = parse_statement();
-        arr_push(statments , stmt);
+typedef struct parse_job_t {
+    const char *source;
+    arena_t *arena;
+    lexer_t *lexer;
+    parser_t *parser;
+    ast_node *program;
+} parse_job_t;
+
+static void run_parse_job(void *context){
+    parse_job_t *job = (parse_job_t*)context;
+    job->lexer = new_lexer(job->source);
+    tokenize_into(job->lexer);
+    job->parser = new_parser(job->lexer, job->arena);
+    job->program = parse_program(job->parser);
+}
+
+ast_node *try_parse(const char *source, arena_t *arena, lexer_t **lexer, nojs_error_t *error){
+    if(!lexer || !error) elog("Can't parse, NULL ptr on lexer or error");
+
+    parse_job_t job = { source, arena, NULL, NULL, NULL };
+    bool parsed = nojs_protect(run_parse_job, &job, error);
+    free_parser(job.parser);
+
+    if(!parsed){
+        free_lexer(job.lexer);
+        *lexer = NULL;
+        return NULL;
+    }
+    *lexer = job.lexer;
+    return job.program;
+}
+
+ast_node *parse_program(parser_t *parser){
+    size_t mark = scratch_mark(parser);
+    while(!current_token_is(parser, END)){
+        ast_node* stmt = parse_statement(parser);
+        scratch_push(parser , stmt);
     }
-    return create_program_node((ast_node**)statments->items , statments->count);
-}
-
-ast_node *parse_statement(){
-    if(current_token_is(LET) || current_token_is(CONST)){
-        return parse_var_declaration();
-    } else if(current_token_is(IF)){
-        return parse_if_statement();
-    } else if(current_token_is(LOOP)){
-        return parse_loop_statement();
-    } else if(current_token_is(FUNCTION)){
-        return parse_function_declaration();
-    } else if(current_token_is(RETURN)){
-        return parse_return_statement();
-    } else if(current_token_is(PRINT)){
-        return parse_print_statement();
-    } else if(current_token_is(TAKE)){
-        return parse_take_statement();
-    } else if(current_token_is(NEXT)){
-        tskip();
-        if(current_token_is(SEMICOLON)) tskip();
-        return create_next_node();
-    } else if(current_token_is(STOP)){
-        tskip();
-        if(current_token_is(SEMICOLON)) tskip();
-        return create_stop_node();
-    } else if(current_token_is(LBRACE)){
-        return parse_block();
+
+    ast_node *node = create_program_node(parser->arena, scratch_items(parser, mark) , scratch_count(parser, mark));
+    scratch_release(parser , mark);
+    return node;
+}
+
+ast_node *parse_statement(parser_t *parser){
+    if(current_token_is(parser, LET) || current_token_is(parser, CONST)){
+        return parse_var_declaration(parser);
+    } else if(current_token_is(parser, IF)){
+        return parse_if_statement(parser);
+    } else if(current_token_is(parser, LOOP)){
+        return parse_loop_statement(parser);
+    } else if(current_token_is(parser, FUNCTION)){
+        return parse_function_declaration(parser);
+    } else if(current_token_is(parser, RETURN)){
+        return parse_return_statement(parser);
+    } else if(current_token_is(parser, PRINT)){
+        return parse_print_statement(parser);
+    } else if(current_token_is(parser, TAKE)){
+        return parse_take_statement(parser);
+    } else if(current_token_is(parser, NEXT)){
+        tskip(parser);
+        if(current_token_is(parser, SEMICOLON)) tskip(parser);
+        return create_next_node(parser->arena);
+    } else if(current_token_is(parser, STOP)){
+        tskip(parser);
+        if(current_token_is(parser, SEMICOLON)) tskip(parser);
+        return create_stop_node(parser->arena);
+    } else if(current_token_is(parser, LBRACE)){
+        return parse_block(parser);
     } else {
-        ast_node *expr = parse_expression();
-        if(current_token_is(SEMICOLON)) tskip();
+        ast_node *expr = parse_expression(parser);
+        if(current_token_is(parser, SEMICOLON)) tskip(parser);
         return expr;
     }
 }
 
-ast_node *parse_var_declaration(){
-    bool is_const = current_token_is(CONST);
-    tskip();
-    if(!current_token_is(IDENTIFIER)){
+ast_node *parse_var_declaration(parser_t *parser){
+    bool is_const = current_token_is(parser, CONST);
+    tskip(parser);
+    if(!current_token_is(parser, IDENTIFIER)){
         if(is_const){
-            syntax_error("Have 'const' but have no var name");
+            syntax_error(parser, "Have 'const' but have no var name");
         } else{
-            syntax_error("Have 'let' but have no var name");
+            syntax_error(parser, "Have 'let' but have no var name");
         }
     }
 
-    token_t *token = peek_current_token();
-    char* name = token->value.string;
-    tskip();
+    token_t token = peek_current_token(parser);
+    const atom_t *name = token.value.atom;
+    tskip(parser);
 
-    if(!current_token_is(ASSIGN))
-        syntax_error("Have declaratin var %s , but not assign value to it" , name);
+    if(!current_token_is(parser, ASSIGN))
+        syntax_error(parser, "Have declaratin var %s , but not assign value to it" , name->text);
 
-    tskip();
-    ast_node *set_expr = parse_expression();
+    tskip(parser);
+    ast_node *set_expr = parse_expression(parser);
 
-    if(!current_token_is(SEMICOLON))
-        syntax_error("Not exist ';'");
-    tskip();
+    if(!current_token_is(parser, SEMICOLON))
+        syntax_error(parser, "Not exist ';'");
+    tskip(parser);
 
     if(is_const)
-        return create_const_declaration_node(name , set_expr);
+        return create_const_declaration_node(parser->arena, name , set_expr);
     else
-        return create_var_declaration_node(name , set_expr);
+        return create_var_declaration_node(parser->arena, name , set_expr);
 }
 
-ast_node *parse_if_statement(){
-    tskip();
-    if(!current_token_is(LPARENT))
-        syntax_error("After 'if' must go '('");
-    tskip();
+ast_node *parse_if_statement(parser_t *parser){
+    tskip(parser);
+    if(!current_token_is(parser, LPARENT))
+        syntax_error(parser, "After 'if' must go '('");
+    tskip(parser);
 
-    ast_node *condition = parse_expression();
+    ast_node *condition = parse_expression(parser);
 
-    if(!current_token_is(RPARENT))
-        syntax_error("Have '(' expression , but have no ')'");
-    tskip();
+    if(!current_token_is(parser, RPARENT))
+        syntax_error(parser, "Have '(' expression , but have no ')'");
+    tskip(parser);
 
-    if(!current_token_is(LBRACE))
-        syntax_error("Not exist '{' , if (expression) <- here");
-    ast_node *if_block = parse_block();
+    if(!current_token_is(parser, LBRACE))
+        syntax_error(parser, "Not exist '{' , if (expression) <- here");
+    ast_node *if_block = parse_block(parser);
     
     ast_node *else_block = NULL;
-    if(current_token_is(ELSE)) {
-        tskip();
-        if(!current_token_is(LBRACE))
-            syntax_error("after 'else' must go '{' ");
-        else_block = parse_block();
+    if(current_token_is(parser, ELSE)) {
+        tskip(parser);
+        if(!current_token_is(parser, LBRACE))
+            syntax_error(parser, "after 'else' must go '{' ");
+        else_block = parse_block(parser);
     }
 
     if(!else_block)
-        return create_if_node(condition , if_block);
+        return create_if_node(parser->arena, condition , if_block);
     else 
-        return create_if_else_node(condition , if_block , else_block);
+        return create_if_else_node(parser->arena, condition , if_block , else_block);
 }
 
-ast_node *parse_loop_statement(){
-    tskip();
-    if(!current_token_is(LPARENT))
-        syntax_error("After 'loop' must go '('");
-    tskip();
+ast_node *parse_loop_statement(parser_t *parser){
+    tskip(parser);
+    if(!current_token_is(parser, LPARENT))
+        syntax_error(parser, "After 'loop' must go '('");
+    tskip(parser);
 
-    ast_node *condition = parse_expression();
+    ast_node *condition = parse_expression(parser);
 
-    if(!current_token_is(RPARENT))
-        syntax_error("Have loop with '(' , expression , but have no ')'");
-    tskip();
+    if(!current_token_is(parser, RPARENT))
+        syntax_error(parser, "Have loop with '(' , expression , but have no ')'");
+    tskip(parser);
 
-    if(!current_token_is(LBRACE))
-        syntax_error("After loop(expression) . <- here must go '{'");
-    ast_node *loop_block = parse_block();
+    if(!current_token_is(parser, LBRACE))
+        syntax_error(parser, "After loop(expression) . <- here must go '{'");
+    ast_node *loop_block = parse_block(parser);
 
-    return create_loop_node(condition , loop_block);
+    return create_loop_node(parser->arena, condition , loop_block);
 }
 
-ast_node *parse_function_declaration() {
-    tskip();
-    if(!current_token_is(IDENTIFIER))
-        syntax_error("have function declaration without name");
-    token_t *token = peek_current_token();
-    char *func_name = token->value.string;
-    tskip();
+ast_node *parse_function_declaration(parser_t *parser){
+    tskip(parser);
+    if(!current_token_is(parser, IDENTIFIER))
+        syntax_error(parser, "have function declaration without name");
+    token_t token = peek_current_token(parser);
+    const atom_t *func_name = token.value.atom;
+    tskip(parser);
     
-    if(!current_token_is(LPARENT)) 
-        syntax_error("After func name %s must go '(' params ')'" , func_name);
-    tskip();
+    if(!current_token_is(parser, LPARENT)) 
+        syntax_error(parser, "After func name %s must go '(' params ')'" , func_name->text);
+    tskip(parser);
     
-    arr_t *params = new_arr(1);
+    size_t mark = scratch_mark(parser);
     
-    if(current_token_is(RPARENT)) {
-        tskip();
+    if(current_token_is(parser, RPARENT)) {
+        tskip(parser);
     } else {
-    token_t* token = peek_current_token();
         while(1) {
-            if(!current_token_is(IDENTIFIER))
-                syntax_error("In function %s must go only names" , func_name);
+            if(!current_token_is(parser, IDENTIFIER))
+                syntax_error(parser, "In function %s must go only names" , func_name->text);
             
-            ast_node *param = parse_expression();
-            arr_push(params, param);
-            tskip();
+            ast_node *param = create_identifier_node(parser->arena, peek_current_token(parser).value.atom);
+            scratch_push(parser, param);
+            tskip(parser);
             
-            if(current_token_is(RPARENT)) {
-                tskip();
+            if(current_token_is(parser, RPARENT)) {
+                tskip(parser);
                 break;
             }
             
-            if(!current_token_is(COMMA))
-                syntax_error("Have something after param(s) name(s), but expected comma in func %s", func_name);
-            tskip();
+            if(!current_token_is(parser, COMMA))
+                syntax_error(parser, "Have something after param(s) name(s), but expected comma in func %s", func_name->text);
+            tskip(parser);
         }
     }
     
-    if(!current_token_is(LBRACE))
-        syntax_error("After func func_name(params) . <- here , must go '{'");
-
-    ast_node *func_body = parse_block();
-    ast_node *node = create_function_declaration_node(func_name, params , func_body);
+    if(!current_token_is(parser, LBRACE))
+        syntax_error(parser, "After func func_name(params) . <- here , must go '{'");
+
+    ast_node *func_body = parser->lazy_functions && parser->lexer->tokens
+        ? preparse_block(parser)
+        : parse_block(parser);
+    ast_node *node = create_function_declaration_node(parser->arena, func_name, scratch_items(parser, mark), scratch_count(parser, mark), func_body);
+    scratch_release(parser , mark);
     return node;
 }
 
-ast_node *parse_return_statement(){
-    tskip();
-    ast_node *value = parse_expression();
-    return create_return_node(value);
+ast_node *parse_return_statement(parser_t *parser){
+    tskip(parser);
+    ast_node *value = NULL;
+    if(!current_token_is(parser, SEMICOLON) && !current_token_is(parser, RBRACE))
+        value = parse_expression(parser);
+    if(current_token_is(parser, SEMICOLON)) tskip(parser);
+    return create_return_node(parser->arena, value);
 }
 
-ast_node *parse_print_statement(){
-    elog("peint keyword is not implemented");
-    return NULL;
+// print(...) and take(...) are calls, see parse_primary
+ast_node *parse_print_statement(parser_t *parser){
+    ast_node *call = parse_expression(parser);
+    if(current_token_is(parser, SEMICOLON)) tskip(parser);
+    return call;
 }
 
-ast_node *parse_take_statement(){
-    elog("peint keyword is not implemented");
-    return NULL;
+ast_node *parse_take_statement(parser_t *parser){
+    return parse_print_statement(parser);
 }
 
-ast_node *parse_block(){
-    tskip();
-    arr_t *stmts = new_arr(1);
+ast_node *parse_block(parser_t *parser){
+    tskip(parser);
+    size_t mark = scratch_mark(parser);
     
-    while(!current_token_is(RBRACE)){
-        ast_node *stm = parse_statement();
-        arr_push(stmts , stm);
+    while(!current_token_is(parser, RBRACE)){
+        ast_node *stm = parse_statement(parser);
+        scratch_push(parser , stm);
     }
     
-    tskip();  
-    return create_block_node(stmts);
+    tskip(parser);  
+    ast_node *node = create_block_node(parser->arena, scratch_items(parser, mark) , scratch_count(parser, mark));
+    scratch_release(parser , mark);
+    return node;
+}
+
+// Skips a block by brace matching on the token types alone, no nodes are built
+ast_node *preparse_block(parser_t *parser){
+    const uint8_t *types = parser->lexer->tokens->types;
+    size_t start = parser->current;
+    size_t index = start;
+    size_t depth = 0;
+
+    do {
+        switch(types[index]){
+        case LBRACE: depth++; break;
+        case RBRACE: depth--; break;
+        case END:
+            syntax_error(parser, "Function body '{' is never closed");
+            break;
+        default: break;
+        }
+        index++;
+    } while(depth);
+
+    parser->current = index;
+    return create_lazy_block_node(parser->arena, parser->lexer, start, index);
+}
+
+ast_node *function_body(ast_node *function, arena_t *arena){
+    if(!function || function->type != AST_FUNCTION_DECLARATION)
+        elog("function_body expects a function declaration node");
+
+    ast_node *body = function->function_declaration.body;
+    if(body->type != AST_LAZY_BLOCK) return body;
+
+    parser_t *parser = new_parser(body->lazy_block.lexer, arena);
+    parser->current = body->lazy_block.start;
+    parser->lazy_functions = true;
+    ast_node *block = parse_block(parser);
+    free_parser(parser);
+
+    function->function_declaration.body = block;
+    if(body->lazy_block.scope)
+        resolve_lazy_body(function, body->lazy_block.scope, arena);
+    return block;
 }
 
-ast_node *parse_function_call(const char *name) {
-    if(!current_token_is(LPARENT))
-        syntax_error("After function name %s must go '('" , name);
-    tskip();
+// Parses the '(' arguments ')' of a call to callee
+ast_node *parse_function_call(parser_t *parser, ast_node *callee) {
+    if(!current_token_is(parser, LPARENT))
+        syntax_error(parser, "Call arguments must start with '('");
+    tskip(parser);
     
-    arr_t *args = new_arr(1);
+    size_t mark = scratch_mark(parser);
     
-    if(current_token_is(RPARENT)) {
-        tskip();
-        ast_node *identifier = create_identifier_node(name);
-        return create_function_call_node(identifier, NULL, 0);
+    if(current_token_is(parser, RPARENT)) {
+        tskip(parser);
+        return create_function_call_node(parser->arena, callee, NULL, 0);
     }
     
     while(1) {
-        ast_node *arg = parse_expression();
-        if(!arg)
-            syntax_error("Invalid argument in function call %s", name);
+        ast_node *arg = parse_expression(parser);
+        scratch_push(parser, arg);
         
-        arr_push(args, arg);
-        
-        if(current_token_is(RPARENT)) {
-            tskip();
+        if(current_token_is(parser, RPARENT)) {
+            tskip(parser);
             break;
         }
         
-        if(!current_token_is(COMMA))
-            syntax_error("Expected comma after argument in function call %s", name);
-        tskip();
+        if(!current_token_is(parser, COMMA))
+            syntax_error(parser, "Expected comma after argument in function call");
+        tskip(parser);
     }
     
-    ast_node *identifier = create_identifier_node(name);
-    return create_function_call_node(identifier, (ast_node**)args->items, args->count);
+    ast_node *node = create_function_call_node(parser->arena, callee, scratch_items(parser, mark), scratch_count(parser, mark));
+    scratch_release(parser , mark);
+    return node;
 }
 
-ast_node *parse_array_literal(){
-    if(!current_token_is(LBRACKET))
-        syntax_error("Array literal must start with '['");
-    tskip();
+ast_node *parse_array_literal(parser_t *parser){
+    if(!current_token_is(parser, LBRACKET))
+        syntax_error(parser, "Array literal must start with '['");
+    tskip(parser);
 
-    if(current_token_is(RBRACKET)){
-        tskip();
-        return create_array_node(NULL , 0);
+    if(current_token_is(parser, RBRACKET)){
+        tskip(parser);
+        return create_array_node(parser->arena, NULL , 0);
     }
 
-    arr_t *elements = new_arr(1);
+    size_t mark = scratch_mark(parser);
     while(1){
-        ast_node *expr = parse_expression();
+        ast_node *expr = parse_expression(parser);
         if(!expr)
-            syntax_error("Invalid element in array literal");
+            syntax_error(parser, "Invalid element in array literal");
 
-        arr_push(elements , expr);
-        if(current_token_is(RBRACKET)){
-            tskip();
+        scratch_push(parser , expr);
+        if(current_token_is(parser, RBRACKET)){
+            tskip(parser);
             break;
         }
 
-        if(!current_token_is(COMMA))
-            syntax_error("Expected comma after array element");
-        tskip();
+        if(!current_token_is(parser, COMMA))
+            syntax_error(parser, "Expected comma after array element");
+        tskip(parser);
     }
 
-    return create_array_node((ast_node**)elements->items , elements->count);
+    ast_node *node = create_array_node(parser->arena, scratch_items(parser, mark) , scratch_count(parser, mark));
+    scratch_release(parser , mark);
+    return node;
 }
 
-ast_node *parse_expression() {
-    return parse_equality();
+/*
+ * Expressions are parsed by precedence climbing (Pratt). Every binary
+ * operator token has a binding power in binary_ops, and parse_binary keeps
+ * folding operators into its left operand while they bind tighter than the
+ * caller's minimum. All binary operators are left associative, and unary
+ * operators bind tighter than any of them.
+ *
+ * The hot path reads the cursor unchecked: the token stream always ends with
+ * END and tskip never moves past it, so the current token always exists.
+ */
+
+typedef enum binding_power {
+    BP_NONE,
+    BP_OR,
+    BP_AND,
+    BP_EQUALITY,
+    BP_COMPARISON,
+    BP_TERM,
+    BP_FACTOR,
+} binding_power;
+
+typedef struct binary_op_info {
+    uint8_t power; // BP_NONE for tokens that don't continue an expression
+    binary_op_type op;
+} binary_op_info;
+
+static const binary_op_info binary_ops[END + 1] = {
+    [OR]            = {BP_OR, OP_OR},
+    [AND]           = {BP_AND, OP_AND},
+    [EQUALS]        = {BP_EQUALITY, OP_EQUALS},
+    [NOT_EQUALS]    = {BP_EQUALITY, OP_NOT_EQUALS},
+    [GREATER]       = {BP_COMPARISON, OP_GREATER},
+    [GREATER_EQUAL] = {BP_COMPARISON, OP_GREATER_EQUAL},
+    [LESS]          = {BP_COMPARISON, OP_LESS},
+    [LESS_EQUAL]    = {BP_COMPARISON, OP_LESS_EQUAL},
+    [PLUS]          = {BP_TERM, OP_ADD},
+    [MINUS]         = {BP_TERM, OP_SUBTRACT},
+    [MUL]           = {BP_FACTOR, OP_MULTIPLY},
+    [DIV]           = {BP_FACTOR, OP_DIVIDE},
+};
+
+static inline ttype current_type(parser_t *parser) {
+    if (parser->lexer->tokens)
+        return (ttype)parser->lexer->tokens->types[parser->current];
+    return lexer_window_token(parser->lexer, parser->current).type;
 }
 
-ast_node *parse_equality() {
-    ast_node *left = parse_comparison();
-    
-    while(current_token_is(EQUALS) || current_token_is(NOT_EQUALS)) {
-        binary_op_type op = current_token_is(EQUALS) ? OP_EQUALS : OP_NOT_EQUALS;
-        tskip();
-        ast_node *right = parse_comparison();
-        left = create_binary_op_node(op, left, right);
-    }
-    
-    return left;
+// Only for a current token already known not to be END
+static inline void advance(parser_t *parser) {
+    parser->current++;
 }
 
-ast_node *parse_comparison(){
-    ast_node *left = parse_term();
+// Assignment binds loosest and is right associative: a = b = c
+ast_node *parse_expression(parser_t *parser){
+    ast_node *left = parse_binary(parser, BP_NONE);
+    if(current_type(parser) != ASSIGN)
+        return left;
+
+    if(left->type != AST_IDENTIFIER && left->type != AST_PROPERTY_ACCESS && left->type != AST_ARRAY_ACCESS)
+        syntax_error(parser, "Can only assign to a variable, a property or an array element");
+    advance(parser);
+    ast_node *value = parse_expression(parser);
+    return create_assignment_node(parser->arena, left, value);
+}
 
- while(current_token_is(GREATER) || current_token_is(LESS) || 
-          current_token_is(GREATER_EQUAL) || current_token_is(LESS_EQUAL)) {
-    binary_op_type op;
-    if(current_token_is(GREATER)) op = OP_GREATER;
-    else if(current_token_is(GREATER_EQUAL)) op = OP_GREATER_EQUAL;
-    else if(current_token_is(LESS)) op = OP_LESS;
-    else op = OP_LESS_EQUAL;
-    tskip();
-    ast_node *rigth = parse_term();
-    left = create_binary_op_node(op ,left , rigth);
- }
-
- return left;
-}
-
-ast_node *parse_term(){
-    ast_node *left = parse_factor();
-
-    while(current_token_is(PLUS) || current_token_is(MINUS)){
-        binary_op_type op = current_token_is(PLUS) ? OP_ADD : OP_SUBTRACT;
-        tskip();
-        ast_node *rigth = parse_factor();
-        left = create_binary_op_node(op , left , rigth);
-    }
+ast_node *parse_binary(parser_t *parser, int min_power) {
+    ast_node *left = parse_unary(parser);
 
-    return left;
-}
+    while(1){
+        const binary_op_info *info = &binary_ops[current_type(parser)];
+        if(info->power <= min_power)
+            break;
 
-ast_node *parse_factor(){
-    ast_node *left = parse_unary();
-    
-    while(current_token_is(MUL) || current_token_is(DIV)){
-        binary_op_type op = current_token_is(MUL) ? OP_MULTIPLY : OP_DIVIDE;
-        tskip();
-        ast_node *rigth = parse_unary();
-        left = create_binary_op_node(op , left , rigth);
+        advance(parser);
+        ast_node *right = parse_binary(parser, info->power);
+        left = create_binary_op_node(parser->arena, info->op , left , right);
     }
+
     return left;
 }
 
-ast_node *parse_unary(){
-    if(current_token_is(MINUS) || current_token_is(NOT)) {
-        unary_op_type op = current_token_is(MINUS) ? OP_NEGATE : OP_NOT;
-        tskip();
-        ast_node *operand = parse_unary();
-        return create_unary_op_node(op, operand);
+ast_node *parse_unary(parser_t *parser){
+    ttype type = current_type(parser);
+    if(type == MINUS || type == NOT) {
+        advance(parser);
+        ast_node *operand = parse_unary(parser);
+        return create_unary_op_node(parser->arena, type == MINUS ? OP_NEGATE : OP_NOT, operand);
     }
     
-    return parse_primary();
+    return parse_primary(parser);
 }
 
-ast_node *parse_primary(){
-    token_t *token = peek_current_token();
-
-    if(current_token_is(NUMBER)){
-        tskip();
-        return create_number_node(token->value.number);
-    }
+// Calls, property and index accesses chained after a primary: a.b[i](x).c
+ast_node *parse_postfix(parser_t *parser, ast_node *expr){
+    while(1){
+        switch(current_type(parser)){
+        case LPARENT:
+            expr = parse_function_call(parser, expr);
+            break;
 
-    if(current_token_is(STRING)){
-        tskip();
-        return create_string_node(token->value.string);
-    }
+        case DOT: {
+            advance(parser);
+            if(current_type(parser) != IDENTIFIER)
+                syntax_error(parser, "Expected property name after '.'");
 
-    if(current_token_is(BOOLEAN)){
-        tskip();
-        return create_boolean_node(token->value.boolean);
-    }
+            const atom_t *prop = lexer_token_at(parser->lexer , parser->current).value.atom;
+            advance(parser);
+            expr = create_property_access_node(parser->arena, expr, prop);
+            break;
+        }
 
-    if(current_token_is(NULL_VAL)){
-        tskip();
-        return create_null_node();
-    }
+        case LBRACKET: {
+            advance(parser);
+            ast_node *index = parse_expression(parser);
 
-    if(current_token_is(IDENTIFIER)){
-        char *name = token->value.string;
-        tskip();
+            if(current_type(parser) != RBRACKET)
+                syntax_error(parser, "Expected ']' after array index");
+            advance(parser);
+            expr = create_array_access_node(parser->arena, expr , index);
+            break;
+        }
 
-        if(current_token_is(LPARENT))
-            return parse_function_call(name);
+        default:
+            return expr;
+        }
+    }
+}
 
-        if(current_token_is(DOT)){
-            tskip();
-            if(!current_token_is(IDENTIFIER))
-                syntax_error("Expected property name after '.'");
+ast_node *parse_primary(parser_t *parser){
+    token_t token = lexer_token_at(parser->lexer , parser->current);
+
+    switch(token.type){
+    case NUMBER:
+        advance(parser);
+        return create_number_node(parser->arena, token.value.number, token.flags & TOKEN_INTEGRAL);
+
+    case STRING:
+        advance(parser);
+        return create_string_node(parser->arena, token_text(parser->lexer, &token));
+
+    case BOOLEAN:
+        advance(parser);
+        return create_boolean_node(parser->arena, token.value.boolean);
+
+    case NULL_VAL:
+        advance(parser);
+        return create_null_node(parser->arena);
+
+    case LPARENT: {
+        advance(parser);
+        ast_node *expr = parse_expression(parser);
+        if(current_type(parser) != RPARENT)
+            syntax_error(parser, "Expected ')' after expression");
+        advance(parser);
+        return parse_postfix(parser, expr);
+    }
 
-            char *prop = token->value.string;
-            tskip();
-            ast_node *obj = create_identifier_node(name);
-            return create_property_access_node(obj, prop);
-        }
+    case LBRACKET:
+        return parse_postfix(parser, parse_array_literal(parser));
 
-        if(current_token_is(LBRACKET)){
-            tskip();
-            ast_node *index = parse_expression();
+    case IDENTIFIER:
+        advance(parser);
+        return parse_postfix(parser, create_identifier_node(parser->arena, token.value.atom));
 
-            if(!current_token_is(RBRACKET))
-                syntax_error("Expected ']' after array index");
-            tskip();
+    // Built-ins are keywords but called like any function
+    case PRINT:
+    case TAKE:
+        advance(parser);
+        if(current_type(parser) != LPARENT)
+            syntax_error(parser, "'%s' must be called like a function", token.type == PRINT ? "print" : "take");
+        return parse_postfix(parser, create_identifier_node(parser->arena, atom_from_cstr(token.type == PRINT ? "print" : "take")));
 
-            ast_node *array = create_identifier_node(name);
-            return create_array_access_node(array , index);
-        }
-        return create_identifier_node(name);
+    default:
+        syntax_error(parser, "Unexpected token in expression %d , token index : %zu" , token.type , parser->current);
+        return NULL;
     }
-
-    if(current_token_is(LBRACKET))
-        return parse_array_literal();
-    
-    syntax_error("Unexpected token in expression %d , token index : %zu" , token->type , current_token);
-    return NULL;    
 }
@@ -5,38 +5,65 @@
 #include "ast.h"
 #include "../lexer/lexer.h"
 #include "../lexer/token.h"
+#include "../utils/error.h"
 
-extern lexer_t *lexer_g;
-extern size_t current_token;
-
-void syntax_error(const char* format, ...);
-bool current_token_is(ttype type);
-bool next_token_is(ttype type);
-bool prev_token_is(ttype type);
-token_t *peek_current_token();
-token_t *peek_next_token();
-token_t *peek_prev_token();
-void tskip();
-
-ast_node *parse_var_declaration();
-ast_node *parse_if_statement();
-ast_node *parse_loop_statement();
-ast_node *parse_function_declaration();
-ast_node *parse_return_statement();
-ast_node *parse_print_statement();
-ast_node *parse_take_statement();
-ast_node *parse_block();
-ast_node *parse_function_call(const char *name);
-ast_node *parse_array_literal();
-
-ast_node *parse_program();
-ast_node *parse_statement();
-ast_node *parse_expression();
-ast_node *parse_equality();
-ast_node *parse_comparison();
-ast_node *parse_term();
-ast_node *parse_factor();
-ast_node *parse_unary();
-ast_node *parse_primary();
+// All state of one parse, parses of different parser_t can run concurrently
+typedef struct parser_t {
+    lexer_t *lexer;
+    size_t current; // index of the current token
+    arena_t *arena; // the tree is allocated here, owned by the caller
+    arr_t *scratch; // child lists under construction
+    bool lazy_functions; // pre-parse function bodies, see function_body
+} parser_t;
+
+parser_t *new_parser(lexer_t *lexer, arena_t *arena);
+void free_parser(parser_t *parser);
+
+_Noreturn void syntax_error(parser_t *parser, const char* format, ...)
+    __attribute__((format(printf, 2, 3)));
+bool current_token_is(parser_t *parser, ttype type);
+bool next_token_is(parser_t *parser, ttype type);
+bool prev_token_is(parser_t *parser, ttype type);
+token_t peek_current_token(parser_t *parser);
+token_t peek_next_token(parser_t *parser);
+token_t peek_prev_token(parser_t *parser);
+void tskip(parser_t *parser);
+
+ast_node *parse_var_declaration(parser_t *parser);
+ast_node *parse_if_statement(parser_t *parser);
+ast_node *parse_loop_statement(parser_t *parser);
+ast_node *parse_function_declaration(parser_t *parser);
+ast_node *parse_return_statement(parser_t *parser);
+ast_node *parse_print_statement(parser_t *parser);
+ast_node *parse_take_statement(parser_t *parser);
+ast_node *parse_block(parser_t *parser);
+ast_node *preparse_block(parser_t *parser);
+ast_node *parse_function_call(parser_t *parser, ast_node *callee);
+ast_node *parse_array_literal(parser_t *parser);
+
+/*
+ * With lazy_functions set, function bodies are only brace matched and kept
+ * as an AST_LAZY_BLOCK holding their token range, so the parse cost of a
+ * script follows the functions it runs rather than its size. function_body
+ * parses such a body on first use into arena, which must be the arena of
+ * the tree, and swaps it into the declaration; a body resolve_scopes went
+ * past is resolved too. The lexer has to outlive the tree. Not thread
+ * safe, a tree is materialized by one thread at a time. Streaming lexers
+ * can't seek back, their bodies are always parsed eagerly.
+ */
+ast_node *function_body(ast_node *function, arena_t *arena);
+
+// Lexes and parses source into arena, without exiting on errors: NULL is
+// returned and error filled instead. On success *lexer holds the tokens,
+// free it after the tree. A failed parse may leave nodes in the arena.
+ast_node *try_parse(const char *source, arena_t *arena, lexer_t **lexer, nojs_error_t *error);
+
+ast_node *parse_program(parser_t *parser);
+ast_node *parse_statement(parser_t *parser);
+ast_node *parse_expression(parser_t *parser);
+ast_node *parse_binary(parser_t *parser, int min_power);
+ast_node *parse_unary(parser_t *parser);
+ast_node *parse_postfix(parser_t *parser, ast_node *expr);
+ast_node *parse_primary(parser_t *parser);
 
 #endif
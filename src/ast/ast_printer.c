@@ -34,6 +34,7 @@ const char* ast_type_to_string(ast_type type) {
         case AST_PRINT: return "PRINT";
         case AST_TAKE: return "TAKE";
         case AST_BLOCK: return "BLOCK";
+        case AST_LAZY_BLOCK: return "LAZY_BLOCK";
         case AST_ARRAY: return "ARRAY";
         case AST_ARRAY_ACCESS: return "ARRAY_ACCESS";
         case AST_PROPERTY_ACCESS: return "PROPERTY_ACCESS";
@@ -84,7 +85,7 @@ void print_ast(ast_node* node, int indent) {
             break;
             
         case AST_STRING:
-            printf(" \"%s\")\n", node->string.value);
+            printf(" \"" SV_FMT "\")\n", SV_ARG(node->string.value));
             break;
             
         case AST_BOOLEAN:
@@ -96,12 +97,15 @@ void print_ast(ast_node* node, int indent) {
             break;
             
         case AST_IDENTIFIER:
-            printf(" %s)\n", node->identifier.name);
+            if (node->identifier.depth == SCOPE_UNRESOLVED)
+                printf(" %s)\n", node->identifier.name->text);
+            else
+                printf(" %s @%u:%u)\n", node->identifier.name->text, node->identifier.depth, node->slot);
             break;
             
         case AST_VAR_DECLARATION:
         case AST_CONST_DECLARATION:
-            printf(" %s\n", node->var_declaration.name);
+            printf(" %s\n", node->var_declaration.name->text);
             print_indent(indent + 1);
             printf("initializer:\n");
             print_ast(node->var_declaration.initializer, indent + 2);
@@ -184,7 +188,7 @@ void print_ast(ast_node* node, int indent) {
             break;
             
         case AST_FUNCTION_DECLARATION:
-            printf(" %s\n", node->function_declaration.name);
+            printf(" %s\n", node->function_declaration.name->text);
             print_indent(indent + 1);
             printf("parameters:\n");
             for(size_t i = 0; i < node->function_declaration.parameters->count; i++) {
@@ -231,6 +235,10 @@ void print_ast(ast_node* node, int indent) {
             printf(")\n");
             break;
             
+        case AST_LAZY_BLOCK:
+            printf(" tokens %u..%u)\n", node->lazy_block.start, node->lazy_block.end);
+            break;
+            
         case AST_ARRAY:
             printf("\n");
             for(size_t i = 0; i < node->array.element_count; i++) {
@@ -253,7 +261,7 @@ void print_ast(ast_node* node, int indent) {
             break;
             
         case AST_PROPERTY_ACCESS:
-            printf(" %s\n", node->property_access.property);
+            printf(" %s\n", node->property_access.property->text);
             print_indent(indent + 1);
             printf("object:\n");
             print_ast(node->property_access.object, indent + 2);
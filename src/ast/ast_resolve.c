@@ -0,0 +1,352 @@
+#include "ast_resolve.h"
+#include "ast_parser.h"
+#include "../utils/logger.h"
+#include "../utils/scope_map.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * A binding packs the function nesting level of the declaration in the
+ * high half and its slot in the low half, depth of a use is the level of
+ * the use minus the level of the declaration.
+ *
+ * A lazy function body is resolved when function_body parses it, after
+ * the pass is over and its bindings are gone. So the pass copies the
+ * bindings of the scopes around a lazy body into scope_record_t records in
+ * the arena, each scope once however many bodies it holds, and the body
+ * keeps the innermost record and how many of its bindings it sees. Records
+ * link to the scope around them with the number of its bindings in sight,
+ * names declared further down stay unresolved as they would have eagerly.
+ * A record is hashed on the first lookup, by then no binding is added to
+ * it any more.
+ */
+typedef struct scope_record_binding_t {
+    const atom_t *name;
+    uintptr_t value;
+    uint32_t shadowed; // index + 1 of the previous binding of name here
+} scope_record_binding_t;
+
+typedef struct scope_record_t {
+    struct scope_record_t *parent;
+    uint32_t parent_visible; // bindings of parent in sight of this scope
+    scope_record_binding_t *bindings;
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t *table; // name -> index + 1 of its last binding
+    uint32_t table_capacity;
+} scope_record_t;
+
+struct lazy_scope_t {
+    scope_record_t *record; // innermost scope around the function
+    uint32_t visible;       // bindings of record it sees
+    uint32_t level;         // of the declaration
+};
+
+// Scopes entered and not left yet, the record is made on demand
+typedef struct open_scope_t {
+    size_t mark;
+    scope_record_t *record;
+} open_scope_t;
+
+typedef struct resolver_t {
+    arena_t *arena;
+    scope_map_t scopes;
+    uint32_t level;     // functions around the current node
+    uint32_t next_slot; // of the current frame
+    open_scope_t *open;
+    size_t open_count;
+    size_t open_capacity;
+    const lazy_scope_t *outer; // around a lazy body being resolved, or NULL
+} resolver_t;
+
+static void enter_scope(resolver_t *resolver) {
+    if (resolver->open_count == resolver->open_capacity) {
+        resolver->open_capacity = resolver->open_capacity ? resolver->open_capacity * 2 : 16;
+        resolver->open = (open_scope_t *)realloc(resolver->open, resolver->open_capacity * sizeof(open_scope_t));
+        if (!resolver->open)
+            elog("Error reallocation memory for resolver scopes");
+    }
+    resolver->open[resolver->open_count++] = (open_scope_t){ scope_mark(&resolver->scopes), NULL };
+}
+
+static void leave_scope(resolver_t *resolver) {
+    scope_pop(&resolver->scopes, resolver->open[--resolver->open_count].mark);
+}
+
+// Brings the records of the open scopes up to date, outermost first: a
+// scope's bindings are the ones on the scope map between its mark and the
+// next scope's, and only those made since the last capture are copied
+static lazy_scope_t *capture_scopes(resolver_t *resolver) {
+    scope_record_t *parent = resolver->outer ? resolver->outer->record : NULL;
+    uint32_t parent_visible = resolver->outer ? resolver->outer->visible : 0;
+
+    for (size_t i = 0; i < resolver->open_count; i++) {
+        open_scope_t *scope = &resolver->open[i];
+        if (!scope->record) {
+            scope->record = (scope_record_t *)arena_alloc(resolver->arena, sizeof(scope_record_t));
+            if (!scope->record)
+                elog("Error allocation memory for a scope record");
+            *scope->record = (scope_record_t){ .parent = parent, .parent_visible = parent_visible };
+        }
+
+        scope_record_t *record = scope->record;
+        size_t end = i + 1 < resolver->open_count ? resolver->open[i + 1].mark : resolver->scopes.count;
+        size_t count = end - scope->mark;
+        if (count > record->capacity) {
+            uint32_t capacity = record->capacity ? record->capacity * 2 : 8;
+            while (capacity < count)
+                capacity *= 2;
+            scope_record_binding_t *bindings =
+                (scope_record_binding_t *)arena_alloc(resolver->arena, capacity * sizeof(scope_record_binding_t));
+            if (!bindings)
+                elog("Error allocation memory for scope record bindings");
+            if (record->count)
+                memcpy(bindings, record->bindings, record->count * sizeof(scope_record_binding_t));
+            record->bindings = bindings;
+            record->capacity = capacity;
+        }
+        for (size_t at = record->count; at < count; at++) {
+            const scope_binding_t *binding = &resolver->scopes.bindings[scope->mark + at];
+            record->bindings[at] = (scope_record_binding_t){ binding->name, binding->value, 0 };
+        }
+        record->count = (uint32_t)count;
+
+        parent = record;
+        parent_visible = record->count;
+    }
+
+    lazy_scope_t *lazy = (lazy_scope_t *)arena_alloc(resolver->arena, sizeof(lazy_scope_t));
+    if (!lazy)
+        elog("Error allocation memory for a lazy function scope");
+    *lazy = (lazy_scope_t){ parent, parent_visible, resolver->level };
+    return lazy;
+}
+
+static uint32_t *record_slot(scope_record_t *record, const atom_t *name) {
+    uint32_t mask = record->table_capacity - 1;
+    for (uint32_t index = name->hash & mask;; index = (index + 1) & mask) {
+        uint32_t at = record->table[index];
+        if (!at || record->bindings[at - 1].name == name)
+            return &record->table[index];
+    }
+}
+
+static void hash_record(scope_record_t *record, arena_t *arena) {
+    uint32_t capacity = 8;
+    while (capacity < record->count * 2)
+        capacity *= 2;
+    record->table = (uint32_t *)arena_alloc(arena, capacity * sizeof(uint32_t));
+    if (!record->table)
+        elog("Error allocation memory for a scope record table");
+    memset(record->table, 0, capacity * sizeof(uint32_t));
+    record->table_capacity = capacity;
+
+    for (uint32_t at = 0; at < record->count; at++) {
+        uint32_t *slot = record_slot(record, record->bindings[at].name);
+        record->bindings[at].shadowed = *slot;
+        *slot = at + 1;
+    }
+}
+
+// The binding of name a lazy body sees outside of itself
+static bool lookup_outer(resolver_t *resolver, const atom_t *name, uintptr_t *value) {
+    if (!resolver->outer)
+        return false;
+
+    uint32_t visible = resolver->outer->visible;
+    for (scope_record_t *record = resolver->outer->record; record; record = record->parent) {
+        if (!record->table)
+            hash_record(record, resolver->arena);
+        uint32_t at = *record_slot(record, name);
+        while (at > visible)
+            at = record->bindings[at - 1].shadowed;
+        if (at) {
+            *value = record->bindings[at - 1].value;
+            return true;
+        }
+        visible = record->parent_visible;
+    }
+    return false;
+}
+
+static void declare(resolver_t *resolver, ast_node *node, const atom_t *name) {
+    if (resolver->next_slot == UINT32_MAX)
+        elog("Too many variables in one frame, at '%s'", name->text);
+
+    node->slot = resolver->next_slot++;
+    scope_bind(&resolver->scopes, name, ((uintptr_t)resolver->level << 32) | node->slot);
+}
+
+static void resolve(resolver_t *resolver, ast_node *node);
+
+// Functions can be called before their declaration in the same block, the
+// declarations are moved to the front of the list, in order, so that they
+// are also defined first at runtime. Their bodies are resolved last, they
+// run later and see every variable of the list, not only earlier ones.
+static void resolve_list(resolver_t *resolver, ast_node **items, size_t count) {
+    size_t functions = 0;
+    for (size_t i = 0; i < count; i++) {
+        ast_node *item = items[i];
+        if (item->type != AST_FUNCTION_DECLARATION)
+            continue;
+        declare(resolver, item, item->function_declaration.name);
+        memmove(items + functions + 1, items + functions, (i - functions) * sizeof(ast_node *));
+        items[functions++] = item;
+    }
+    for (size_t i = functions; i < count; i++)
+        resolve(resolver, items[i]);
+    for (size_t i = 0; i < functions; i++)
+        resolve(resolver, items[i]);
+}
+
+static void resolve_function(resolver_t *resolver, ast_node *node) {
+    ast_node *body = node->function_declaration.body;
+    if (body->type == AST_LAZY_BLOCK) {
+        body->lazy_block.scope = capture_scopes(resolver);
+        return;
+    }
+
+    uint32_t outer_slot = resolver->next_slot;
+    enter_scope(resolver);
+    resolver->level++;
+    resolver->next_slot = 0;
+
+    arr_t *params = node->function_declaration.parameters;
+    for (size_t i = 0; i < params->count; i++) {
+        ast_node *param = (ast_node *)params->items[i];
+        declare(resolver, param, param->identifier.name);
+        param->identifier.depth = 0;
+    }
+    resolve(resolver, body);
+    body->block.frame_size = resolver->next_slot;
+
+    resolver->level--;
+    resolver->next_slot = outer_slot;
+    leave_scope(resolver);
+}
+
+static void resolve(resolver_t *resolver, ast_node *node) {
+    if (!node)
+        return;
+
+    switch (node->type) {
+    case AST_NUMBER:
+    case AST_STRING:
+    case AST_BOOLEAN:
+    case AST_NULL:
+    case AST_NEXT:
+    case AST_STOP:
+        return;
+
+    case AST_IDENTIFIER: {
+        uintptr_t binding;
+        if (!scope_lookup(&resolver->scopes, node->identifier.name, &binding)
+            && !lookup_outer(resolver, node->identifier.name, &binding)) {
+            node->identifier.depth = SCOPE_UNRESOLVED;
+            return;
+        }
+        node->identifier.depth = resolver->level - (uint32_t)(binding >> 32);
+        node->slot = (uint32_t)binding;
+        return;
+    }
+    case AST_VAR_DECLARATION:
+    case AST_CONST_DECLARATION:
+        // The initializer still sees an outer variable of the same name
+        resolve(resolver, node->var_declaration.initializer);
+        declare(resolver, node, node->var_declaration.name);
+        return;
+    case AST_ASSIGNMENT:
+        resolve(resolver, node->assignment.left);
+        resolve(resolver, node->assignment.right);
+        return;
+
+    case AST_BINARY_OP:
+        resolve(resolver, node->binary_op.left);
+        resolve(resolver, node->binary_op.right);
+        return;
+    case AST_UNARY_OP:
+        resolve(resolver, node->unary_op.operand);
+        return;
+
+    case AST_IF:
+        resolve(resolver, node->if_statement.condition);
+        resolve(resolver, node->if_statement.body);
+        return;
+    case AST_IF_ELSE:
+        resolve(resolver, node->if_else_statement.condition);
+        resolve(resolver, node->if_else_statement.if_body);
+        resolve(resolver, node->if_else_statement.else_body);
+        return;
+    case AST_LOOP:
+        resolve(resolver, node->loop.condition);
+        resolve(resolver, node->loop.body);
+        return;
+
+    case AST_FUNCTION_DECLARATION:
+        // Declared by resolve_list, declarations only appear in lists
+        resolve_function(resolver, node);
+        return;
+    case AST_FUNCTION_CALL:
+    case AST_PRINT:
+    case AST_TAKE:
+        resolve(resolver, node->function_call.callee);
+        for (size_t i = 0; i < node->function_call.argument_count; i++)
+            resolve(resolver, node->function_call.arguments[i]);
+        return;
+    case AST_RETURN:
+        resolve(resolver, node->return_statement.value);
+        return;
+
+    case AST_BLOCK:
+        enter_scope(resolver);
+        resolve_list(resolver, (ast_node **)node->block.stmts->items, node->block.stmts->count);
+        leave_scope(resolver);
+        return;
+    case AST_LAZY_BLOCK:
+        elog("Lazy function body reached the resolver unparsed");
+        return;
+    case AST_ARRAY:
+        for (size_t i = 0; i < node->array.element_count; i++)
+            resolve(resolver, node->array.elements[i]);
+        return;
+    case AST_ARRAY_ACCESS:
+        resolve(resolver, node->array_access.array);
+        resolve(resolver, node->array_access.index);
+        return;
+    case AST_PROPERTY_ACCESS:
+        resolve(resolver, node->property_access.object);
+        return;
+    case AST_PROGRAM:
+        enter_scope(resolver);
+        resolve_list(resolver, node->program.statements, node->program.statement_count);
+        leave_scope(resolver);
+        node->program.frame_size = resolver->next_slot;
+        return;
+    }
+
+    elog("Can't resolve ast node with unknown type %d", node->type);
+}
+
+void resolve_scopes(ast_node *program, arena_t *arena) {
+    if (!program || !arena)
+        elog("Can't resolve scopes, NULL ptr on program or arena");
+
+    resolver_t resolver = { .arena = arena };
+    scope_map_init(&resolver.scopes);
+    resolve(&resolver, program);
+    scope_map_free(&resolver.scopes);
+    free(resolver.open);
+}
+
+void resolve_lazy_body(ast_node *function, const lazy_scope_t *scope, arena_t *arena) {
+    if (!function || !scope || !arena)
+        elog("Can't resolve a lazy body, NULL ptr on function, scope or arena");
+
+    resolver_t resolver = { .arena = arena, .level = scope->level, .outer = scope };
+    scope_map_init(&resolver.scopes);
+    resolve_function(&resolver, function);
+    scope_map_free(&resolver.scopes);
+    free(resolver.open);
+}
@@ -0,0 +1,34 @@
+#ifndef AST_RESOLVE_H
+#define AST_RESOLVE_H
+
+#include "ast.h"
+#include "../utils/arena.h"
+
+/*
+ * Static scope resolution. Every function call gets one frame of slots and
+ * the program one global frame; blocks don't get frames of their own, each
+ * declaration in a function takes the next free slot of its frame, so
+ * shadowing names in inner blocks simply get different slots. The pass
+ * annotates
+ *   - let, const, function declarations and parameters with node->slot
+ *   - identifiers, assignment targets included, with node->slot and
+ *     identifier.depth, the number of frames to walk up from the use
+ *   - function body blocks and the program with the frame_size they need
+ * Function declarations are hoisted, the pass moves them to the top of
+ * their block keeping their order. Names with no declaration in sight
+ * (natives, globals defined at runtime) keep depth SCOPE_UNRESOLVED and
+ * are looked up by name.
+ *
+ * Lazy function bodies are left unparsed: the pass keeps the scopes around
+ * them in arena, which must be the arena of the tree, and function_body
+ * resolves a body with resolve_lazy_body once it has parsed it, so it gets
+ * the slots and depths it would have got eagerly. Engines materialize
+ * bodies through function_body, the tree walker on the first call, the
+ * compilers when they reach the declaration.
+ */
+typedef struct lazy_scope_t lazy_scope_t;
+
+void resolve_scopes(ast_node *program, arena_t *arena);
+void resolve_lazy_body(ast_node *function, const lazy_scope_t *scope, arena_t *arena);
+
+#endif
@@ -0,0 +1,485 @@
+#include "flat_ast.h"
+#include "../utils/arr.h"
+#include "../utils/logger.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define FLAT_MIN_CAPACITY 64
+
+static void *grow_column(void *column, size_t capacity, size_t item_size) {
+    void *grown = realloc(column, capacity * item_size);
+    if (!grown)
+        elog("Error reallocation memory for flat ast column");
+    return grown;
+}
+
+static size_t next_capacity(size_t capacity, size_t needed) {
+    if (capacity < FLAT_MIN_CAPACITY)
+        capacity = FLAT_MIN_CAPACITY;
+    while (capacity < needed)
+        capacity *= 2;
+    return capacity;
+}
+
+/*
+ * Builder state for flat_ast_from_tree. Child lists are gathered on the
+ * scratch stack until all children are flattened (they may append to extra
+ * themselves) and only then copied to extra as one run. Atoms are
+ * deduplicated through a small open-addressing table of atoms indices.
+ */
+typedef struct flat_builder_t {
+    flat_ast_t *ast;
+    arr_t *scratch;
+    uint32_t *atom_slots; // atoms index + 1, 0 is empty
+    size_t atom_slots_capacity;
+} flat_builder_t;
+
+static flat_ref_t push_node(flat_ast_t *ast, ast_type kind, uint8_t op, uint32_t lhs, uint32_t rhs) {
+    if (ast->count == ast->capacity) {
+        ast->capacity = next_capacity(ast->capacity, ast->count + 1);
+        ast->kinds = (uint8_t *)grow_column(ast->kinds, ast->capacity, sizeof(uint8_t));
+        ast->ops = (uint8_t *)grow_column(ast->ops, ast->capacity, sizeof(uint8_t));
+        ast->data = (flat_data_t *)grow_column(ast->data, ast->capacity, sizeof(flat_data_t));
+    }
+    if (ast->count >= FLAT_NONE)
+        elog("Flat ast can't hold more than %u nodes", FLAT_NONE);
+
+    ast->kinds[ast->count] = (uint8_t)kind;
+    ast->ops[ast->count] = op;
+    ast->data[ast->count].lhs = lhs;
+    ast->data[ast->count].rhs = rhs;
+    return (flat_ref_t)ast->count++;
+}
+
+static uint32_t push_extra(flat_ast_t *ast, uint32_t value) {
+    if (ast->extra_count == ast->extra_capacity) {
+        ast->extra_capacity = next_capacity(ast->extra_capacity, ast->extra_count + 1);
+        ast->extra = (uint32_t *)grow_column(ast->extra, ast->extra_capacity, sizeof(uint32_t));
+    }
+    ast->extra[ast->extra_count] = value;
+    return (uint32_t)ast->extra_count++;
+}
+
+static uint32_t push_number(flat_ast_t *ast, double value) {
+    if (ast->numbers_count == ast->numbers_capacity) {
+        ast->numbers_capacity = next_capacity(ast->numbers_capacity, ast->numbers_count + 1);
+        ast->numbers = (double *)grow_column(ast->numbers, ast->numbers_capacity, sizeof(double));
+    }
+    ast->numbers[ast->numbers_count] = value;
+    return (uint32_t)ast->numbers_count++;
+}
+
+static uint32_t push_string(flat_ast_t *ast, str_view_t value) {
+    if (ast->strings_count == ast->strings_capacity) {
+        ast->strings_capacity = next_capacity(ast->strings_capacity, ast->strings_count + 1);
+        ast->strings = (str_view_t *)grow_column(ast->strings, ast->strings_capacity, sizeof(str_view_t));
+    }
+    ast->strings[ast->strings_count] = value;
+    return (uint32_t)ast->strings_count++;
+}
+
+static void rehash_atoms(flat_builder_t *builder) {
+    flat_ast_t *ast = builder->ast;
+    free(builder->atom_slots);
+
+    builder->atom_slots_capacity = next_capacity(builder->atom_slots_capacity * 2, ast->atoms_count * 2);
+    builder->atom_slots = (uint32_t *)calloc(builder->atom_slots_capacity, sizeof(uint32_t));
+    if (!builder->atom_slots)
+        elog("Error allocation memory for flat ast atom table");
+
+    size_t mask = builder->atom_slots_capacity - 1;
+    for (size_t i = 0; i < ast->atoms_count; i++) {
+        size_t slot = ast->atoms[i]->hash & mask;
+        while (builder->atom_slots[slot])
+            slot = (slot + 1) & mask;
+        builder->atom_slots[slot] = (uint32_t)i + 1;
+    }
+}
+
+static uint32_t intern_atom(flat_builder_t *builder, const atom_t *atom) {
+    flat_ast_t *ast = builder->ast;
+    if ((ast->atoms_count + 1) * 2 > builder->atom_slots_capacity)
+        rehash_atoms(builder);
+
+    size_t mask = builder->atom_slots_capacity - 1;
+    size_t slot = atom->hash & mask;
+    while (builder->atom_slots[slot]) {
+        uint32_t index = builder->atom_slots[slot] - 1;
+        if (ast->atoms[index] == atom)
+            return index;
+        slot = (slot + 1) & mask;
+    }
+
+    if (ast->atoms_count == ast->atoms_capacity) {
+        ast->atoms_capacity = next_capacity(ast->atoms_capacity, ast->atoms_count + 1);
+        ast->atoms = (const atom_t **)grow_column((void *)ast->atoms, ast->atoms_capacity, sizeof(const atom_t *));
+    }
+    ast->atoms[ast->atoms_count] = atom;
+    builder->atom_slots[slot] = (uint32_t)ast->atoms_count + 1;
+    return (uint32_t)ast->atoms_count++;
+}
+
+static flat_ref_t flatten(flat_builder_t *builder, ast_node *node);
+
+static flat_ref_t flatten_optional(flat_builder_t *builder, ast_node *node) {
+    return node ? flatten(builder, node) : FLAT_NONE;
+}
+
+// Flattens the nodes and leaves their refs on the scratch stack from mark
+static void flatten_list(flat_builder_t *builder, ast_node **nodes, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        flat_ref_t ref = flatten(builder, nodes[i]);
+        if (!arr_push(builder->scratch, (void *)(uintptr_t)ref))
+            elog("Error allocation memory for flat ast scratch list");
+    }
+}
+
+// Moves the refs from mark up to extra, returns where the run starts
+static uint32_t commit_list(flat_builder_t *builder, size_t mark) {
+    uint32_t start = (uint32_t)builder->ast->extra_count;
+    for (size_t i = mark; i < builder->scratch->count; i++)
+        push_extra(builder->ast, (uint32_t)(uintptr_t)builder->scratch->items[i]);
+    builder->scratch->count = mark;
+    return start;
+}
+
+static flat_ref_t flatten(flat_builder_t *builder, ast_node *node) {
+    flat_ast_t *ast = builder->ast;
+    size_t mark = builder->scratch->count;
+
+    switch (node->type) {
+    case AST_NUMBER:
+        return push_node(ast, AST_NUMBER, node->number.integral, push_number(ast, node->number.value), 0);
+    case AST_STRING:
+        return push_node(ast, AST_STRING, 0, push_string(ast, node->string.value), 0);
+    case AST_BOOLEAN:
+        return push_node(ast, AST_BOOLEAN, node->boolean.value, 0, 0);
+    case AST_NULL:
+    case AST_NEXT:
+    case AST_STOP:
+        return push_node(ast, node->type, 0, 0, 0);
+    case AST_IDENTIFIER:
+        return push_node(ast, AST_IDENTIFIER, 0, intern_atom(builder, node->identifier.name), 0);
+
+    case AST_VAR_DECLARATION:
+    case AST_CONST_DECLARATION: {
+        flat_ref_t initializer = flatten_optional(builder, node->var_declaration.initializer);
+        return push_node(ast, node->type, 0, intern_atom(builder, node->var_declaration.name), initializer);
+    }
+    case AST_ASSIGNMENT: {
+        flat_ref_t left = flatten(builder, node->assignment.left);
+        flat_ref_t right = flatten(builder, node->assignment.right);
+        return push_node(ast, AST_ASSIGNMENT, 0, left, right);
+    }
+    case AST_BINARY_OP: {
+        flat_ref_t left = flatten(builder, node->binary_op.left);
+        flat_ref_t right = flatten(builder, node->binary_op.right);
+        return push_node(ast, AST_BINARY_OP, (uint8_t)node->binary_op.op, left, right);
+    }
+    case AST_UNARY_OP: {
+        flat_ref_t operand = flatten(builder, node->unary_op.operand);
+        return push_node(ast, AST_UNARY_OP, (uint8_t)node->unary_op.op, operand, 0);
+    }
+    case AST_IF: {
+        flat_ref_t condition = flatten(builder, node->if_statement.condition);
+        flat_ref_t body = flatten(builder, node->if_statement.body);
+        return push_node(ast, AST_IF, 0, condition, body);
+    }
+    case AST_IF_ELSE: {
+        flat_ref_t condition = flatten(builder, node->if_else_statement.condition);
+        flat_ref_t if_body = flatten(builder, node->if_else_statement.if_body);
+        flat_ref_t else_body = flatten(builder, node->if_else_statement.else_body);
+        uint32_t bodies = push_extra(ast, if_body);
+        push_extra(ast, else_body);
+        return push_node(ast, AST_IF_ELSE, 0, condition, bodies);
+    }
+    case AST_LOOP: {
+        flat_ref_t condition = flatten_optional(builder, node->loop.condition);
+        flat_ref_t body = flatten(builder, node->loop.body);
+        return push_node(ast, AST_LOOP, 0, condition, body);
+    }
+    case AST_FUNCTION_DECLARATION: {
+        arr_t *params = node->function_declaration.parameters;
+        flatten_list(builder, (ast_node **)params->items, params->count);
+        flat_ref_t body = flatten(builder, node->function_declaration.body);
+
+        uint32_t start = push_extra(ast, (uint32_t)params->count);
+        commit_list(builder, mark);
+        push_extra(ast, body);
+        return push_node(ast, AST_FUNCTION_DECLARATION, 0, intern_atom(builder, node->function_declaration.name), start);
+    }
+    case AST_FUNCTION_CALL:
+    case AST_PRINT:
+    case AST_TAKE: {
+        flat_ref_t callee = flatten(builder, node->function_call.callee);
+        flatten_list(builder, node->function_call.arguments, node->function_call.argument_count);
+
+        uint32_t start = push_extra(ast, (uint32_t)node->function_call.argument_count);
+        commit_list(builder, mark);
+        return push_node(ast, node->type, 0, callee, start);
+    }
+    case AST_RETURN:
+        return push_node(ast, AST_RETURN, 0, flatten_optional(builder, node->return_statement.value), 0);
+
+    case AST_BLOCK: {
+        arr_t *stmts = node->block.stmts;
+        flatten_list(builder, (ast_node **)stmts->items, stmts->count);
+        return push_node(ast, AST_BLOCK, 0, commit_list(builder, mark), (uint32_t)stmts->count);
+    }
+    case AST_LAZY_BLOCK:
+        elog("Can't flatten a function body that is not parsed yet, parse with lazy_functions off or call function_body first");
+        return FLAT_NONE;
+    case AST_ARRAY:
+        flatten_list(builder, node->array.elements, node->array.element_count);
+        return push_node(ast, AST_ARRAY, 0, commit_list(builder, mark), (uint32_t)node->array.element_count);
+    case AST_PROGRAM:
+        flatten_list(builder, node->program.statements, node->program.statement_count);
+        return push_node(ast, AST_PROGRAM, 0, commit_list(builder, mark), (uint32_t)node->program.statement_count);
+
+    case AST_ARRAY_ACCESS: {
+        flat_ref_t array = flatten(builder, node->array_access.array);
+        flat_ref_t index = flatten(builder, node->array_access.index);
+        return push_node(ast, AST_ARRAY_ACCESS, 0, array, index);
+    }
+    case AST_PROPERTY_ACCESS: {
+        flat_ref_t object = flatten(builder, node->property_access.object);
+        return push_node(ast, AST_PROPERTY_ACCESS, 0, object, intern_atom(builder, node->property_access.property));
+    }
+    }
+
+    elog("Can't flatten ast node with unknown type %d", node->type);
+    return FLAT_NONE;
+}
+
+flat_ast_t *flat_ast_from_tree(ast_node *root) {
+    if (!root)
+        elog("Can't flatten ast, NULL ptr on root");
+
+    flat_ast_t *ast = (flat_ast_t *)calloc(1, sizeof(flat_ast_t));
+    if (!ast)
+        elog("Error allocation memory for flat_ast_t struct");
+
+    flat_builder_t builder = { ast, new_arr(64), NULL, 0 };
+    if (!builder.scratch)
+        elog("Error allocation memory for flat ast scratch list");
+
+    flatten(&builder, root);
+
+    free(builder.atom_slots);
+    free_arr(builder.scratch);
+    return ast;
+}
+
+void free_flat_ast(flat_ast_t *ast) {
+    if (!ast)
+        return;
+
+    free(ast->kinds);
+    free(ast->ops);
+    free(ast->data);
+    free(ast->extra);
+    free(ast->numbers);
+    free(ast->strings);
+    free((void *)ast->atoms);
+    free(ast);
+}
+
+size_t flat_ast_bytes(flat_ast_t *ast) {
+    return ast->count * (2 * sizeof(uint8_t) + sizeof(flat_data_t))
+         + ast->extra_count * sizeof(uint32_t)
+         + ast->numbers_count * sizeof(double)
+         + ast->strings_count * sizeof(str_view_t)
+         + ast->atoms_count * sizeof(const atom_t *);
+}
+
+const atom_t *flat_atom(flat_ast_t *ast, flat_ref_t node) {
+    switch (flat_kind(ast, node)) {
+    case AST_IDENTIFIER:
+    case AST_VAR_DECLARATION:
+    case AST_CONST_DECLARATION:
+    case AST_FUNCTION_DECLARATION:
+        return ast->atoms[ast->data[node].lhs];
+    case AST_PROPERTY_ACCESS:
+        return ast->atoms[ast->data[node].rhs];
+    default:
+        elog("Flat ast node %u of type %d has no name", node, flat_kind(ast, node));
+        return NULL;
+    }
+}
+
+flat_child_iter_t flat_children(flat_ast_t *ast, flat_ref_t node) {
+    flat_child_iter_t it = { {FLAT_NONE, FLAT_NONE, FLAT_NONE}, 0, NULL, 0, 0 };
+    flat_data_t data = ast->data[node];
+
+    switch (flat_kind(ast, node)) {
+    case AST_VAR_DECLARATION:
+    case AST_CONST_DECLARATION:
+        it.fixed[0] = data.rhs;
+        it.fixed_count = 1;
+        break;
+    case AST_UNARY_OP:
+    case AST_RETURN:
+    case AST_PROPERTY_ACCESS:
+        it.fixed[0] = data.lhs;
+        it.fixed_count = 1;
+        break;
+    case AST_ASSIGNMENT:
+    case AST_BINARY_OP:
+    case AST_IF:
+    case AST_LOOP:
+    case AST_ARRAY_ACCESS:
+        it.fixed[0] = data.lhs;
+        it.fixed[1] = data.rhs;
+        it.fixed_count = 2;
+        break;
+    case AST_IF_ELSE:
+        it.fixed[0] = data.lhs;
+        it.fixed[1] = ast->extra[data.rhs];
+        it.fixed[2] = ast->extra[data.rhs + 1];
+        it.fixed_count = 3;
+        break;
+    case AST_FUNCTION_DECLARATION:
+        // The body directly follows the parameters in extra
+        it.list = ast->extra + data.rhs + 1;
+        it.list_count = ast->extra[data.rhs] + 1;
+        break;
+    case AST_FUNCTION_CALL:
+    case AST_PRINT:
+    case AST_TAKE:
+        it.fixed[0] = data.lhs;
+        it.fixed_count = 1;
+        it.list = ast->extra + data.rhs + 1;
+        it.list_count = ast->extra[data.rhs];
+        break;
+    case AST_BLOCK:
+    case AST_ARRAY:
+    case AST_PROGRAM:
+        it.list = ast->extra + data.lhs;
+        it.list_count = data.rhs;
+        break;
+    default:
+        break;
+    }
+    return it;
+}
+
+static ast_node *unflatten(flat_ast_t *ast, arena_t *arena, arr_t *scratch, flat_ref_t node);
+
+static ast_node *unflatten_optional(flat_ast_t *ast, arena_t *arena, arr_t *scratch, flat_ref_t node) {
+    return node == FLAT_NONE ? NULL : unflatten(ast, arena, scratch, node);
+}
+
+// Rebuilds a run of extra on the scratch stack, returns the items from mark
+static ast_node **unflatten_list(flat_ast_t *ast, arena_t *arena, arr_t *scratch, const uint32_t *list, size_t count, size_t mark) {
+    for (size_t i = 0; i < count; i++)
+        if (!arr_push(scratch, unflatten(ast, arena, scratch, list[i])))
+            elog("Error allocation memory for flat ast scratch list");
+    return (ast_node **)scratch->items + mark;
+}
+
+static ast_node *unflatten(flat_ast_t *ast, arena_t *arena, arr_t *scratch, flat_ref_t node) {
+    flat_data_t data = ast->data[node];
+    uint8_t op = ast->ops[node];
+    size_t mark = scratch->count;
+    ast_node *result = NULL;
+
+    switch (flat_kind(ast, node)) {
+    case AST_NUMBER:
+        return create_number_node(arena, ast->numbers[data.lhs], op);
+    case AST_STRING:
+        return create_string_node(arena, ast->strings[data.lhs]);
+    case AST_BOOLEAN:
+        return create_boolean_node(arena, op);
+    case AST_NULL:
+        return create_null_node(arena);
+    case AST_NEXT:
+        return create_next_node(arena);
+    case AST_STOP:
+        return create_stop_node(arena);
+    case AST_IDENTIFIER:
+        return create_identifier_node(arena, ast->atoms[data.lhs]);
+    case AST_VAR_DECLARATION:
+        return create_var_declaration_node(arena, ast->atoms[data.lhs], unflatten_optional(ast, arena, scratch, data.rhs));
+    case AST_CONST_DECLARATION:
+        return create_const_declaration_node(arena, ast->atoms[data.lhs], unflatten_optional(ast, arena, scratch, data.rhs));
+    case AST_ASSIGNMENT: {
+        ast_node *left = unflatten(ast, arena, scratch, data.lhs);
+        return create_assignment_node(arena, left, unflatten(ast, arena, scratch, data.rhs));
+    }
+    case AST_BINARY_OP: {
+        ast_node *left = unflatten(ast, arena, scratch, data.lhs);
+        return create_binary_op_node(arena, (binary_op_type)op, left, unflatten(ast, arena, scratch, data.rhs));
+    }
+    case AST_UNARY_OP:
+        return create_unary_op_node(arena, (unary_op_type)op, unflatten(ast, arena, scratch, data.lhs));
+    case AST_IF: {
+        ast_node *condition = unflatten(ast, arena, scratch, data.lhs);
+        return create_if_node(arena, condition, unflatten(ast, arena, scratch, data.rhs));
+    }
+    case AST_IF_ELSE: {
+        ast_node *condition = unflatten(ast, arena, scratch, data.lhs);
+        ast_node *if_body = unflatten(ast, arena, scratch, ast->extra[data.rhs]);
+        return create_if_else_node(arena, condition, if_body, unflatten(ast, arena, scratch, ast->extra[data.rhs + 1]));
+    }
+    case AST_LOOP: {
+        ast_node *condition = unflatten_optional(ast, arena, scratch, data.lhs);
+        return create_loop_node(arena, condition, unflatten(ast, arena, scratch, data.rhs));
+    }
+    case AST_FUNCTION_DECLARATION: {
+        size_t count = ast->extra[data.rhs];
+        ast_node **params = unflatten_list(ast, arena, scratch, ast->extra + data.rhs + 1, count, mark);
+        ast_node *body = unflatten(ast, arena, scratch, ast->extra[data.rhs + 1 + count]);
+        params = (ast_node **)scratch->items + mark;
+        result = create_function_declaration_node(arena, ast->atoms[data.lhs], params, count, body);
+        break;
+    }
+    case AST_FUNCTION_CALL:
+    case AST_PRINT:
+    case AST_TAKE: {
+        ast_node *callee = unflatten(ast, arena, scratch, data.lhs);
+        size_t count = ast->extra[data.rhs];
+        ast_node **args = unflatten_list(ast, arena, scratch, ast->extra + data.rhs + 1, count, mark);
+        result = create_function_call_node(arena, callee, args, count);
+        result->type = flat_kind(ast, node);
+        break;
+    }
+    case AST_RETURN:
+        return create_return_node(arena, unflatten_optional(ast, arena, scratch, data.lhs));
+    case AST_BLOCK:
+        result = create_block_node(arena, unflatten_list(ast, arena, scratch, ast->extra + data.lhs, data.rhs, mark), data.rhs);
+        break;
+    case AST_ARRAY:
+        result = create_array_node(arena, unflatten_list(ast, arena, scratch, ast->extra + data.lhs, data.rhs, mark), data.rhs);
+        break;
+    case AST_PROGRAM:
+        result = create_program_node(arena, unflatten_list(ast, arena, scratch, ast->extra + data.lhs, data.rhs, mark), data.rhs);
+        break;
+    case AST_ARRAY_ACCESS: {
+        ast_node *array = unflatten(ast, arena, scratch, data.lhs);
+        return create_array_access_node(arena, array, unflatten(ast, arena, scratch, data.rhs));
+    }
+    case AST_PROPERTY_ACCESS:
+        return create_property_access_node(arena, unflatten(ast, arena, scratch, data.lhs), ast->atoms[data.rhs]);
+    default:
+        elog("Can't rebuild flat ast node %u with unknown type %d", node, flat_kind(ast, node));
+    }
+
+    scratch->count = mark;
+    return result;
+}
+
+ast_node *flat_ast_to_tree(flat_ast_t *ast, arena_t *arena) {
+    if (!ast || !arena)
+        elog("Can't rebuild ast tree, NULL ptr on flat ast or arena");
+    if (ast->count == 0)
+        return NULL;
+
+    arr_t *scratch = new_arr(64);
+    if (!scratch)
+        elog("Error allocation memory for flat ast scratch list");
+
+    ast_node *root = unflatten(ast, arena, scratch, flat_ast_root(ast));
+    free_arr(scratch);
+    return root;
+}
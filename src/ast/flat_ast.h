@@ -0,0 +1,142 @@
+#ifndef FLAT_AST_H
+#define FLAT_AST_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "ast.h"
+#include "../utils/arena.h"
+#include "../utils/atom.h"
+#include "../utils/str_view.h"
+
+/*
+ * Data-oriented encoding of an ast_node tree. Nodes are rows of three
+ * parallel columns:
+ *   kinds - ast_type, one byte
+ *   ops   - binary_op_type / unary_op_type, boolean value, number integral flag
+ *   data  - two 32 bit words, lhs and rhs, usually child node indices
+ * Nodes are stored in post-order, children before their parent, and the
+ * root is the last node. Literals live in side tables (numbers, strings,
+ * atoms, deduplicated) and every list of children is a run in extra.
+ *
+ *   kind                  lhs                 rhs
+ *   NUMBER                numbers index       -
+ *   STRING                strings index       -
+ *   BOOLEAN, NULL         -                   -
+ *   IDENTIFIER            atoms index         -
+ *   VAR/CONST_DECLARATION atoms index         initializer or FLAT_NONE
+ *   ASSIGNMENT            target              value
+ *   BINARY_OP             left                right
+ *   UNARY_OP              operand             -
+ *   IF, LOOP              condition           body
+ *   IF_ELSE               condition           extra: if_body, else_body
+ *   NEXT, STOP            -                   -
+ *   FUNCTION_DECLARATION  atoms index         extra: count, params..., body
+ *   FUNCTION_CALL         callee              extra: count, arguments...
+ *   RETURN                value or FLAT_NONE  -
+ *   BLOCK, ARRAY, PROGRAM extra start         count
+ *   ARRAY_ACCESS          array               index
+ *   PROPERTY_ACCESS       object              atoms index
+ */
+
+typedef uint32_t flat_ref_t;
+#define FLAT_NONE UINT32_MAX
+
+typedef struct flat_data_t {
+    uint32_t lhs;
+    uint32_t rhs;
+} flat_data_t;
+
+typedef struct flat_ast_t {
+    uint8_t *kinds;
+    uint8_t *ops;
+    flat_data_t *data;
+    size_t count;
+    size_t capacity;
+
+    uint32_t *extra;
+    size_t extra_count;
+    size_t extra_capacity;
+
+    double *numbers;
+    size_t numbers_count;
+    size_t numbers_capacity;
+
+    str_view_t *strings;
+    size_t strings_count;
+    size_t strings_capacity;
+
+    const atom_t **atoms;
+    size_t atoms_count;
+    size_t atoms_capacity;
+} flat_ast_t;
+
+flat_ast_t *flat_ast_from_tree(ast_node *root);
+ast_node *flat_ast_to_tree(flat_ast_t *ast, arena_t *arena);
+void free_flat_ast(flat_ast_t *ast);
+size_t flat_ast_bytes(flat_ast_t *ast);
+
+static inline flat_ref_t flat_ast_root(flat_ast_t *ast) {
+    return ast->count ? (flat_ref_t)(ast->count - 1) : FLAT_NONE;
+}
+
+static inline ast_type flat_kind(flat_ast_t *ast, flat_ref_t node) {
+    return (ast_type)ast->kinds[node];
+}
+
+static inline uint8_t flat_op(flat_ast_t *ast, flat_ref_t node) {
+    return ast->ops[node];
+}
+
+static inline uint32_t flat_lhs(flat_ast_t *ast, flat_ref_t node) {
+    return ast->data[node].lhs;
+}
+
+static inline uint32_t flat_rhs(flat_ast_t *ast, flat_ref_t node) {
+    return ast->data[node].rhs;
+}
+
+static inline double flat_number(flat_ast_t *ast, flat_ref_t node) {
+    return ast->numbers[ast->data[node].lhs];
+}
+
+static inline str_view_t flat_string(flat_ast_t *ast, flat_ref_t node) {
+    return ast->strings[ast->data[node].lhs];
+}
+
+// Name of an IDENTIFIER, declaration or PROPERTY_ACCESS node
+const atom_t *flat_atom(flat_ast_t *ast, flat_ref_t node);
+
+// Visits the direct children of a node in source order, skipping absent
+// optional ones:
+//   flat_child_iter_t it = flat_children(ast, node);
+//   flat_ref_t child;
+//   while (flat_child_next(&it, &child)) ...
+typedef struct flat_child_iter_t {
+    flat_ref_t fixed[3];   // children stored in data or extra directly
+    size_t fixed_count;
+    const uint32_t *list;  // followed by a run of children in extra
+    size_t list_count;
+    size_t index;
+} flat_child_iter_t;
+
+flat_child_iter_t flat_children(flat_ast_t *ast, flat_ref_t node);
+
+static inline bool flat_child_next(flat_child_iter_t *it, flat_ref_t *child) {
+    while (it->index < it->fixed_count) {
+        flat_ref_t ref = it->fixed[it->index++];
+        if (ref != FLAT_NONE) {
+            *child = ref;
+            return true;
+        }
+    }
+
+    size_t index = it->index - it->fixed_count;
+    if (index >= it->list_count)
+        return false;
+    it->index++;
+    *child = it->list[index];
+    return true;
+}
+
+#endif
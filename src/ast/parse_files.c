@@ -0,0 +1,136 @@
+#include "parse_files.h"
+#include "ast_parser.h"
+#include "../utils/file.h"
+#include "../utils/logger.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+
+/*
+ * A fixed pool of workers takes files off a shared counter, so a few big
+ * scripts don't leave the other threads idle. Every file gets its own
+ * lexer and parser_t, and results go to the file's own slot, so workers
+ * share nothing but the counter (and the atom table, which locks itself).
+ *
+ * Each file is parsed under nojs_protect. After a failure workers take no
+ * new files, and once all are joined the error of the failed file that
+ * comes first in paths is raised again on the calling thread, with every
+ * file released. parse_files is as safe inside nojs_protect as try_parse.
+ */
+
+#define PARSE_MAX_THREADS 64
+#define AST_ARENA_CHUNK (64 * 1024)
+
+typedef struct parse_pool_t {
+    const char **paths;
+    parsed_file_t *files;
+    size_t count;
+    size_t next;
+    bool failed; // a worker hit an error, the others stop taking files
+} parse_pool_t;
+
+typedef struct parse_worker_t {
+    parse_pool_t *pool;
+    size_t failed;      // index of the file that raised, count if none
+    nojs_error_t error;
+} parse_worker_t;
+
+typedef struct parse_job_t {
+    const char *path;
+    parsed_file_t *file;
+    parser_t *parser;
+} parse_job_t;
+
+// Everything is stored in the file as soon as it exists, for
+// free_parsed_files to release whether parsing finished or not
+static void parse_one(void *context) {
+    parse_job_t *job = (parse_job_t *)context;
+    parsed_file_t *file = job->file;
+    file->path = job->path;
+    file->source = read_file(job->path, NULL);
+    file->lexer = new_lexer(file->source);
+    tokenize_into(file->lexer);
+
+    file->arena = new_arena(AST_ARENA_CHUNK);
+
+    job->parser = new_parser(file->lexer, file->arena);
+    file->program = parse_program(job->parser);
+}
+
+static void *parse_worker(void *arg) {
+    parse_worker_t *worker = (parse_worker_t *)arg;
+    parse_pool_t *pool = worker->pool;
+    worker->failed = pool->count;
+
+    while (!__atomic_load_n(&pool->failed, __ATOMIC_RELAXED)) {
+        size_t index = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED);
+        if (index >= pool->count)
+            break;
+
+        parse_job_t job = { pool->paths[index], &pool->files[index], NULL };
+        bool parsed = nojs_protect(parse_one, &job, &worker->error);
+        free_parser(job.parser);
+        if (!parsed) {
+            worker->failed = index;
+            __atomic_store_n(&pool->failed, true, __ATOMIC_RELAXED);
+        }
+    }
+    return NULL;
+}
+
+parsed_file_t *parse_files(const char **paths, size_t count, size_t threads) {
+    if (!paths)
+        elog("Can't parse files, NULL ptr on paths");
+
+    parsed_file_t *files = (parsed_file_t *)calloc(count ? count : 1, sizeof(parsed_file_t));
+    if (!files)
+        elog("Error allocation memory for parsed files");
+
+    if (threads > PARSE_MAX_THREADS)
+        threads = PARSE_MAX_THREADS;
+    if (threads > count)
+        threads = count;
+
+    parse_pool_t pool = { paths, files, count, 0, false };
+    pthread_t handles[PARSE_MAX_THREADS];
+    parse_worker_t workers[PARSE_MAX_THREADS];
+
+    // The calling thread is one of the workers, the others are a bonus: when
+    // one can't be started, the rest share its files
+    size_t started = 1;
+    for (size_t i = 1; i < threads; i++) {
+        workers[started].pool = &pool;
+        if (pthread_create(&handles[started], NULL, parse_worker, &workers[started]) != 0)
+            break;
+        started++;
+    }
+
+    workers[0].pool = &pool;
+    parse_worker(&workers[0]);
+
+    for (size_t i = 1; i < started; i++)
+        pthread_join(handles[i], NULL);
+
+    parse_worker_t *first = NULL;
+    for (size_t i = 0; i < started; i++)
+        if (workers[i].failed < count && (!first || workers[i].failed < first->failed))
+            first = &workers[i];
+    if (first) {
+        nojs_error_t error = first->error;
+        free_parsed_files(files, count);
+        nojs_reraise(&error);
+    }
+    return files;
+}
+
+void free_parsed_files(parsed_file_t *files, size_t count) {
+    if (!files)
+        return;
+
+    for (size_t i = 0; i < count; i++) {
+        free_arena(files[i].arena);
+        free_lexer(files[i].lexer);
+        free(files[i].source);
+    }
+    free(files);
+}
@@ -0,0 +1,22 @@
+#ifndef PARSE_FILES_H
+#define PARSE_FILES_H
+
+#include <stddef.h>
+#include "ast.h"
+#include "../lexer/lexer.h"
+
+typedef struct parsed_file_t {
+    const char *path;
+    char *source;   // owned, tokens and string nodes point into it
+    lexer_t *lexer;
+    arena_t *arena; // holds the whole tree
+    ast_node *program;
+} parsed_file_t;
+
+// Reads, lexes and parses every file on a pool of threads. Results are in
+// the order of paths. An error in any file is raised on the calling thread
+// after all workers are done, nothing is returned then.
+parsed_file_t *parse_files(const char **paths, size_t count, size_t threads);
+void free_parsed_files(parsed_file_t *files, size_t count);
+
+#endif
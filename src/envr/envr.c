@@ -15,8 +15,10 @@ environment_t* new_env(environment_t* parent) {
     env->parent = parent;
     env->capacity = 8;   
     env->count = 0;
+    env->fixed = false;
+    env->captured = false;
     
-    env->keys = (char**)malloc(env->capacity * sizeof(char*));
+    env->keys = (const atom_t**)malloc(env->capacity * sizeof(atom_t*));
     env->values = (value_t*)malloc(env->capacity * sizeof(value_t));
     env->constants = (bool*)malloc(env->capacity * sizeof(bool));
     
@@ -30,9 +32,9 @@ void free_env(environment_t* env) {
     if (!env)
         return;
     
-    for (size_t i = 0; i < env->count; i++) {
-        free(env->keys[i]);
-        free_value(env->values[i]);
+    if (env->fixed) {
+        free(env);
+        return;
     }
     
     free(env->keys);
@@ -42,9 +44,12 @@ void free_env(environment_t* env) {
 }
 
 static void env_resize(environment_t* env) {
+    if (env->fixed)
+        elog("Can't add variables to a frame, it has a slot for each of them");
+
     size_t new_capacity = env->capacity * 2;
     
-    char** new_keys = (char**)realloc(env->keys, new_capacity * sizeof(char*));
+    const atom_t** new_keys = (const atom_t**)realloc(env->keys, new_capacity * sizeof(atom_t*));
     value_t* new_values = (value_t*)realloc(env->values, new_capacity * sizeof(value_t));
     bool* new_constants = (bool*)realloc(env->constants, new_capacity * sizeof(bool));
     
@@ -57,7 +62,7 @@ static void env_resize(environment_t* env) {
     env->capacity = new_capacity;
 }
 
-void env_define(environment_t* env, const char* name, value_t value, bool is_const) {
+void env_define(environment_t* env, const atom_t* name, value_t value, bool is_const) {
     if (!env) 
         elog("Can't define variable in null environment");
     
@@ -66,28 +71,27 @@ void env_define(environment_t* env, const char* name, value_t value, bool is_con
     }
     
     for (size_t i = 0; i < env->count; i++) {
-        if (strcmp(env->keys[i], name) == 0) {
+        if (env->keys[i] == name) {
             if (env->constants[i]) {
-                elog("Cannot reassign to constant '%s'", name);
+                elog("Cannot reassign to constant '%s'", name->text);
             }
-            free_value(env->values[i]);
             env->values[i] = value;
             return;
         }
     }
     
-    env->keys[env->count] = strdup(name);
+    env->keys[env->count] = name;
     env->values[env->count] = value;
     env->constants[env->count] = is_const;
     env->count++;
 }
 
-value_t env_get(environment_t* env, const char* name) {
+value_t env_get(environment_t* env, const atom_t* name) {
     if (!env) 
         elog("Can't get value from null environment");
     
     for (size_t i = 0; i < env->count; i++) {
-        if (strcmp(env->keys[i], name) == 0) {
+        if (env->keys[i] == name) {
             return env->values[i];
         }
     }
@@ -97,20 +101,19 @@ value_t env_get(environment_t* env, const char* name) {
     }
     
     // Не найдено
-    elog("Undefined variable '%s'", name);
+    elog("Undefined variable '%s'", name->text);
     return create_null_value(); 
 }
 
-bool env_assign(environment_t* env, const char* name, value_t value) {
+bool env_assign(environment_t* env, const atom_t* name, value_t value) {
     if (!env) 
         elog("Can't assign value to null environment");
     
     for (size_t i = 0; i < env->count; i++) {
-        if (strcmp(env->keys[i], name) == 0) {
+        if (env->keys[i] == name) {
             if (env->constants[i]) {
-                elog("Cannot reassign to constant '%s'", name);
+                elog("Cannot reassign to constant '%s'", name->text);
             }
-            free_value(env->values[i]);
             env->values[i] = value;
             return true;
         }
@@ -123,201 +126,232 @@ bool env_assign(environment_t* env, const char* name, value_t value) {
     return false;
 }
 
-value_t create_empty_value() {
-    value_t v;
-    v.type = VAL_NULL;
-    v.isconst = false;
-    v.name = NULL;
-    return v;
+// The environment and its three columns are one allocation
+environment_t* new_frame_env(environment_t* parent, size_t slot_count) {
+    size_t size = sizeof(environment_t)
+                + slot_count * (sizeof(value_t) + sizeof(atom_t*) + sizeof(bool));
+    environment_t* env = (environment_t*)malloc(size);
+    if (!env)
+        elog("Error allocating memory for environment");
+
+    env->parent = parent;
+    env->capacity = slot_count;
+    env->count = slot_count;
+    env->fixed = true;
+    env->captured = false;
+
+    env->values = (value_t*)(env + 1);
+    env->keys = (const atom_t**)(env->values + slot_count);
+    env->constants = (bool*)(env->keys + slot_count);
+
+    for (size_t i = 0; i < slot_count; i++) {
+        env->values[i] = create_null_value();
+        env->keys[i] = NULL;
+        env->constants[i] = false;
+    }
+    return env;
 }
 
-value_t create_string_value(const char* string) {
-    value_t v;
-    v.type = VAL_STRING;
-    v.string = strdup(string);
-    v.isconst = false;
-    v.name = NULL;
-    return v;
+void env_define_slot(environment_t* env, uint32_t slot, const atom_t* name, value_t value, bool is_const) {
+    if (!env)
+        elog("Can't define variable in null environment");
+    if (slot >= env->count)
+        elog("Slot %u of '%s' is out of the frame of %zu slots", slot, name->text, env->count);
+
+    env->keys[slot] = name;
+    env->values[slot] = value;
+    env->constants[slot] = is_const;
 }
 
-value_t create_number_value(double number) {
-    value_t v;
-    v.type = VAL_NUMBER;
-    v.number = number;
-    v.isconst = false;
-    v.name = NULL;
-    return v;
+void env_assign_slot(environment_t* env, uint32_t depth, uint32_t slot, value_t value) {
+    environment_t* frame = env_frame(env, depth);
+    if (frame->constants[slot])
+        elog("Cannot reassign to constant '%s'", frame->keys[slot]->text);
+
+    frame->values[slot] = value;
 }
 
-value_t create_boolean_value(bool boolean) {
-    value_t v;
-    v.type = VAL_BOOLEAN;
-    v.boolean = boolean;
-    v.isconst = false;
-    v.name = NULL;
-    return v;
+heap_t* new_heap(void) {
+    heap_t* heap = (heap_t*)malloc(sizeof(heap_t));
+    if (!heap)
+        elog("Error allocating memory for heap");
+    heap->objects = NULL;
+    heap->bytes = 0;
+    return heap;
 }
 
-value_t create_null_value() {
-    value_t v;
-    v.type = VAL_NULL;
-    v.isconst = false;
-    v.name = NULL;
-    return v;
+// Object body follows its header, aligned for value_t
+static void* heap_alloc(heap_t* heap, value_type type, size_t size) {
+    size_t header = (sizeof(heap_object_t) + 15) & ~(size_t)15;
+    heap_object_t* object = (heap_object_t*)malloc(header + size);
+    if (!object)
+        elog("Error allocating memory for heap object");
+
+    object->next = heap->objects;
+    object->type = type;
+    heap->objects = object;
+    heap->bytes += header + size;
+    return (char*)object + header;
 }
 
-value_t create_array_value(value_t** elements, size_t element_count) {
-    value_t v;
-    v.type = VAL_ARRAY;
-    v.isconst = false;
-    v.name = NULL;
-    
-    v.array.elements = (value_t**)malloc(element_count * sizeof(value_t*));
-    if (!v.array.elements && element_count > 0) 
-        elog("Error allocating memory for array elements");
-    
-    for (size_t i = 0; i < element_count; i++) {
-        v.array.elements[i] = (value_t*)malloc(sizeof(value_t));
-        *(v.array.elements[i]) = *elements[i];
+void free_heap(heap_t* heap) {
+    if (!heap)
+        return;
+
+    size_t header = (sizeof(heap_object_t) + 15) & ~(size_t)15;
+    heap_object_t* object = heap->objects;
+    while (object) {
+        heap_object_t* next = object->next;
+        void* body = (char*)object + header;
+        if (object->type == VAL_ARRAY) {
+            free(((array_object_t*)body)->elements);
+        } else if (object->type == VAL_STRUCT) {
+            free(((struct_object_t*)body)->field_names);
+            free(((struct_object_t*)body)->field_values);
+        }
+        free(object);
+        object = next;
     }
-    
-    v.array.element_count = element_count;
-    return v;
+    free(heap);
 }
 
-value_t create_function_value(ast_node* decl, environment_t* env) {
-    value_t v;
-    v.type = VAL_FUNCTION;
-    v.isconst = false;
-    v.name = NULL;
-    v.func.declaration = decl;
-    v.func.env = env;
-    return v;
+const str_view_t* heap_string(heap_t* heap, const char* data, size_t length) {
+    str_view_t* view = (str_view_t*)heap_alloc(heap, VAL_STRING, sizeof(str_view_t) + length + 1);
+    char* copy = (char*)(view + 1);
+    memcpy(copy, data, length);
+    copy[length] = '\0';
+    *view = sv_make(copy, length);
+    return view;
 }
 
-value_t create_native_function_value(native_function_ptr func, const char* name) {
-    value_t v;
-    v.type = VAL_NATIVE_FUNCTION;
-    v.isconst = false;
-    v.name = NULL;
-    v.native_func.function = func;
-    v.native_func.name = name;
-    return v;
+value_t create_array_value(heap_t* heap, const value_t* elements, size_t element_count) {
+    array_object_t* object = (array_object_t*)heap_alloc(heap, VAL_ARRAY, sizeof(array_object_t));
+    object->count = element_count;
+    object->capacity = element_count;
+    object->elements = NULL;
+    if (element_count) {
+        object->elements = (value_t*)malloc(element_count * sizeof(value_t));
+        if (!object->elements)
+            elog("Error allocating memory for array elements");
+        memcpy(object->elements, elements, element_count * sizeof(value_t));
+    }
+    return nanbox(VAL_ARRAY, (uintptr_t)object);
 }
 
-value_t create_struct_value(const char* struct_name, char** field_names, value_t* field_values, size_t field_count) {
-    value_t v;
-    v.type = VAL_STRUCT;
-    v.isconst = false;
-    v.name = NULL;
-    
-    v.structure.struct_name = strdup(struct_name);
-    v.structure.field_count = field_count;
-    
-    v.structure.field_names = (char**)malloc(field_count * sizeof(char*));
-    v.structure.field_values = (value_t*)malloc(field_count * sizeof(value_t));
-    
-    if ((!v.structure.field_names || !v.structure.field_values) && field_count > 0)
-        elog("Error allocating memory for struct fields");
-    
-    for (size_t i = 0; i < field_count; i++) {
-        v.structure.field_names[i] = strdup(field_names[i]);
-        v.structure.field_values[i] = field_values[i];
+void array_push(value_t array, value_t value) {
+    if (value_type_of(array) != VAL_ARRAY)
+        elog("Cannot push to non-array value");
+
+    array_object_t* object = value_as_array(array);
+    if (object->count == object->capacity) {
+        object->capacity = object->capacity ? object->capacity * 2 : 8;
+        object->elements = (value_t*)realloc(object->elements, object->capacity * sizeof(value_t));
+        if (!object->elements)
+            elog("Error reallocating memory for array elements");
+    }
+    object->elements[object->count++] = value;
+}
+
+value_t create_function_value(heap_t* heap, ast_node* decl, const void* code, environment_t* env) {
+    function_object_t* object = (function_object_t*)heap_alloc(heap, VAL_FUNCTION, sizeof(function_object_t));
+    object->declaration = decl;
+    object->code = code;
+    object->env = env;
+    return nanbox(VAL_FUNCTION, (uintptr_t)object);
+}
+
+value_t create_native_function_value(heap_t* heap, native_function_ptr func, const char* name) {
+    native_object_t* object = (native_object_t*)heap_alloc(heap, VAL_NATIVE_FUNCTION, sizeof(native_object_t));
+    object->function = func;
+    object->name = name;
+    return nanbox(VAL_NATIVE_FUNCTION, (uintptr_t)object);
+}
+
+value_t create_struct_value(heap_t* heap, const atom_t* struct_name, const atom_t** field_names, const value_t* field_values, size_t field_count) {
+    struct_object_t* object = (struct_object_t*)heap_alloc(heap, VAL_STRUCT, sizeof(struct_object_t));
+    object->struct_name = struct_name;
+    object->field_count = field_count;
+    object->field_capacity = field_count;
+    object->field_names = NULL;
+    object->field_values = NULL;
+    
+    if (field_count) {
+        object->field_names = (const atom_t**)malloc(field_count * sizeof(atom_t*));
+        object->field_values = (value_t*)malloc(field_count * sizeof(value_t));
+        if (!object->field_names || !object->field_values)
+            elog("Error allocating memory for struct fields");
+        memcpy(object->field_names, field_names, field_count * sizeof(atom_t*));
+        memcpy(object->field_values, field_values, field_count * sizeof(value_t));
     }
     
-    return v;
+    return nanbox(VAL_STRUCT, (uintptr_t)object);
 }
 
-value_t get_struct_field(value_t structure, const char* field_name) {
-    if (structure.type != VAL_STRUCT) {
-        elog("Cannot access field of non-structure value");
+value_t get_struct_field(value_t structure, const atom_t* field_name) {
+    if (value_type_of(structure) != VAL_STRUCT) {
+        elog("Cannot access field '%s' of non-structure value", field_name->text);
     }
     
-    for (size_t i = 0; i < structure.structure.field_count; i++) {
-        if (strcmp(structure.structure.field_names[i], field_name) == 0) {
-            return structure.structure.field_values[i];
+    struct_object_t* object = value_as_struct(structure);
+    for (size_t i = 0; i < object->field_count; i++) {
+        if (object->field_names[i] == field_name) {
+            return object->field_values[i];
         }
     }
     
     elog("Structure '%s' has no field named '%s'", 
-         structure.structure.struct_name, field_name);
-    return create_null_value();
+         object->struct_name->text, field_name->text);
 }
 
-void set_struct_field(value_t* structure, const char* field_name, value_t value) {
-    if (structure->type != VAL_STRUCT) {
-        elog("Cannot set field of non-structure value");
+void set_struct_field(value_t structure, const atom_t* field_name, value_t value) {
+    if (value_type_of(structure) != VAL_STRUCT) {
+        elog("Cannot set field '%s' of non-structure value", field_name->text);
     }
     
-    for (size_t i = 0; i < structure->structure.field_count; i++) {
-        if (strcmp(structure->structure.field_names[i], field_name) == 0) {
-            free_value(structure->structure.field_values[i]);
-            structure->structure.field_values[i] = value;
+    struct_object_t* object = value_as_struct(structure);
+    for (size_t i = 0; i < object->field_count; i++) {
+        if (object->field_names[i] == field_name) {
+            object->field_values[i] = value;
             return;
         }
     }
     
-    size_t new_count = structure->structure.field_count + 1;
-    structure->structure.field_names = (char**)realloc(
-        structure->structure.field_names, new_count * sizeof(char*));
-    structure->structure.field_values = (value_t*)realloc(
-        structure->structure.field_values, new_count * sizeof(value_t));
-    
-    if (!structure->structure.field_names || !structure->structure.field_values)
-        elog("Error reallocating memory for new struct field");
-    
-    structure->structure.field_names[structure->structure.field_count] = strdup(field_name);
-    structure->structure.field_values[structure->structure.field_count] = value;
-    structure->structure.field_count = new_count;
-}
-
-void free_value(value_t value) {
-    switch (value.type) {
-        case VAL_STRING:
-            free(value.string);
-            break;
-        
-        case VAL_ARRAY:
-            for (size_t i = 0; i < value.array.element_count; i++) {
-                free_value(*value.array.elements[i]);
-                free(value.array.elements[i]);
-            }
-            free(value.array.elements);
-            break;
+    if (object->field_count == object->field_capacity) {
+        object->field_capacity = object->field_capacity ? object->field_capacity * 2 : 4;
+        object->field_names = (const atom_t**)realloc(
+            object->field_names, object->field_capacity * sizeof(atom_t*));
+        object->field_values = (value_t*)realloc(
+            object->field_values, object->field_capacity * sizeof(value_t));
         
-        case VAL_STRUCT:
-            for (size_t i = 0; i < value.structure.field_count; i++) {
-                free(value.structure.field_names[i]);
-                free_value(value.structure.field_values[i]);
-            }
-            free(value.structure.field_names);
-            free(value.structure.field_values);
-            free((void*)value.structure.struct_name);
-            break;
-            
-        default:
-            break;
+        if (!object->field_names || !object->field_values)
+            elog("Error reallocating memory for new struct field");
     }
+    
+    object->field_names[object->field_count] = field_name;
+    object->field_values[object->field_count] = value;
+    object->field_count++;
 }
 
 char* value_to_string(value_t value) {
     char buffer[1024];
     
-    switch (value.type) {
-        case VAL_NUMBER:
-            if (floor(value.number) == value.number) {
-                snprintf(buffer, sizeof(buffer), "%.0f", value.number);
+    switch (value_type_of(value)) {
+        case VAL_NUMBER: {
+            double number = value_as_number(value);
+            if (floor(number) == number) {
+                snprintf(buffer, sizeof(buffer), "%.0f", number);
             } else {
-                snprintf(buffer, sizeof(buffer), "%g", value.number);
+                snprintf(buffer, sizeof(buffer), "%g", number);
             }
             break;
+        }
             
         case VAL_STRING:
-            snprintf(buffer, sizeof(buffer), "\"%s\"", value.string);
+            snprintf(buffer, sizeof(buffer), "\"" SV_FMT "\"", SV_ARG(value_as_string(value)));
             break;
             
         case VAL_BOOLEAN:
-            snprintf(buffer, sizeof(buffer), "%s", value.boolean ? "true" : "false");
+            snprintf(buffer, sizeof(buffer), "%s", value_as_boolean(value) ? "true" : "false");
             break;
             
         case VAL_NULL:
@@ -325,11 +359,12 @@ char* value_to_string(value_t value) {
             break;
             
         case VAL_ARRAY: {
+            array_object_t* array = value_as_array(value);
             char temp[1024] = "[";
             size_t len = 1;
             
-            for (size_t i = 0; i < value.array.element_count; i++) {
-                char* element_str = value_to_string(*value.array.elements[i]);
+            for (size_t i = 0; i < array->count; i++) {
+                char* element_str = value_to_string(array->elements[i]);
                 len += snprintf(temp + len, sizeof(temp) - len, "%s%s", 
                               i > 0 ? ", " : "", element_str);
                 free(element_str);
@@ -341,22 +376,23 @@ char* value_to_string(value_t value) {
             
         case VAL_FUNCTION:
             snprintf(buffer, sizeof(buffer), "<function %s>", 
-                    value.func.declaration->function_declaration.name);
+                    value_as_function(value)->declaration->function_declaration.name->text);
             break;
             
         case VAL_NATIVE_FUNCTION:
-            snprintf(buffer, sizeof(buffer), "<native function %s>", value.native_func.name);
+            snprintf(buffer, sizeof(buffer), "<native function %s>", value_as_native(value)->name);
             break;
             
         case VAL_STRUCT: {
+            struct_object_t* structure = value_as_struct(value);
             char temp[1024];
-            snprintf(temp, sizeof(temp), "%s {", value.structure.struct_name);
+            snprintf(temp, sizeof(temp), "%s {", structure->struct_name->text);
             size_t len = strlen(temp);
             
-            for (size_t i = 0; i < value.structure.field_count; i++) {
-                char* field_value = value_to_string(value.structure.field_values[i]);
+            for (size_t i = 0; i < structure->field_count; i++) {
+                char* field_value = value_to_string(structure->field_values[i]);
                 len += snprintf(temp + len, sizeof(temp) - len, "%s%s: %s", 
-                              i > 0 ? ", " : " ", value.structure.field_names[i], field_value);
+                              i > 0 ? ", " : " ", structure->field_names[i]->text, field_value);
                 free(field_value);
             }
             
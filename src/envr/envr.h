@@ -2,12 +2,32 @@
 #define ENVER_H
 
 #include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
 #include "../utils/arr.h"
 #include "../ast/ast.h"
+#include "../utils/str_view.h"
+#include "../utils/atom.h"
 
 typedef struct value_t value_t;
 typedef struct environment_t environment_t;
-typedef value_t (*native_function_ptr)(value_t** args, size_t arg_count);
+typedef struct heap_t heap_t;
+typedef value_t (*native_function_ptr)(heap_t* heap, value_t* args, size_t arg_count);
+
+// Arrays and structs are shared by reference, values only point at them
+typedef struct array_object_t {
+    value_t* elements;
+    size_t count;
+    size_t capacity;
+} array_object_t;
+
+typedef struct struct_object_t {
+    const atom_t* struct_name;
+    const atom_t** field_names;
+    value_t* field_values;
+    size_t field_count;
+    size_t field_capacity;
+} struct_object_t;
 
 typedef enum value_type {
     VAL_NUMBER,
@@ -20,69 +40,177 @@ typedef enum value_type {
     VAL_NATIVE_FUNCTION
 } value_type;
 
-typedef struct value_t {
-    value_type type;
+// declaration for the tree walker, code for a compiled engine
+typedef struct function_object_t {
+    ast_node* declaration;
+    const void* code;
+    environment_t* env;
+} function_object_t;
+
+typedef struct native_object_t {
+    native_function_ptr function;
     const char* name;
-    bool isconst;
-    
-    union {
-        double number;
-        char* string;
-        bool boolean;
-        
-        struct {
-            value_t** elements;
-            size_t element_count;
-        } array;
-
-        struct {
-            ast_node* declaration;
-            environment_t* env;
-        } func;
-
-        struct {
-            native_function_ptr function;
-            const char* name;
-        } native_func;
-        
-        struct {
-            char** field_names;
-            value_t* field_values;
-            size_t field_count;
-            const char* struct_name;
-        } structure;
-    };
+} native_object_t;
+
+/*
+ * A value is one NaN-boxed 64-bit word. A number is the double itself,
+ * anything else hides in a quiet NaN with bit 50 set, which arithmetic
+ * never produces (create_number_value makes other NaNs canonical):
+ *   - the sign bit and bits 48-49 hold the value_type, 1 to 7
+ *   - a boolean is the low bit, null has no payload
+ *   - strings, arrays, structs and functions are a 48-bit pointer to their
+ *     object, a string to a str_view_t that stays where it is: in the tree
+ *     or a module, with its characters in the source or the module file,
+ *     or in the heap
+ * Names and const-ness of variables are columns of the environment, a
+ * value carries neither.
+ */
+typedef struct value_t {
+    uint64_t bits;
 } value_t;
 
+_Static_assert(sizeof(void*) == 8, "values keep pointers in 48 bits of a NaN");
+
+#define NANBOX_QNAN 0x7ffc000000000000ull
+#define NANBOX_PAYLOAD 0x0000ffffffffffffull
+#define NANBOX_CANONICAL_NAN 0x7ff8000000000000ull
+
+static inline value_t nanbox(value_type type, uint64_t payload) {
+    value_t v = { NANBOX_QNAN | ((uint64_t)(type & 4) << 61) | ((uint64_t)(type & 3) << 48) | payload };
+    return v;
+}
+
+static inline bool value_is_number(value_t value) {
+    return (value.bits & NANBOX_QNAN) != NANBOX_QNAN;
+}
+
+static inline value_type value_type_of(value_t value) {
+    if (value_is_number(value))
+        return VAL_NUMBER;
+    return (value_type)(((value.bits >> 61) & 4) | ((value.bits >> 48) & 3));
+}
+
+static inline double value_as_number(value_t value) {
+    double number;
+    memcpy(&number, &value.bits, sizeof(number));
+    return number;
+}
+
+static inline bool value_as_boolean(value_t value) {
+    return value.bits & 1;
+}
+
+static inline void* value_as_pointer(value_t value) {
+    return (void*)(uintptr_t)(value.bits & NANBOX_PAYLOAD);
+}
+
+static inline str_view_t value_as_string(value_t value) {
+    return *(const str_view_t*)value_as_pointer(value);
+}
+
+static inline array_object_t* value_as_array(value_t value) {
+    return (array_object_t*)value_as_pointer(value);
+}
+
+static inline struct_object_t* value_as_struct(value_t value) {
+    return (struct_object_t*)value_as_pointer(value);
+}
+
+static inline function_object_t* value_as_function(value_t value) {
+    return (function_object_t*)value_as_pointer(value);
+}
+
+static inline native_object_t* value_as_native(value_t value) {
+    return (native_object_t*)value_as_pointer(value);
+}
+
+static inline value_t create_number_value(double number) {
+    value_t v;
+    memcpy(&v.bits, &number, sizeof(number));
+    if (number != number)
+        v.bits = NANBOX_CANONICAL_NAN;
+    return v;
+}
+
+static inline value_t create_boolean_value(bool boolean) {
+    return nanbox(VAL_BOOLEAN, boolean);
+}
+
+static inline value_t create_null_value(void) {
+    return nanbox(VAL_NULL, 0);
+}
+
+static inline value_t create_empty_value(void) {
+    return create_null_value();
+}
+
+// Borrows the view, not only the characters: it must outlive the value
+static inline value_t create_string_value(const str_view_t* string) {
+    return nanbox(VAL_STRING, (uintptr_t)string);
+}
+
 typedef struct environment_t {
     struct environment_t* parent;
-    char** keys;
+    const atom_t** keys;
     value_t* values;
     bool* constants;
     size_t count;
     size_t capacity;
+    bool fixed;    // a frame from new_frame_env, one block that can't grow
+    bool captured; // a closure refers to the frame, it outlives its call
 } environment_t;
 
+/*
+ * Owner of every array, struct, function and runtime string of a run.
+ * Values only point into it and are copied freely, nothing is collected
+ * before free_heap releases all of it at once.
+ */
+typedef struct heap_object_t {
+    struct heap_object_t* next;
+    value_type type; // of the value pointing at the object
+} heap_object_t;
+
+typedef struct heap_t {
+    heap_object_t* objects;
+    size_t bytes;
+} heap_t;
+
+heap_t* new_heap(void);
+void free_heap(heap_t* heap);
+const str_view_t* heap_string(heap_t* heap, const char* data, size_t length);
+
 environment_t* new_env(environment_t* parent);
 void free_env(environment_t* env);
-void env_define(environment_t* env, const char* name, value_t value, bool is_const);
-value_t env_get(environment_t* env, const char* name);
-bool env_assign(environment_t* env, const char* name, value_t value);
-
-value_t create_empty_value();
-value_t create_string_value(const char* string);
-value_t create_number_value(double number);
-value_t create_boolean_value(bool boolean);
-value_t create_null_value();
-value_t create_array_value(value_t** elements, size_t element_count);
-value_t create_function_value(ast_node* decl, environment_t* env);
-value_t create_native_function_value(native_function_ptr func, const char* name);
-value_t create_struct_value(const char* struct_name, char** field_names, value_t* field_values, size_t field_count);
-
-value_t get_struct_field(value_t structure, const char* field_name);
-void set_struct_field(value_t* structure, const char* field_name, value_t value);
-
-void free_value(value_t value);
+void env_define(environment_t* env, const atom_t* name, value_t value, bool is_const);
+value_t env_get(environment_t* env, const atom_t* name);
+bool env_assign(environment_t* env, const atom_t* name, value_t value);
+
+// Frame of slot_count variables for code annotated by resolve_scopes, all
+// slots start null. Slots are read and written by (depth, slot) with no
+// name comparison, names are kept only for error messages and env_get.
+environment_t* new_frame_env(environment_t* parent, size_t slot_count);
+void env_define_slot(environment_t* env, uint32_t slot, const atom_t* name, value_t value, bool is_const);
+void env_assign_slot(environment_t* env, uint32_t depth, uint32_t slot, value_t value);
+
+static inline environment_t* env_frame(environment_t* env, uint32_t depth) {
+    while (depth--)
+        env = env->parent;
+    return env;
+}
+
+static inline value_t env_get_slot(environment_t* env, uint32_t depth, uint32_t slot) {
+    return env_frame(env, depth)->values[slot];
+}
+
+value_t create_array_value(heap_t* heap, const value_t* elements, size_t element_count);
+value_t create_function_value(heap_t* heap, ast_node* decl, const void* code, environment_t* env);
+value_t create_native_function_value(heap_t* heap, native_function_ptr func, const char* name);
+value_t create_struct_value(heap_t* heap, const atom_t* struct_name, const atom_t** field_names, const value_t* field_values, size_t field_count);
+
+value_t get_struct_field(value_t structure, const atom_t* field_name);
+void set_struct_field(value_t structure, const atom_t* field_name, value_t value);
+void array_push(value_t array, value_t value);
+
 char* value_to_string(value_t value);
 
 #endif
@@ -0,0 +1,863 @@
+#include "closure_compiler.h"
+#include "runtime.h"
+#include "../ast/ast_parser.h"
+#include "../ast/ast_printer.h"
+#include "../ast/ast_resolve.h"
+#include "../utils/logger.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define CALL_ARGS_ON_STACK 8
+
+typedef enum cl_status {
+    CL_NORMAL,
+    CL_NEXT,
+    CL_STOP,
+    CL_RETURN
+} cl_status;
+
+typedef value_t (*cl_eval_fn)(const cl_node_t *node, environment_t *env, interp_t *interp);
+typedef bool (*cl_test_fn)(const cl_node_t *node, environment_t *env, interp_t *interp);
+typedef cl_status (*cl_exec_fn)(const cl_node_t *node, environment_t *env, interp_t *interp);
+
+// An expression has eval and test, its truthiness as a condition, and
+// exec to run as a statement; a statement has exec only
+struct cl_node_t {
+    cl_eval_fn eval;
+    cl_test_fn test;
+    cl_exec_fn exec;
+
+    union {
+        value_t constant;
+        struct {
+            uint32_t depth;
+            uint32_t slot;
+            const atom_t *name;
+        } variable;
+        struct {
+            uint32_t left;
+            uint32_t right;
+        } local_local;
+        struct {
+            uint32_t slot;
+            double number;
+            const atom_t *name; // of the local, x = x + 1 checks it's not a const
+        } local_const;
+        struct {
+            binary_op_type op;
+            cl_node_t *left;
+            cl_node_t *right;
+            double number; // right side of the any_const shapes
+        } binary;
+        struct {
+            cl_node_t *operand;
+        } unary;
+        struct {
+            cl_node_t *value;
+            uint32_t depth;
+            uint32_t slot;
+            const atom_t *name;
+        } assign;
+        // a[i], a[i] = v, o.f and o.f = v
+        struct {
+            cl_node_t *object;
+            cl_node_t *index;
+            cl_node_t *value;
+            const atom_t *field;
+        } element;
+        struct {
+            cl_node_t *callee;
+            cl_node_t **args;
+            size_t count;
+        } call;
+        // blocks and array literals
+        struct {
+            cl_node_t **items;
+            size_t count;
+        } list;
+        // if, if-else and loops
+        struct {
+            cl_node_t *condition;
+            cl_node_t *body;
+            cl_node_t *other;
+        } branch;
+        struct {
+            cl_node_t *value;
+            uint32_t slot;
+            const atom_t *name;
+            bool is_const;
+        } declare;
+        struct {
+            cl_function_t *function;
+            uint32_t slot;
+            ast_node *declaration;
+        } function;
+    };
+};
+
+typedef struct cl_compiler_t {
+    cl_program_t *program;
+    arena_t *arena; // of the tree, lazy bodies are parsed into it
+} cl_compiler_t;
+
+// Defaults of expressions, on top of their own eval
+
+static bool test_value(const cl_node_t *node, environment_t *env, interp_t *interp) {
+    return value_truthy(node->eval(node, env, interp));
+}
+
+static cl_status exec_expression(const cl_node_t *node, environment_t *env, interp_t *interp) {
+    node->eval(node, env, interp);
+    return CL_NORMAL;
+}
+
+static cl_node_t *new_node(cl_compiler_t *compiler, cl_eval_fn eval, cl_exec_fn exec) {
+    cl_node_t *node = (cl_node_t *)arena_alloc(compiler->program->arena, sizeof(cl_node_t));
+    if (!node)
+        elog("Error allocation memory for a compiled node");
+    memset(node, 0, sizeof(*node));
+    node->eval = eval;
+    node->test = eval ? test_value : NULL;
+    node->exec = exec ? exec : exec_expression;
+    compiler->program->node_count++;
+    return node;
+}
+
+static cl_node_t *new_expression(cl_compiler_t *compiler, cl_eval_fn eval) {
+    return new_node(compiler, eval, NULL);
+}
+
+static cl_node_t *new_statement(cl_compiler_t *compiler, cl_exec_fn exec) {
+    return new_node(compiler, NULL, exec);
+}
+
+static cl_node_t **new_list(cl_compiler_t *compiler, size_t count) {
+    cl_node_t **items = (cl_node_t **)arena_alloc(compiler->program->arena, (count + 1) * sizeof(cl_node_t *));
+    if (!items)
+        elog("Error allocation memory for compiled nodes");
+    return items;
+}
+
+// Constants and variables
+
+static value_t eval_constant(const cl_node_t *node, environment_t *env, interp_t *interp) {
+    (void)env;
+    (void)interp;
+    return node->constant;
+}
+
+static value_t eval_local(const cl_node_t *node, environment_t *env, interp_t *interp) {
+    (void)interp;
+    return env->values[node->variable.slot];
+}
+
+static value_t eval_outer(const cl_node_t *node, environment_t *env, interp_t *interp) {
+    (void)interp;
+    return env_get_slot(env, node->variable.depth, node->variable.slot);
+}
+
+static value_t eval_native(const cl_node_t *node, environment_t *env, interp_t *interp) {
+    (void)env;
+    return env_get(interp->natives, node->variable.name);
+}
+
+/*
+ * Binary operators in four shapes each, the operands are
+ *   local_local  two variables of the current frame
+ *   local_const  a variable and a number literal
+ *   any_const    any expression and a number literal
+ *   any_any      any two expressions
+ * with numbers computed in place and everything else handed to runtime.h.
+ * SHAPES is instantiated once per operator for eval and, for comparisons,
+ * once more for test, which returns a C bool.
+ */
+#define AS_VALUE(value) (value)
+#define AS_BOOL(result) (result)
+
+#define SHAPES(name, op, result, make, fallback, compute) \
+    static result name##_local_local(const cl_node_t *node, environment_t *env, interp_t *interp) { \
+        value_t left = env->values[node->local_local.left]; \
+        value_t right = env->values[node->local_local.right]; \
+        if (value_is_number(left) && value_is_number(right)) \
+            return make(compute(value_as_number(left), value_as_number(right))); \
+        return fallback(value_binary_op(interp->heap, op, left, right)); \
+    } \
+    static result name##_local_const(const cl_node_t *node, environment_t *env, interp_t *interp) { \
+        value_t left = env->values[node->local_const.slot]; \
+        if (value_is_number(left)) \
+            return make(compute(value_as_number(left), node->local_const.number)); \
+        return fallback(value_binary_op(interp->heap, op, left, create_number_value(node->local_const.number))); \
+    } \
+    static result name##_any_const(const cl_node_t *node, environment_t *env, interp_t *interp) { \
+        value_t left = node->binary.left->eval(node->binary.left, env, interp); \
+        if (value_is_number(left)) \
+            return make(compute(value_as_number(left), node->binary.number)); \
+        return fallback(value_binary_op(interp->heap, op, left, create_number_value(node->binary.number))); \
+    } \
+    static result name##_any_any(const cl_node_t *node, environment_t *env, interp_t *interp) { \
+        value_t left = node->binary.left->eval(node->binary.left, env, interp); \
+        value_t right = node->binary.right->eval(node->binary.right, env, interp); \
+        if (value_is_number(left) && value_is_number(right)) \
+            return make(compute(value_as_number(left), value_as_number(right))); \
+        return fallback(value_binary_op(interp->heap, op, left, right)); \
+    }
+
+#define ADD(a, b) ((a) + (b))
+#define SUBTRACT(a, b) ((a) - (b))
+#define MULTIPLY(a, b) ((a) * (b))
+#define DIVIDE(a, b) ((a) / (b))
+#define GREATER(a, b) ((a) > (b))
+#define LESS(a, b) ((a) < (b))
+#define GREATER_EQUAL(a, b) ((a) >= (b))
+#define LESS_EQUAL(a, b) ((a) <= (b))
+
+SHAPES(add, OP_ADD, value_t, create_number_value, AS_VALUE, ADD)
+SHAPES(sub, OP_SUBTRACT, value_t, create_number_value, AS_VALUE, SUBTRACT)
+SHAPES(mul, OP_MULTIPLY, value_t, create_number_value, AS_VALUE, MULTIPLY)
+SHAPES(div, OP_DIVIDE, value_t, create_number_value, AS_VALUE, DIVIDE)
+SHAPES(gt, OP_GREATER, value_t, create_boolean_value, AS_VALUE, GREATER)
+SHAPES(lt, OP_LESS, value_t, create_boolean_value, AS_VALUE, LESS)
+SHAPES(ge, OP_GREATER_EQUAL, value_t, create_boolean_value, AS_VALUE, GREATER_EQUAL)
+SHAPES(le, OP_LESS_EQUAL, value_t, create_boolean_value, AS_VALUE, LESS_EQUAL)
+SHAPES(test_gt, OP_GREATER, bool, AS_BOOL, value_truthy, GREATER)
+SHAPES(test_lt, OP_LESS, bool, AS_BOOL, value_truthy, LESS)
+SHAPES(test_ge, OP_GREATER_EQUAL, bool, AS_BOOL, value_truthy, GREATER_EQUAL)
+SHAPES(test_le, OP_LESS_EQUAL, bool, AS_BOOL, value_truthy, LESS_EQUAL)
+
+typedef struct binary_shapes_t {
+    cl_eval_fn eval[4];
+    cl_test_fn test[4]; // NULL when test_value does
+} binary_shapes_t;
+
+enum { SHAPE_LOCAL_LOCAL, SHAPE_LOCAL_CONST, SHAPE_ANY_CONST, SHAPE_ANY_ANY };
+
+#define EVALS(name) { name##_local_local, name##_local_const, name##_any_const, name##_any_any }
+
+static const binary_shapes_t binary_shapes[] = {
+    [OP_ADD] = { EVALS(add), { NULL } },
+    [OP_SUBTRACT] = { EVALS(sub), { NULL } },
+    [OP_MULTIPLY] = { EVALS(mul), { NULL } },
+    [OP_DIVIDE] = { EVALS(div), { NULL } },
+    [OP_GREATER] = { EVALS(gt), EVALS(test_gt) },
+    [OP_LESS] = { EVALS(lt), EVALS(test_lt) },
+    [OP_GREATER_EQUAL] = { EVALS(ge), EVALS(test_ge) },
+    [OP_LESS_EQUAL] = { EVALS(le), EVALS(test_le) },
+};
+
+#undef EVALS
+#undef SHAPES
+
+static value_t eq_any_any(const cl_node_t *node, environment_t *env, interp_t *interp) {
+    value_t left = node->binary.left->eval(node->binary.left, env, interp);
+    return create_boolean_value(values_equal(left, node->binary.right->eval(node->binary.right, env, interp)));
+}
+
+static bool test_eq_any_any(const cl_node_t *node, environment_t *env, interp_t *interp) {
+    value_t left = node->binary.left->eval(node->binary.left, env, interp);
+    return values_equal(left, node->binary.right->eval(node->binary.right, env, interp));
+}
+
+static value_t ne_any_any(const cl_node_t *node, environment_t *env, interp_t *interp) {
+    return create_boolean_value(!test_eq_any_any(node, env, interp));
+}
+
+static bool test_ne_any_any(const cl_node_t *node, environment_t *env, interp_t *interp) {
+    return !test_eq_any_any(node, env, interp);
+}
+
+static bool test_and(const cl_node_t *node, environment_t *env, interp_t *interp) {
+    return node->binary.left->test(node->binary.left, env, interp) &&
+           node->binary.right->test(node->binary.right, env, interp);
+}
+
+static value_t eval_and(const cl_node_t *node, environment_t *env, interp_t *interp) {
+    return create_boolean_value(test_and(node, env, interp));
+}
+
+static bool test_or(const cl_node_t *node, environment_t *env, interp_t *interp) {
+    return node->binary.left->test(node->binary.left, env, interp) ||
+           node->binary.right->test(node->binary.right, env, interp);
+}
+
+static value_t eval_or(const cl_node_t *node, environment_t *env, interp_t *interp) {
+    return create_boolean_value(test_or(node, env, interp));
+}
+
+static bool test_not(const cl_node_t *node, environment_t *env, interp_t *interp) {
+    return !node->unary.operand->test(node->unary.operand, env, interp);
+}
+
+static value_t eval_not(const cl_node_t *node, environment_t *env, interp_t *interp) {
+    return create_boolean_value(test_not(node, env, interp));
+}
+
+static value_t eval_negate(const cl_node_t *node, environment_t *env, interp_t *interp) {
+    value_t value = node->unary.operand->eval(node->unary.operand, env, interp);
+    if (!value_is_number(value))
+        elog("Operator '-' can't take %s", value_type_name(value_type_of(value)));
+    return create_number_value(-value_as_number(value));
+}
+
+// Assignments
+
+static value_t eval_assign_local(const cl_node_t *node, environment_t *env, interp_t *interp) {
+    value_t value = node->assign.value->eval(node->assign.value, env, interp);
+    if (env->constants[node->assign.slot])
+        elog("Cannot reassign to constant '%s'", node->assign.name->text);
+    env->values[node->assign.slot] = value;
+    return value;
+}
+
+static cl_status exec_assign_local(const cl_node_t *node, environment_t *env, interp_t *interp) {
+    eval_assign_local(node, env, interp);
+    return CL_NORMAL;
+}
+
+static value_t eval_assign_outer(const cl_node_t *node, environment_t *env, interp_t *interp) {
+    value_t value = node->assign.value->eval(node->assign.value, env, interp);
+    environment_t *frame = env_frame(env, node->assign.depth);
+    if (frame->constants[node->assign.slot])
+        elog("Cannot reassign to constant '%s'", node->assign.name->text);
+    frame->values[node->assign.slot] = value;
+    return value;
+}
+
+// x = x + 1 and x = x - 1 update the slot in place, as statements they
+// don't even copy the value out
+#define ASSIGN_LOCAL_CONST(shape, op, compute) \
+    static value_t *shape##_in_place(const cl_node_t *node, environment_t *env, interp_t *interp) { \
+        if (env->constants[node->local_const.slot]) \
+            elog("Cannot reassign to constant '%s'", node->local_const.name->text); \
+        value_t *target = &env->values[node->local_const.slot]; \
+        if (value_is_number(*target)) \
+            *target = create_number_value(compute(value_as_number(*target), node->local_const.number)); \
+        else \
+            *target = value_binary_op(interp->heap, op, *target, create_number_value(node->local_const.number)); \
+        return target; \
+    } \
+    static value_t eval_##shape(const cl_node_t *node, environment_t *env, interp_t *interp) { \
+        return *shape##_in_place(node, env, interp); \
+    } \
+    static cl_status exec_##shape(const cl_node_t *node, environment_t *env, interp_t *interp) { \
+        shape##_in_place(node, env, interp); \
+        return CL_NORMAL; \
+    }
+
+ASSIGN_LOCAL_CONST(assign_add_local_const, OP_ADD, ADD)
+ASSIGN_LOCAL_CONST(assign_sub_local_const, OP_SUBTRACT, SUBTRACT)
+
+#undef ASSIGN_LOCAL_CONST
+#undef ADD
+#undef SUBTRACT
+#undef MULTIPLY
+#undef DIVIDE
+#undef GREATER
+#undef LESS
+#undef GREATER_EQUAL
+#undef LESS_EQUAL
+
+static value_t eval_assign_index(const cl_node_t *node, environment_t *env, interp_t *interp) {
+    value_t value = node->element.value->eval(node->element.value, env, interp);
+    value_t array = node->element.object->eval(node->element.object, env, interp);
+    value_t index = node->element.index->eval(node->element.index, env, interp);
+    value_set_index(array, index, value);
+    return value;
+}
+
+static value_t eval_assign_field(const cl_node_t *node, environment_t *env, interp_t *interp) {
+    value_t value = node->element.value->eval(node->element.value, env, interp);
+    set_struct_field(node->element.object->eval(node->element.object, env, interp), node->element.field, value);
+    return value;
+}
+
+// Calls, arrays, indexing and fields
+
+static value_t eval_call(const cl_node_t *node, environment_t *env, interp_t *interp) {
+    value_t callee = node->call.callee->eval(node->call.callee, env, interp);
+    cl_node_t **args = node->call.args;
+    size_t argument_count = node->call.count;
+
+    value_type type = value_type_of(callee);
+    if (type == VAL_NATIVE_FUNCTION) {
+        value_t on_stack[CALL_ARGS_ON_STACK];
+        value_t *values = on_stack;
+        if (argument_count > CALL_ARGS_ON_STACK) {
+            values = (value_t *)malloc(argument_count * sizeof(value_t));
+            if (!values)
+                elog("Error allocating memory for call arguments");
+        }
+        for (size_t i = 0; i < argument_count; i++)
+            values[i] = args[i]->eval(args[i], env, interp);
+
+        value_t result = value_as_native(callee)->function(interp->heap, values, argument_count);
+        if (values != on_stack)
+            free(values);
+        return result;
+    }
+
+    if (type != VAL_FUNCTION)
+        elog("Can't call a %s", value_type_name(type));
+    const function_object_t *closure = value_as_function(callee);
+    if (!closure->code)
+        elog("Can't call a function of the tree walker from compiled closures");
+
+    // Missing arguments stay null, extra ones are evaluated and dropped
+    const cl_function_t *function = (const cl_function_t *)closure->code;
+    environment_t *frame = interp_take_frame(interp, closure->env, function->frame_size);
+    for (size_t i = 0; i < argument_count; i++) {
+        value_t value = args[i]->eval(args[i], env, interp);
+        if (i < function->param_count) {
+            frame->values[i] = value;
+            frame->keys[i] = function->params[i];
+        }
+    }
+
+    if (++interp->call_depth > INTERP_MAX_CALL_DEPTH)
+        elog("Call stack overflow in '%s', more than %d nested calls",
+             function->name->text, INTERP_MAX_CALL_DEPTH);
+
+    value_t result = create_null_value();
+    if (function->body->exec(function->body, frame, interp) == CL_RETURN)
+        result = interp->result;
+
+    interp->call_depth--;
+    interp_release_frame(interp, frame);
+    return result;
+}
+
+static value_t eval_array(const cl_node_t *node, environment_t *env, interp_t *interp) {
+    value_t result = create_array_value(interp->heap, NULL, 0);
+    for (size_t i = 0; i < node->list.count; i++)
+        array_push(result, node->list.items[i]->eval(node->list.items[i], env, interp));
+    return result;
+}
+
+static value_t eval_index(const cl_node_t *node, environment_t *env, interp_t *interp) {
+    value_t array = node->element.object->eval(node->element.object, env, interp);
+    return value_index(array, node->element.index->eval(node->element.index, env, interp));
+}
+
+static value_t eval_field(const cl_node_t *node, environment_t *env, interp_t *interp) {
+    return value_property(node->element.object->eval(node->element.object, env, interp), node->element.field);
+}
+
+// Statements
+
+static cl_status exec_nothing(const cl_node_t *node, environment_t *env, interp_t *interp) {
+    (void)node;
+    (void)env;
+    (void)interp;
+    return CL_NORMAL;
+}
+
+static cl_status exec_block(const cl_node_t *node, environment_t *env, interp_t *interp) {
+    for (size_t i = 0; i < node->list.count; i++) {
+        cl_status status = node->list.items[i]->exec(node->list.items[i], env, interp);
+        if (status != CL_NORMAL)
+            return status;
+    }
+    return CL_NORMAL;
+}
+
+// Declarations always go to the current frame, blocks don't have their own
+static cl_status exec_declare(const cl_node_t *node, environment_t *env, interp_t *interp) {
+    env->values[node->declare.slot] = node->declare.value
+        ? node->declare.value->eval(node->declare.value, env, interp)
+        : create_null_value();
+    env->keys[node->declare.slot] = node->declare.name;
+    env->constants[node->declare.slot] = node->declare.is_const;
+    return CL_NORMAL;
+}
+
+static cl_status exec_function(const cl_node_t *node, environment_t *env, interp_t *interp) {
+    env->values[node->function.slot] = create_function_value(interp->heap, node->function.declaration,
+                                                             node->function.function, env);
+    env->keys[node->function.slot] = node->function.function->name;
+    env->constants[node->function.slot] = false;
+    env->captured = true;
+    return CL_NORMAL;
+}
+
+static cl_status exec_if(const cl_node_t *node, environment_t *env, interp_t *interp) {
+    if (node->branch.condition->test(node->branch.condition, env, interp))
+        return node->branch.body->exec(node->branch.body, env, interp);
+    return CL_NORMAL;
+}
+
+static cl_status exec_if_else(const cl_node_t *node, environment_t *env, interp_t *interp) {
+    if (node->branch.condition->test(node->branch.condition, env, interp))
+        return node->branch.body->exec(node->branch.body, env, interp);
+    return node->branch.other->exec(node->branch.other, env, interp);
+}
+
+static cl_status exec_loop_with_cond(const cl_node_t *node, environment_t *env, interp_t *interp) {
+    const cl_node_t *condition = node->branch.condition, *body = node->branch.body;
+    while (condition->test(condition, env, interp)) {
+        cl_status status = body->exec(body, env, interp);
+        if (status == CL_STOP)
+            break;
+        if (status == CL_RETURN)
+            return status;
+    }
+    return CL_NORMAL;
+}
+
+static cl_status exec_loop_forever(const cl_node_t *node, environment_t *env, interp_t *interp) {
+    const cl_node_t *body = node->branch.body;
+    for (;;) {
+        cl_status status = body->exec(body, env, interp);
+        if (status == CL_STOP)
+            break;
+        if (status == CL_RETURN)
+            return status;
+    }
+    return CL_NORMAL;
+}
+
+static cl_status exec_next(const cl_node_t *node, environment_t *env, interp_t *interp) {
+    (void)node;
+    (void)env;
+    (void)interp;
+    return CL_NEXT;
+}
+
+static cl_status exec_stop(const cl_node_t *node, environment_t *env, interp_t *interp) {
+    (void)node;
+    (void)env;
+    (void)interp;
+    return CL_STOP;
+}
+
+static cl_status exec_return(const cl_node_t *node, environment_t *env, interp_t *interp) {
+    interp->result = node->unary.operand
+        ? node->unary.operand->eval(node->unary.operand, env, interp)
+        : create_null_value();
+    return CL_RETURN;
+}
+
+// Compiler
+
+static cl_node_t *compile_expression(cl_compiler_t *compiler, ast_node *node);
+static cl_node_t *compile_statement(cl_compiler_t *compiler, ast_node *node);
+
+static bool is_local(ast_node *node) {
+    return node->type == AST_IDENTIFIER && node->identifier.depth == 0;
+}
+
+static cl_node_t *compile_variable(cl_compiler_t *compiler, ast_node *node) {
+    uint32_t depth = node->identifier.depth;
+    cl_node_t *result = new_expression(compiler, depth == 0 ? eval_local
+                                                 : depth == SCOPE_UNRESOLVED ? eval_native : eval_outer);
+    result->variable.depth = depth;
+    result->variable.slot = node->slot;
+    result->variable.name = node->identifier.name;
+    return result;
+}
+
+static cl_node_t *compile_binary(cl_compiler_t *compiler, ast_node *node) {
+    binary_op_type op = node->binary_op.op;
+    ast_node *left = node->binary_op.left, *right = node->binary_op.right;
+    cl_node_t *result;
+
+    switch (op) {
+    case OP_AND:
+    case OP_OR:
+        result = new_expression(compiler, op == OP_AND ? eval_and : eval_or);
+        result->test = op == OP_AND ? test_and : test_or;
+        break;
+    case OP_EQUALS:
+    case OP_NOT_EQUALS:
+        result = new_expression(compiler, op == OP_EQUALS ? eq_any_any : ne_any_any);
+        result->test = op == OP_EQUALS ? test_eq_any_any : test_ne_any_any;
+        break;
+    default: {
+        const binary_shapes_t *shapes = &binary_shapes[op];
+        int shape = SHAPE_ANY_ANY;
+        if (is_local(left) && is_local(right))
+            shape = SHAPE_LOCAL_LOCAL;
+        else if (right->type == AST_NUMBER)
+            shape = is_local(left) ? SHAPE_LOCAL_CONST : SHAPE_ANY_CONST;
+
+        result = new_expression(compiler, shapes->eval[shape]);
+        if (shapes->test[shape])
+            result->test = shapes->test[shape];
+        if (shape != SHAPE_ANY_ANY)
+            compiler->program->specialized_count++;
+
+        switch (shape) {
+        case SHAPE_LOCAL_LOCAL:
+            result->local_local.left = left->slot;
+            result->local_local.right = right->slot;
+            return result;
+        case SHAPE_LOCAL_CONST:
+            result->local_const.slot = left->slot;
+            result->local_const.number = right->number.value;
+            return result;
+        case SHAPE_ANY_CONST:
+            result->binary.op = op;
+            result->binary.left = compile_expression(compiler, left);
+            result->binary.number = right->number.value;
+            return result;
+        default:
+            break;
+        }
+    }
+    }
+
+    result->binary.op = op;
+    result->binary.left = compile_expression(compiler, left);
+    result->binary.right = compile_expression(compiler, right);
+    return result;
+}
+
+// x = x + k, x = x - k
+static bool is_local_update(ast_node *target, ast_node *value) {
+    return is_local(target) && value->type == AST_BINARY_OP &&
+           (value->binary_op.op == OP_ADD || value->binary_op.op == OP_SUBTRACT) &&
+           is_local(value->binary_op.left) && value->binary_op.left->slot == target->slot &&
+           value->binary_op.right->type == AST_NUMBER;
+}
+
+static cl_node_t *compile_assignment(cl_compiler_t *compiler, ast_node *node) {
+    ast_node *target = node->assignment.left;
+    ast_node *value = node->assignment.right;
+    cl_node_t *result;
+
+    switch (target->type) {
+    case AST_IDENTIFIER:
+        if (target->identifier.depth == SCOPE_UNRESOLVED)
+            elog("Cannot assign to undeclared variable '%s'", target->identifier.name->text);
+        if (is_local_update(target, value)) {
+            bool add = value->binary_op.op == OP_ADD;
+            result = new_node(compiler, add ? eval_assign_add_local_const : eval_assign_sub_local_const,
+                              add ? exec_assign_add_local_const : exec_assign_sub_local_const);
+            result->local_const.slot = target->slot;
+            result->local_const.number = value->binary_op.right->number.value;
+            result->local_const.name = target->identifier.name;
+            compiler->program->specialized_count++;
+            return result;
+        }
+        if (target->identifier.depth == 0)
+            result = new_node(compiler, eval_assign_local, exec_assign_local);
+        else
+            result = new_expression(compiler, eval_assign_outer);
+        result->assign.value = compile_expression(compiler, value);
+        result->assign.depth = target->identifier.depth;
+        result->assign.slot = target->slot;
+        result->assign.name = target->identifier.name;
+        return result;
+
+    case AST_ARRAY_ACCESS:
+        result = new_expression(compiler, eval_assign_index);
+        result->element.value = compile_expression(compiler, value);
+        result->element.object = compile_expression(compiler, target->array_access.array);
+        result->element.index = compile_expression(compiler, target->array_access.index);
+        return result;
+
+    case AST_PROPERTY_ACCESS:
+        result = new_expression(compiler, eval_assign_field);
+        result->element.value = compile_expression(compiler, value);
+        result->element.object = compile_expression(compiler, target->property_access.object);
+        result->element.field = target->property_access.property;
+        return result;
+
+    default:
+        elog("Can't assign to %s", ast_type_to_string(target->type));
+    }
+}
+
+static cl_node_t *compile_expression(cl_compiler_t *compiler, ast_node *node) {
+    cl_node_t *result;
+    switch (node->type) {
+    case AST_NUMBER:
+    case AST_STRING:
+    case AST_BOOLEAN:
+    case AST_NULL:
+        result = new_expression(compiler, eval_constant);
+        result->constant = node->type == AST_NUMBER ? create_number_value(node->number.value)
+                         : node->type == AST_STRING ? create_string_value(&node->string.value)
+                         : node->type == AST_BOOLEAN ? create_boolean_value(node->boolean.value)
+                         : create_null_value();
+        return result;
+    case AST_IDENTIFIER:
+        return compile_variable(compiler, node);
+    case AST_ASSIGNMENT:
+        return compile_assignment(compiler, node);
+    case AST_BINARY_OP:
+        return compile_binary(compiler, node);
+    case AST_UNARY_OP:
+        result = new_expression(compiler, node->unary_op.op == OP_NOT ? eval_not : eval_negate);
+        if (node->unary_op.op == OP_NOT)
+            result->test = test_not;
+        result->unary.operand = compile_expression(compiler, node->unary_op.operand);
+        return result;
+
+    case AST_FUNCTION_CALL:
+    case AST_PRINT:
+    case AST_TAKE:
+        result = new_expression(compiler, eval_call);
+        result->call.callee = compile_expression(compiler, node->function_call.callee);
+        result->call.count = node->function_call.argument_count;
+        result->call.args = new_list(compiler, result->call.count);
+        for (size_t i = 0; i < result->call.count; i++)
+            result->call.args[i] = compile_expression(compiler, node->function_call.arguments[i]);
+        return result;
+
+    case AST_ARRAY:
+        result = new_expression(compiler, eval_array);
+        result->list.count = node->array.element_count;
+        result->list.items = new_list(compiler, result->list.count);
+        for (size_t i = 0; i < result->list.count; i++)
+            result->list.items[i] = compile_expression(compiler, node->array.elements[i]);
+        return result;
+    case AST_ARRAY_ACCESS:
+        result = new_expression(compiler, eval_index);
+        result->element.object = compile_expression(compiler, node->array_access.array);
+        result->element.index = compile_expression(compiler, node->array_access.index);
+        return result;
+    case AST_PROPERTY_ACCESS:
+        result = new_expression(compiler, eval_field);
+        result->element.object = compile_expression(compiler, node->property_access.object);
+        result->element.field = node->property_access.property;
+        return result;
+
+    default:
+        elog("%s is not an expression", ast_type_to_string(node->type));
+    }
+}
+
+// A block of one statement is that statement
+static cl_node_t *compile_list(cl_compiler_t *compiler, ast_node **statements, size_t count) {
+    if (count == 0)
+        return new_statement(compiler, exec_nothing);
+    if (count == 1)
+        return compile_statement(compiler, statements[0]);
+
+    cl_node_t *result = new_statement(compiler, exec_block);
+    result->list.count = count;
+    result->list.items = new_list(compiler, count);
+    for (size_t i = 0; i < count; i++)
+        result->list.items[i] = compile_statement(compiler, statements[i]);
+    return result;
+}
+
+static cl_function_t *compile_function(cl_compiler_t *compiler, ast_node *node) {
+    arr_t *params = node->function_declaration.parameters;
+    ast_node *body = function_body(node, compiler->arena);
+
+    cl_function_t *function = (cl_function_t *)arena_alloc(compiler->program->arena, sizeof(cl_function_t));
+    if (!function)
+        elog("Error allocation memory for a compiled function");
+    function->name = node->function_declaration.name;
+    function->param_count = params ? (uint32_t)params->count : 0;
+    function->frame_size = body->block.frame_size;
+    function->params = (const atom_t **)arena_alloc(compiler->program->arena,
+                                                    (function->param_count + 1) * sizeof(atom_t *));
+    if (!function->params)
+        elog("Error allocation memory for parameter names");
+    for (uint32_t i = 0; i < function->param_count; i++) {
+        ast_node *param = (ast_node *)params->items[i];
+        if (param->slot != i)
+            elog("Parameter '%s' is not in slot %u", param->identifier.name->text, i);
+        function->params[i] = param->identifier.name;
+    }
+    function->body = compile_statement(compiler, body);
+    return function;
+}
+
+static cl_node_t *compile_statement(cl_compiler_t *compiler, ast_node *node) {
+    cl_node_t *result;
+    switch (node->type) {
+    case AST_VAR_DECLARATION:
+    case AST_CONST_DECLARATION:
+        result = new_statement(compiler, exec_declare);
+        if (node->var_declaration.initializer)
+            result->declare.value = compile_expression(compiler, node->var_declaration.initializer);
+        result->declare.slot = node->slot;
+        result->declare.name = node->var_declaration.name;
+        result->declare.is_const = node->type == AST_CONST_DECLARATION;
+        return result;
+
+    case AST_FUNCTION_DECLARATION:
+        result = new_statement(compiler, exec_function);
+        result->function.function = compile_function(compiler, node);
+        result->function.slot = node->slot;
+        result->function.declaration = node;
+        return result;
+
+    case AST_IF:
+        result = new_statement(compiler, exec_if);
+        result->branch.condition = compile_expression(compiler, node->if_statement.condition);
+        result->branch.body = compile_statement(compiler, node->if_statement.body);
+        return result;
+    case AST_IF_ELSE:
+        result = new_statement(compiler, exec_if_else);
+        result->branch.condition = compile_expression(compiler, node->if_else_statement.condition);
+        result->branch.body = compile_statement(compiler, node->if_else_statement.if_body);
+        result->branch.other = compile_statement(compiler, node->if_else_statement.else_body);
+        return result;
+    case AST_LOOP:
+        result = new_statement(compiler, node->loop.condition ? exec_loop_with_cond : exec_loop_forever);
+        if (node->loop.condition)
+            result->branch.condition = compile_expression(compiler, node->loop.condition);
+        result->branch.body = compile_statement(compiler, node->loop.body);
+        return result;
+    case AST_NEXT:
+        return new_statement(compiler, exec_next);
+    case AST_STOP:
+        return new_statement(compiler, exec_stop);
+    case AST_RETURN:
+        result = new_statement(compiler, exec_return);
+        if (node->return_statement.value)
+            result->unary.operand = compile_expression(compiler, node->return_statement.value);
+        return result;
+
+    case AST_BLOCK:
+        return compile_list(compiler, (ast_node **)node->block.stmts->items, node->block.stmts->count);
+    case AST_LAZY_BLOCK:
+        elog("Lazy function body reached the closure compiler unparsed");
+
+    default:
+        return compile_expression(compiler, node);
+    }
+}
+
+cl_program_t *cl_compile(ast_node *program, arena_t *arena) {
+    if (!program || !arena)
+        elog("Can't compile, NULL ptr on program or arena");
+    if (program->type != AST_PROGRAM)
+        elog("Can't compile %s, expected a program", ast_type_to_string(program->type));
+
+    resolve_scopes(program, arena);
+
+    cl_program_t *result = (cl_program_t *)calloc(1, sizeof(cl_program_t));
+    if (!result)
+        elog("Error allocation memory for cl_program_t struct");
+    result->arena = new_arena(0);
+    result->frame_size = program->program.frame_size;
+
+    cl_compiler_t compiler = { .program = result, .arena = arena };
+    result->root = compile_list(&compiler, program->program.statements, program->program.statement_count);
+    return result;
+}
+
+void free_cl_program(cl_program_t *program) {
+    if (!program)
+        return;
+    free_arena(program->arena);
+    free(program);
+}
+
+value_t cl_run(interp_t *interp, const cl_program_t *program) {
+    if (!interp || !program)
+        elog("Can't run compiled closures, NULL ptr on interpreter or program");
+
+    environment_t *globals = interp_reset_globals(interp, program->frame_size);
+    cl_status status = program->root->exec(program->root, globals, interp);
+    if (status == CL_NEXT || status == CL_STOP)
+        elog("'%s' outside of a loop", status == CL_NEXT ? "next" : "stop");
+    if (status != CL_RETURN)
+        interp->result = create_null_value();
+    return interp->result;
+}
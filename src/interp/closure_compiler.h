@@ -0,0 +1,53 @@
+#ifndef CLOSURE_COMPILER_H
+#define CLOSURE_COMPILER_H
+
+#include <stddef.h>
+#include "interp.h"
+#include "../ast/ast.h"
+#include "../utils/arena.h"
+
+/*
+ * Closure compilation, between walking the tree and generating code: each
+ * ast_node of a resolved program is compiled once into a cl_node_t, a C
+ * function pointer with its operands resolved ahead of time, and running
+ * the program is calling through those pointers. There is no dispatch on
+ * node type left at runtime, the choice is made by the compiler, which
+ * also specializes nodes on their shape: i < n with a local on the left
+ * and a number on the right becomes lt_local_const, reading the slot and
+ * comparing in one call, a loop with a condition is loop_with_cond, and a
+ * condition is tested as a C bool without building a boolean value.
+ *
+ * Frames, heap and natives are the tree walker's (interp.h), values behave
+ * as in every engine (runtime.h). Function values point at a cl_function_t
+ * and only run here; calls recurse on the C stack, INTERP_MAX_CALL_DEPTH
+ * deep at most.
+ */
+
+typedef struct cl_node_t cl_node_t;
+
+typedef struct cl_function_t {
+    const atom_t *name;
+    const atom_t **params; // parameters are slots 0 .. param_count - 1
+    uint32_t param_count;
+    uint32_t frame_size;
+    cl_node_t *body;
+} cl_function_t;
+
+typedef struct cl_program_t {
+    arena_t *arena;     // of every node and function
+    cl_node_t *root;
+    uint32_t frame_size; // of the global frame
+    size_t node_count;
+    size_t specialized_count; // nodes compiled to a shape of their own
+} cl_program_t;
+
+// Resolves program (lazy bodies are parsed into arena) and compiles it.
+// Strings are borrowed from the tree, the source must outlive the result.
+cl_program_t *cl_compile(ast_node *program, arena_t *arena);
+void free_cl_program(cl_program_t *program);
+
+// Runs the program in a fresh global frame of interp, returns the value of
+// a top-level return or null. The program must outlive values it created.
+value_t cl_run(interp_t *interp, const cl_program_t *program);
+
+#endif
@@ -0,0 +1,559 @@
+#include "interp.h"
+#include "runtime.h"
+#include "../ast/ast_parser.h"
+#include "../ast/ast_printer.h"
+#include "../ast/ast_resolve.h"
+#include "../utils/logger.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef enum exec_status {
+    EXEC_NORMAL,
+    EXEC_NEXT,
+    EXEC_STOP,
+    EXEC_RETURN
+} exec_status;
+
+#define CALL_ARGS_ON_STACK 8
+
+environment_t *interp_take_frame(interp_t *interp, environment_t *parent, uint32_t slot_count) {
+    return interp_take_frame_cleared(interp, parent, slot_count, slot_count);
+}
+
+static environment_t *activate(interp_t *interp, environment_t *frame) {
+    if (interp->active_count == interp->active_capacity) {
+        interp->active_capacity = interp->active_capacity ? interp->active_capacity * 2 : 64;
+        interp->active = (environment_t **)realloc(interp->active, interp->active_capacity * sizeof(environment_t *));
+        if (!interp->active)
+            elog("Error reallocating memory for active frames");
+    }
+    interp->active[interp->active_count++] = frame;
+    return frame;
+}
+
+environment_t *interp_take_frame_cleared(interp_t *interp, environment_t *parent, uint32_t slot_count,
+                                         uint32_t cleared) {
+    if (slot_count > INTERP_POOLED_SLOTS || !interp->pool[slot_count])
+        return activate(interp, new_frame_env(parent, slot_count));
+
+    environment_t *frame = interp->pool[slot_count];
+    interp->pool[slot_count] = frame->parent;
+    frame->parent = parent;
+    for (uint32_t i = 0; i < cleared; i++) {
+        frame->values[i] = create_null_value();
+        frame->constants[i] = false;
+    }
+    return activate(interp, frame);
+}
+
+static void release_frame(interp_t *interp, environment_t *frame) {
+    if (frame->captured) {
+        if (interp->captured_count == interp->captured_capacity) {
+            interp->captured_capacity = interp->captured_capacity ? interp->captured_capacity * 2 : 16;
+            interp->captured = (environment_t **)realloc(
+                interp->captured, interp->captured_capacity * sizeof(environment_t *));
+            if (!interp->captured)
+                elog("Error reallocating memory for captured frames");
+        }
+        interp->captured[interp->captured_count++] = frame;
+        return;
+    }
+
+    if (frame->count > INTERP_POOLED_SLOTS) {
+        free_env(frame);
+        return;
+    }
+    frame->parent = interp->pool[frame->count];
+    interp->pool[frame->count] = frame;
+}
+
+void interp_release_frame(interp_t *interp, environment_t *frame) {
+    interp->active_count--;
+    release_frame(interp, frame);
+}
+
+// Frames of the calls a raising run was in
+static void release_active(interp_t *interp) {
+    while (interp->active_count)
+        release_frame(interp, interp->active[--interp->active_count]);
+}
+
+static exec_status exec(interp_t *interp, ast_node *node, environment_t *env);
+static value_t eval(interp_t *interp, ast_node *node, environment_t *env);
+
+static value_t call(interp_t *interp, ast_node *node, value_t callee, environment_t *env) {
+    ast_node **arguments = node->function_call.arguments;
+    size_t argument_count = node->function_call.argument_count;
+
+    value_type type = value_type_of(callee);
+    if (type == VAL_NATIVE_FUNCTION) {
+        value_t on_stack[CALL_ARGS_ON_STACK];
+        value_t *args = on_stack;
+        if (argument_count > CALL_ARGS_ON_STACK) {
+            args = (value_t *)malloc(argument_count * sizeof(value_t));
+            if (!args)
+                elog("Error allocating memory for call arguments");
+        }
+        for (size_t i = 0; i < argument_count; i++)
+            args[i] = eval(interp, arguments[i], env);
+
+        value_t result = value_as_native(callee)->function(interp->heap, args, argument_count);
+        if (args != on_stack)
+            free(args);
+        return result;
+    }
+
+    if (type != VAL_FUNCTION)
+        elog("Can't call a %s", value_type_name(type));
+
+    const function_object_t *function = value_as_function(callee);
+    ast_node *declaration = function->declaration;
+    arr_t *params = declaration->function_declaration.parameters;
+    ast_node *body = declaration->function_declaration.body;
+    if (body->type != AST_BLOCK)
+        body = function_body(declaration, interp->arena);
+
+    // Arguments are evaluated in the caller, straight into the new frame;
+    // missing ones stay null, extra ones are evaluated and dropped
+    environment_t *frame = interp_take_frame(interp, function->env, body->block.frame_size);
+    for (size_t i = 0; i < argument_count; i++) {
+        value_t value = eval(interp, arguments[i], env);
+        if (i < params->count) {
+            ast_node *param = (ast_node *)params->items[i];
+            frame->values[param->slot] = value;
+            frame->keys[param->slot] = param->identifier.name;
+        }
+    }
+
+    if (++interp->call_depth > INTERP_MAX_CALL_DEPTH)
+        elog("Call stack overflow in '%s', more than %d nested calls",
+             declaration->function_declaration.name->text, INTERP_MAX_CALL_DEPTH);
+
+    value_t result = create_null_value();
+    if (exec(interp, body, frame) == EXEC_RETURN)
+        result = interp->result;
+
+    interp->call_depth--;
+    interp_release_frame(interp, frame);
+    return result;
+}
+
+static value_t assign(interp_t *interp, ast_node *target, value_t value, environment_t *env) {
+    switch (target->type) {
+    case AST_IDENTIFIER: {
+        if (target->identifier.depth == SCOPE_UNRESOLVED)
+            elog("Cannot assign to undeclared variable '%s'", target->identifier.name->text);
+
+        environment_t *frame = env_frame(env, target->identifier.depth);
+        if (frame->constants[target->slot])
+            elog("Cannot reassign to constant '%s'", target->identifier.name->text);
+        frame->values[target->slot] = value;
+        return value;
+    }
+    case AST_ARRAY_ACCESS: {
+        value_t array = eval(interp, target->array_access.array, env);
+        value_t index = eval(interp, target->array_access.index, env);
+        value_set_index(array, index, value);
+        return value;
+    }
+    case AST_PROPERTY_ACCESS: {
+        value_t object = eval(interp, target->property_access.object, env);
+        set_struct_field(object, target->property_access.property, value);
+        return value;
+    }
+    default:
+        elog("Can't assign to %s", ast_type_to_string(target->type));
+    }
+}
+
+static value_t eval(interp_t *interp, ast_node *node, environment_t *env) {
+    static void *const dispatch[] = {
+        [AST_NUMBER] = &&number,
+        [AST_STRING] = &&string,
+        [AST_BOOLEAN] = &&boolean,
+        [AST_NULL] = &&null,
+        [AST_IDENTIFIER] = &&identifier,
+        [AST_VAR_DECLARATION] = &&not_expression,
+        [AST_CONST_DECLARATION] = &&not_expression,
+        [AST_ASSIGNMENT] = &&assignment,
+        [AST_BINARY_OP] = &&binary_op,
+        [AST_UNARY_OP] = &&unary_op,
+        [AST_IF] = &&not_expression,
+        [AST_IF_ELSE] = &&not_expression,
+        [AST_LOOP] = &&not_expression,
+        [AST_NEXT] = &&not_expression,
+        [AST_STOP] = &&not_expression,
+        [AST_FUNCTION_DECLARATION] = &&not_expression,
+        [AST_FUNCTION_CALL] = &&function_call,
+        [AST_RETURN] = &&not_expression,
+        [AST_PRINT] = &&function_call,
+        [AST_TAKE] = &&function_call,
+        [AST_BLOCK] = &&not_expression,
+        [AST_LAZY_BLOCK] = &&not_expression,
+        [AST_ARRAY] = &&array,
+        [AST_ARRAY_ACCESS] = &&array_access,
+        [AST_PROPERTY_ACCESS] = &&property_access,
+        [AST_PROGRAM] = &&not_expression,
+    };
+    static void *const binary_dispatch[] = {
+        [OP_ADD] = &&add,
+        [OP_SUBTRACT] = &&subtract,
+        [OP_MULTIPLY] = &&multiply,
+        [OP_DIVIDE] = &&divide,
+        [OP_EQUALS] = &&equals,
+        [OP_NOT_EQUALS] = &&not_equals,
+        [OP_GREATER] = &&greater,
+        [OP_LESS] = &&less,
+        [OP_GREATER_EQUAL] = &&greater_equal,
+        [OP_LESS_EQUAL] = &&less_equal,
+        [OP_AND] = &&and,
+        [OP_OR] = &&or,
+    };
+
+    value_t left = { 0 }, right = { 0 };
+    goto *dispatch[node->type];
+
+number:
+    return create_number_value(node->number.value);
+string:
+    return create_string_value(&node->string.value);
+boolean:
+    return create_boolean_value(node->boolean.value);
+null:
+    return create_null_value();
+
+identifier:
+    if (node->identifier.depth == 0)
+        return env->values[node->slot];
+    if (node->identifier.depth == SCOPE_UNRESOLVED)
+        return env_get(interp->natives, node->identifier.name);
+    return env_get_slot(env, node->identifier.depth, node->slot);
+
+assignment:
+    return assign(interp, node->assignment.left, eval(interp, node->assignment.right, env), env);
+
+binary_op:
+    left = eval(interp, node->binary_op.left, env);
+    if (node->binary_op.op == OP_AND) {
+        if (!value_truthy(left))
+            return create_boolean_value(false);
+    } else if (node->binary_op.op == OP_OR) {
+        if (value_truthy(left))
+            return create_boolean_value(true);
+    }
+    right = eval(interp, node->binary_op.right, env);
+    goto *binary_dispatch[node->binary_op.op];
+
+add:
+    if (value_is_number(left) && value_is_number(right))
+        return create_number_value(value_as_number(left) + value_as_number(right));
+    goto generic;
+subtract:
+    if (value_is_number(left) && value_is_number(right))
+        return create_number_value(value_as_number(left) - value_as_number(right));
+    goto generic;
+multiply:
+    if (value_is_number(left) && value_is_number(right))
+        return create_number_value(value_as_number(left) * value_as_number(right));
+    goto generic;
+divide:
+    if (value_is_number(left) && value_is_number(right))
+        return create_number_value(value_as_number(left) / value_as_number(right));
+    goto generic;
+greater:
+    if (value_is_number(left) && value_is_number(right))
+        return create_boolean_value(value_as_number(left) > value_as_number(right));
+    goto generic;
+less:
+    if (value_is_number(left) && value_is_number(right))
+        return create_boolean_value(value_as_number(left) < value_as_number(right));
+    goto generic;
+greater_equal:
+    if (value_is_number(left) && value_is_number(right))
+        return create_boolean_value(value_as_number(left) >= value_as_number(right));
+    goto generic;
+less_equal:
+    if (value_is_number(left) && value_is_number(right))
+        return create_boolean_value(value_as_number(left) <= value_as_number(right));
+    goto generic;
+
+equals:
+    return create_boolean_value(values_equal(left, right));
+not_equals:
+    return create_boolean_value(!values_equal(left, right));
+
+// The left side already didn't decide
+and:
+or:
+    return create_boolean_value(value_truthy(right));
+
+generic:
+    return value_binary_op(interp->heap, node->binary_op.op, left, right);
+
+unary_op:
+    left = eval(interp, node->unary_op.operand, env);
+    if (node->unary_op.op == OP_NOT)
+        return create_boolean_value(!value_truthy(left));
+    if (!value_is_number(left))
+        elog("Operator '-' can't take %s", value_type_name(value_type_of(left)));
+    return create_number_value(-value_as_number(left));
+
+function_call:
+    return call(interp, node, eval(interp, node->function_call.callee, env), env);
+
+array: {
+    value_t result = create_array_value(interp->heap, NULL, 0);
+    for (size_t i = 0; i < node->array.element_count; i++)
+        array_push(result, eval(interp, node->array.elements[i], env));
+    return result;
+}
+
+array_access:
+    left = eval(interp, node->array_access.array, env);
+    return value_index(left, eval(interp, node->array_access.index, env));
+
+property_access:
+    return value_property(eval(interp, node->property_access.object, env), node->property_access.property);
+
+not_expression:
+    elog("%s is not an expression", ast_type_to_string(node->type));
+}
+
+static exec_status exec_list(interp_t *interp, ast_node **statements, size_t count, environment_t *env) {
+    for (size_t i = 0; i < count; i++) {
+        exec_status status = exec(interp, statements[i], env);
+        if (status != EXEC_NORMAL)
+            return status;
+    }
+    return EXEC_NORMAL;
+}
+
+static exec_status exec(interp_t *interp, ast_node *node, environment_t *env) {
+    static void *const dispatch[] = {
+        [AST_NUMBER] = &&expression,
+        [AST_STRING] = &&expression,
+        [AST_BOOLEAN] = &&expression,
+        [AST_NULL] = &&expression,
+        [AST_IDENTIFIER] = &&expression,
+        [AST_VAR_DECLARATION] = &&declaration,
+        [AST_CONST_DECLARATION] = &&declaration,
+        [AST_ASSIGNMENT] = &&expression,
+        [AST_BINARY_OP] = &&expression,
+        [AST_UNARY_OP] = &&expression,
+        [AST_IF] = &&if_statement,
+        [AST_IF_ELSE] = &&if_else_statement,
+        [AST_LOOP] = &&loop,
+        [AST_NEXT] = &&next,
+        [AST_STOP] = &&stop,
+        [AST_FUNCTION_DECLARATION] = &&function_declaration,
+        [AST_FUNCTION_CALL] = &&expression,
+        [AST_RETURN] = &&return_statement,
+        [AST_PRINT] = &&expression,
+        [AST_TAKE] = &&expression,
+        [AST_BLOCK] = &&block,
+        [AST_LAZY_BLOCK] = &&lazy_block,
+        [AST_ARRAY] = &&expression,
+        [AST_ARRAY_ACCESS] = &&expression,
+        [AST_PROPERTY_ACCESS] = &&expression,
+        [AST_PROGRAM] = &&program,
+    };
+
+    goto *dispatch[node->type];
+
+expression:
+    eval(interp, node, env);
+    return EXEC_NORMAL;
+
+// Declarations always go to the current frame, blocks don't have their own
+declaration:
+    env->values[node->slot] = node->var_declaration.initializer
+        ? eval(interp, node->var_declaration.initializer, env)
+        : create_null_value();
+    env->keys[node->slot] = node->var_declaration.name;
+    env->constants[node->slot] = node->type == AST_CONST_DECLARATION;
+    return EXEC_NORMAL;
+
+function_declaration:
+    env->values[node->slot] = create_function_value(interp->heap, node, NULL, env);
+    env->keys[node->slot] = node->function_declaration.name;
+    env->constants[node->slot] = false;
+    env->captured = true;
+    return EXEC_NORMAL;
+
+if_statement:
+    if (value_truthy(eval(interp, node->if_statement.condition, env)))
+        return exec(interp, node->if_statement.body, env);
+    return EXEC_NORMAL;
+
+if_else_statement:
+    if (value_truthy(eval(interp, node->if_else_statement.condition, env)))
+        return exec(interp, node->if_else_statement.if_body, env);
+    return exec(interp, node->if_else_statement.else_body, env);
+
+loop:
+    while (!node->loop.condition || value_truthy(eval(interp, node->loop.condition, env))) {
+        exec_status status = exec(interp, node->loop.body, env);
+        if (status == EXEC_STOP)
+            break;
+        if (status == EXEC_RETURN)
+            return status;
+    }
+    return EXEC_NORMAL;
+
+next:
+    return EXEC_NEXT;
+stop:
+    return EXEC_STOP;
+
+return_statement:
+    interp->result = node->return_statement.value
+        ? eval(interp, node->return_statement.value, env)
+        : create_null_value();
+    return EXEC_RETURN;
+
+block:
+    return exec_list(interp, (ast_node **)node->block.stmts->items, node->block.stmts->count, env);
+
+program:
+    return exec_list(interp, node->program.statements, node->program.statement_count, env);
+
+lazy_block:
+    elog("Lazy function body reached the interpreter unparsed");
+}
+
+static value_t native_print(heap_t *heap, value_t *args, size_t arg_count) {
+    (void)heap;
+    for (size_t i = 0; i < arg_count; i++) {
+        char *allocated;
+        str_view_t text = value_text(args[i], &allocated);
+        if (i)
+            fputc(' ', stdout);
+        fwrite(text.data, 1, text.length, stdout);
+        free(allocated);
+    }
+    fputc('\n', stdout);
+    return create_null_value();
+}
+
+// take() or take(prompt), a line of stdin without its newline, null at EOF
+static value_t native_take(heap_t *heap, value_t *args, size_t arg_count) {
+    if (arg_count > 0) {
+        char *allocated;
+        str_view_t prompt = value_text(args[0], &allocated);
+        fwrite(prompt.data, 1, prompt.length, stdout);
+        free(allocated);
+    }
+    fflush(stdout);
+
+    char *line = NULL;
+    size_t capacity = 0;
+    ssize_t length = getline(&line, &capacity, stdin);
+    if (length < 0) {
+        free(line);
+        return create_null_value();
+    }
+    if (length > 0 && line[length - 1] == '\n')
+        length--;
+
+    value_t result = create_string_value(heap_string(heap, line, (size_t)length));
+    free(line);
+    return result;
+}
+
+// struct() or struct(name), fields are added by assigning to them
+static value_t native_struct(heap_t *heap, value_t *args, size_t arg_count) {
+    const atom_t *name = atom_from_cstr("struct");
+    if (arg_count > 0) {
+        if (value_type_of(args[0]) != VAL_STRING)
+            elog("Struct name must be a string, got %s", value_type_name(value_type_of(args[0])));
+        str_view_t text = value_as_string(args[0]);
+        name = atom_intern(text.data, text.length);
+    }
+    return create_struct_value(heap, name, NULL, NULL, 0);
+}
+
+interp_t *new_interp(arena_t *arena) {
+    if (!arena)
+        elog("Can't create interpreter, NULL ptr on arena");
+
+    interp_t *interp = (interp_t *)calloc(1, sizeof(interp_t));
+    if (!interp)
+        elog("Error allocating memory for interpreter");
+
+    interp->arena = arena;
+    interp->heap = new_heap();
+    interp->natives = new_env(NULL);
+    interp->result = create_null_value();
+
+    interp_define_native(interp, "print", native_print);
+    interp_define_native(interp, "take", native_take);
+    interp_define_native(interp, "struct", native_struct);
+    return interp;
+}
+
+void interp_define_native(interp_t *interp, const char *name, native_function_ptr function) {
+    env_define(interp->natives, atom_from_cstr(name), create_native_function_value(interp->heap, function, name), true);
+}
+
+void free_interp(interp_t *interp) {
+    if (!interp)
+        return;
+
+    release_active(interp);
+    free(interp->active);
+    free(interp->vm_stack);
+    free(interp->vm_calls);
+    free(interp->rg_calls);
+    free(interp->rg_arguments);
+
+    for (size_t i = 0; i < interp->captured_count; i++)
+        free_env(interp->captured[i]);
+    free(interp->captured);
+
+    for (size_t i = 0; i <= INTERP_POOLED_SLOTS; i++) {
+        while (interp->pool[i]) {
+            environment_t *frame = interp->pool[i];
+            interp->pool[i] = frame->parent;
+            free_env(frame);
+        }
+    }
+
+    if (interp->globals)
+        free_env(interp->globals);
+    free_env(interp->natives);
+    free_heap(interp->heap);
+    free(interp);
+}
+
+environment_t *interp_reset_globals(interp_t *interp, uint32_t slot_count) {
+    release_active(interp);
+
+    // Closures of an earlier run may still point at its globals
+    if (interp->globals) {
+        interp->globals->captured = true;
+        release_frame(interp, interp->globals);
+    }
+    interp->globals = new_frame_env(NULL, slot_count);
+    interp->result = create_null_value();
+    interp->call_depth = 0;
+    return interp->globals;
+}
+
+value_t interp_run(interp_t *interp, ast_node *program) {
+    if (!interp || !program)
+        elog("Can't run program, NULL ptr on interpreter or program");
+    if (program->type != AST_PROGRAM)
+        elog("Can't run %s, expected a program", ast_type_to_string(program->type));
+
+    resolve_scopes(program, interp->arena);
+    interp_reset_globals(interp, program->program.frame_size);
+
+    exec_status status = exec(interp, program, interp->globals);
+    if (status == EXEC_NEXT || status == EXEC_STOP)
+        elog("'%s' outside of a loop", status == EXEC_NEXT ? "next" : "stop");
+    if (status != EXEC_RETURN)
+        interp->result = create_null_value();
+    return interp->result;
+}
@@ -1 +1,89 @@
+#ifndef INTERP_H
+#define INTERP_H
 
+#include <stddef.h>
+#include "../ast/ast.h"
+#include "../envr/envr.h"
+#include "../utils/arena.h"
+
+/*
+ * Tree-walking interpreter over a resolved ast_node tree. exec runs
+ * statements and eval computes expressions, both dispatch with computed
+ * goto on node->type (GCC labels as values) instead of a switch, binary
+ * operators get a second table on binary_op_type with a fast path when
+ * both sides are numbers. next, stop and return travel up as exec_status
+ * codes, the value of a return waits in interp->result.
+ *
+ * Variables live in frames from new_frame_env, one per call plus the
+ * global one, and are read by (depth, slot) as set by resolve_scopes.
+ * Identifiers left unresolved are natives, looked up by name. Frames of
+ * finished calls go back to a pool unless a function value was created in
+ * them, a closure may still use those, they are freed with the interpreter.
+ * Arrays, structs and strings built at runtime belong to interp->heap.
+ *
+ * Everything a run needs is reachable from the interpreter, so a run that
+ * raised under nojs_protect leaves nothing behind: frames of calls it was
+ * in are still on interp->active and are released by the next run or
+ * free_interp, the VMs' stacks are allocated once and reused.
+ */
+
+#define INTERP_MAX_CALL_DEPTH 4000 // C stack of an 8 MB thread holds about 7000
+#define INTERP_POOLED_SLOTS 16 // frames up to this size are recycled
+
+typedef struct interp_t {
+    arena_t *arena;           // of the tree, lazy bodies are parsed into it
+    heap_t *heap;
+    environment_t *natives;
+    environment_t *globals;
+    value_t result;           // of the last return
+    size_t call_depth;
+
+    environment_t **captured; // frames kept alive for closures
+    size_t captured_count;
+    size_t captured_capacity;
+
+    // Frames taken and not released yet, innermost last
+    environment_t **active;
+    size_t active_count;
+    size_t active_capacity;
+
+    // Free frames by slot count, chained through parent
+    environment_t *pool[INTERP_POOLED_SLOTS + 1];
+
+    // Stacks of the bytecode and register VMs, NULL until their first run
+    value_t *vm_stack;
+    struct vm_call_t *vm_calls;
+    struct rg_call_t *rg_calls;
+    value_t *rg_arguments; // for natives, rg_arguments_capacity values
+    size_t rg_arguments_capacity;
+} interp_t;
+
+// Defines the print, take and struct natives
+interp_t *new_interp(arena_t *arena);
+void free_interp(interp_t *interp);
+void interp_define_native(interp_t *interp, const char *name, native_function_ptr function);
+
+// Resolves program and runs it in a fresh global frame. Returns the value
+// of a top-level return, null otherwise. Values are never copied out of a
+// run: a string, also inside an array or struct, points into the source,
+// the tree's arena or the heap of interp, so the result is only good while
+// all three live. A host that keeps it longer copies it first, for example
+// with value_to_string.
+value_t interp_run(interp_t *interp, ast_node *program);
+
+// For other engines running on the same heap and natives: a frame of
+// slot_count null slots, and its release once the call is over, to the
+// pool or kept for closures when captured. Frames are released in the
+// reverse order they were taken.
+environment_t *interp_take_frame(interp_t *interp, environment_t *parent, uint32_t slot_count);
+// Same, but a recycled frame only has its first cleared slots reset, the
+// others hold stale values the caller overwrites before reading them
+environment_t *interp_take_frame_cleared(interp_t *interp, environment_t *parent, uint32_t slot_count,
+                                         uint32_t cleared);
+void interp_release_frame(interp_t *interp, environment_t *frame);
+
+// Replaces interp->globals with a fresh frame for a new run, after
+// releasing frames an earlier run that raised left active
+environment_t *interp_reset_globals(interp_t *interp, uint32_t slot_count);
+
+#endif
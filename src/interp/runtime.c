@@ -0,0 +1,173 @@
+#include "runtime.h"
+#include "../ast/ast_printer.h"
+#include "../utils/logger.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const atom_t *length_atom;
+
+const char *value_type_name(value_type type) {
+    switch (type) {
+    case VAL_NUMBER: return "number";
+    case VAL_STRING: return "string";
+    case VAL_BOOLEAN: return "boolean";
+    case VAL_NULL: return "null";
+    case VAL_ARRAY: return "array";
+    case VAL_STRUCT: return "struct";
+    case VAL_FUNCTION: return "function";
+    case VAL_NATIVE_FUNCTION: return "native function";
+    }
+    return "unknown";
+}
+
+bool value_truthy(value_t value) {
+    switch (value_type_of(value)) {
+    case VAL_BOOLEAN: return value_as_boolean(value);
+    case VAL_NULL: return false;
+    case VAL_NUMBER: return value_as_number(value) != 0 && !isnan(value_as_number(value));
+    case VAL_STRING: return value_as_string(value).length != 0;
+    default: return true;
+    }
+}
+
+// Booleans, null, arrays and structs are equal when their words are, a
+// closure object is made each time a declaration runs
+bool values_equal(value_t a, value_t b) {
+    value_type type = value_type_of(a);
+    if (type != value_type_of(b))
+        return false;
+
+    switch (type) {
+    case VAL_NUMBER: return value_as_number(a) == value_as_number(b);
+    case VAL_STRING: return sv_eq(value_as_string(a), value_as_string(b));
+    case VAL_FUNCTION: {
+        const function_object_t *left = value_as_function(a), *right = value_as_function(b);
+        return left->declaration == right->declaration && left->code == right->code
+            && left->env == right->env;
+    }
+    case VAL_NATIVE_FUNCTION: return value_as_native(a)->function == value_as_native(b)->function;
+    default: return a.bits == b.bits;
+    }
+}
+
+static int compare_strings(str_view_t a, str_view_t b) {
+    size_t length = a.length < b.length ? a.length : b.length;
+    int order = memcmp(a.data, b.data, length);
+    if (order)
+        return order;
+    return (a.length > b.length) - (a.length < b.length);
+}
+
+str_view_t value_text(value_t value, char **allocated) {
+    *allocated = NULL;
+    if (value_type_of(value) == VAL_STRING)
+        return value_as_string(value);
+    *allocated = value_to_string(value);
+    return sv_from_cstr(*allocated);
+}
+
+static value_t concat(heap_t *heap, value_t left, value_t right) {
+    char *left_allocated, *right_allocated;
+    str_view_t a = value_text(left, &left_allocated);
+    str_view_t b = value_text(right, &right_allocated);
+
+    char *buffer = (char *)malloc(a.length + b.length);
+    if (!buffer && a.length + b.length)
+        elog("Error allocating memory for string concatenation");
+    memcpy(buffer, a.data, a.length);
+    memcpy(buffer + a.length, b.data, b.length);
+    value_t result = create_string_value(heap_string(heap, buffer, a.length + b.length));
+
+    free(buffer);
+    free(left_allocated);
+    free(right_allocated);
+    return result;
+}
+
+value_t value_binary_op(heap_t *heap, binary_op_type op, value_t left, value_t right) {
+    if (value_is_number(left) && value_is_number(right)) {
+        double a = value_as_number(left), b = value_as_number(right);
+        switch (op) {
+        case OP_ADD: return create_number_value(a + b);
+        case OP_SUBTRACT: return create_number_value(a - b);
+        case OP_MULTIPLY: return create_number_value(a * b);
+        case OP_DIVIDE: return create_number_value(a / b);
+        case OP_GREATER: return create_boolean_value(a > b);
+        case OP_LESS: return create_boolean_value(a < b);
+        case OP_GREATER_EQUAL: return create_boolean_value(a >= b);
+        case OP_LESS_EQUAL: return create_boolean_value(a <= b);
+        default: break;
+        }
+    }
+
+    switch (op) {
+    case OP_ADD:
+        if (value_type_of(left) == VAL_STRING || value_type_of(right) == VAL_STRING)
+            return concat(heap, left, right);
+        break;
+    case OP_EQUALS:
+        return create_boolean_value(values_equal(left, right));
+    case OP_NOT_EQUALS:
+        return create_boolean_value(!values_equal(left, right));
+    case OP_GREATER:
+    case OP_LESS:
+    case OP_GREATER_EQUAL:
+    case OP_LESS_EQUAL: {
+        if (value_type_of(left) != VAL_STRING || value_type_of(right) != VAL_STRING)
+            break;
+        int order = compare_strings(value_as_string(left), value_as_string(right));
+        bool result = op == OP_GREATER ? order > 0
+                    : op == OP_LESS ? order < 0
+                    : op == OP_GREATER_EQUAL ? order >= 0
+                    : order <= 0;
+        return create_boolean_value(result);
+    }
+    case OP_AND:
+        return create_boolean_value(value_truthy(left) && value_truthy(right));
+    case OP_OR:
+        return create_boolean_value(value_truthy(left) || value_truthy(right));
+    default:
+        break;
+    }
+
+    elog("Operator '%s' can't take %s and %s", binary_op_to_string(op),
+         value_type_name(value_type_of(left)), value_type_name(value_type_of(right)));
+}
+
+static value_t *array_element(value_t array, value_t index) {
+    if (value_type_of(array) != VAL_ARRAY)
+        elog("Can't index a %s", value_type_name(value_type_of(array)));
+    double at = value_as_number(index);
+    if (!value_is_number(index) || at != floor(at))
+        elog("Array index must be a whole number, got %s", value_type_name(value_type_of(index)));
+    array_object_t *object = value_as_array(array);
+    if (at < 0 || at >= (double)object->count)
+        elog("Array index %.0f out of bounds, length %zu", at, object->count);
+    return &object->elements[(size_t)at];
+}
+
+value_t value_index(value_t array, value_t index) {
+    return *array_element(array, index);
+}
+
+void value_set_index(value_t array, value_t index, value_t value) {
+    *array_element(array, index) = value;
+}
+
+value_t value_property(value_t object, const atom_t *name) {
+    value_type type = value_type_of(object);
+    if (type == VAL_STRUCT)
+        return get_struct_field(object, name);
+
+    if (!length_atom)
+        length_atom = atom_from_cstr("length");
+    if (name == length_atom) {
+        if (type == VAL_ARRAY)
+            return create_number_value((double)value_as_array(object)->count);
+        if (type == VAL_STRING)
+            return create_number_value((double)value_as_string(object).length);
+    }
+    elog("A %s has no property '%s'", value_type_name(type), name->text);
+}
@@ -0,0 +1,40 @@
+#ifndef RUNTIME_H
+#define RUNTIME_H
+
+#include <stdbool.h>
+#include "../ast/ast.h"
+#include "../envr/envr.h"
+#include "../utils/str_view.h"
+
+/*
+ * Semantics of values shared by every execution engine, so the tree walker
+ * and the compiled forms agree on them. Engines keep their own fast paths
+ * for numbers and call in here for everything else.
+ *   - false, null, 0, NaN and "" are falsy
+ *   - == compares values of the same type, strings by content, arrays,
+ *     structs and functions by identity; different types are unequal
+ *   - + concatenates when either side is a string, < > <= >= also order
+ *     strings, other operators take only numbers
+ * Failures raise through elog.
+ */
+
+const char *value_type_name(value_type type);
+bool value_truthy(value_t value);
+bool values_equal(value_t a, value_t b);
+
+// Any binary operator, && and || on both operands already evaluated.
+// Runtime strings are allocated in heap.
+value_t value_binary_op(heap_t *heap, binary_op_type op, value_t left, value_t right);
+
+// Bounds-checked, the index must be a whole number
+value_t value_index(value_t array, value_t index);
+void value_set_index(value_t array, value_t index, value_t value);
+
+// Struct fields, length of arrays and strings
+value_t value_property(value_t object, const atom_t *name);
+
+// Strings as they are, everything else as value_to_string prints it, in
+// which case *allocated is to be freed
+str_view_t value_text(value_t value, char **allocated);
+
+#endif
@@ -3,14 +3,273 @@
 #include "utils/queue.h"
 
 #include "lexer.h"
+#include "number.h"
+#include "scan.h"
 #include "token.h"
 
-#include <ctype.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
+/*
+ * The lexer is a single table-driven DFA. Every byte of the source is mapped
+ * to a character class, and (state, class) is looked up in the transition
+ * table. States below LS_ACCEPT keep scanning, states from LS_ACCEPT up end
+ * the current token and are described by the accepts table. Whitespace runs,
+ * comments and string bodies are skipped in bulk by the scan.h kernels, and
+ * number literals are scanned and converted in one go by scan_number.
+ */
+
+typedef enum char_class {
+  CC_OTHER,
+  CC_EOF,
+  CC_SPACE,
+  CC_NEWLINE,
+  CC_ALPHA,
+  CC_DIGIT,
+  CC_QUOTE,
+  CC_DOT,
+  CC_PLUS,
+  CC_MINUS,
+  CC_STAR,
+  CC_SLASH,
+  CC_LPARENT,
+  CC_RPARENT,
+  CC_LBRACE,
+  CC_RBRACE,
+  CC_LBRACKET,
+  CC_RBRACKET,
+  CC_SEMICOLON,
+  CC_COLON,
+  CC_COMMA,
+  CC_EQUAL,
+  CC_BANG,
+  CC_LESS,
+  CC_GREATER,
+  CC_AMP,
+  CC_PIPE,
+  CC_COUNT
+} char_class;
+
+typedef enum lex_state {
+  LS_START,
+  LS_IDENT,
+  LS_NUMBER,
+  LS_STRING,
+  LS_SLASH,
+  LS_COMMENT,
+  LS_EQUAL,
+  LS_BANG,
+  LS_LESS,
+  LS_GREATER,
+  LS_AMP,
+  LS_PIPE,
+
+  LS_ACCEPT,
+  LA_END = LS_ACCEPT,
+  LA_IDENT,
+  LA_NUMBER,
+  LA_STRING,
+  LA_PLUS,
+  LA_MINUS,
+  LA_MUL,
+  LA_DIV,
+  LA_LPARENT,
+  LA_RPARENT,
+  LA_LBRACE,
+  LA_RBRACE,
+  LA_LBRACKET,
+  LA_RBRACKET,
+  LA_SEMICOLON,
+  LA_COLON,
+  LA_COMMA,
+  LA_DOT,
+  LA_ASSIGN,
+  LA_EQUALS,
+  LA_NOT,
+  LA_NOT_EQUALS,
+  LA_LESS,
+  LA_LESS_EQUAL,
+  LA_GREATER,
+  LA_GREATER_EQUAL,
+  LA_AND,
+  LA_OR,
+  LE_UNEXPECTED,
+  LE_STRING,
+  LE_NUMBER,
+  LS_COUNT
+} lex_state;
+
+typedef struct lex_accept {
+  ttype type;
+  int8_t adjust; // where the token ends relative to the byte that ended it
+  const char *error;
+} lex_accept;
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Woverride-init"
+
+static const uint8_t char_classes[256] = {
+    [0 ... 255] = CC_OTHER,
+    ['\0'] = CC_EOF,
+    [' '] = CC_SPACE, ['\t'] = CC_SPACE, ['\r'] = CC_SPACE,
+    ['\v'] = CC_SPACE, ['\f'] = CC_SPACE,
+    ['\n'] = CC_NEWLINE,
+    ['a' ... 'z'] = CC_ALPHA, ['A' ... 'Z'] = CC_ALPHA,
+    ['_'] = CC_ALPHA, ['$'] = CC_ALPHA, [0x80 ... 0xFF] = CC_ALPHA,
+    ['0' ... '9'] = CC_DIGIT,
+    ['"'] = CC_QUOTE,
+    ['.'] = CC_DOT,
+    ['+'] = CC_PLUS, ['-'] = CC_MINUS, ['*'] = CC_STAR, ['/'] = CC_SLASH,
+    ['('] = CC_LPARENT, [')'] = CC_RPARENT,
+    ['{'] = CC_LBRACE, ['}'] = CC_RBRACE,
+    ['['] = CC_LBRACKET, [']'] = CC_RBRACKET,
+    [';'] = CC_SEMICOLON, [':'] = CC_COLON, [','] = CC_COMMA,
+    ['='] = CC_EQUAL, ['!'] = CC_BANG, ['<'] = CC_LESS, ['>'] = CC_GREATER,
+    ['&'] = CC_AMP, ['|'] = CC_PIPE,
+};
+
+static const uint8_t transitions[LS_ACCEPT][CC_COUNT] = {
+    [LS_START] = {
+        [0 ... CC_COUNT - 1] = LE_UNEXPECTED,
+        [CC_EOF] = LA_END,
+        [CC_SPACE] = LS_START, [CC_NEWLINE] = LS_START,
+        [CC_ALPHA] = LS_IDENT, [CC_DIGIT] = LS_NUMBER, [CC_QUOTE] = LS_STRING,
+        [CC_DOT] = LA_DOT,
+        [CC_PLUS] = LA_PLUS, [CC_MINUS] = LA_MINUS, [CC_STAR] = LA_MUL,
+        [CC_SLASH] = LS_SLASH,
+        [CC_LPARENT] = LA_LPARENT, [CC_RPARENT] = LA_RPARENT,
+        [CC_LBRACE] = LA_LBRACE, [CC_RBRACE] = LA_RBRACE,
+        [CC_LBRACKET] = LA_LBRACKET, [CC_RBRACKET] = LA_RBRACKET,
+        [CC_SEMICOLON] = LA_SEMICOLON, [CC_COLON] = LA_COLON,
+        [CC_COMMA] = LA_COMMA,
+        [CC_EQUAL] = LS_EQUAL, [CC_BANG] = LS_BANG,
+        [CC_LESS] = LS_LESS, [CC_GREATER] = LS_GREATER,
+        [CC_AMP] = LS_AMP, [CC_PIPE] = LS_PIPE,
+    },
+    [LS_IDENT] = {
+        [0 ... CC_COUNT - 1] = LA_IDENT,
+        [CC_ALPHA] = LS_IDENT, [CC_DIGIT] = LS_IDENT,
+    },
+    [LS_NUMBER] = {
+        // Never looked up, get_next_token hands the literal to scan_number
+        [0 ... CC_COUNT - 1] = LE_NUMBER,
+    },
+    [LS_STRING] = {
+        [0 ... CC_COUNT - 1] = LS_STRING,
+        [CC_QUOTE] = LA_STRING, [CC_EOF] = LE_STRING,
+    },
+    [LS_SLASH] = {
+        [0 ... CC_COUNT - 1] = LA_DIV,
+        [CC_SLASH] = LS_COMMENT,
+    },
+    [LS_COMMENT] = {
+        [0 ... CC_COUNT - 1] = LS_COMMENT,
+        [CC_NEWLINE] = LS_START, [CC_EOF] = LA_END,
+    },
+    [LS_EQUAL] = {
+        [0 ... CC_COUNT - 1] = LA_ASSIGN,
+        [CC_EQUAL] = LA_EQUALS,
+    },
+    [LS_BANG] = {
+        [0 ... CC_COUNT - 1] = LA_NOT,
+        [CC_EQUAL] = LA_NOT_EQUALS,
+    },
+    [LS_LESS] = {
+        [0 ... CC_COUNT - 1] = LA_LESS,
+        [CC_EQUAL] = LA_LESS_EQUAL,
+    },
+    [LS_GREATER] = {
+        [0 ... CC_COUNT - 1] = LA_GREATER,
+        [CC_EQUAL] = LA_GREATER_EQUAL,
+    },
+    [LS_AMP] = {
+        [0 ... CC_COUNT - 1] = LE_UNEXPECTED,
+        [CC_AMP] = LA_AND,
+    },
+    [LS_PIPE] = {
+        [0 ... CC_COUNT - 1] = LE_UNEXPECTED,
+        [CC_PIPE] = LA_OR,
+    },
+};
+
+#pragma GCC diagnostic pop
+
+static const lex_accept accepts[LS_COUNT - LS_ACCEPT] = {
+    [LA_END - LS_ACCEPT] = {END, 0, NULL},
+    [LA_IDENT - LS_ACCEPT] = {IDENTIFIER, 0, NULL},
+    [LA_NUMBER - LS_ACCEPT] = {NUMBER, 0, NULL},
+    [LA_STRING - LS_ACCEPT] = {STRING, 1, NULL},
+    [LA_PLUS - LS_ACCEPT] = {PLUS, 1, NULL},
+    [LA_MINUS - LS_ACCEPT] = {MINUS, 1, NULL},
+    [LA_MUL - LS_ACCEPT] = {MUL, 1, NULL},
+    [LA_DIV - LS_ACCEPT] = {DIV, 0, NULL},
+    [LA_LPARENT - LS_ACCEPT] = {LPARENT, 1, NULL},
+    [LA_RPARENT - LS_ACCEPT] = {RPARENT, 1, NULL},
+    [LA_LBRACE - LS_ACCEPT] = {LBRACE, 1, NULL},
+    [LA_RBRACE - LS_ACCEPT] = {RBRACE, 1, NULL},
+    [LA_LBRACKET - LS_ACCEPT] = {LBRACKET, 1, NULL},
+    [LA_RBRACKET - LS_ACCEPT] = {RBRACKET, 1, NULL},
+    [LA_SEMICOLON - LS_ACCEPT] = {SEMICOLON, 1, NULL},
+    [LA_COLON - LS_ACCEPT] = {COLON, 1, NULL},
+    [LA_COMMA - LS_ACCEPT] = {COMMA, 1, NULL},
+    [LA_DOT - LS_ACCEPT] = {DOT, 1, NULL},
+    [LA_ASSIGN - LS_ACCEPT] = {ASSIGN, 0, NULL},
+    [LA_EQUALS - LS_ACCEPT] = {EQUALS, 1, NULL},
+    [LA_NOT - LS_ACCEPT] = {NOT, 0, NULL},
+    [LA_NOT_EQUALS - LS_ACCEPT] = {NOT_EQUALS, 1, NULL},
+    [LA_LESS - LS_ACCEPT] = {LESS, 0, NULL},
+    [LA_LESS_EQUAL - LS_ACCEPT] = {LESS_EQUAL, 1, NULL},
+    [LA_GREATER - LS_ACCEPT] = {GREATER, 0, NULL},
+    [LA_GREATER_EQUAL - LS_ACCEPT] = {GREATER_EQUAL, 1, NULL},
+    [LA_AND - LS_ACCEPT] = {AND, 1, NULL},
+    [LA_OR - LS_ACCEPT] = {OR, 1, NULL},
+    [LE_UNEXPECTED - LS_ACCEPT] = {END, 1, "unexpected character"},
+    [LE_STRING - LS_ACCEPT] = {END, 0, "unterminated string literal"},
+    [LE_NUMBER - LS_ACCEPT] = {END, 1, "invalid number literal"},
+};
+
+/*
+ * Keywords are recognised with a perfect hash over the first two bytes and
+ * the length. The slot macro is a constant expression, so the table below is
+ * filled by it at compile time and a collision between two keywords shows up
+ * as an -Woverride-init warning. A lookup is one hash and at most one memcmp.
+ */
+
+#define KEYWORD_SLOTS 32
+#define KEYWORD_MIN_LENGTH 2
+#define KEYWORD_MAX_LENGTH 8
+#define KEYWORD_SLOT(c0, c1, length)                                         \
+  ((((unsigned)(unsigned char)(c0)) * 4 + ((unsigned)(unsigned char)(c1)) * 7 + \
+    (unsigned)(length)) & (KEYWORD_SLOTS - 1))
+#define KEYWORD(c0, c1, word, ttype)                                         \
+  [KEYWORD_SLOT(c0, c1, sizeof(word) - 1)] = {word, sizeof(word) - 1, ttype}
+
+typedef struct keyword_t {
+  const char *text;
+  size_t length;
+  ttype type;
+} keyword_t;
+
+static const keyword_t keywords[KEYWORD_SLOTS] = {
+    KEYWORD('i', 'f', "if", IF),
+    KEYWORD('e', 'l', "else", ELSE),
+    KEYWORD('l', 'o', "loop", LOOP),
+    KEYWORD('n', 'e', "next", NEXT),
+    KEYWORD('s', 't', "stop", STOP),
+    KEYWORD('f', 'u', "function", FUNCTION),
+    KEYWORD('r', 'e', "return", RETURN),
+    KEYWORD('p', 'r', "print", PRINT),
+    KEYWORD('t', 'a', "take", TAKE),
+    KEYWORD('l', 'e', "let", LET),
+    KEYWORD('c', 'o', "const", CONST),
+    KEYWORD('t', 'r', "true", BOOLEAN),
+    KEYWORD('f', 'a', "false", BOOLEAN),
+    KEYWORD('n', 'u', "null", NULL_VAL),
+};
+
 lexer_t *new_lexer(const char *source) {
   if (!source)
     elog("Can't create lexer_t struct with NULL ptr on source code");
@@ -21,10 +280,14 @@ lexer_t *new_lexer(const char *source) {
   if (!lexer)
     elog("Error allocation memory for lexer_t struct");
 
-  lexer->tokens = new_arr(1);
-  lexer->line = 1;
-  lexer->column = 0;
+  scan_init();
+
+  lexer->tokens = NULL;
+  lexer->lines = NULL;
+  lexer->window = NULL;
+  lexer->window_base = 0;
   lexer->position = 0;
+  lexer->token_start = 0;
   lexer->length = strlen(source);
   lexer->source = source;
 
@@ -35,8 +298,14 @@ void free_lexer(lexer_t *lexer) {
   if (!lexer)
     return;
 
-  if (lexer->tokens)
-    free_arr(lexer->tokens);
+  free_token_store(lexer->tokens);
+  free_line_index(lexer->lines);
+
+  if (lexer->window) {
+    while (!is_queue_empty(lexer->window))
+      free(dequeue(lexer->window));
+    free_queue(lexer->window);
+  }
 
   // free(lexer->source);
   free(lexer);
@@ -62,285 +331,165 @@ char lexer_advance(lexer_t *lexer) {
   return lexer->source[lexer->position - 1];
 }
 
-token_t *get_previouse_token(lexer_t *lexer) {
-  if (lexer->tokens->count == 0)
-    return NULL;
-  return (token_t *)arr_get(lexer->tokens, lexer->tokens->count - 1);
-}
+// Returns the keyword type of the word, or IDENTIFIER when it isn't one
+ttype check_keyword(const char *word, size_t length) {
+  if (length < KEYWORD_MIN_LENGTH || length > KEYWORD_MAX_LENGTH)
+    return IDENTIFIER;
 
-bool is_keyword(const char *word_one, const char *word_two) {
-  return strcmp(word_one, word_two) == 0;
-}
+  const keyword_t *keyword = &keywords[KEYWORD_SLOT(word[0], word[1], length)];
+  if (keyword->length != length || memcmp(keyword->text, word, length) != 0)
+    return IDENTIFIER;
 
-void skip_whitespace(lexer_t *lexer) {
-  char c;
-  while (isspace(c = lexer_peak(lexer))) {
-    if (c == ' ') {
-      lexer->column++;
-    } else {
-      lexer->line++;
-      lexer->column = 0;
-    }
-
-    lexer_advance(lexer);
-  }
-}
-
-bool is_system(char c) {
-  return c == '.' || c == '-' || c == '+' || c == '/' || c == '*' || c == ')' ||
-         c == '(' || c == '{' || c == '}' || c == '[' || c == ']' || c == ';' ||
-         c == ':' || c == ',' || c == '=' || c == '>' || c == '<' || c == '!' ||
-         c == '&' || c == '|';
+  return keyword->type;
 }
 
-token_t *check_keyword(lexer_t *lexer, const char *word) {
-  if (is_keyword(word, "*"))
-    return new_token(lexer, MUL);
-  if (is_keyword(word, "/"))
-    return new_token(lexer, DIV);
-  if (is_keyword(word, "+"))
-    return new_token(lexer, PLUS);
-  if (is_keyword(word, "-"))
-    return new_token(lexer, MINUS);
-
-  if (is_keyword(word, "("))
-    return new_token(lexer, LPARENT);
-  if (is_keyword(word, ")"))
-    return new_token(lexer, RPARENT);
-  if (is_keyword(word, "{"))
-    return new_token(lexer, LBRACE);
-  if (is_keyword(word, "}"))
-    return new_token(lexer, RBRACE);
-  if (is_keyword(word, "["))
-    return new_token(lexer, LBRACKET);
-  if (is_keyword(word, "]"))
-    return new_token(lexer, RBRACKET);
-
-  if (is_keyword(word, "=="))
-    return new_token(lexer, EQUALS);
-  if (is_keyword(word, "!="))
-    return new_token(lexer, NOT_EQUALS);
-  if (is_keyword(word, ">"))
-    return new_token(lexer, GREATER);
-  if (is_keyword(word, "<"))
-    return new_token(lexer, LESS);
-  if (is_keyword(word, ">="))
-    return new_token(lexer, GREATER_EQUAL);
-  if (is_keyword(word, "<="))
-    return new_token(lexer, LESS_EQUAL);
-
-  if (is_keyword(word, "&&"))
-    return new_token(lexer, AND);
-  if (is_keyword(word, "||"))
-    return new_token(lexer, OR);
-  if (is_keyword(word, "!"))
-    return new_token(lexer, NOT);
-
-  if (is_keyword(word, "="))
-    return new_token(lexer, ASSIGN);
-
-  if (is_keyword(word, "if"))
-    return new_token(lexer, IF);
-  if (is_keyword(word, "else"))
-    return new_token(lexer, ELSE);
-  if (is_keyword(word, "loop"))
-    return new_token(lexer, LOOP);
-  if (is_keyword(word, "next"))
-    return new_token(lexer, NEXT);
-  if (is_keyword(word, "stop"))
-    return new_token(lexer, STOP);
-
-  if (is_keyword(word, "function"))
-    return new_token(lexer, FUNCTION);
-  if (is_keyword(word, "return"))
-    return new_token(lexer, RETURN);
-
-  if (is_keyword(word, "print"))
-    return new_token(lexer, PRINT);
-  if (is_keyword(word, "take"))
-    return new_token(lexer, TAKE);
-
-  if (is_keyword(word, "let"))
-    return new_token(lexer, LET);
-  if (is_keyword(word, "const"))
-    return new_token(lexer, CONST);
-
-  if (is_keyword(word, "true"))
-    return new_boolean_token(lexer, BOOLEAN, true);
-  if (is_keyword(word, "false"))
-    return new_boolean_token(lexer, BOOLEAN, false);
-  if (is_keyword(word, "null"))
-    return new_token(lexer, NULL_VAL);
-
-  if (is_keyword(word, ";"))
-    return new_token(lexer, SEMICOLON);
-  if (is_keyword(word, ":"))
-    return new_token(lexer, COLON);
-  if (is_keyword(word, ","))
-    return new_token(lexer, COMMA);
-  if (is_keyword(word, "."))
-    return new_token(lexer, DOT);
-
-  return NULL;
+source_location_t lexer_location(lexer_t *lexer, size_t offset) {
+  if (!lexer->lines)
+    lexer->lines = new_line_index(lexer->source, lexer->length);
+  return line_index_lookup(lexer->lines, offset);
 }
 
-void skip_comment(lexer_t *lexer) {
-  if (lexer_peak(lexer) != '/' || lexer_peak_next(lexer) != '/')
-    return;
-  char c;
-  while ((c = lexer_peak(lexer)) != '\n' && !lexer_is_end(lexer)) {
-    lexer_advance(lexer);
-  }
-
-  lexer_advance(lexer);
-}
+token_t get_next_token(lexer_t *lexer) {
+  const unsigned char *source = (const unsigned char *)lexer->source;
+  size_t position = lexer->position;
+  size_t start = position;
+  uint8_t state = LS_START;
+  number_literal_t number = {0};
 
-char *take_word(lexer_t *lexer) {
-  char c = lexer_peak(lexer);
+  while (state < LS_ACCEPT) {
+    uint8_t class = char_classes[source[position]];
+    state = transitions[state][class];
+    position++;
 
-  if (is_system(c)) {
-    size_t len = 1;
-    char n;
-    if ((n = lexer_peak_next(lexer)) == '=' || n == '&' || n == '|') {
-      len++;
-    }
-    char *result = (char *)malloc(sizeof(char) * (len + 1));
-    if (!result)
-      elog("Error allocation memory for taking word in lexer");
-    strncpy(result, &lexer->source[lexer->position] , len);
-    lexer->position += len;
-    result[len] = '\0';
-    return result;
-  }
+    if (state >= LS_ACCEPT)
+      break;
 
-  size_t len = 0;
-  size_t base_pos = lexer->position;
-  if(lexer_peak(lexer) == '"'){
-    lexer_advance(lexer);
-    len++;
-    while(1){
-        if(lexer_peak(lexer) == '\0')
-            elog("Error parsing string , search where =))");
-            
-        if(lexer_peak(lexer) == '"'){
-            lexer_advance(lexer);
-            len++; 
-            break;
-        }
-        
-        len++;
-        lexer_advance(lexer);
+    switch (state) {
+    case LS_START: {
+      // Single separators are the common case, only runs go to the kernel
+      uint8_t next = char_classes[source[position]];
+      if (next == CC_SPACE || next == CC_NEWLINE)
+        position = scan_whitespace(lexer->source, position);
+      start = position;
+      break;
     }
-    
-    char *result = (char*)malloc(sizeof(char) * (len + 1));
-    if(!result) elog("Error allocation memory for word");
-    
-    strncpy(result, &lexer->source[base_pos], len);
-    result[len] = '\0';
-    
-    return result;
-}
-
-  while (1) {
-    c = lexer_peak(lexer);
-    if (c == '\n' || c == ' ' || c == '\0')
+    case LS_COMMENT:
+      position = scan_comment(lexer->source, position);
+      break;
+    case LS_STRING:
+      position = scan_string(lexer->source, position);
+      break;
+    case LS_NUMBER:
+      number = scan_number(lexer->source, position - 1);
+      // Accepts end the token one byte before position, see adjust
+      position = number.end + 1;
+      state = number.valid ? LA_NUMBER : LE_NUMBER;
+      break;
+    default:
       break;
-
-    if (is_system(c)) {
-      if (c == '.' && isdigit(lexer_peak_next(lexer))) {
-        len++;
-        lexer_advance(lexer);
-      } else {
-        break;
-      }
-    } else {
-      len++;
-      lexer_advance(lexer);
     }
   }
 
-  char *result = (char *)malloc(sizeof(char) * (len + 1));
-  if (!result)
-    elog("Error allocation memory for taking word");
-  strncpy(result, &lexer->source[base_pos], len);
-  result[len] = '\0';
+  const lex_accept *accept = &accepts[state - LS_ACCEPT];
+  position = position - 1 + accept->adjust;
+  if (start > UINT32_MAX || position > UINT32_MAX)
+    elog("Source is too big, token offsets don't fit in 32 bits");
 
-  return result;
-}
+  lexer->position = position;
+  lexer->token_start = start;
 
-bool is_number(char *word) {
-  while (*word) {
-    if (!isdigit(*word)) {
-      if (*word != '.' && !isdigit(*(word + 1)))
-        return false;
-    }
-
-    word++;
+  if (accept->error) {
+    source_location_t location = lexer_location(lexer, start);
+    nojs_raise(__FILE__, __LINE__, NOJS_ERROR_SYNTAX, location.line, location.column, "%s", accept->error);
   }
-  return true;
-}
 
-bool is_string(char *word) {
-  if (*word != '"')
-    return false;
-  word++;
-  while (*word) {
-    if (*word == '"') {
-      word++;
-      if (*word)
-        elog("Lexer : invalid string formating where =)");
-      return true;
-    }
-    word++;
- }
-  return false;
+  const char *text = lexer->source + start;
+  size_t length = position - start;
+
+  switch (accept->type) {
+  case IDENTIFIER: {
+    ttype type = check_keyword(text, length);
+    if (type == BOOLEAN)
+      return new_boolean_token(lexer, BOOLEAN, text[0] == 't');
+    if (type != IDENTIFIER)
+      return new_token(lexer, type);
+    return new_atom_token(lexer, IDENTIFIER, atom_intern(text, length));
+  }
+  case NUMBER:
+    return new_number_token(lexer, NUMBER, number.value, number.integral);
+  case STRING:
+    return new_slice_token(lexer, STRING, 1, length - 2);
+  default:
+    return new_token(lexer, accept->type);
+  }
 }
 
-token_t *get_next_token(lexer_t *lexer) {
-  if(lexer_is_end(lexer))
-      elog("Error , try tokenize after ending");
-
-  skip_whitespace(lexer);
-  skip_comment(lexer);
+lexer_t *tokenize(const char *code) {
+  if (!code)
+    elog("Can't tokenize code, NULL ptr on it");
+  if (!*code)
+    elog("Can't tokenize code, have empty string");
 
-  char *word = take_word(lexer);
-  //dlog("Parse word : %s" , word);
-  skip_whitespace(lexer);
+  lexer_t *lexer = new_lexer(code);
+  tokenize_into(lexer);
+  return lexer;
+}
 
-  if(is_string(word)){
-     return new_string_token(lexer , STRING , word);
-  }
+void tokenize_into(lexer_t *lexer) {
+  // Roughly one token per 5 bytes of typical source
+  lexer->tokens = new_token_store(lexer->length / 5);
 
-  if (is_number(word)) {
-    double value = atof(word);
-    free(word);
-    return new_number_token(lexer, NUMBER, value);
+  while (1) {
+    token_t token = get_next_token(lexer);
+    token_store_push(lexer->tokens, token);
+    if (token.type == END)
+      break;
   }
+}
 
-  token_t *token = check_keyword(lexer, word);
+/*
+ * Streaming mode never materializes the token array. The parser pulls
+ * tokens through lexer_token_at/lexer_type_at, which lex ahead on demand
+ * into a ring of TOKEN_WINDOW_SIZE slots. Once the ring is full the oldest
+ * token is dropped and its slot reused, so token memory stays constant no
+ * matter how large the source is. The window only has to cover the parser's
+ * lookbehind and lookahead.
+ */
 
-  if (token)
-    return token;
-  
-  token = new_string_token(lexer , IDENTIFIER , word);
-  free(word);
-  return token;
-}
+#define TOKEN_WINDOW_SIZE 8
 
-lexer_t *tokenize(const char *code) {
+lexer_t *tokenize_stream(const char *code) {
   if (!code)
     elog("Can't tokenize code, NULL ptr on it");
   if (!*code)
     elog("Can't tokenize code, have empty string");
 
   lexer_t *lexer = new_lexer(code);
+  lexer->window = new_queue(TOKEN_WINDOW_SIZE);
+  return lexer;
+}
 
-  while (!lexer_is_end(lexer)) {
-    token_t *token = get_next_token(lexer);
-    arr_push(lexer->tokens, token);
-  }
+token_t lexer_window_token(lexer_t *lexer, size_t index) {
+  queue_t *window = lexer->window;
 
-  arr_push(lexer->tokens, new_token(lexer, END));
+  if (index < lexer->window_base)
+    elog("Token %zu already left the streaming window (oldest kept is %zu)",
+         index, lexer->window_base);
 
-  return lexer;
+  while (index >= lexer->window_base + queue_size(window)) {
+    token_t *slot;
+    if (queue_size(window) == TOKEN_WINDOW_SIZE) {
+      slot = (token_t *)dequeue(window);
+      lexer->window_base++;
+    } else {
+      slot = (token_t *)malloc(sizeof(token_t));
+      if (!slot)
+        elog("Error allocation memory for token window slot");
+    }
+
+    *slot = get_next_token(lexer);
+    enqueue(window, slot);
+  }
+
+  return *(token_t *)queue_at(window, index - lexer->window_base);
 }
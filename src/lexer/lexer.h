@@ -6,16 +6,23 @@
 #include "utils/arr.h"
 #include "utils/queue.h"
 #include "token.h"
+#include "token_store.h"
+#include "line_index.h"
 
 typedef struct token_t token_t;
+typedef struct token_store_t token_store_t;
 
 typedef struct lexer_t {
     const char *source;
     size_t length;
     size_t position;
-    size_t line;
-    size_t column;
-    arr_t *tokens;
+    size_t token_start; // offset of the last produced token
+    token_store_t *tokens; // all tokens, NULL in streaming mode
+    line_index_t *lines; // built on the first lexer_location call
+
+    // Streaming mode: the last few tokens, pulled on demand
+    queue_t *window;      // of token_t*, oldest first
+    size_t window_base;   // index of the token at the front of window
 } lexer_t;
 
 lexer_t *new_lexer(const char *source);
@@ -26,15 +33,52 @@ char lexer_peak(lexer_t *lexer);
 char lexer_peak_next(lexer_t *lexer);
 char lexer_advance(lexer_t *lexer);
 
-token_t *get_next_token(lexer_t *lexer);
-token_t *get_previouse_token(lexer_t *lexer);
-
-bool is_keyword(const char *word_one , const char *word_two);
-void skip_whitespace(lexer_t *lexer);
-double parse_number(lexer_t *lexer);
-bool is_ssytem(char c);
-token_t *check_keyword(lexer_t *lexer , const char *word);
+token_t get_next_token(lexer_t *lexer);
+source_location_t lexer_location(lexer_t *lexer, size_t offset);
+ttype check_keyword(const char *word , size_t length);
 
 lexer_t *tokenize(const char *code);
+// tokenize on a lexer from new_lexer, the caller keeps it if lexing fails
+void tokenize_into(lexer_t *lexer);
+lexer_t *tokenize_stream(const char *code);
+lexer_t *tokenize_parallel(const char *code, size_t threads);
+
+token_t lexer_window_token(lexer_t *lexer, size_t index);
+
+// An edit already applied to the source: at offset, deleted bytes were
+// replaced by inserted bytes
+typedef struct lexer_edit_t {
+    size_t offset;
+    size_t deleted;
+    size_t inserted;
+} lexer_edit_t;
+
+// Tokens [first, old_end) of the previous stream are now [first, new_end)
+typedef struct token_range_t {
+    size_t first;
+    size_t old_end;
+    size_t new_end;
+} token_range_t;
+
+// Re-lexes the tokens an edit may have changed, see relex.c. A lexer error
+// in the new source is raised with the lexer left on the previous source
+// and its tokens, the next edit is then relative to that source.
+token_range_t relex(lexer_t *lexer, const char *source, lexer_edit_t edit);
+
+// Token access that works in both modes. Past the last token it is END.
+static inline ttype lexer_type_at(lexer_t *lexer, size_t index) {
+    if (lexer->tokens)
+        return index < lexer->tokens->count ? token_store_type(lexer->tokens, index) : END;
+    return lexer_window_token(lexer, index).type;
+}
+
+static inline token_t lexer_token_at(lexer_t *lexer, size_t index) {
+    if (lexer->tokens) {
+        if (index >= lexer->tokens->count)
+            index = lexer->tokens->count - 1;
+        return token_store_get(lexer->tokens, index);
+    }
+    return lexer_window_token(lexer, index);
+}
 
 #endif
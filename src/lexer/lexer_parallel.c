@@ -0,0 +1,210 @@
+#include "lexer.h"
+#include "scan.h"
+#include "utils/logger.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <string.h>
+
+/*
+ * Parallel tokenize. The source is cut into one chunk per thread, each
+ * ending right after a newline, and the chunks are lexed independently into
+ * their own token stores which are then appended in order.
+ *
+ * Only a string literal can run across a newline (line comments end at it),
+ * so the one thing a chunk can't know on its own is whether it starts inside
+ * a string. The first pass answers that speculatively: every chunk is scanned
+ * once assuming it starts in code and once assuming it starts in a string,
+ * recording the state it ends in for both. A sequential walk over those
+ * results picks the real entry state of each chunk, and chunks that turn out
+ * to start inside a string are merged into their predecessor.
+ *
+ * Token offsets are absolute because every chunk lexer reads the whole
+ * source, so appending the stores is a plain copy.
+ *
+ * Each chunk runs under nojs_protect on its thread. Once all are joined,
+ * the error of the first failed chunk, the one a sequential run would have
+ * hit, is raised again on the calling thread, so tokenize_parallel is as
+ * safe inside nojs_protect as tokenize.
+ */
+
+#define PARALLEL_MAX_THREADS 64
+// Below this many bytes per thread, spawning threads costs more than it saves
+#define PARALLEL_MIN_CHUNK (64 * 1024)
+
+typedef struct lex_chunk_t {
+    const char *source;
+    size_t length;
+    size_t start;
+    size_t end;
+    bool ends_in_string[2]; // indexed by "starts in string"
+    token_store_t *tokens;
+    lexer_t lexer;          // of the lex pass, its line index locates errors
+    void (*body)(void *chunk);
+    bool failed;
+    nojs_error_t error;
+} lex_chunk_t;
+
+// Whether the chunk [from, to) ends inside a string literal
+static bool chunk_ends_in_string(const char *source, size_t from, size_t to, bool in_string) {
+    size_t position = from;
+    while (position < to) {
+        if (in_string) {
+            position = scan_string(source, position);
+            if (position >= to)
+                return true;
+            position++;
+            in_string = false;
+            continue;
+        }
+
+        char c = source[position];
+        if (c == '"') {
+            in_string = true;
+            position++;
+        } else if (c == '/' && source[position + 1] == '/') {
+            position = scan_comment(source, position + 2);
+        } else {
+            position++;
+        }
+    }
+    return in_string;
+}
+
+static void speculate_chunk(void *arg) {
+    lex_chunk_t *chunk = (lex_chunk_t *)arg;
+    chunk->ends_in_string[0] = chunk_ends_in_string(chunk->source, chunk->start, chunk->end, false);
+    chunk->ends_in_string[1] = chunk_ends_in_string(chunk->source, chunk->start, chunk->end, true);
+}
+
+static void lex_chunk(void *arg) {
+    lex_chunk_t *chunk = (lex_chunk_t *)arg;
+    lexer_t *lexer = &chunk->lexer;
+    lexer->source = chunk->source;
+    lexer->length = chunk->length;
+    lexer->position = chunk->start;
+
+    chunk->tokens = new_token_store((chunk->end - chunk->start) / 5);
+    bool last = chunk->end == chunk->length;
+
+    while (1) {
+        token_t token = get_next_token(lexer);
+        // The first token of the next chunk belongs to that chunk
+        if (!last && token.offset >= chunk->end)
+            break;
+        token_store_push(chunk->tokens, token);
+        if (token.type == END)
+            break;
+    }
+}
+
+static void *run_chunk(void *arg) {
+    lex_chunk_t *chunk = (lex_chunk_t *)arg;
+    chunk->failed = !nojs_protect(chunk->body, chunk, &chunk->error);
+    return NULL;
+}
+
+// Chunks whose thread can't be started run on the calling thread
+static void run_chunks(lex_chunk_t *chunks, size_t count, void (*body)(void *)) {
+    pthread_t threads[PARALLEL_MAX_THREADS];
+    bool started[PARALLEL_MAX_THREADS] = { false };
+
+    for (size_t i = 0; i < count; i++)
+        chunks[i].body = body;
+
+    // The calling thread takes the first chunk itself
+    for (size_t i = 1; i < count; i++)
+        started[i] = pthread_create(&threads[i], NULL, run_chunk, &chunks[i]) == 0;
+
+    run_chunk(&chunks[0]);
+
+    for (size_t i = 1; i < count; i++) {
+        if (started[i])
+            pthread_join(threads[i], NULL);
+        else
+            run_chunk(&chunks[i]);
+    }
+}
+
+static void free_chunks(lex_chunk_t *chunks, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        free_token_store(chunks[i].tokens);
+        free_line_index(chunks[i].lexer.lines);
+    }
+}
+
+// Raises the error of the first failed chunk, after releasing everything
+static void raise_failed_chunk(lexer_t *lexer, lex_chunk_t *chunks, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        if (!chunks[i].failed)
+            continue;
+        nojs_error_t error = chunks[i].error;
+        free_chunks(chunks, count);
+        free_lexer(lexer);
+        nojs_reraise(&error);
+    }
+}
+
+lexer_t *tokenize_parallel(const char *code, size_t threads) {
+    if (!code)
+        elog("Can't tokenize code, NULL ptr on it");
+    if (!*code)
+        elog("Can't tokenize code, have empty string");
+
+    size_t length = strlen(code);
+    if (threads > PARALLEL_MAX_THREADS)
+        threads = PARALLEL_MAX_THREADS;
+    if (threads > length / PARALLEL_MIN_CHUNK)
+        threads = length / PARALLEL_MIN_CHUNK;
+    if (threads <= 1)
+        return tokenize(code);
+
+    lexer_t *lexer = new_lexer(code);
+    lex_chunk_t chunks[PARALLEL_MAX_THREADS];
+    size_t count = 0;
+    size_t start = 0;
+
+    for (size_t i = 1; i <= threads && start < length; i++) {
+        size_t end = length;
+        if (i < threads) {
+            const char *newline = memchr(code + length * i / threads, '\n', length - length * i / threads);
+            end = newline ? (size_t)(newline - code) + 1 : length;
+            if (end <= start)
+                continue;
+        }
+
+        chunks[count++] = (lex_chunk_t){ .source = code, .length = length, .start = start, .end = end };
+        start = end;
+    }
+
+    run_chunks(chunks, count, speculate_chunk);
+    raise_failed_chunk(lexer, chunks, count);
+
+    // Resolve the real entry state of each chunk, folding string continuations back
+    size_t merged = 1;
+    bool in_string = chunks[0].ends_in_string[0];
+    for (size_t i = 1; i < count; i++) {
+        bool next = chunks[i].ends_in_string[in_string];
+        if (in_string)
+            chunks[merged - 1].end = chunks[i].end;
+        else
+            chunks[merged++] = chunks[i];
+        in_string = next;
+    }
+    count = merged;
+
+    run_chunks(chunks, count, lex_chunk);
+    raise_failed_chunk(lexer, chunks, count);
+
+    size_t total = 0;
+    for (size_t i = 0; i < count; i++)
+        total += chunks[i].tokens->count;
+
+    lexer->tokens = new_token_store(total);
+    for (size_t i = 0; i < count; i++)
+        token_store_append(lexer->tokens, chunks[i].tokens);
+    free_chunks(chunks, count);
+
+    lexer->position = length;
+    return lexer;
+}
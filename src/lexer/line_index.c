@@ -0,0 +1,53 @@
+#include "line_index.h"
+#include "scan.h"
+#include "utils/logger.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+line_index_t *new_line_index(const char *source, size_t length) {
+    line_index_t *index = (line_index_t *)malloc(sizeof(line_index_t));
+    if (!index)
+        elog("Error allocation memory for line_index_t struct");
+
+    index->count = scan_count_newlines(source, length) + 1;
+    index->starts = (uint32_t *)malloc(index->count * sizeof(uint32_t));
+    if (!index->starts)
+        elog("Error allocation memory for line index");
+
+    index->starts[0] = 0;
+    size_t line = 1;
+    const char *cursor = source;
+    const char *end = source + length;
+    while ((cursor = memchr(cursor, '\n', end - cursor))) {
+        cursor++;
+        index->starts[line++] = (uint32_t)(cursor - source);
+    }
+
+    return index;
+}
+
+void free_line_index(line_index_t *index) {
+    if (!index)
+        return;
+
+    free(index->starts);
+    free(index);
+}
+
+source_location_t line_index_lookup(line_index_t *index, size_t offset) {
+    size_t low = 0;
+    size_t high = index->count;
+
+    // Last line whose start is <= offset
+    while (high - low > 1) {
+        size_t middle = low + (high - low) / 2;
+        if (index->starts[middle] <= offset)
+            low = middle;
+        else
+            high = middle;
+    }
+
+    source_location_t location = {low + 1, offset - index->starts[low]};
+    return location;
+}
@@ -0,0 +1,26 @@
+#ifndef LINE_INDEX_H
+#define LINE_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Offsets of the first byte of every line of a source. Tokens only carry a
+ * byte offset; the index is built when a diagnostic first needs a line and
+ * column, and each lookup is a binary search.
+ */
+typedef struct line_index_t {
+    uint32_t *starts;
+    size_t count;
+} line_index_t;
+
+typedef struct source_location_t {
+    size_t line;   // 1-based
+    size_t column; // 0-based, in bytes
+} source_location_t;
+
+line_index_t *new_line_index(const char *source, size_t length);
+void free_line_index(line_index_t *index);
+source_location_t line_index_lookup(line_index_t *index, size_t offset);
+
+#endif
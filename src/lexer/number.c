@@ -0,0 +1,187 @@
+#define _GNU_SOURCE // strtod_l
+#include "number.h"
+#include "number_pow10.h"
+
+#include <locale.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Significant digits are accumulated into a 64 bit mantissa while scanning,
+ * the value is then mantissa * 10^exponent, converted in three tiers:
+ *
+ *   - Clinger's fast path: a mantissa of at most 53 bits and an exponent
+ *     within +-22 are both exact doubles, one multiply or divide rounds
+ *     correctly.
+ *   - Eisel-Lemire: the mantissa times a 128 bit truncation of 10^exponent
+ *     (number_pow10.h) gives the 54 leading bits of the product, which
+ *     round correctly unless the truncation error could reach them or the
+ *     value lies exactly halfway; the algorithm detects both and gives up.
+ *     Past 19 significant digits the mantissa is truncated and the value
+ *     lies between mantissa and mantissa + 1, it's settled when both round
+ *     the same way.
+ *   - Otherwise (subnormals, exponents out of the table, the rare ambiguous
+ *     case) strtod_l on the already validated text, in the C locale, so a
+ *     host's setlocale never changes what a literal means.
+ */
+
+#define MANTISSA_MAX_DIGITS 19
+#define EXACT_POW10_MAX 22
+#define EXPONENT_LIMIT 100000
+#define TWO_POW_53 9007199254740992ULL
+
+static const double exact_pow10[EXACT_POW10_MAX + 1] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+static inline bool is_digit(unsigned char c) {
+    return c >= '0' && c <= '9';
+}
+
+// Bytes that continue an identifier, see CC_ALPHA in lexer.c
+static inline bool is_ident_byte(unsigned char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' || c == '$' || c >= 0x80;
+}
+
+static pthread_once_t c_locale_once = PTHREAD_ONCE_INIT;
+static locale_t c_locale;
+
+static void make_c_locale(void) {
+    c_locale = newlocale(LC_ALL_MASK, "C", (locale_t)0);
+}
+
+// Correctly rounded text to double whatever the process locale, for what
+// the fast paths give up on
+static double strtod_c(const char *text) {
+    pthread_once(&c_locale_once, make_c_locale);
+    if (!c_locale)
+        return strtod(text, NULL);
+    return strtod_l(text, NULL, c_locale);
+}
+
+// mantissa * 10^exponent rounded to nearest, false if it can't be decided
+// here. mantissa is not 0.
+static bool eisel_lemire(uint64_t mantissa, long exponent, double *value) {
+    if (exponent < NUMBER_POW10_MIN || exponent > NUMBER_POW10_MAX)
+        return false;
+
+    const uint64_t *pow10 = number_pow10[exponent - NUMBER_POW10_MIN];
+    int shift = __builtin_clzll(mantissa);
+    mantissa <<= shift;
+    // floor(log2(10) * exponent) + 64 + bias, as a fixed point product
+    uint64_t exponent2 = (uint64_t)(((217706 * exponent) >> 16) + 64 + 1023) - (uint64_t)shift;
+
+    unsigned __int128 product = (unsigned __int128)mantissa * pow10[0];
+    uint64_t high = (uint64_t)(product >> 64);
+    uint64_t low = (uint64_t)product;
+
+    // The low half of 10^exponent can carry into the bits that round
+    if ((high & 0x1ff) == 0x1ff && low + mantissa < mantissa) {
+        unsigned __int128 wider = (unsigned __int128)mantissa * pow10[1];
+        uint64_t wider_high = (uint64_t)(wider >> 64);
+        uint64_t wider_low = (uint64_t)wider;
+        uint64_t merged_low = low + wider_high;
+        uint64_t merged_high = high + (merged_low < low);
+        if ((merged_high & 0x1ff) == 0x1ff && merged_low + 1 == 0 && wider_low + mantissa < mantissa)
+            return false;
+        high = merged_high;
+        low = merged_low;
+    }
+
+    // Keep 54 bits, the 54th decides rounding
+    uint64_t top = high >> 63;
+    uint64_t bits = high >> (top + 9);
+    exponent2 -= 1 ^ top;
+
+    // Exactly halfway between two doubles, ties go to even and the
+    // truncated 10^exponent can't tell which side the value is on
+    if (low == 0 && (high & 0x1ff) == 0 && (bits & 3) == 1)
+        return false;
+
+    bits += bits & 1;
+    bits >>= 1;
+    if (bits >> 53) {
+        bits >>= 1;
+        exponent2++;
+    }
+    // Subnormal, infinite or out of range
+    if (exponent2 - 1 >= 0x7ff - 1)
+        return false;
+
+    uint64_t raw = exponent2 << 52 | (bits & 0x000fffffffffffffULL);
+    memcpy(value, &raw, sizeof(*value));
+    return true;
+}
+
+number_literal_t scan_number(const char *source, size_t position) {
+    const unsigned char *p = (const unsigned char *)source + position;
+    const unsigned char *start = p;
+    number_literal_t number = {0};
+
+    uint64_t mantissa = 0;
+    int digits = 0;        // significant digits in mantissa
+    bool truncated = false;
+    long exponent = 0;
+
+    for (; is_digit(*p); p++) {
+        if (digits < MANTISSA_MAX_DIGITS) {
+            mantissa = mantissa * 10 + (*p - '0');
+            digits += mantissa != 0;
+        } else {
+            truncated |= *p != '0';
+            exponent++;
+        }
+    }
+
+    if (*p == '.' && is_digit(p[1])) {
+        for (p++; is_digit(*p); p++) {
+            if (digits < MANTISSA_MAX_DIGITS) {
+                mantissa = mantissa * 10 + (*p - '0');
+                digits += mantissa != 0;
+                exponent--;
+            } else {
+                truncated |= *p != '0';
+            }
+        }
+    }
+
+    if (*p == 'e' || *p == 'E') {
+        const unsigned char *e = p + 1;
+        bool negative = *e == '-';
+        if (*e == '+' || *e == '-')
+            e++;
+        if (!is_digit(*e)) {
+            number.end = (size_t)(e - (const unsigned char *)source);
+            return number;
+        }
+
+        long written = 0;
+        for (; is_digit(*e); e++)
+            if (written < EXPONENT_LIMIT)
+                written = written * 10 + (*e - '0');
+        exponent += negative ? -written : written;
+        p = e;
+    }
+
+    number.end = (size_t)(p - (const unsigned char *)source);
+    if (is_ident_byte(*p) || (*p == '.' && is_digit(p[1])))
+        return number;
+
+    number.valid = true;
+    double above;
+    if (mantissa == 0) {
+        number.value = 0;
+    } else if (!truncated && mantissa <= TWO_POW_53 && exponent >= -EXACT_POW10_MAX && exponent <= EXACT_POW10_MAX) {
+        double value = (double)mantissa;
+        number.value = exponent < 0 ? value / exact_pow10[-exponent] : value * exact_pow10[exponent];
+    } else if (!eisel_lemire(mantissa, exponent, &number.value)
+               || (truncated && (!eisel_lemire(mantissa + 1, exponent, &above) || above != number.value))) {
+        number.value = strtod_c((const char *)start);
+    }
+
+    number.integral = number.value <= (double)TWO_POW_53 && number.value == (double)(uint64_t)number.value;
+    return number;
+}
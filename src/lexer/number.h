@@ -0,0 +1,26 @@
+#ifndef NUMBER_H
+#define NUMBER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Numeric literal scanner: digits, optional fraction and optional exponent,
+ * validated and converted in the same pass over the bytes.
+ *
+ *   123   4.5   6e3   7.25E-2
+ *
+ * A dot that isn't followed by a digit is left alone ("1.foo" is the number
+ * 1 followed by DOT). A literal directly followed by an identifier byte is
+ * invalid ("1a2").
+ */
+typedef struct number_literal_t {
+    double value;
+    size_t end;    // offset of the first byte after the literal
+    bool integral; // whole number no larger than 2^53, usable as an integer
+    bool valid;
+} number_literal_t;
+
+number_literal_t scan_number(const char *source, size_t position);
+
+#endif
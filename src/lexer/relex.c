@@ -0,0 +1,129 @@
+#include "lexer.h"
+#include "utils/error.h"
+#include "utils/logger.h"
+
+/*
+ * Incremental re-lex after an edit, for editor integrations that would
+ * otherwise re-tokenize the whole buffer on every keystroke.
+ *
+ * The DFA carries no state across tokens, so lexing from any token start
+ * gives the same tokens as the full run did. The only reach a token has past
+ * its own end is lookahead. Operators read one byte past ("=" before "=="),
+ * scan_number up to two: "1.x" is the number "1" only after the byte past
+ * the dot is found not to be a digit. An exponent reads further, "1e+"
+ * looks at the byte after the sign, but those bytes are the token's own:
+ * the literal takes them or is a syntax error ending on them, so they
+ * never reach past its end either.
+ *
+ * Every token is at least one byte, so the two bytes a token may have read
+ * after itself lie in the next two tokens at most. Restarting one token
+ * before the last one that starts ahead of the edit re-lexes every token
+ * that may have looked at an edited byte.
+ *
+ * Past the edited bytes the new source equals the old one shifted by the
+ * size difference. As soon as a freshly lexed token starts past the edit at
+ * the shifted offset of an old token, every following token is the same
+ * too. Lexing stops there, and the fresh tokens are spliced over the old
+ * ones in place.
+ *
+ * The new source is lexed by a scratch lexer under nojs_protect, and the
+ * lexer only takes the source and the spliced tokens once lexing is done.
+ * An edit that leaves a lexer error (a half typed string or "1e") raises
+ * that error with the lexer untouched: it still holds the tokens of the
+ * last source it lexed, and the next edit passed to it has to be relative
+ * to that source.
+ */
+
+typedef struct relex_pass_t {
+    lexer_t lexer;          // scratch, reads the new source
+    token_store_t *old;
+    token_store_t *fresh;
+    size_t old_end;         // first old token that may still be reused
+    size_t edit_end;        // in the new source
+    int64_t shift;
+} relex_pass_t;
+
+// Number of tokens starting before offset
+static size_t tokens_before(token_store_t *tokens, size_t offset) {
+    size_t low = 0;
+    size_t high = tokens->count;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (tokens->offsets[mid] < offset)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return low;
+}
+
+// Lexes from the restart token until the stream meets the old one again
+static void lex_edit(void *arg) {
+    relex_pass_t *pass = (relex_pass_t *)arg;
+    token_store_t *old = pass->old;
+    while (1) {
+        token_t token = get_next_token(&pass->lexer);
+
+        if (token.offset >= pass->edit_end) {
+            while (pass->old_end < old->count && old->offsets[pass->old_end] + pass->shift < token.offset)
+                pass->old_end++;
+            if (pass->old_end < old->count && old->offsets[pass->old_end] + pass->shift == token.offset)
+                break;
+        }
+
+        token_store_push(pass->fresh, token);
+        if (token.type == END) {
+            pass->old_end = old->count;
+            break;
+        }
+    }
+}
+
+token_range_t relex(lexer_t *lexer, const char *source, lexer_edit_t edit) {
+    if (!lexer || !lexer->tokens)
+        elog("Can't relex, lexer has no token store (streaming lexers can't be relexed)");
+    if (!source)
+        elog("Can't relex, NULL ptr on source");
+
+    token_store_t *old = lexer->tokens;
+    size_t length = lexer->length - edit.deleted + edit.inserted;
+    if (edit.offset + edit.deleted > lexer->length || source[length] != '\0')
+        elog("Edit at %zu (-%zu +%zu) doesn't match the source", edit.offset, edit.deleted, edit.inserted);
+    if (length > UINT32_MAX)
+        elog("Source is too big, token offsets don't fit in 32 bits");
+
+    size_t before = tokens_before(old, edit.offset);
+    size_t first = before >= 2 ? before - 2 : 0;
+
+    // First old token that starts after the deleted bytes
+    size_t old_end = first;
+    while (old_end < old->count && old->offsets[old_end] < edit.offset + edit.deleted)
+        old_end++;
+
+    relex_pass_t pass = {
+        .lexer = { .source = source, .length = length, .position = first ? old->offsets[first] : 0 },
+        .old = old,
+        .fresh = new_token_store(0),
+        .old_end = old_end,
+        .edit_end = edit.offset + edit.inserted,
+        .shift = (int64_t)edit.inserted - (int64_t)edit.deleted,
+    };
+    nojs_error_t error;
+    bool lexed = nojs_protect(lex_edit, &pass, &error);
+    free_line_index(pass.lexer.lines);
+    if (!lexed) {
+        free_token_store(pass.fresh);
+        nojs_reraise(&error);
+    }
+
+    token_range_t range = { first, pass.old_end, first + pass.fresh->count };
+    token_store_splice(old, first, pass.old_end, pass.fresh, pass.shift);
+    free_token_store(pass.fresh);
+
+    lexer->source = source;
+    lexer->length = length;
+    free_line_index(lexer->lines);
+    lexer->lines = NULL;
+    lexer->position = length;
+    return range;
+}
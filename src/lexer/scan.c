@@ -0,0 +1,246 @@
+#include "scan.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_X86 1
+#endif
+
+typedef struct scan_kernels_t {
+    const char *name;
+    scan_kernel_fn whitespace;
+    scan_kernel_fn comment;
+    scan_kernel_fn string;
+    scan_count_fn count_newlines;
+} scan_kernels_t;
+
+static inline bool is_space_byte(unsigned char c) {
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+static size_t scalar_whitespace(const char *source, size_t position) {
+    while (is_space_byte((unsigned char)source[position]))
+        position++;
+    return position;
+}
+
+static size_t scalar_comment(const char *source, size_t position) {
+    while (source[position] != '\n' && source[position] != '\0')
+        position++;
+    return position;
+}
+
+static size_t scalar_string(const char *source, size_t position) {
+    while (source[position] != '"' && source[position] != '\0')
+        position++;
+    return position;
+}
+
+static size_t scalar_count_newlines(const char *source, size_t length) {
+    size_t count = 0;
+    for (size_t i = 0; i < length; i++)
+        count += source[i] == '\n';
+    return count;
+}
+
+static const scan_kernels_t scalar_kernels = {
+    "scalar", scalar_whitespace, scalar_comment, scalar_string, scalar_count_newlines,
+};
+
+#ifdef SCAN_X86
+
+/*
+ * The vector kernels only issue aligned loads: the first block is loaded from
+ * the aligned address below position and the bytes before position are
+ * masked off. An aligned block never crosses a page, so reading the block
+ * that holds the terminating NUL is always safe.
+ */
+
+static inline __m128i sse2_space_mask(__m128i bytes) {
+    __m128i control = _mm_sub_epi8(bytes, _mm_set1_epi8('\t'));
+    __m128i is_control = _mm_cmpeq_epi8(_mm_min_epu8(control, _mm_set1_epi8('\r' - '\t')), control);
+    return _mm_or_si128(is_control, _mm_cmpeq_epi8(bytes, _mm_set1_epi8(' ')));
+}
+
+static size_t sse2_whitespace(const char *source, size_t position) {
+    const char *start = source + position;
+    const char *block = (const char *)((uintptr_t)start & ~(uintptr_t)15);
+    uint32_t skip = ~0u << (start - block);
+
+    while (1) {
+        __m128i bytes = _mm_load_si128((const __m128i *)block);
+        uint32_t space = (uint32_t)_mm_movemask_epi8(sse2_space_mask(bytes));
+        uint32_t stop = ~space & 0xFFFF & skip;
+
+        if (stop)
+            return (size_t)(block - source) + __builtin_ctz(stop);
+
+        block += 16;
+        skip = ~0u;
+    }
+}
+
+static size_t sse2_find(const char *source, size_t position, char target) {
+    const char *start = source + position;
+    const char *block = (const char *)((uintptr_t)start & ~(uintptr_t)15);
+    uint32_t skip = ~0u << (start - block);
+    __m128i wanted = _mm_set1_epi8(target);
+    __m128i zero = _mm_setzero_si128();
+
+    while (1) {
+        __m128i bytes = _mm_load_si128((const __m128i *)block);
+        __m128i hit = _mm_or_si128(_mm_cmpeq_epi8(bytes, wanted), _mm_cmpeq_epi8(bytes, zero));
+        uint32_t stop = (uint32_t)_mm_movemask_epi8(hit) & skip;
+
+        if (stop)
+            return (size_t)(block - source) + __builtin_ctz(stop);
+
+        block += 16;
+        skip = ~0u;
+    }
+}
+
+static size_t sse2_comment(const char *source, size_t position) {
+    return sse2_find(source, position, '\n');
+}
+
+static size_t sse2_string(const char *source, size_t position) {
+    return sse2_find(source, position, '"');
+}
+
+static size_t sse2_count_newlines(const char *source, size_t length) {
+    __m128i newline = _mm_set1_epi8('\n');
+    size_t count = 0;
+    size_t i = 0;
+
+    for (; i + 16 <= length; i += 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i *)(source + i));
+        count += __builtin_popcount((uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, newline)));
+    }
+
+    return count + scalar_count_newlines(source + i, length - i);
+}
+
+static const scan_kernels_t sse2_kernels = {
+    "sse2", sse2_whitespace, sse2_comment, sse2_string, sse2_count_newlines,
+};
+
+__attribute__((target("avx2")))
+static inline __m256i avx2_space_mask(__m256i bytes) {
+    __m256i control = _mm256_sub_epi8(bytes, _mm256_set1_epi8('\t'));
+    __m256i is_control = _mm256_cmpeq_epi8(_mm256_min_epu8(control, _mm256_set1_epi8('\r' - '\t')), control);
+    return _mm256_or_si256(is_control, _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(' ')));
+}
+
+__attribute__((target("avx2")))
+static size_t avx2_whitespace(const char *source, size_t position) {
+    const char *start = source + position;
+    const char *block = (const char *)((uintptr_t)start & ~(uintptr_t)31);
+    uint32_t skip = ~0u << (start - block);
+
+    while (1) {
+        __m256i bytes = _mm256_load_si256((const __m256i *)block);
+        uint32_t space = (uint32_t)_mm256_movemask_epi8(avx2_space_mask(bytes));
+        uint32_t stop = ~space & skip;
+
+        if (stop)
+            return (size_t)(block - source) + __builtin_ctz(stop);
+
+        block += 32;
+        skip = ~0u;
+    }
+}
+
+__attribute__((target("avx2")))
+static size_t avx2_find(const char *source, size_t position, char target) {
+    const char *start = source + position;
+    const char *block = (const char *)((uintptr_t)start & ~(uintptr_t)31);
+    uint32_t skip = ~0u << (start - block);
+    __m256i wanted = _mm256_set1_epi8(target);
+    __m256i zero = _mm256_setzero_si256();
+
+    while (1) {
+        __m256i bytes = _mm256_load_si256((const __m256i *)block);
+        __m256i hit = _mm256_or_si256(_mm256_cmpeq_epi8(bytes, wanted), _mm256_cmpeq_epi8(bytes, zero));
+        uint32_t stop = (uint32_t)_mm256_movemask_epi8(hit) & skip;
+
+        if (stop)
+            return (size_t)(block - source) + __builtin_ctz(stop);
+
+        block += 32;
+        skip = ~0u;
+    }
+}
+
+__attribute__((target("avx2")))
+static size_t avx2_comment(const char *source, size_t position) {
+    return avx2_find(source, position, '\n');
+}
+
+__attribute__((target("avx2")))
+static size_t avx2_string(const char *source, size_t position) {
+    return avx2_find(source, position, '"');
+}
+
+__attribute__((target("avx2,popcnt")))
+static size_t avx2_count_newlines(const char *source, size_t length) {
+    __m256i newline = _mm256_set1_epi8('\n');
+    size_t count = 0;
+    size_t i = 0;
+
+    for (; i + 32 <= length; i += 32) {
+        __m256i bytes = _mm256_loadu_si256((const __m256i *)(source + i));
+        count += __builtin_popcount((uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, newline)));
+    }
+
+    return count + scalar_count_newlines(source + i, length - i);
+}
+
+static const scan_kernels_t avx2_kernels = {
+    "avx2", avx2_whitespace, avx2_comment, avx2_string, avx2_count_newlines,
+};
+
+#endif
+
+static const scan_kernels_t *kernels = &scalar_kernels;
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+
+static void pick_kernels(void) {
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        kernels = &avx2_kernels;
+    else if (__builtin_cpu_supports("sse2"))
+        kernels = &sse2_kernels;
+#endif
+}
+
+void scan_init(void) {
+    pthread_once(&kernels_once, pick_kernels);
+}
+
+const char *scan_kernel_name(void) {
+    scan_init();
+    return kernels->name;
+}
+
+size_t scan_whitespace(const char *source, size_t position) {
+    return kernels->whitespace(source, position);
+}
+
+size_t scan_comment(const char *source, size_t position) {
+    return kernels->comment(source, position);
+}
+
+size_t scan_string(const char *source, size_t position) {
+    return kernels->string(source, position);
+}
+
+size_t scan_count_newlines(const char *source, size_t length) {
+    scan_init();
+    return kernels->count_newlines(source, length);
+}
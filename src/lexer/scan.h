@@ -0,0 +1,28 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stddef.h>
+
+/*
+ * Bulk scanning kernels used by the lexer for long runs of bytes that can't
+ * end a token early: whitespace, line comments and string bodies. Every
+ * kernel starts at position and returns the offset of the first byte it did
+ * not skip. The source must be NUL-terminated; the kernels never skip the
+ * NUL. scan_count_newlines is used to size the line index.
+ *
+ * scan_init picks SSE2 or AVX2 versions at runtime (cpuid), falling back to
+ * plain C on other targets.
+ */
+
+typedef size_t (*scan_kernel_fn)(const char *source, size_t position);
+typedef size_t (*scan_count_fn)(const char *source, size_t length);
+
+void scan_init(void);
+const char *scan_kernel_name(void);
+
+size_t scan_whitespace(const char *source, size_t position);
+size_t scan_comment(const char *source, size_t position);
+size_t scan_string(const char *source, size_t position);
+size_t scan_count_newlines(const char *source, size_t length);
+
+#endif
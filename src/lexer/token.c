@@ -4,46 +4,50 @@
 #include "utils/logger.h"
 #include <stdlib.h>
 
-token_t *new_token(lexer_t *lexer, ttype type) {
+token_t new_token(lexer_t *lexer, ttype type) {
   if (!lexer)
     elog("Can't create token with NULL ptr on lexer");
 
-  token_t *token = (token_t *)malloc(sizeof(token_t));
-  if (!token)
-    elog("Error allocation memory for token_t struct");
-
-  token->type = type;
-  token->line = lexer->line;
-  token->column = lexer->column;
+  token_t token;
+  token.type = type;
+  token.offset = (uint32_t)lexer->token_start;
+  token.value.number = 0;
+  token.flags = 0;
   return token;
 }
 
-token_t *new_number_token(lexer_t *lexer, ttype type, double number) {
-  token_t *token = new_token(lexer, type);
-  token->value.number = number;
+token_t new_number_token(lexer_t *lexer, ttype type, double number, bool integral) {
+  token_t token = new_token(lexer, type);
+  token.value.number = number;
+  if (integral)
+    token.flags |= TOKEN_INTEGRAL;
   return token;
 }
 
-void free_token(token_t *token) {
-  if (!token)
-    return;
-
-  free(token);
+token_t new_boolean_token(lexer_t *lexer , ttype type , bool boolean){
+    token_t token = new_token(lexer , type);
+    token.value.boolean = boolean;
+    return token;
 }
 
-token_t *new_boolean_token(lexer_t *lexer , ttype type , bool boolean){
-    token_t *token = new_token(lexer , type);
-    token->value.boolean = boolean;
+token_t new_slice_token(lexer_t *lexer , ttype type , size_t offset , size_t length){
+    token_t token = new_token(lexer , type);
+    token.value.slice.offset = (uint32_t)offset;
+    token.value.slice.length = (uint32_t)length;
     return token;
 }
 
-token_t *new_string_token(lexer_t *lexer , ttype type , char* string){
-    token_t *token = new_token(lexer , type);
-    token->value.string = strdup(string);
+token_t new_atom_token(lexer_t *lexer , ttype type , const atom_t *atom){
+    token_t token = new_token(lexer , type);
+    token.value.atom = atom;
     return token;
 }
 
-void log_token(token_t *token){
+str_view_t token_text(lexer_t *lexer , token_t *token){
+    return sv_make(lexer->source + token->offset + token->value.slice.offset , token->value.slice.length);
+}
+
+void log_token(lexer_t *lexer , token_t *token){
     if(!token) elog("Can't print token by NULL ptr on it");
     switch(token->type){
         case MUL    : dlog("MUL"); break;
@@ -55,7 +59,7 @@ void log_token(token_t *token){
         case NUMBER  : dlog("NUMBER : %f" , token->value.number); break;
         case END     : dlog("END"); break;
         
-        case STRING   : dlog("STRING : %s", token->value.string); break;
+        case STRING   : dlog("STRING : " SV_FMT, SV_ARG(token_text(lexer , token))); break;
         case BOOLEAN  : dlog("BOOLEAN : %s", token->value.boolean ? "true" : "false"); break;
         case NULL_VAL : dlog("NULL_VAL"); break;
         
@@ -96,7 +100,7 @@ void log_token(token_t *token){
         case COMMA     : dlog("COMMA"); break;
         case DOT       : dlog("DOT"); break;
         
-        case IDENTIFIER : dlog("IDENTIFIER : %s", token->value.string); break;
+        case IDENTIFIER : dlog("IDENTIFIER : %s", token->value.atom->text); break;
         
         default : dlog("Indefine token type");
     }
@@ -1,8 +1,10 @@
 #ifndef TOKENS_H
 #define TOKENS_H
 
-#include "lexer.h"
 #include "utils/arr.h"
+#include "utils/str_view.h"
+#include "utils/atom.h"
+#include <stdint.h>
 #include <stdlib.h>
 #include <stdbool.h>
 
@@ -73,22 +75,33 @@ typedef enum ttype {
     END            /* Конец файла */
 } ttype; // token type
          
+typedef union token_value_t {
+    double number;
+    struct {
+        uint32_t offset; // from the token offset, so edits never move it
+        uint32_t length;
+    } slice;             // STRING
+    const atom_t *atom;  // IDENTIFIER
+    bool boolean;
+} token_value_t;
+
+// token_t.flags
+#define TOKEN_INTEGRAL 0x01 // NUMBER that is a whole number no larger than 2^53
+
+// Unpacked token, passed by value. Tokens are stored in a token_store_t.
 typedef struct token_t {
     ttype type;
-    size_t line;
-    size_t column;
-    union {
-        double number;
-        char *string;
-        bool boolean;
-    } value;
+    uint32_t offset; // of the first byte of the token in the source
+    token_value_t value;
+    uint8_t flags;
 } token_t;
 
-token_t *new_token(lexer_t *lexer , ttype type);
-token_t *new_number_token(lexer_t *lexer , ttype type, double number);
-token_t *new_boolean_token(lexer_t *lexer , ttype type , bool boolean);
-token_t *new_string_token(lexer_t *lexer , ttype type , char* string);
-void free_token(token_t *token);
-void log_token(token_t *token);
+token_t new_token(lexer_t *lexer , ttype type);
+token_t new_number_token(lexer_t *lexer , ttype type, double number , bool integral);
+token_t new_boolean_token(lexer_t *lexer , ttype type , bool boolean);
+token_t new_slice_token(lexer_t *lexer , ttype type , size_t offset , size_t length);
+token_t new_atom_token(lexer_t *lexer , ttype type , const atom_t *atom);
+str_view_t token_text(lexer_t *lexer , token_t *token);
+void log_token(lexer_t *lexer , token_t *token);
 
 #endif
@@ -0,0 +1,118 @@
+#include "token_store.h"
+#include "utils/logger.h"
+#include <string.h>
+
+#define TOKEN_STORE_MIN_CAPACITY 64
+
+static size_t token_store_block_size(size_t capacity) {
+    return capacity * (sizeof(token_value_t) + sizeof(uint32_t) + 2 * sizeof(uint8_t));
+}
+
+static void token_store_layout(token_store_t *store, void *block, size_t capacity) {
+    store->block = block;
+    store->values = (token_value_t *)block;
+    store->offsets = (uint32_t *)(store->values + capacity);
+    store->types = (uint8_t *)(store->offsets + capacity);
+    store->flags = store->types + capacity;
+    store->capacity = capacity;
+}
+
+token_store_t *new_token_store(size_t capacity) {
+    if (capacity < TOKEN_STORE_MIN_CAPACITY)
+        capacity = TOKEN_STORE_MIN_CAPACITY;
+
+    token_store_t *store = (token_store_t *)malloc(sizeof(token_store_t));
+    if (!store)
+        elog("Error allocation memory for token_store_t struct");
+
+    void *block = malloc(token_store_block_size(capacity));
+    if (!block)
+        elog("Error allocation memory for token store columns");
+
+    token_store_layout(store, block, capacity);
+    store->count = 0;
+    return store;
+}
+
+void free_token_store(token_store_t *store) {
+    if (!store)
+        return;
+
+    free(store->block);
+    free(store);
+}
+
+void token_store_grow(token_store_t *store) {
+    size_t new_capacity = store->capacity * 2;
+    void *block = malloc(token_store_block_size(new_capacity));
+    if (!block)
+        elog("Error reallocation memory for token store columns");
+
+    token_store_t grown;
+    token_store_layout(&grown, block, new_capacity);
+    memcpy(grown.values, store->values, store->count * sizeof(token_value_t));
+    memcpy(grown.offsets, store->offsets, store->count * sizeof(uint32_t));
+    memcpy(grown.types, store->types, store->count * sizeof(uint8_t));
+    memcpy(grown.flags, store->flags, store->count * sizeof(uint8_t));
+
+    free(store->block);
+    token_store_layout(store, block, new_capacity);
+}
+
+void token_store_append(token_store_t *store, const token_store_t *other) {
+    size_t count = store->count + other->count;
+    while (store->capacity < count)
+        token_store_grow(store);
+
+    memcpy(store->values + store->count, other->values, other->count * sizeof(token_value_t));
+    memcpy(store->offsets + store->count, other->offsets, other->count * sizeof(uint32_t));
+    memcpy(store->types + store->count, other->types, other->count * sizeof(uint8_t));
+    memcpy(store->flags + store->count, other->flags, other->count * sizeof(uint8_t));
+    store->count = count;
+}
+
+// Replaces tokens [from, to) with all of other, and moves the source
+// offsets of the tokens after them by shift
+void token_store_splice(token_store_t *store, size_t from, size_t to, const token_store_t *other, int64_t shift) {
+    if (from > to || to > store->count)
+        elog("Invalid token range [%zu, %zu) to splice in token store of %zu tokens", from, to, store->count);
+
+    size_t tail = store->count - to;
+    size_t count = from + other->count + tail;
+    while (store->capacity < count)
+        token_store_grow(store);
+
+    size_t dest = from + other->count;
+    if (dest != to) {
+        memmove(store->values + dest, store->values + to, tail * sizeof(token_value_t));
+        memmove(store->offsets + dest, store->offsets + to, tail * sizeof(uint32_t));
+        memmove(store->types + dest, store->types + to, tail * sizeof(uint8_t));
+        memmove(store->flags + dest, store->flags + to, tail * sizeof(uint8_t));
+    }
+
+    memcpy(store->values + from, other->values, other->count * sizeof(token_value_t));
+    memcpy(store->offsets + from, other->offsets, other->count * sizeof(uint32_t));
+    memcpy(store->types + from, other->types, other->count * sizeof(uint8_t));
+    memcpy(store->flags + from, other->flags, other->count * sizeof(uint8_t));
+    store->count = count;
+
+    if (shift == 0)
+        return;
+
+    // Wrapping 32 bit add, also right for negative shifts, and vectorizes
+    uint32_t delta = (uint32_t)shift;
+    for (size_t i = dest; i < count; i++)
+        store->offsets[i] += delta;
+}
+
+token_t token_store_get(token_store_t *store, size_t index) {
+    if (index >= store->count)
+        elog("Token index %zu out of range in token store of %zu tokens", index, store->count);
+
+    token_t token;
+    token.type = (ttype)store->types[index];
+    token.offset = store->offsets[index];
+    token.value = store->values[index];
+    token.flags = store->flags[index];
+    return token;
+}
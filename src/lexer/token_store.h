@@ -0,0 +1,48 @@
+#ifndef TOKEN_STORE_H
+#define TOKEN_STORE_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include "token.h"
+
+/*
+ * Columnar token buffer. All three columns live in one allocation:
+ *   values  - literal payloads (number, string slice, atom, boolean)
+ *   offsets - byte offset of every token in the source
+ *   types   - one ttype byte per token, scanned by the parser's lookahead
+ *   flags   - TOKEN_* bits
+ * Freeing a store is a single free no matter how many tokens it holds.
+ */
+typedef struct token_store_t {
+    void *block;
+    token_value_t *values;
+    uint32_t *offsets;
+    uint8_t *types;
+    uint8_t *flags;
+    size_t count;
+    size_t capacity;
+} token_store_t;
+
+token_store_t *new_token_store(size_t capacity);
+void free_token_store(token_store_t *store);
+void token_store_grow(token_store_t *store);
+void token_store_append(token_store_t *store, const token_store_t *other);
+void token_store_splice(token_store_t *store, size_t from, size_t to, const token_store_t *other, int64_t shift);
+token_t token_store_get(token_store_t *store, size_t index);
+
+static inline void token_store_push(token_store_t *store, token_t token) {
+    if (store->count == store->capacity)
+        token_store_grow(store);
+
+    store->types[store->count] = (uint8_t)token.type;
+    store->offsets[store->count] = token.offset;
+    store->values[store->count] = token.value;
+    store->flags[store->count] = token.flags;
+    store->count++;
+}
+
+static inline ttype token_store_type(token_store_t *store, size_t index) {
+    return (ttype)store->types[index];
+}
+
+#endif
@@ -1,9 +1,18 @@
 #include "lexer/lexer.h"
 #include "lexer/token.h"
 
+#include "ast/ast_fold.h"
 #include "ast/ast_parser.h"
+#include "ast/ast_resolve.h"
 #include "ast/ast_printer.h"
 
+#include "interp/closure_compiler.h"
+#include "interp/interp.h"
+#include "vm/bc_compiler.h"
+#include "vm/reg_compiler.h"
+#include "vm/reg_vm.h"
+#include "vm/stack_vm.h"
+
 #include "utils/logger.h"
 
 int main(void) {
@@ -22,14 +31,47 @@ int main(void) {
   
   dlog("Tokens list : ");
   for(size_t i = 0 ; i < lexer->tokens->count; i++){
-      log_token((token_t*)lexer->tokens->items[i]);
+      token_t token = token_store_get(lexer->tokens , i);
+      log_token(lexer , &token);
   }
     
-  lexer_g = lexer;
-  current_token = 0;
+  arena_t *arena = new_arena(0);
+  parser_t *parser = new_parser(lexer , arena);
+  ast_node *prog = parse_program(parser);
+  print_ast(prog , 0);
 
-  ast_node *prog = parse_program();
+  fold_stats_t stats;
+  prog = fold_constants(prog , arena , &stats);
+  dlog("Constant folding : %zu nodes -> %zu (%zu folded, %zu propagated, %zu pruned)",
+       stats.nodes_before , stats.nodes_after , stats.folded , stats.propagated , stats.pruned);
+
+  resolve_scopes(prog , arena);
+  dlog("Scopes resolved, global frame of %u slots" , prog->program.frame_size);
   print_ast(prog , 0);
+
+  interp_t *interp = new_interp(arena);
+  interp_run(interp , prog);
+  dlog("Program ran, %zu heap bytes in use" , interp->heap->bytes);
+
+  bc_module_t *module = bc_compile(prog , arena);
+  dlog("Bytecode : %zu instructions in %zu functions" , module->code_count , module->functions_count);
+  bc_disassemble(module , stdout);
+  vm_run(interp , module);
+
+  rg_module_t *registers = rg_compile(prog , arena);
+  rg_disassemble(registers , stdout);
+  rg_run(interp , registers);
+
+  cl_program_t *closures = cl_compile(prog , arena);
+  dlog("Closures : %zu nodes, %zu specialized" , closures->node_count , closures->specialized_count);
+  cl_run(interp , closures);
+  free_cl_program(closures);
+  free_rg_module(registers);
+  free_bc_module(module);
+  free_interp(interp);
+
+  free_parser(parser);
+  free_arena(arena);
   return 0;
 }
 
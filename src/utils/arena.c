@@ -0,0 +1,65 @@
+#include "arena.h"
+#include "logger.h"
+#include <stdlib.h>
+
+#define ARENA_MIN_CHUNK 4096
+
+static arena_chunk_t *new_arena_chunk(size_t size) {
+    arena_chunk_t *chunk = (arena_chunk_t *)malloc(sizeof(arena_chunk_t) + size);
+    if (!chunk)
+        elog("Error allocation memory for arena chunk of %zu bytes", size);
+
+    chunk->next = NULL;
+    chunk->size = size;
+    chunk->used = 0;
+    return chunk;
+}
+
+arena_t *new_arena(size_t chunk_size) {
+    if (chunk_size < ARENA_MIN_CHUNK)
+        chunk_size = ARENA_MIN_CHUNK;
+
+    arena_t *arena = (arena_t *)malloc(sizeof(arena_t));
+    if (!arena)
+        elog("Error allocation memory for arena_t struct");
+
+    arena->head = NULL;
+    arena->chunk_size = chunk_size;
+    arena->allocated = 0;
+    return arena;
+}
+
+void free_arena(arena_t *arena) {
+    if (!arena)
+        return;
+
+    arena_chunk_t *chunk = arena->head;
+    while (chunk) {
+        arena_chunk_t *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    free(arena);
+}
+
+// size is already aligned by arena_alloc
+void *arena_alloc_slow(arena_t *arena, size_t size) {
+    // Oversized requests get a chunk of their own behind the current one, so
+    // the rest of the current chunk isn't wasted
+    if (size > arena->chunk_size / 4 && arena->head) {
+        arena_chunk_t *chunk = new_arena_chunk(size);
+        chunk->used = size;
+        chunk->next = arena->head->next;
+        arena->head->next = chunk;
+        arena->allocated += size;
+        return chunk->data;
+    }
+
+    arena_chunk_t *chunk = new_arena_chunk(size > arena->chunk_size ? size : arena->chunk_size);
+    chunk->next = arena->head;
+    arena->head = chunk;
+
+    chunk->used = size;
+    arena->allocated += size;
+    return chunk->data;
+}
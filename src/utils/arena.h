@@ -0,0 +1,44 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Bump allocator over a list of chunks. Allocations are never freed one by
+ * one; free_arena releases everything at once, however many objects were
+ * allocated. Not thread safe, use one arena per thread or per parse.
+ */
+
+#define ARENA_ALIGN 16
+
+typedef struct arena_chunk_t {
+    struct arena_chunk_t *next;
+    size_t size;
+    size_t used;
+    _Alignas(ARENA_ALIGN) unsigned char data[];
+} arena_chunk_t;
+
+typedef struct arena_t {
+    arena_chunk_t *head; // chunk allocations are bumped in, newest first
+    size_t chunk_size;
+    size_t allocated;    // bytes handed out, over all chunks
+} arena_t;
+
+arena_t *new_arena(size_t chunk_size);
+void free_arena(arena_t *arena);
+void *arena_alloc_slow(arena_t *arena, size_t size);
+
+static inline void *arena_alloc(arena_t *arena, size_t size) {
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    arena_chunk_t *chunk = arena->head;
+    if (!chunk || chunk->size - chunk->used < size)
+        return arena_alloc_slow(arena, size);
+
+    void *ptr = chunk->data + chunk->used;
+    chunk->used += size;
+    arena->allocated += size;
+    return ptr;
+}
+
+#endif
@@ -0,0 +1,144 @@
+#include "atom.h"
+#include "logger.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ATOM_SHARD_BITS 4
+#define ATOM_SHARDS (1 << ATOM_SHARD_BITS)
+#define ATOM_INITIAL_SLOTS 256
+#define ATOM_CHUNK_SIZE (64 * 1024)
+
+/*
+ * The table is split into shards picked by the top bits of the hash, each
+ * one an open addressing (linear probing) table with its own lock, so
+ * threads interning different names rarely wait on each other. Atom
+ * storage is bump allocated from per-shard chunks.
+ *
+ * Nothing raises while a shard is locked: under nojs_protect the longjmp
+ * would skip the unlock and the next intern into the shard would hang.
+ * Allocation failures are reported back and raised after unlocking.
+ */
+typedef struct atom_shard_t {
+    pthread_mutex_t lock;
+    const atom_t **slots;
+    size_t capacity;
+    size_t count;
+    char *chunk;
+    size_t chunk_used;
+} atom_shard_t;
+
+static atom_shard_t shards[ATOM_SHARDS] = {
+    [0 ... ATOM_SHARDS - 1] = {.lock = PTHREAD_MUTEX_INITIALIZER},
+};
+
+static uint32_t atom_hash(const char *data, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char)data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// NULL when out of memory
+static atom_t *shard_alloc_atom(atom_shard_t *shard, size_t length) {
+    size_t size = (sizeof(atom_t) + length + 1 + 7) & ~(size_t)7;
+
+    if (size > ATOM_CHUNK_SIZE / 4)
+        return (atom_t *)malloc(size);
+
+    if (!shard->chunk || shard->chunk_used + size > ATOM_CHUNK_SIZE) {
+        char *chunk = (char *)malloc(ATOM_CHUNK_SIZE);
+        if (!chunk)
+            return NULL;
+        shard->chunk = chunk;
+        shard->chunk_used = 0;
+    }
+
+    atom_t *atom = (atom_t *)(shard->chunk + shard->chunk_used);
+    shard->chunk_used += size;
+    return atom;
+}
+
+// False when out of memory, the shard is left as it was
+static bool shard_grow(atom_shard_t *shard) {
+    size_t new_capacity = shard->capacity ? shard->capacity * 2 : ATOM_INITIAL_SLOTS;
+    const atom_t **new_slots = (const atom_t **)calloc(new_capacity, sizeof(atom_t *));
+    if (!new_slots)
+        return false;
+
+    for (size_t i = 0; i < shard->capacity; i++) {
+        const atom_t *atom = shard->slots[i];
+        if (!atom)
+            continue;
+
+        size_t slot = atom->hash & (new_capacity - 1);
+        while (new_slots[slot])
+            slot = (slot + 1) & (new_capacity - 1);
+        new_slots[slot] = atom;
+    }
+
+    free(shard->slots);
+    shard->slots = new_slots;
+    shard->capacity = new_capacity;
+    return true;
+}
+
+const atom_t *atom_intern(const char *data, size_t length) {
+    if (length > UINT32_MAX)
+        elog("Can't intern name longer than 4 GB");
+
+    uint32_t hash = atom_hash(data, length);
+    atom_shard_t *shard = &shards[hash >> (32 - ATOM_SHARD_BITS)];
+
+    pthread_mutex_lock(&shard->lock);
+
+    if (shard->count * 2 >= shard->capacity && !shard_grow(shard)) {
+        pthread_mutex_unlock(&shard->lock);
+        elog("Error allocation memory for atom table");
+    }
+
+    size_t mask = shard->capacity - 1;
+    size_t slot = hash & mask;
+    const atom_t *atom;
+    while ((atom = shard->slots[slot])) {
+        if (atom->hash == hash && atom->length == length &&
+            memcmp(atom->text, data, length) == 0) {
+            pthread_mutex_unlock(&shard->lock);
+            return atom;
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    atom_t *created = shard_alloc_atom(shard, length);
+    if (!created) {
+        pthread_mutex_unlock(&shard->lock);
+        elog("Error allocation memory for atom");
+    }
+    created->hash = hash;
+    created->length = (uint32_t)length;
+    memcpy(created->text, data, length);
+    created->text[length] = '\0';
+
+    shard->slots[slot] = created;
+    shard->count++;
+
+    pthread_mutex_unlock(&shard->lock);
+    return created;
+}
+
+const atom_t *atom_from_cstr(const char *cstr) {
+    return atom_intern(cstr, strlen(cstr));
+}
+
+size_t atom_count(void) {
+    size_t count = 0;
+    for (size_t i = 0; i < ATOM_SHARDS; i++) {
+        pthread_mutex_lock(&shards[i].lock);
+        count += shards[i].count;
+        pthread_mutex_unlock(&shards[i].lock);
+    }
+    return count;
+}
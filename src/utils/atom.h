@@ -0,0 +1,22 @@
+#ifndef ATOM_H
+#define ATOM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Interned string. Every distinct name is stored exactly once for the whole
+ * process, so two names are equal iff their atom pointers are equal. Atoms
+ * are never freed. The table is safe to use from several threads at once.
+ */
+typedef struct atom_t {
+    uint32_t hash;
+    uint32_t length;
+    char text[]; // NUL-terminated
+} atom_t;
+
+const atom_t *atom_intern(const char *data, size_t length);
+const atom_t *atom_from_cstr(const char *cstr);
+size_t atom_count(void);
+
+#endif
@@ -0,0 +1,75 @@
+#include "error.h"
+#include "logger.h"
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct nojs_recovery_t {
+    jmp_buf jump;
+    nojs_error_t *error;
+    struct nojs_recovery_t *outer;
+} nojs_recovery_t;
+
+static _Thread_local nojs_recovery_t *recovery = NULL;
+
+const char *nojs_error_kind_name(nojs_error_kind kind) {
+    switch (kind) {
+    case NOJS_ERROR_NONE: return "No error";
+    case NOJS_ERROR_SYNTAX: return "Syntax error";
+    case NOJS_ERROR_RUNTIME: return "Runtime error";
+    }
+    return "Unknown error";
+}
+
+void nojs_raise(const char *where, int where_line, nojs_error_kind kind,
+                size_t line, size_t column, const char *format, ...) {
+    char message[NOJS_ERROR_MESSAGE_MAX];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+
+    if (!recovery) {
+        if (line)
+            logger(where, where_line, ERR, "[%zu:%zu] %s : %s", line, column, nojs_error_kind_name(kind), message);
+        else
+            logger(where, where_line, ERR, "%s", message);
+        exit(1);
+    }
+
+    nojs_error_t *error = recovery->error;
+    error->kind = kind;
+    error->line = line;
+    error->column = column;
+    error->where = where;
+    error->where_line = where_line;
+    memcpy(error->message, message, sizeof(message));
+    longjmp(recovery->jump, 1);
+}
+
+void nojs_reraise(const nojs_error_t *error) {
+    nojs_raise(error->where, error->where_line, error->kind, error->line, error->column, "%s", error->message);
+}
+
+bool nojs_protect(void (*body)(void *context), void *context, nojs_error_t *error) {
+    if (!body || !error)
+        elog("Can't protect a call, NULL ptr on body or error");
+
+    nojs_recovery_t frame;
+    frame.error = error;
+    frame.outer = recovery;
+    recovery = &frame;
+
+    if (setjmp(frame.jump)) {
+        recovery = frame.outer;
+        return false;
+    }
+
+    body(context);
+    recovery = frame.outer;
+    error->kind = NOJS_ERROR_NONE;
+    return true;
+}
@@ -0,0 +1,51 @@
+#ifndef ERROR_H
+#define ERROR_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Every failure goes through nojs_raise (elog, syntax_error, lexer errors).
+ * Outside of nojs_protect it logs the message and exits, as a command line
+ * run wants. Inside, it fills the caller's nojs_error_t and longjmps back
+ * to nojs_protect, which returns false, so a host process survives a bad
+ * script with its caches intact. The only cost on the happy path is the
+ * setjmp in nojs_protect, nothing is checked or allocated per operation.
+ *
+ * Memory allocated by the failed call is not unwound, callers keep what
+ * they need to release in the context they pass (see try_parse). Recovery
+ * points nest and are per thread: code running on threads of its own
+ * protects each of them and hands the first error to nojs_reraise on the
+ * calling thread once all are joined (see tokenize_parallel, parse_files).
+ */
+
+#define NOJS_ERROR_MESSAGE_MAX 256
+
+typedef enum nojs_error_kind {
+    NOJS_ERROR_NONE,
+    NOJS_ERROR_SYNTAX,  // lexer and parser, line and column are set
+    NOJS_ERROR_RUNTIME  // everything else raised through elog, no line or column
+} nojs_error_kind;
+
+typedef struct nojs_error_t {
+    nojs_error_kind kind;
+    size_t line;        // in the script, 1 based; 0 for runtime errors, the tree keeps no positions
+    size_t column;
+    const char *where;  // Nojs source file that raised it
+    int where_line;
+    char message[NOJS_ERROR_MESSAGE_MAX];
+} nojs_error_t;
+
+_Noreturn void nojs_raise(const char *where, int where_line, nojs_error_kind kind,
+                          size_t line, size_t column, const char *format, ...)
+    __attribute__((format(printf, 6, 7)));
+
+// Runs body(context), false with error filled if it raised
+bool nojs_protect(void (*body)(void *context), void *context, nojs_error_t *error);
+
+// Raises an error caught on another thread again on this one
+_Noreturn void nojs_reraise(const nojs_error_t *error);
+
+const char *nojs_error_kind_name(nojs_error_kind kind);
+
+#endif
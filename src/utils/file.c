@@ -0,0 +1,33 @@
+#include "file.h"
+#include "logger.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+char *read_file(const char *path, size_t *length) {
+    if (!path)
+        elog("Can't read file, NULL ptr on path");
+
+    FILE *file = fopen(path, "rb");
+    if (!file)
+        elog("Can't open file %s", path);
+
+    if (fseek(file, 0, SEEK_END) != 0)
+        elog("Can't seek in file %s", path);
+    long size = ftell(file);
+    if (size < 0)
+        elog("Can't get size of file %s", path);
+    rewind(file);
+
+    char *data = (char *)malloc((size_t)size + 1);
+    if (!data)
+        elog("Error allocation memory for content of file %s", path);
+
+    if (fread(data, 1, (size_t)size, file) != (size_t)size)
+        elog("Can't read file %s", path);
+    data[size] = '\0';
+    fclose(file);
+
+    if (length)
+        *length = (size_t)size;
+    return data;
+}
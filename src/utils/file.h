@@ -0,0 +1,9 @@
+#ifndef FILE_H
+#define FILE_H
+
+#include <stddef.h>
+
+// Whole file as a NUL-terminated buffer owned by the caller, length is optional
+char *read_file(const char *path, size_t *length);
+
+#endif
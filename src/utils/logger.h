@@ -10,6 +10,7 @@
 #include <string.h>
 #include <stdbool.h>
 #include <stdarg.h>
+#include "error.h"
 
 #define RESET   "\x1b[0m"
 #define RED     "\x1b[31m"
@@ -58,10 +59,9 @@ log_level get_log_level(void);
 #define dlog(format, ...) logger(__FILE__, __LINE__, DEBUG, format, ##__VA_ARGS__)
 #define ilog(format, ...) logger(__FILE__, __LINE__, INFO, format, ##__VA_ARGS__)
 #define wlog(format, ...) logger(__FILE__, __LINE__, WARN, format, ##__VA_ARGS__)
-#define elog(format, ...) do { \
-    logger(__FILE__, __LINE__, ERR, format, ##__VA_ARGS__); \
-    exit(1); \
-} while(0)
+// Logs and exits, or returns to the innermost nojs_protect, see error.h
+#define elog(format, ...) \
+    nojs_raise(__FILE__, __LINE__, NOJS_ERROR_RUNTIME, 0, 0, format, ##__VA_ARGS__)
 
 #pragma GCC diagnostic pop
 #endif
@@ -78,6 +78,15 @@ void *peek(queue_t *queue) {
   return queue->q[queue->front];
 }
 
+// Element index positions behind the front, without dequeuing anything
+void *queue_at(queue_t *queue, size_t index) {
+  if (!queue || !queue->q)
+    lfatal("Cannot index into an invalid queue");
+  if (index >= queue->count)
+    lfatal("Queue index %zu out of range, queue holds %zu items", index, queue->count);
+  return queue->q[(queue->front + index) % queue->capacity];
+}
+
 bool is_queue_empty(queue_t *queue) {
   if (!queue)
     return true;
@@ -53,6 +53,7 @@ void resize_queue(queue_t *queue);
 void enqueue(queue_t *queue, void *item);
 void *dequeue(queue_t *queue);
 void *peek(queue_t *queue);
+void *queue_at(queue_t *queue, size_t index);
 bool is_queue_empty(queue_t *queue);
 size_t queue_size(queue_t *queue);
 #endif
@@ -0,0 +1,85 @@
+#include "scope_map.h"
+#include "logger.h"
+
+#include <stdlib.h>
+
+#define SCOPE_MIN_CAPACITY 64
+
+void scope_map_init(scope_map_t *map) {
+    map->bindings = NULL;
+    map->count = 0;
+    map->capacity = 0;
+    map->slots = NULL;
+    map->slots_used = 0;
+    map->slots_capacity = 0;
+}
+
+void scope_map_free(scope_map_t *map) {
+    free(map->bindings);
+    free(map->slots);
+    scope_map_init(map);
+}
+
+static scope_slot_t *find_slot(scope_slot_t *slots, size_t capacity, const atom_t *name) {
+    size_t mask = capacity - 1;
+    for (size_t index = name->hash & mask;; index = (index + 1) & mask)
+        if (slots[index].name == name || !slots[index].name)
+            return &slots[index];
+}
+
+static scope_slot_t *name_slot(scope_map_t *map, const atom_t *name) {
+    if (map->slots_used * 2 >= map->slots_capacity) {
+        size_t capacity = map->slots_capacity ? map->slots_capacity * 2 : SCOPE_MIN_CAPACITY;
+        scope_slot_t *slots = (scope_slot_t *)calloc(capacity, sizeof(scope_slot_t));
+        if (!slots)
+            elog("Error allocation memory for scope map names");
+        for (size_t i = 0; i < map->slots_capacity; i++)
+            if (map->slots[i].name)
+                *find_slot(slots, capacity, map->slots[i].name) = map->slots[i];
+        free(map->slots);
+        map->slots = slots;
+        map->slots_capacity = capacity;
+    }
+
+    scope_slot_t *slot = find_slot(map->slots, map->slots_capacity, name);
+    if (!slot->name) {
+        slot->name = name;
+        map->slots_used++;
+    }
+    return slot;
+}
+
+void scope_bind(scope_map_t *map, const atom_t *name, uintptr_t value) {
+    if (map->count == map->capacity) {
+        map->capacity = map->capacity ? map->capacity * 2 : SCOPE_MIN_CAPACITY;
+        map->bindings = (scope_binding_t *)realloc(map->bindings, map->capacity * sizeof(scope_binding_t));
+        if (!map->bindings)
+            elog("Error reallocation memory for scope map bindings");
+    }
+
+    scope_slot_t *slot = name_slot(map, name);
+    map->bindings[map->count++] = (scope_binding_t){ name, value, slot->top };
+    slot->top = map->count;
+}
+
+bool scope_lookup(scope_map_t *map, const atom_t *name, uintptr_t *value) {
+    return scope_lookup_since(map, name, 0, value);
+}
+
+bool scope_lookup_since(scope_map_t *map, const atom_t *name, size_t mark, uintptr_t *value) {
+    if (!map->slots_capacity)
+        return false;
+
+    scope_slot_t *slot = find_slot(map->slots, map->slots_capacity, name);
+    if (slot->top <= mark)
+        return false;
+    *value = map->bindings[slot->top - 1].value;
+    return true;
+}
+
+void scope_pop(scope_map_t *map, size_t mark) {
+    while (map->count > mark) {
+        scope_binding_t *binding = &map->bindings[--map->count];
+        find_slot(map->slots, map->slots_capacity, binding->name)->top = binding->shadowed;
+    }
+}
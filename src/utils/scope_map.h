@@ -0,0 +1,51 @@
+#ifndef SCOPE_MAP_H
+#define SCOPE_MAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "atom.h"
+
+/*
+ * Lexically scoped name -> value map for passes over the AST. Bindings sit
+ * on a stack, innermost last, and each name has a slot in an open-addressing
+ * table pointing at its innermost binding. A binding links to the one it
+ * shadows, so leaving a scope unwinds the stack to the mark taken on entry
+ * and restores the outer bindings. Lookups are O(1) whatever the nesting.
+ */
+
+typedef struct scope_binding_t {
+    const atom_t *name;
+    uintptr_t value;
+    size_t shadowed; // index + 1 of the outer binding of name, 0 if none
+} scope_binding_t;
+
+typedef struct scope_slot_t {
+    const atom_t *name;
+    size_t top; // index + 1 of the innermost binding, 0 if none
+} scope_slot_t;
+
+typedef struct scope_map_t {
+    scope_binding_t *bindings;
+    size_t count;
+    size_t capacity;
+    scope_slot_t *slots;
+    size_t slots_used;
+    size_t slots_capacity;
+} scope_map_t;
+
+void scope_map_init(scope_map_t *map);
+void scope_map_free(scope_map_t *map);
+
+void scope_bind(scope_map_t *map, const atom_t *name, uintptr_t value);
+bool scope_lookup(scope_map_t *map, const atom_t *name, uintptr_t *value);
+// Like scope_lookup, but only sees bindings made since mark was taken
+bool scope_lookup_since(scope_map_t *map, const atom_t *name, size_t mark, uintptr_t *value);
+
+static inline size_t scope_mark(scope_map_t *map) {
+    return map->count;
+}
+
+void scope_pop(scope_map_t *map, size_t mark);
+
+#endif
@@ -0,0 +1,13 @@
+#include "str_view.h"
+#include "logger.h"
+#include <stdlib.h>
+
+char *sv_dup(str_view_t view) {
+    char *copy = (char *)malloc(view.length + 1);
+    if (!copy)
+        elog("Error allocation memory for string copy");
+
+    memcpy(copy, view.data, view.length);
+    copy[view.length] = '\0';
+    return copy;
+}
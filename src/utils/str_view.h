@@ -0,0 +1,31 @@
+#ifndef STR_VIEW_H
+#define STR_VIEW_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+// Non-owning slice of a string, usually pointing into the source buffer
+typedef struct str_view_t {
+    const char *data;
+    size_t length;
+} str_view_t;
+
+#define SV_FMT "%.*s"
+#define SV_ARG(view) (int)(view).length, (view).data
+
+static inline str_view_t sv_make(const char *data, size_t length) {
+    return (str_view_t){data, length};
+}
+
+static inline str_view_t sv_from_cstr(const char *cstr) {
+    return (str_view_t){cstr, strlen(cstr)};
+}
+
+static inline bool sv_eq(str_view_t a, str_view_t b) {
+    return a.length == b.length && (a.data == b.data || memcmp(a.data, b.data, a.length) == 0);
+}
+
+char *sv_dup(str_view_t view);
+
+#endif
@@ -0,0 +1,424 @@
+#include "bc_compiler.h"
+#include "../ast/ast_parser.h"
+#include "../ast/ast_printer.h"
+#include "../ast/ast_resolve.h"
+#include "../utils/logger.h"
+#include "../utils/scope_map.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Jumps of stop statements wait here until the end of their loop is known
+typedef struct loop_t {
+    struct loop_t *outer;
+    size_t start; // of the condition, where next jumps
+    size_t *stops;
+    size_t stops_count;
+    size_t stops_capacity;
+} loop_t;
+
+// Function being compiled, its code goes to the module once it's done
+typedef struct function_builder_t {
+    bc_instr_t *code;
+    size_t count;
+    size_t capacity;
+    uint32_t *slot_names;
+    uint32_t frame_size;
+    uint32_t depth; // values on the stack at the current instruction
+    uint32_t max_depth;
+    loop_t *loop;
+} function_builder_t;
+
+typedef struct compiler_t {
+    bc_module_t *module;
+    arena_t *arena;    // of the tree, lazy bodies are parsed into it
+    scope_map_t atoms; // atom -> index in module atoms
+    function_builder_t *function;
+} compiler_t;
+
+static uint32_t atom_index(compiler_t *compiler, const atom_t *atom) {
+    uintptr_t index;
+    if (scope_lookup(&compiler->atoms, atom, &index))
+        return (uint32_t)index;
+
+    index = bc_add_atom(compiler->module, atom);
+    if (index > BC_OPERAND_MAX)
+        elog("Too many names for bytecode, at '%s'", atom->text);
+    scope_bind(&compiler->atoms, atom, index);
+    return (uint32_t)index;
+}
+
+static size_t emit(compiler_t *compiler, bc_op op, uint32_t operand) {
+    function_builder_t *function = compiler->function;
+    if (operand > BC_OPERAND_MAX)
+        elog("Operand %u of %s doesn't fit an instruction", operand, bc_op_name(op));
+
+    if (function->count == function->capacity) {
+        function->capacity = function->capacity ? function->capacity * 2 : 64;
+        function->code = (bc_instr_t *)realloc(function->code, function->capacity * sizeof(bc_instr_t));
+        if (!function->code)
+            elog("Error reallocation memory for bytecode");
+    }
+    function->code[function->count] = bc_make(op, operand);
+
+    function->depth += bc_stack_effect(op, operand);
+    if (function->depth > function->max_depth)
+        function->max_depth = function->depth;
+    return function->count++;
+}
+
+static void set_jump(compiler_t *compiler, size_t at, size_t target) {
+    int64_t offset = (int64_t)target - (int64_t)at - 1;
+    if (offset < BC_JUMP_MIN || offset > BC_JUMP_MAX)
+        elog("Jump of %lld instructions is too long for bytecode", (long long)offset);
+
+    bc_instr_t *instr = &compiler->function->code[at];
+    *instr = bc_make(BC_OP(*instr), (uint32_t)offset & BC_OPERAND_MAX);
+}
+
+// Forward jumps are emitted with no offset and patched to land here
+static void patch_jump(compiler_t *compiler, size_t at) {
+    set_jump(compiler, at, compiler->function->count);
+}
+
+static void emit_jump_back(compiler_t *compiler, bc_op op, size_t target) {
+    size_t at = emit(compiler, op, 0);
+    set_jump(compiler, at, target);
+}
+
+static void name_slot(compiler_t *compiler, uint32_t slot, const atom_t *name) {
+    function_builder_t *function = compiler->function;
+    if (slot >= function->frame_size)
+        elog("Slot %u of '%s' is out of the frame of %u slots", slot, name->text, function->frame_size);
+    function->slot_names[slot] = atom_index(compiler, name);
+}
+
+static void compile_expression(compiler_t *compiler, ast_node *node);
+static void compile_statement(compiler_t *compiler, ast_node *node);
+static uint32_t compile_function(compiler_t *compiler, ast_node *declaration, ast_node *body,
+                                 arr_t *params, uint32_t frame_size);
+
+static void compile_variable(compiler_t *compiler, ast_node *node, bool set) {
+    uint32_t depth = node->identifier.depth;
+    if (depth == 0) {
+        emit(compiler, set ? BC_SET_LOCAL : BC_GET_LOCAL, node->slot);
+        return;
+    }
+    if (depth == SCOPE_UNRESOLVED) {
+        if (set)
+            elog("Cannot assign to undeclared variable '%s'", node->identifier.name->text);
+        emit(compiler, BC_GET_NATIVE, atom_index(compiler, node->identifier.name));
+        return;
+    }
+
+    if (depth > BC_OUTER_DEPTH_MAX || node->slot > BC_OUTER_SLOT_MAX)
+        elog("Variable '%s' is too far out for bytecode, %u frames up at slot %u",
+             node->identifier.name->text, depth, node->slot);
+    emit(compiler, set ? BC_SET_OUTER : BC_GET_OUTER, (depth << 16) | node->slot);
+}
+
+static void compile_assignment(compiler_t *compiler, ast_node *node) {
+    ast_node *target = node->assignment.left;
+    switch (target->type) {
+    case AST_IDENTIFIER:
+        compile_expression(compiler, node->assignment.right);
+        compile_variable(compiler, target, true);
+        return;
+    case AST_ARRAY_ACCESS:
+        compile_expression(compiler, target->array_access.array);
+        compile_expression(compiler, target->array_access.index);
+        compile_expression(compiler, node->assignment.right);
+        emit(compiler, BC_SET_INDEX, 0);
+        return;
+    case AST_PROPERTY_ACCESS:
+        compile_expression(compiler, target->property_access.object);
+        compile_expression(compiler, node->assignment.right);
+        emit(compiler, BC_SET_FIELD, atom_index(compiler, target->property_access.property));
+        return;
+    default:
+        elog("Can't assign to %s", ast_type_to_string(target->type));
+    }
+}
+
+// a && b is a, JUMP_IF_FALSE, b, TRUTHY, JUMP over a FALSE; || mirrors it
+static void compile_logical(compiler_t *compiler, ast_node *node) {
+    bool is_and = node->binary_op.op == OP_AND;
+    compile_expression(compiler, node->binary_op.left);
+    size_t decided = emit(compiler, is_and ? BC_JUMP_IF_FALSE : BC_JUMP_IF_TRUE, 0);
+    uint32_t depth = compiler->function->depth;
+
+    compile_expression(compiler, node->binary_op.right);
+    emit(compiler, BC_TRUTHY, 0);
+    size_t end = emit(compiler, BC_JUMP, 0);
+
+    compiler->function->depth = depth;
+    patch_jump(compiler, decided);
+    emit(compiler, is_and ? BC_FALSE : BC_TRUE, 0);
+    patch_jump(compiler, end);
+}
+
+static void compile_expression(compiler_t *compiler, ast_node *node) {
+    switch (node->type) {
+    case AST_NUMBER:
+        emit(compiler, BC_NUMBER, bc_add_number(compiler->module, node->number.value));
+        return;
+    case AST_STRING:
+        emit(compiler, BC_STRING, bc_add_string(compiler->module, node->string.value));
+        return;
+    case AST_BOOLEAN:
+        emit(compiler, node->boolean.value ? BC_TRUE : BC_FALSE, 0);
+        return;
+    case AST_NULL:
+        emit(compiler, BC_NULL, 0);
+        return;
+    case AST_IDENTIFIER:
+        compile_variable(compiler, node, false);
+        return;
+    case AST_ASSIGNMENT:
+        compile_assignment(compiler, node);
+        return;
+
+    case AST_BINARY_OP:
+        if (node->binary_op.op == OP_AND || node->binary_op.op == OP_OR) {
+            compile_logical(compiler, node);
+            return;
+        }
+        compile_expression(compiler, node->binary_op.left);
+        compile_expression(compiler, node->binary_op.right);
+        emit(compiler, (bc_op)(BC_ADD + node->binary_op.op), 0);
+        return;
+    case AST_UNARY_OP:
+        compile_expression(compiler, node->unary_op.operand);
+        emit(compiler, node->unary_op.op == OP_NOT ? BC_NOT : BC_NEGATE, 0);
+        return;
+
+    case AST_FUNCTION_CALL:
+    case AST_PRINT:
+    case AST_TAKE:
+        compile_expression(compiler, node->function_call.callee);
+        for (size_t i = 0; i < node->function_call.argument_count; i++)
+            compile_expression(compiler, node->function_call.arguments[i]);
+        emit(compiler, BC_CALL, (uint32_t)node->function_call.argument_count);
+        return;
+
+    case AST_ARRAY:
+        for (size_t i = 0; i < node->array.element_count; i++)
+            compile_expression(compiler, node->array.elements[i]);
+        emit(compiler, BC_ARRAY, (uint32_t)node->array.element_count);
+        return;
+    case AST_ARRAY_ACCESS:
+        compile_expression(compiler, node->array_access.array);
+        compile_expression(compiler, node->array_access.index);
+        emit(compiler, BC_INDEX, 0);
+        return;
+    case AST_PROPERTY_ACCESS:
+        compile_expression(compiler, node->property_access.object);
+        emit(compiler, BC_GET_FIELD, atom_index(compiler, node->property_access.property));
+        return;
+
+    default:
+        elog("%s is not an expression", ast_type_to_string(node->type));
+    }
+}
+
+static void compile_list(compiler_t *compiler, ast_node **statements, size_t count) {
+    for (size_t i = 0; i < count; i++)
+        compile_statement(compiler, statements[i]);
+}
+
+static void compile_loop(compiler_t *compiler, ast_node *node) {
+    loop_t loop = { .outer = compiler->function->loop, .start = compiler->function->count };
+    compiler->function->loop = &loop;
+
+    size_t exit = SIZE_MAX;
+    if (node->loop.condition) {
+        compile_expression(compiler, node->loop.condition);
+        exit = emit(compiler, BC_JUMP_IF_FALSE, 0);
+    }
+    compile_statement(compiler, node->loop.body);
+    emit_jump_back(compiler, BC_JUMP, loop.start);
+
+    if (exit != SIZE_MAX)
+        patch_jump(compiler, exit);
+    for (size_t i = 0; i < loop.stops_count; i++)
+        patch_jump(compiler, loop.stops[i]);
+
+    free(loop.stops);
+    compiler->function->loop = loop.outer;
+}
+
+static void compile_stop(compiler_t *compiler) {
+    loop_t *loop = compiler->function->loop;
+    if (!loop)
+        elog("'stop' outside of a loop");
+
+    if (loop->stops_count == loop->stops_capacity) {
+        loop->stops_capacity = loop->stops_capacity ? loop->stops_capacity * 2 : 4;
+        loop->stops = (size_t *)realloc(loop->stops, loop->stops_capacity * sizeof(size_t));
+        if (!loop->stops)
+            elog("Error reallocation memory for loop jumps");
+    }
+    loop->stops[loop->stops_count++] = emit(compiler, BC_JUMP, 0);
+}
+
+static void compile_statement(compiler_t *compiler, ast_node *node) {
+    switch (node->type) {
+    case AST_VAR_DECLARATION:
+    case AST_CONST_DECLARATION:
+        if (node->var_declaration.initializer)
+            compile_expression(compiler, node->var_declaration.initializer);
+        else
+            emit(compiler, BC_NULL, 0);
+        name_slot(compiler, node->slot, node->var_declaration.name);
+        emit(compiler, node->type == AST_CONST_DECLARATION ? BC_DEFINE_CONST : BC_DEFINE, node->slot);
+        return;
+
+    case AST_FUNCTION_DECLARATION: {
+        ast_node *body = function_body(node, compiler->arena);
+        uint32_t index = compile_function(compiler, node, body, node->function_declaration.parameters,
+                                          body->block.frame_size);
+        name_slot(compiler, node->slot, node->function_declaration.name);
+        emit(compiler, BC_CLOSURE, index);
+        emit(compiler, BC_DEFINE, node->slot);
+        return;
+    }
+
+    case AST_IF: {
+        compile_expression(compiler, node->if_statement.condition);
+        size_t skip = emit(compiler, BC_JUMP_IF_FALSE, 0);
+        compile_statement(compiler, node->if_statement.body);
+        patch_jump(compiler, skip);
+        return;
+    }
+    case AST_IF_ELSE: {
+        compile_expression(compiler, node->if_else_statement.condition);
+        size_t to_else = emit(compiler, BC_JUMP_IF_FALSE, 0);
+        compile_statement(compiler, node->if_else_statement.if_body);
+        size_t to_end = emit(compiler, BC_JUMP, 0);
+        patch_jump(compiler, to_else);
+        compile_statement(compiler, node->if_else_statement.else_body);
+        patch_jump(compiler, to_end);
+        return;
+    }
+    case AST_LOOP:
+        compile_loop(compiler, node);
+        return;
+    case AST_NEXT:
+        if (!compiler->function->loop)
+            elog("'next' outside of a loop");
+        emit_jump_back(compiler, BC_JUMP, compiler->function->loop->start);
+        return;
+    case AST_STOP:
+        compile_stop(compiler);
+        return;
+
+    case AST_RETURN:
+        if (node->return_statement.value) {
+            compile_expression(compiler, node->return_statement.value);
+            emit(compiler, BC_RETURN, 0);
+        } else {
+            emit(compiler, BC_RETURN_NULL, 0);
+        }
+        return;
+
+    case AST_BLOCK:
+        compile_list(compiler, (ast_node **)node->block.stmts->items, node->block.stmts->count);
+        return;
+    case AST_LAZY_BLOCK:
+        elog("Lazy function body reached the bytecode compiler unparsed");
+
+    default:
+        compile_expression(compiler, node);
+        emit(compiler, BC_POP, 0);
+        return;
+    }
+}
+
+// The record is reserved first, nested functions compiled meanwhile come
+// after it and its index stays valid
+static uint32_t compile_function(compiler_t *compiler, ast_node *declaration, ast_node *body,
+                                 arr_t *params, uint32_t frame_size) {
+    bc_module_t *module = compiler->module;
+    if (module->functions_count == module->functions_capacity) {
+        module->functions_capacity = module->functions_capacity ? module->functions_capacity * 2 : 16;
+        module->functions = (bc_function_t *)realloc(module->functions, module->functions_capacity * sizeof(bc_function_t));
+        if (!module->functions)
+            elog("Error reallocation memory for bytecode functions");
+    }
+    uint32_t index = (uint32_t)module->functions_count++;
+
+    function_builder_t function = { .frame_size = frame_size };
+    function.slot_names = (uint32_t *)malloc((frame_size + 1) * sizeof(uint32_t));
+    if (!function.slot_names)
+        elog("Error allocation memory for slot names");
+    for (uint32_t i = 0; i < frame_size; i++)
+        function.slot_names[i] = BC_NO_NAME;
+
+    function_builder_t *outer = compiler->function;
+    compiler->function = &function;
+
+    size_t param_count = params ? params->count : 0;
+    for (size_t i = 0; i < param_count; i++) {
+        ast_node *param = (ast_node *)params->items[i];
+        if (param->slot != i)
+            elog("Parameter '%s' is not in slot %zu", param->identifier.name->text, i);
+        name_slot(compiler, param->slot, param->identifier.name);
+    }
+
+    if (body->type == AST_PROGRAM)
+        compile_list(compiler, body->program.statements, body->program.statement_count);
+    else
+        compile_statement(compiler, body);
+    emit(compiler, BC_RETURN_NULL, 0);
+
+    // Append code and slot names to the module
+    if (module->code_count + function.count > UINT32_MAX)
+        elog("Program is too large for bytecode");
+    while (module->code_capacity < module->code_count + function.count) {
+        module->code_capacity = module->code_capacity ? module->code_capacity * 2 : 256;
+        module->code = (bc_instr_t *)realloc(module->code, module->code_capacity * sizeof(bc_instr_t));
+        if (!module->code)
+            elog("Error reallocation memory for bytecode");
+    }
+    while (module->slot_names_capacity < module->slot_names_count + frame_size) {
+        module->slot_names_capacity = module->slot_names_capacity ? module->slot_names_capacity * 2 : 64;
+        module->slot_names = (uint32_t *)realloc(module->slot_names, module->slot_names_capacity * sizeof(uint32_t));
+        if (!module->slot_names)
+            elog("Error reallocation memory for slot names");
+    }
+
+    bc_function_t *record = &module->functions[index];
+    memset(record, 0, sizeof(*record));
+    record->name = declaration ? atom_index(compiler, declaration->function_declaration.name) : BC_NO_NAME;
+    record->param_count = (uint32_t)param_count;
+    record->frame_size = frame_size;
+    record->max_stack = function.max_depth;
+    record->code_start = (uint32_t)module->code_count;
+    record->code_length = (uint32_t)function.count;
+    record->slot_names = (uint32_t)module->slot_names_count;
+
+    memcpy(module->code + module->code_count, function.code, function.count * sizeof(bc_instr_t));
+    module->code_count += function.count;
+    memcpy(module->slot_names + module->slot_names_count, function.slot_names, frame_size * sizeof(uint32_t));
+    module->slot_names_count += frame_size;
+
+    free(function.code);
+    free(function.slot_names);
+    compiler->function = outer;
+    return index;
+}
+
+bc_module_t *bc_compile(ast_node *program, arena_t *arena) {
+    if (!program || !arena)
+        elog("Can't compile, NULL ptr on program or arena");
+    if (program->type != AST_PROGRAM)
+        elog("Can't compile %s, expected a program", ast_type_to_string(program->type));
+
+    resolve_scopes(program, arena);
+
+    compiler_t compiler = { .module = new_bc_module(), .arena = arena };
+    scope_map_init(&compiler.atoms);
+    compile_function(&compiler, NULL, program, NULL, program->program.frame_size);
+    scope_map_free(&compiler.atoms);
+    return compiler.module;
+}
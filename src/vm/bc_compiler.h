@@ -0,0 +1,20 @@
+#ifndef BC_COMPILER_H
+#define BC_COMPILER_H
+
+#include "bytecode.h"
+#include "../ast/ast.h"
+#include "../utils/arena.h"
+
+/*
+ * Lowers a program to a bytecode module. The tree is resolved first (see
+ * resolve_scopes, lazy bodies are parsed into arena), so every variable
+ * is already a frame slot and the code never looks names up, except for
+ * natives. Each function declaration becomes a bc_function_t, the top
+ * level is function 0. Strings in the module are borrowed from the tree,
+ * the source must outlive the module unless it is saved and loaded back.
+ * Assigning to an undeclared name and next or stop outside of a loop are
+ * compile errors.
+ */
+bc_module_t *bc_compile(ast_node *program, arena_t *arena);
+
+#endif
@@ -0,0 +1,127 @@
+#include "bytecode.h"
+
+static const char *op_names[BC_OP_COUNT] = {
+    [BC_NUMBER] = "NUMBER",
+    [BC_STRING] = "STRING",
+    [BC_TRUE] = "TRUE",
+    [BC_FALSE] = "FALSE",
+    [BC_NULL] = "NULL",
+    [BC_POP] = "POP",
+    [BC_GET_LOCAL] = "GET_LOCAL",
+    [BC_SET_LOCAL] = "SET_LOCAL",
+    [BC_DEFINE] = "DEFINE",
+    [BC_DEFINE_CONST] = "DEFINE_CONST",
+    [BC_GET_OUTER] = "GET_OUTER",
+    [BC_SET_OUTER] = "SET_OUTER",
+    [BC_GET_NATIVE] = "GET_NATIVE",
+    [BC_ADD] = "ADD",
+    [BC_SUBTRACT] = "SUBTRACT",
+    [BC_MULTIPLY] = "MULTIPLY",
+    [BC_DIVIDE] = "DIVIDE",
+    [BC_EQUALS] = "EQUALS",
+    [BC_NOT_EQUALS] = "NOT_EQUALS",
+    [BC_GREATER] = "GREATER",
+    [BC_LESS] = "LESS",
+    [BC_GREATER_EQUAL] = "GREATER_EQUAL",
+    [BC_LESS_EQUAL] = "LESS_EQUAL",
+    [BC_NEGATE] = "NEGATE",
+    [BC_NOT] = "NOT",
+    [BC_TRUTHY] = "TRUTHY",
+    [BC_JUMP] = "JUMP",
+    [BC_JUMP_IF_FALSE] = "JUMP_IF_FALSE",
+    [BC_JUMP_IF_TRUE] = "JUMP_IF_TRUE",
+    [BC_CLOSURE] = "CLOSURE",
+    [BC_CALL] = "CALL",
+    [BC_RETURN] = "RETURN",
+    [BC_RETURN_NULL] = "RETURN_NULL",
+    [BC_ARRAY] = "ARRAY",
+    [BC_INDEX] = "INDEX",
+    [BC_SET_INDEX] = "SET_INDEX",
+    [BC_GET_FIELD] = "GET_FIELD",
+    [BC_SET_FIELD] = "SET_FIELD",
+};
+
+const char *bc_op_name(bc_op op) {
+    if (op >= BC_OP_COUNT || !op_names[op])
+        return "UNKNOWN";
+    return op_names[op];
+}
+
+static const char *atom_text(const bc_module_t *module, uint32_t index) {
+    return index < module->atoms_count ? module->atoms[index]->text : "?";
+}
+
+static const char *function_name(const bc_module_t *module, const bc_function_t *function) {
+    return function->name == BC_NO_NAME ? "<top level>" : atom_text(module, function->name);
+}
+
+static const char *slot_name(const bc_module_t *module, const bc_function_t *function, uint32_t slot) {
+    if (slot >= function->frame_size)
+        return "?";
+    uint32_t name = module->slot_names[function->slot_names + slot];
+    return name == BC_NO_NAME ? "?" : atom_text(module, name);
+}
+
+// One line, "  0012  JUMP_IF_FALSE  +5 -> 0018", returns the next offset
+size_t bc_disassemble_instr(const bc_module_t *module, const bc_function_t *function, size_t at, FILE *out) {
+    bc_instr_t instr = module->code[function->code_start + at];
+    bc_op op = BC_OP(instr);
+    uint32_t operand = BC_OPERAND(instr);
+
+    char detail[160] = "";
+    switch (op) {
+    case BC_NUMBER:
+        snprintf(detail, sizeof(detail), "%u ; %g", operand, operand < module->numbers_count ? module->numbers[operand] : 0.0);
+        break;
+    case BC_STRING:
+        if (operand < module->strings_count)
+            snprintf(detail, sizeof(detail), "%u ; \"%.*s\"", operand, (int)module->strings[operand].length, module->strings[operand].data);
+        break;
+    case BC_GET_LOCAL:
+    case BC_SET_LOCAL:
+    case BC_DEFINE:
+    case BC_DEFINE_CONST:
+        snprintf(detail, sizeof(detail), "%u ; %s", operand, slot_name(module, function, operand));
+        break;
+    case BC_GET_OUTER:
+    case BC_SET_OUTER:
+        snprintf(detail, sizeof(detail), "%u:%u", BC_OUTER_DEPTH(operand), BC_OUTER_SLOT(operand));
+        break;
+    case BC_GET_NATIVE:
+    case BC_GET_FIELD:
+    case BC_SET_FIELD:
+        snprintf(detail, sizeof(detail), "%u ; %s", operand, atom_text(module, operand));
+        break;
+    case BC_JUMP:
+    case BC_JUMP_IF_FALSE:
+    case BC_JUMP_IF_TRUE:
+        snprintf(detail, sizeof(detail), "%+d -> %04lld", BC_JUMP(instr), (long long)at + 1 + BC_JUMP(instr));
+        break;
+    case BC_CLOSURE:
+        if (operand < module->functions_count)
+            snprintf(detail, sizeof(detail), "%u ; %s", operand, function_name(module, &module->functions[operand]));
+        break;
+    case BC_CALL:
+    case BC_ARRAY:
+        snprintf(detail, sizeof(detail), "%u", operand);
+        break;
+    default:
+        break;
+    }
+    if (detail[0])
+        fprintf(out, "  %04zu  %-14s %s\n", at, bc_op_name(op), detail);
+    else
+        fprintf(out, "  %04zu  %s\n", at, bc_op_name(op));
+    return at + 1;
+}
+
+void bc_disassemble(const bc_module_t *module, FILE *out) {
+    for (size_t i = 0; i < module->functions_count; i++) {
+        const bc_function_t *function = &module->functions[i];
+        fprintf(out, "function %zu %s: %u params, %u slots, stack %u, %u instructions\n",
+                i, function_name(module, function), function->param_count,
+                function->frame_size, function->max_stack, function->code_length);
+        for (size_t at = 0; at < function->code_length;)
+            at = bc_disassemble_instr(module, function, at, out);
+    }
+}
@@ -0,0 +1,583 @@
+#include "bytecode.h"
+#include "../utils/logger.h"
+#include "../version.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define BC_ALIGN 8
+
+bc_module_t *new_bc_module(void) {
+    bc_module_t *module = (bc_module_t *)calloc(1, sizeof(bc_module_t));
+    if (!module)
+        elog("Error allocation memory for bc_module_t struct");
+    return module;
+}
+
+void free_bc_module(bc_module_t *module) {
+    if (!module)
+        return;
+
+    // Of a loaded module only the relocated tables are separate allocations
+    if (!module->file) {
+        free(module->functions);
+        free(module->code);
+        free(module->slot_names);
+        free(module->numbers);
+    }
+    free(module->strings);
+    free((void *)module->atoms);
+    free(module->file);
+    free(module);
+}
+
+static void *grow(void *items, size_t *capacity, size_t item_size) {
+    *capacity = *capacity ? *capacity * 2 : 16;
+    items = realloc(items, *capacity * item_size);
+    if (!items)
+        elog("Error reallocation memory for bytecode module");
+    return items;
+}
+
+uint32_t bc_add_number(bc_module_t *module, double number) {
+    if (module->numbers_count == module->numbers_capacity)
+        module->numbers = (double *)grow(module->numbers, &module->numbers_capacity, sizeof(double));
+    module->numbers[module->numbers_count] = number;
+    return (uint32_t)module->numbers_count++;
+}
+
+uint32_t bc_add_string(bc_module_t *module, str_view_t string) {
+    if (module->strings_count == module->strings_capacity)
+        module->strings = (str_view_t *)grow(module->strings, &module->strings_capacity, sizeof(str_view_t));
+    module->strings[module->strings_count] = string;
+    return (uint32_t)module->strings_count++;
+}
+
+uint32_t bc_add_atom(bc_module_t *module, const atom_t *atom) {
+    if (module->atoms_count == module->atoms_capacity)
+        module->atoms = (const atom_t **)grow((void *)module->atoms, &module->atoms_capacity, sizeof(atom_t *));
+    module->atoms[module->atoms_count] = atom;
+    return (uint32_t)module->atoms_count++;
+}
+
+int bc_stack_effect(bc_op op, uint32_t operand) {
+    switch (op) {
+    case BC_NUMBER:
+    case BC_STRING:
+    case BC_TRUE:
+    case BC_FALSE:
+    case BC_NULL:
+    case BC_GET_LOCAL:
+    case BC_GET_OUTER:
+    case BC_GET_NATIVE:
+    case BC_CLOSURE:
+        return 1;
+    case BC_POP:
+    case BC_DEFINE:
+    case BC_DEFINE_CONST:
+    case BC_JUMP_IF_FALSE:
+    case BC_JUMP_IF_TRUE:
+    case BC_RETURN:
+    case BC_INDEX:
+    case BC_SET_FIELD:
+        return -1;
+    case BC_ADD:
+    case BC_SUBTRACT:
+    case BC_MULTIPLY:
+    case BC_DIVIDE:
+    case BC_EQUALS:
+    case BC_NOT_EQUALS:
+    case BC_GREATER:
+    case BC_LESS:
+    case BC_GREATER_EQUAL:
+    case BC_LESS_EQUAL:
+        return -1;
+    case BC_SET_INDEX:
+        return -2;
+    case BC_CALL:
+        return -(int)operand;
+    case BC_ARRAY:
+        return 1 - (int)operand;
+    default:
+        return 0;
+    }
+}
+
+static size_t align_offset(size_t offset) {
+    return (offset + BC_ALIGN - 1) & ~(size_t)(BC_ALIGN - 1);
+}
+
+// Places a section of bytes at the next aligned offset, returns the offset
+static uint64_t put_section(char *file, size_t *size, const void *data, size_t bytes) {
+    size_t offset = align_offset(*size);
+    memset(file + *size, 0, offset - *size);
+    if (bytes)
+        memcpy(file + offset, data, bytes);
+    *size = offset + bytes;
+    return offset;
+}
+
+static bool write_all(int fd, const char *data, size_t size) {
+    while (size) {
+        ssize_t written = write(fd, data, size);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        data += written;
+        size -= (size_t)written;
+    }
+    return true;
+}
+
+bool bc_module_save(const bc_module_t *module, const char *path) {
+    if (!module || !path)
+        elog("Can't save bytecode, NULL ptr on module or path");
+
+    size_t blob_length = 0;
+    for (size_t i = 0; i < module->strings_count; i++)
+        blob_length += module->strings[i].length;
+    for (size_t i = 0; i < module->atoms_count; i++)
+        blob_length += module->atoms[i]->length;
+    if (blob_length > UINT32_MAX || module->code_count > UINT32_MAX
+        || module->slot_names_count > UINT32_MAX || module->numbers_count > UINT32_MAX) {
+        wlog("Program is too large for a bytecode file");
+        return false;
+    }
+
+    bc_file_span_t *spans = (bc_file_span_t *)malloc((module->strings_count + module->atoms_count + 1) * sizeof(bc_file_span_t));
+    char *blob = (char *)malloc(blob_length + 1);
+    if (!spans || !blob)
+        elog("Error allocation memory for bytecode string tables");
+
+    size_t blob_used = 0;
+    for (size_t i = 0; i < module->strings_count; i++) {
+        spans[i] = (bc_file_span_t){ (uint32_t)blob_used, (uint32_t)module->strings[i].length };
+        memcpy(blob + blob_used, module->strings[i].data, module->strings[i].length);
+        blob_used += module->strings[i].length;
+    }
+    bc_file_span_t *atom_spans = spans + module->strings_count;
+    for (size_t i = 0; i < module->atoms_count; i++) {
+        atom_spans[i] = (bc_file_span_t){ (uint32_t)blob_used, module->atoms[i]->length };
+        memcpy(blob + blob_used, module->atoms[i]->text, module->atoms[i]->length);
+        blob_used += module->atoms[i]->length;
+    }
+
+    // Upper bound, every section may need BC_ALIGN - 1 bytes of padding
+    size_t capacity = sizeof(bc_file_header_t) + 7 * BC_ALIGN
+                    + module->functions_count * sizeof(bc_function_t)
+                    + module->code_count * sizeof(bc_instr_t)
+                    + module->slot_names_count * sizeof(uint32_t)
+                    + module->numbers_count * sizeof(double)
+                    + (module->strings_count + module->atoms_count) * sizeof(bc_file_span_t)
+                    + blob_length;
+    char *file = (char *)malloc(capacity);
+    if (!file)
+        elog("Error allocation memory for bytecode file");
+
+    bc_file_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BC_FILE_MAGIC, sizeof(header.magic));
+    header.format = BC_FILE_FORMAT;
+    strncpy(header.version, NOJS_VERSION, sizeof(header.version));
+    header.functions_count = (uint32_t)module->functions_count;
+    header.code_count = (uint32_t)module->code_count;
+    header.slot_names_count = (uint32_t)module->slot_names_count;
+    header.numbers_count = (uint32_t)module->numbers_count;
+    header.strings_count = (uint32_t)module->strings_count;
+    header.atoms_count = (uint32_t)module->atoms_count;
+    header.blob_length = (uint32_t)blob_length;
+
+    size_t size = sizeof(header);
+    header.functions = put_section(file, &size, module->functions, module->functions_count * sizeof(bc_function_t));
+    header.code = put_section(file, &size, module->code, module->code_count * sizeof(bc_instr_t));
+    header.slot_names = put_section(file, &size, module->slot_names, module->slot_names_count * sizeof(uint32_t));
+    header.numbers = put_section(file, &size, module->numbers, module->numbers_count * sizeof(double));
+    header.strings = put_section(file, &size, spans, module->strings_count * sizeof(bc_file_span_t));
+    header.atoms = put_section(file, &size, atom_spans, module->atoms_count * sizeof(bc_file_span_t));
+    header.blob = put_section(file, &size, blob, blob_length);
+    header.size = size;
+    memcpy(file, &header, sizeof(header));
+
+    char temp[4096 + 32];
+    int written = snprintf(temp, sizeof(temp), "%s.%ld.tmp", path, (long)getpid());
+    if (written < 0 || (size_t)written >= sizeof(temp))
+        elog("Bytecode file path %s is too long", path);
+
+    bool stored = false;
+    int fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd >= 0) {
+        stored = write_all(fd, file, size);
+        stored = close(fd) == 0 && stored;
+        stored = stored && rename(temp, path) == 0;
+        if (!stored)
+            unlink(temp);
+    }
+    if (!stored)
+        wlog("Can't write bytecode file %s: %s", path, strerror(errno));
+
+    free(file);
+    free(blob);
+    free(spans);
+    return stored;
+}
+
+// Section [offset, offset + bytes) lies inside the file and is aligned
+static bool section_fits(uint64_t offset, uint64_t bytes, uint64_t size) {
+    return offset % BC_ALIGN == 0 && offset <= size && bytes <= size - offset;
+}
+
+static bool header_valid(const bc_file_header_t *header, size_t size) {
+    char version[sizeof(header->version)] = { 0 };
+    strncpy(version, NOJS_VERSION, sizeof(version));
+
+    if (memcmp(header->magic, BC_FILE_MAGIC, sizeof(header->magic)) != 0
+        || header->format != BC_FILE_FORMAT
+        || memcmp(header->version, version, sizeof(version)) != 0
+        || header->size != size
+        || header->functions_count == 0)
+        return false;
+
+    return section_fits(header->functions, (uint64_t)header->functions_count * sizeof(bc_function_t), size)
+        && section_fits(header->code, (uint64_t)header->code_count * sizeof(bc_instr_t), size)
+        && section_fits(header->slot_names, (uint64_t)header->slot_names_count * sizeof(uint32_t), size)
+        && section_fits(header->numbers, (uint64_t)header->numbers_count * sizeof(double), size)
+        && section_fits(header->strings, (uint64_t)header->strings_count * sizeof(bc_file_span_t), size)
+        && section_fits(header->atoms, (uint64_t)header->atoms_count * sizeof(bc_file_span_t), size)
+        && section_fits(header->blob, header->blob_length, size);
+}
+
+static bool span_valid(bc_file_span_t span, uint32_t blob_length) {
+    return span.offset <= blob_length && span.length <= blob_length - span.offset;
+}
+
+// Values the instruction reads off the stack, at least what it pops
+static uint32_t stack_inputs(bc_op op, uint32_t operand) {
+    switch (op) {
+    case BC_POP:
+    case BC_SET_LOCAL:
+    case BC_DEFINE:
+    case BC_DEFINE_CONST:
+    case BC_SET_OUTER:
+    case BC_NEGATE:
+    case BC_NOT:
+    case BC_TRUTHY:
+    case BC_JUMP_IF_FALSE:
+    case BC_JUMP_IF_TRUE:
+    case BC_RETURN:
+    case BC_GET_FIELD:
+        return 1;
+    case BC_ADD:
+    case BC_SUBTRACT:
+    case BC_MULTIPLY:
+    case BC_DIVIDE:
+    case BC_EQUALS:
+    case BC_NOT_EQUALS:
+    case BC_GREATER:
+    case BC_LESS:
+    case BC_GREATER_EQUAL:
+    case BC_LESS_EQUAL:
+    case BC_INDEX:
+    case BC_SET_FIELD:
+        return 2;
+    case BC_SET_INDEX:
+        return 3;
+    case BC_CALL:
+        return operand + 1;
+    case BC_ARRAY:
+        return operand;
+    default:
+        return 0;
+    }
+}
+
+// Walks every path through the code with the stack depth the VM would have:
+// no instruction pops more than is there, none pushes past max_stack (the
+// overflow check of a call trusts it), every path into an instruction
+// agrees on the depth and none falls off the end. Unreachable code is
+// left alone, the VM never gets to it.
+static bool stack_valid(const bc_instr_t *code, const bc_function_t *function) {
+    uint32_t length = function->code_length;
+    int64_t *depths = (int64_t *)malloc(length * sizeof(int64_t));
+    uint32_t *pending = (uint32_t *)malloc(length * sizeof(uint32_t));
+    if (!depths || !pending)
+        elog("Error allocation memory for bytecode validation");
+    for (uint32_t at = 0; at < length; at++)
+        depths[at] = -1;
+
+    size_t pending_count = 0;
+    depths[0] = 0;
+    pending[pending_count++] = 0;
+
+    bool valid = true;
+    while (valid && pending_count > 0) {
+        uint32_t at = pending[--pending_count];
+        bc_op op = BC_OP(code[at]);
+        uint32_t operand = BC_OPERAND(code[at]);
+
+        int64_t depth = depths[at];
+        if (depth < stack_inputs(op, operand)) {
+            valid = false;
+            break;
+        }
+        depth += bc_stack_effect(op, operand);
+        if (depth > function->max_stack) {
+            valid = false;
+            break;
+        }
+
+        // Each instruction goes on the list once, when its depth is first set
+        int64_t next[2];
+        int next_count = 0;
+        if (op == BC_RETURN || op == BC_RETURN_NULL)
+            continue;
+        if (op != BC_JUMP)
+            next[next_count++] = (int64_t)at + 1;
+        if (op == BC_JUMP || op == BC_JUMP_IF_FALSE || op == BC_JUMP_IF_TRUE)
+            next[next_count++] = (int64_t)at + 1 + BC_JUMP(code[at]);
+
+        for (int i = 0; i < next_count; i++) {
+            if (next[i] >= length) {
+                valid = false;
+                break;
+            }
+            if (depths[next[i]] < 0) {
+                depths[next[i]] = depth;
+                pending[pending_count++] = (uint32_t)next[i];
+            } else if (depths[next[i]] != depth) {
+                valid = false;
+                break;
+            }
+        }
+    }
+
+    free(depths);
+    free(pending);
+    return valid;
+}
+
+// Every index an instruction carries points into its pool, every jump
+// stays in its function and the stack holds up on every path, so a damaged
+// file can't make the VM read or write out of bounds. Outer variables are
+// checked in nesting_valid once all functions are.
+static bool function_valid(const bc_module_t *module, const bc_function_t *function) {
+    if (function->code_start > module->code_count
+        || function->code_length > module->code_count - function->code_start
+        || function->code_length == 0
+        || function->slot_names > module->slot_names_count
+        || function->frame_size > module->slot_names_count - function->slot_names
+        || function->param_count > function->frame_size
+        || (function->name != BC_NO_NAME && function->name >= module->atoms_count))
+        return false;
+
+    for (uint32_t slot = 0; slot < function->frame_size; slot++) {
+        uint32_t name = module->slot_names[function->slot_names + slot];
+        if (name != BC_NO_NAME && name >= module->atoms_count)
+            return false;
+    }
+
+    const bc_instr_t *code = module->code + function->code_start;
+    for (uint32_t at = 0; at < function->code_length; at++) {
+        bc_instr_t instr = code[at];
+        uint32_t operand = BC_OPERAND(instr);
+        switch (BC_OP(instr)) {
+        case BC_NUMBER:
+            if (operand >= module->numbers_count)
+                return false;
+            break;
+        case BC_STRING:
+            if (operand >= module->strings_count)
+                return false;
+            break;
+        case BC_GET_NATIVE:
+        case BC_GET_FIELD:
+        case BC_SET_FIELD:
+            if (operand >= module->atoms_count)
+                return false;
+            break;
+        case BC_CLOSURE:
+            if (operand == 0 || operand >= module->functions_count)
+                return false;
+            break;
+        case BC_GET_LOCAL:
+        case BC_SET_LOCAL:
+        case BC_DEFINE:
+        case BC_DEFINE_CONST:
+            if (operand >= function->frame_size)
+                return false;
+            break;
+        case BC_JUMP:
+        case BC_JUMP_IF_FALSE:
+        case BC_JUMP_IF_TRUE: {
+            int64_t target = (int64_t)at + 1 + BC_JUMP(instr);
+            if (target < 0 || target >= function->code_length)
+                return false;
+            break;
+        }
+        default:
+            if (BC_OP(instr) >= BC_OP_COUNT)
+                return false;
+            break;
+        }
+    }
+    return stack_valid(code, function);
+}
+
+// Outer variables name a frame by how many functions out it is and a slot
+// in it. Each function but the top level is made by one CLOSURE in the
+// function around it, which the compiler numbers first, so the nesting is
+// known from the code: the depth must stay inside it and the slot inside
+// the frame of the function it reaches.
+static bool nesting_valid(const bc_module_t *module) {
+    size_t count = module->functions_count;
+    uint32_t *parents = (uint32_t *)malloc(count * sizeof(uint32_t));
+    uint32_t *levels = (uint32_t *)malloc(count * sizeof(uint32_t));
+    if (!parents || !levels)
+        elog("Error allocation memory for bytecode validation");
+    for (size_t i = 0; i < count; i++)
+        parents[i] = BC_NO_NAME;
+
+    bool valid = true;
+    for (size_t i = 0; i < count && valid; i++) {
+        const bc_function_t *function = &module->functions[i];
+        const bc_instr_t *code = module->code + function->code_start;
+        for (uint32_t at = 0; at < function->code_length; at++) {
+            if (BC_OP(code[at]) != BC_CLOSURE)
+                continue;
+            uint32_t child = BC_OPERAND(code[at]);
+            if (child <= i || parents[child] != BC_NO_NAME) {
+                valid = false;
+                break;
+            }
+            parents[child] = (uint32_t)i;
+        }
+    }
+
+    levels[0] = 0;
+    for (size_t i = 1; i < count && valid; i++) {
+        if (parents[i] == BC_NO_NAME)
+            valid = false;
+        else
+            levels[i] = levels[parents[i]] + 1;
+    }
+
+    for (size_t i = 0; i < count && valid; i++) {
+        const bc_function_t *function = &module->functions[i];
+        const bc_instr_t *code = module->code + function->code_start;
+        for (uint32_t at = 0; at < function->code_length; at++) {
+            bc_op op = BC_OP(code[at]);
+            if (op != BC_GET_OUTER && op != BC_SET_OUTER)
+                continue;
+
+            uint32_t depth = BC_OUTER_DEPTH(BC_OPERAND(code[at]));
+            if (depth > levels[i]) {
+                valid = false;
+                break;
+            }
+            uint32_t outer = (uint32_t)i;
+            while (depth--)
+                outer = parents[outer];
+            if (BC_OUTER_SLOT(BC_OPERAND(code[at])) >= module->functions[outer].frame_size) {
+                valid = false;
+                break;
+            }
+        }
+    }
+
+    free(parents);
+    free(levels);
+    return valid;
+}
+
+bc_module_t *bc_module_load(const char *path) {
+    if (!path)
+        elog("Can't load bytecode, NULL ptr on path");
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(bc_file_header_t)) {
+        close(fd);
+        return NULL;
+    }
+
+    size_t size = (size_t)st.st_size;
+    char *file = (char *)malloc(size);
+    if (!file)
+        elog("Error allocation memory for bytecode file %s", path);
+
+    size_t done = 0;
+    while (done < size) {
+        ssize_t got = read(fd, file + done, size - done);
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got <= 0)
+            break;
+        done += (size_t)got;
+    }
+    close(fd);
+
+    const bc_file_header_t *header = (const bc_file_header_t *)file;
+    if (done != size || !header_valid(header, size)) {
+        free(file);
+        return NULL;
+    }
+
+    bc_module_t *module = new_bc_module();
+    module->file = file;
+    module->functions = (bc_function_t *)(file + header->functions);
+    module->functions_count = header->functions_count;
+    module->code = (bc_instr_t *)(file + header->code);
+    module->code_count = header->code_count;
+    module->slot_names = (uint32_t *)(file + header->slot_names);
+    module->slot_names_count = header->slot_names_count;
+    module->numbers = (double *)(file + header->numbers);
+    module->numbers_count = header->numbers_count;
+
+    // Relocation, the only tables that hold pointers
+    const char *blob = file + header->blob;
+    const bc_file_span_t *strings = (const bc_file_span_t *)(file + header->strings);
+    const bc_file_span_t *atoms = (const bc_file_span_t *)(file + header->atoms);
+
+    module->strings = (str_view_t *)malloc((header->strings_count + 1) * sizeof(str_view_t));
+    module->atoms = (const atom_t **)malloc((header->atoms_count + 1) * sizeof(const atom_t *));
+    if (!module->strings || !module->atoms)
+        elog("Error allocation memory for bytecode string tables");
+
+    for (uint32_t i = 0; i < header->strings_count; i++) {
+        if (!span_valid(strings[i], header->blob_length)) {
+            free_bc_module(module);
+            return NULL;
+        }
+        module->strings[i] = sv_make(blob + strings[i].offset, strings[i].length);
+    }
+    module->strings_count = header->strings_count;
+
+    for (uint32_t i = 0; i < header->atoms_count; i++) {
+        if (!span_valid(atoms[i], header->blob_length)) {
+            free_bc_module(module);
+            return NULL;
+        }
+        module->atoms[i] = atom_intern(blob + atoms[i].offset, atoms[i].length);
+    }
+    module->atoms_count = header->atoms_count;
+
+    for (size_t i = 0; i < module->functions_count; i++) {
+        if (!function_valid(module, &module->functions[i])) {
+            free_bc_module(module);
+            return NULL;
+        }
+    }
+    if (!nesting_valid(module)) {
+        free_bc_module(module);
+        return NULL;
+    }
+    return module;
+}
@@ -0,0 +1,194 @@
+#ifndef BYTECODE_H
+#define BYTECODE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "../utils/atom.h"
+#include "../utils/str_view.h"
+
+/*
+ * Bytecode for the stack VM. An instruction is one 32 bit word, the opcode
+ * in the low byte and a 24 bit operand above it: a constant, atom or
+ * function index, a slot, a count, or a jump offset relative to the next
+ * instruction (signed). Outer variables pack the frame depth in the top 8
+ * bits of the operand and the slot in the low 16.
+ *
+ * A module is one program: all functions share one code array and the
+ * constant pools, function 0 is the top level. Control flow (if, loop,
+ * next, stop, && and ||) is lowered to jumps, so the VM never recurses.
+ *
+ * The .njb file is the module as sections behind a bc_file_header_t, each
+ * on an 8 byte boundary, in host byte order like the AST cache:
+ *   functions   bc_function_t records
+ *   code        bc_instr_t words
+ *   slot_names  atoms index per frame slot, see bc_function_t
+ *   numbers     double
+ *   strings     (offset, length) spans into the blob
+ *   atoms       (offset, length) spans into the blob
+ *   blob        string and atom bytes
+ */
+
+typedef uint32_t bc_instr_t;
+
+#define BC_OPERAND_MAX 0xffffff
+#define BC_JUMP_MIN (-0x800000)
+#define BC_JUMP_MAX 0x7fffff
+#define BC_OUTER_DEPTH_MAX 0xff
+#define BC_OUTER_SLOT_MAX 0xffff
+#define BC_NO_NAME UINT32_MAX
+
+#define BC_OP(instr) ((bc_op)((instr) & 0xff))
+#define BC_OPERAND(instr) ((uint32_t)(instr) >> 8)
+#define BC_JUMP(instr) ((int32_t)(instr) >> 8)
+#define BC_OUTER_DEPTH(operand) ((operand) >> 16)
+#define BC_OUTER_SLOT(operand) ((operand) & 0xffff)
+
+static inline bc_instr_t bc_make(uint8_t op, uint32_t operand) {
+    return (bc_instr_t)op | (operand << 8);
+}
+
+typedef enum bc_op {
+    BC_NUMBER,        // push numbers[operand]
+    BC_STRING,        // push strings[operand]
+    BC_TRUE,
+    BC_FALSE,
+    BC_NULL,
+    BC_POP,
+
+    BC_GET_LOCAL,     // push slot
+    BC_SET_LOCAL,     // slot = top, keeps it
+    BC_DEFINE,        // slot = pop
+    BC_DEFINE_CONST,  // slot = pop, reassigning it raises
+    BC_GET_OUTER,     // (depth, slot)
+    BC_SET_OUTER,
+    BC_GET_NATIVE,    // natives by atoms[operand]
+
+    // Same order as binary_op_type, pop two, push one
+    BC_ADD,
+    BC_SUBTRACT,
+    BC_MULTIPLY,
+    BC_DIVIDE,
+    BC_EQUALS,
+    BC_NOT_EQUALS,
+    BC_GREATER,
+    BC_LESS,
+    BC_GREATER_EQUAL,
+    BC_LESS_EQUAL,
+    BC_NEGATE,
+    BC_NOT,
+    BC_TRUTHY,        // top to a boolean, for && and ||
+
+    BC_JUMP,
+    BC_JUMP_IF_FALSE, // pops the condition
+    BC_JUMP_IF_TRUE,
+
+    BC_CLOSURE,       // push a function value of functions[operand]
+    BC_CALL,          // callee and operand arguments on the stack
+    BC_RETURN,        // pop the result
+    BC_RETURN_NULL,
+
+    BC_ARRAY,         // operand elements on the stack
+    BC_INDEX,         // array, index
+    BC_SET_INDEX,     // array, index, value, keeps value
+    BC_GET_FIELD,     // object, field atoms[operand]
+    BC_SET_FIELD,     // object, value, keeps value
+
+    BC_OP_COUNT
+} bc_op;
+
+typedef struct bc_function_t {
+    uint32_t name;        // atoms index, BC_NO_NAME for the top level
+    uint32_t param_count; // parameters take slots 0 .. param_count - 1
+    uint32_t frame_size;
+    uint32_t max_stack;   // values the code pushes at most
+    uint32_t code_start;  // in module code
+    uint32_t code_length;
+    uint32_t slot_names;  // frame_size atoms indexes in slot_names
+    uint32_t reserved;
+} bc_function_t;
+
+typedef struct bc_module_t {
+    bc_function_t *functions;
+    size_t functions_count;
+    size_t functions_capacity;
+
+    bc_instr_t *code;
+    size_t code_count;
+    size_t code_capacity;
+
+    uint32_t *slot_names; // BC_NO_NAME for a slot never declared
+    size_t slot_names_count;
+    size_t slot_names_capacity;
+
+    double *numbers;
+    size_t numbers_count;
+    size_t numbers_capacity;
+
+    str_view_t *strings;
+    size_t strings_count;
+    size_t strings_capacity;
+
+    const atom_t **atoms;
+    size_t atoms_count;
+    size_t atoms_capacity;
+
+    char *file; // a loaded module's sections and strings live here
+} bc_module_t;
+
+#define BC_FILE_MAGIC "NJB"
+#define BC_FILE_FORMAT 1
+#define BC_FILE_EXTENSION ".njb"
+
+typedef struct bc_file_span_t {
+    uint32_t offset; // into the blob
+    uint32_t length;
+} bc_file_span_t;
+
+typedef struct bc_file_header_t {
+    char magic[4];
+    uint32_t format;
+    char version[16]; // NOJS_VERSION, NUL padded
+    uint64_t size;    // of the whole file
+
+    uint32_t functions_count;
+    uint32_t code_count;
+    uint32_t slot_names_count;
+    uint32_t numbers_count;
+    uint32_t strings_count;
+    uint32_t atoms_count;
+    uint32_t blob_length;
+    uint32_t reserved;
+
+    uint64_t functions;
+    uint64_t code;
+    uint64_t slot_names;
+    uint64_t numbers;
+    uint64_t strings;
+    uint64_t atoms;
+    uint64_t blob;
+} bc_file_header_t;
+
+bc_module_t *new_bc_module(void);
+void free_bc_module(bc_module_t *module);
+
+// Append to the pools and return the index, nothing is deduplicated
+uint32_t bc_add_number(bc_module_t *module, double number);
+uint32_t bc_add_string(bc_module_t *module, str_view_t string);
+uint32_t bc_add_atom(bc_module_t *module, const atom_t *atom);
+
+// Values the instruction leaves on the stack minus the ones it takes, the
+// compiler sizes max_stack with it and the loader checks it
+int bc_stack_effect(bc_op op, uint32_t operand);
+
+// false (with a warning) if the file can't be written
+bool bc_module_save(const bc_module_t *module, const char *path);
+// NULL if the file is missing, of another format or version, or malformed
+bc_module_t *bc_module_load(const char *path);
+
+const char *bc_op_name(bc_op op);
+void bc_disassemble(const bc_module_t *module, FILE *out);
+size_t bc_disassemble_instr(const bc_module_t *module, const bc_function_t *function, size_t at, FILE *out);
+
+#endif
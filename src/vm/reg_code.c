@@ -0,0 +1,221 @@
+#include "reg_code.h"
+#include "../utils/logger.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+rg_module_t *new_rg_module(void) {
+    rg_module_t *module = (rg_module_t *)calloc(1, sizeof(rg_module_t));
+    if (!module)
+        elog("Error allocation memory for rg_module_t struct");
+    return module;
+}
+
+void free_rg_module(rg_module_t *module) {
+    if (!module)
+        return;
+
+    for (size_t i = 0; i < module->functions_count; i++) {
+        rg_function_t *function = &module->functions[i];
+        free(function->constants);
+        free((void *)function->register_names);
+        free(function->code);
+    }
+    free(module->functions);
+    free((void *)module->atoms);
+    free(module);
+}
+
+static const char *op_names[RG_OP_COUNT] = {
+    [RG_MOVE] = "MOVE",
+    [RG_LOAD_NULL] = "LOAD_NULL",
+    [RG_LOAD_TRUE] = "LOAD_TRUE",
+    [RG_LOAD_FALSE] = "LOAD_FALSE",
+    [RG_MARK_CONST] = "MARK_CONST",
+    [RG_GET_OUTER] = "GET_OUTER",
+    [RG_SET_OUTER] = "SET_OUTER",
+    [RG_GET_NATIVE] = "GET_NATIVE",
+    [RG_ADD] = "ADD",
+    [RG_SUBTRACT] = "SUBTRACT",
+    [RG_MULTIPLY] = "MULTIPLY",
+    [RG_DIVIDE] = "DIVIDE",
+    [RG_EQUALS] = "EQUALS",
+    [RG_NOT_EQUALS] = "NOT_EQUALS",
+    [RG_GREATER] = "GREATER",
+    [RG_LESS] = "LESS",
+    [RG_GREATER_EQUAL] = "GREATER_EQUAL",
+    [RG_LESS_EQUAL] = "LESS_EQUAL",
+    [RG_NEGATE] = "NEGATE",
+    [RG_NOT] = "NOT",
+    [RG_TRUTHY] = "TRUTHY",
+    [RG_JUMP] = "JUMP",
+    [RG_JUMP_IF_FALSE] = "JUMP_IF_FALSE",
+    [RG_JUMP_IF_TRUE] = "JUMP_IF_TRUE",
+    [RG_CLOSURE] = "CLOSURE",
+    [RG_CALL] = "CALL",
+    [RG_RETURN] = "RETURN",
+    [RG_RETURN_NULL] = "RETURN_NULL",
+    [RG_ARRAY] = "ARRAY",
+    [RG_INDEX] = "INDEX",
+    [RG_SET_INDEX] = "SET_INDEX",
+    [RG_GET_FIELD] = "GET_FIELD",
+    [RG_SET_FIELD] = "SET_FIELD",
+};
+
+const char *rg_op_name(rg_op op) {
+    if (op >= RG_OP_COUNT || !op_names[op])
+        return "UNKNOWN";
+    return op_names[op];
+}
+
+static const char *atom_text(const rg_module_t *module, uint32_t index) {
+    return index < module->atoms_count ? module->atoms[index]->text : "?";
+}
+
+static const char *function_name(const rg_function_t *function) {
+    return function->name ? function->name->text : "<top level>";
+}
+
+// r3 for a register, k1 for a constant, whose value goes to the comment
+static int operand(char *out, size_t size, const rg_function_t *function, uint32_t reg) {
+    if (reg < function->register_count)
+        return snprintf(out, size, "r%u", reg);
+    return snprintf(out, size, "k%u", reg - function->register_count);
+}
+
+static void comment(char *out, size_t size, const rg_function_t *function, uint32_t reg) {
+    size_t used = strlen(out);
+    if (used >= size)
+        return;
+    out += used;
+    size -= used;
+
+    if (reg < function->register_count) {
+        if (function->register_names[reg])
+            snprintf(out, size, " %s", function->register_names[reg]->text);
+        return;
+    }
+    value_t constant = function->constants[reg - function->register_count];
+    if (value_is_number(constant)) {
+        snprintf(out, size, " %g", value_as_number(constant));
+    } else {
+        str_view_t text = value_as_string(constant);
+        snprintf(out, size, " \"%.*s\"", (int)text.length, text.data);
+    }
+}
+
+// One line, "  0004  ADD            r1, r1, k0 ; i 1"
+static size_t disassemble_instr(const rg_module_t *module, const rg_function_t *function, size_t at, FILE *out) {
+    rg_instr_t instr = function->code[at];
+    char detail[160] = "";
+    char notes[160] = "";
+    int n = 0;
+
+// Long argument lists are cut at the end of the buffers
+#define REG(reg) do { \
+        if (n < (int)sizeof(detail)) \
+            n += operand(detail + n, sizeof(detail) - n, function, reg); \
+        comment(notes, sizeof(notes), function, reg); \
+    } while (0)
+#define TEXT(...) do { \
+        if (n < (int)sizeof(detail)) \
+            n += snprintf(detail + n, sizeof(detail) - n, __VA_ARGS__); \
+    } while (0)
+
+    switch ((rg_op)instr.op) {
+    case RG_MOVE:
+    case RG_NEGATE:
+    case RG_NOT:
+    case RG_TRUTHY:
+        REG(instr.a); TEXT(", "); REG(instr.b);
+        break;
+    case RG_LOAD_NULL:
+    case RG_LOAD_TRUE:
+    case RG_LOAD_FALSE:
+    case RG_MARK_CONST:
+    case RG_RETURN:
+        REG(instr.a);
+        break;
+    case RG_GET_OUTER:
+    case RG_SET_OUTER:
+        REG(instr.a); TEXT(", %u:%u", instr.b, instr.c);
+        break;
+    case RG_GET_NATIVE:
+        REG(instr.a); TEXT(", %u", instr.index);
+        snprintf(notes, sizeof(notes), " %s", atom_text(module, instr.index));
+        break;
+    case RG_ADD:
+    case RG_SUBTRACT:
+    case RG_MULTIPLY:
+    case RG_DIVIDE:
+    case RG_EQUALS:
+    case RG_NOT_EQUALS:
+    case RG_GREATER:
+    case RG_LESS:
+    case RG_GREATER_EQUAL:
+    case RG_LESS_EQUAL:
+    case RG_INDEX:
+    case RG_SET_INDEX:
+        REG(instr.a); TEXT(", "); REG(instr.b); TEXT(", "); REG(instr.c);
+        break;
+    case RG_JUMP:
+        TEXT("%+d -> %04lld", instr.jump, (long long)at + 1 + instr.jump);
+        break;
+    case RG_JUMP_IF_FALSE:
+    case RG_JUMP_IF_TRUE:
+        REG(instr.a); TEXT(", %+d -> %04lld", instr.jump, (long long)at + 1 + instr.jump);
+        break;
+    case RG_CLOSURE:
+        REG(instr.a); TEXT(", %u", instr.index);
+        if (instr.index < module->functions_count)
+            snprintf(notes, sizeof(notes), " %s", function_name(&module->functions[instr.index]));
+        break;
+    case RG_CALL:
+    case RG_ARRAY:
+        REG(instr.a);
+        if (instr.op == RG_CALL) {
+            TEXT(", ");
+            REG(instr.b);
+        }
+        TEXT(", (");
+        for (uint32_t i = 0; i < instr.c; i++) {
+            if (i)
+                TEXT(", ");
+            REG(function->code[at + 1 + i / 4].args[i % 4]);
+        }
+        TEXT(")");
+        break;
+    case RG_GET_FIELD:
+        REG(instr.a); TEXT(", "); REG(instr.b); TEXT(", %u", instr.c);
+        snprintf(notes, sizeof(notes), " %s", atom_text(module, instr.c));
+        break;
+    case RG_SET_FIELD:
+        REG(instr.a); TEXT(", %u, ", instr.b); REG(instr.c);
+        snprintf(notes, sizeof(notes), " %s", atom_text(module, instr.b));
+        break;
+    default:
+        break;
+    }
+#undef REG
+#undef TEXT
+
+    if (!detail[0])
+        fprintf(out, "  %04zu  %s\n", at, rg_op_name(instr.op));
+    else if (!notes[0])
+        fprintf(out, "  %04zu  %-14s %s\n", at, rg_op_name(instr.op), detail);
+    else
+        fprintf(out, "  %04zu  %-14s %s ;%s\n", at, rg_op_name(instr.op), detail, notes);
+    return at + rg_instr_words(instr);
+}
+
+void rg_disassemble(const rg_module_t *module, FILE *out) {
+    for (size_t i = 0; i < module->functions_count; i++) {
+        const rg_function_t *function = &module->functions[i];
+        fprintf(out, "function %zu %s: %u params, %u registers%s, %u constants, %u instructions\n",
+                i, function_name(function), function->param_count, function->register_count,
+                function->pinned ? " (variables pinned)" : "", function->constant_count,
+                function->instruction_count);
+        for (size_t at = 0; at < function->code_length;)
+            at = disassemble_instr(module, function, at, out);
+    }
+}
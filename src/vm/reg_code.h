@@ -0,0 +1,129 @@
+#ifndef REG_CODE_H
+#define REG_CODE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "../envr/envr.h"
+#include "../utils/atom.h"
+
+/*
+ * Three-address code for the register VM. Every operand is a register of
+ * the frame, an environment_t whose values are laid out as
+ *   [0, frame_size)                  variables, by resolve_scopes slot
+ *                                    when pinned, see rg_function_t
+ *   [.., register_count)             variables and temporaries placed by
+ *                                    the linear-scan allocator
+ *   [register_count, + constant_count) the function's constants, copied
+ *                                    into the frame by the call
+ * so a + 1 is a single ADD with no loads, and x = x + 1 writes straight
+ * into the register of x.
+ *
+ * Instructions are 8 bytes, an opcode and three 16 bit operands, or a
+ * register and a 32 bit jump offset (relative to the next instruction) or
+ * pool index. CALL and ARRAY are followed by the argument registers, four
+ * per word.
+ */
+
+typedef enum rg_op {
+    RG_MOVE,         // a = b
+    RG_LOAD_NULL,    // a = null
+    RG_LOAD_TRUE,
+    RG_LOAD_FALSE,
+    RG_MARK_CONST,   // a is a const, assigning it from an inner function raises
+    RG_GET_OUTER,    // a = frame b levels up, slot c
+    RG_SET_OUTER,    // frame b levels up, slot c = a
+    RG_GET_NATIVE,   // a = natives[atoms[index]]
+
+    // a = b op c, same order as binary_op_type
+    RG_ADD,
+    RG_SUBTRACT,
+    RG_MULTIPLY,
+    RG_DIVIDE,
+    RG_EQUALS,
+    RG_NOT_EQUALS,
+    RG_GREATER,
+    RG_LESS,
+    RG_GREATER_EQUAL,
+    RG_LESS_EQUAL,
+    RG_NEGATE,       // a = op b
+    RG_NOT,
+    RG_TRUTHY,
+
+    RG_JUMP,
+    RG_JUMP_IF_FALSE, // on register a
+    RG_JUMP_IF_TRUE,
+
+    RG_CLOSURE,      // a = function value of functions[index]
+    RG_CALL,         // a = b(c arguments)
+    RG_RETURN,       // return a
+    RG_RETURN_NULL,
+
+    RG_ARRAY,        // a = [c arguments]
+    RG_INDEX,        // a = b[c]
+    RG_SET_INDEX,    // a[b] = c
+    RG_GET_FIELD,    // a = b.atoms[c]
+    RG_SET_FIELD,    // a.atoms[b] = c
+
+    RG_OP_COUNT
+} rg_op;
+
+#define RG_REGISTER_MAX UINT16_MAX
+
+typedef union rg_instr_t {
+    struct {
+        uint8_t op;
+        uint8_t unused;
+        uint16_t a;
+        union {
+            struct {
+                uint16_t b;
+                uint16_t c;
+            };
+            int32_t jump;
+            uint32_t index;
+        };
+    };
+    uint16_t args[4]; // words after CALL and ARRAY
+} rg_instr_t;
+
+typedef struct rg_function_t {
+    const atom_t *name;       // NULL for the top level
+    uint32_t param_count;     // parameters are registers 0 .. param_count - 1
+    uint32_t frame_size;      // slots given by resolve_scopes
+    uint32_t register_count;  // variables and temporaries
+    uint32_t constant_count;
+    bool pinned;              // variables keep their slot, inner functions use them
+    value_t *constants;
+    const atom_t **register_names; // of variables, NULL for temporaries
+    rg_instr_t *code;
+    uint32_t code_length;
+    uint32_t instruction_count; // code_length without argument words
+} rg_function_t;
+
+// Function 0 is the top level
+typedef struct rg_module_t {
+    rg_function_t *functions;
+    size_t functions_count;
+    size_t functions_capacity;
+
+    const atom_t **atoms; // natives and field names
+    size_t atoms_count;
+    size_t atoms_capacity;
+} rg_module_t;
+
+rg_module_t *new_rg_module(void);
+void free_rg_module(rg_module_t *module);
+
+const char *rg_op_name(rg_op op);
+void rg_disassemble(const rg_module_t *module, FILE *out);
+
+// Words an instruction takes, 1 plus argument words
+static inline uint32_t rg_instr_words(rg_instr_t instr) {
+    if (instr.op == RG_CALL || instr.op == RG_ARRAY)
+        return 1 + (instr.c + 3) / 4;
+    return 1;
+}
+
+#endif
@@ -0,0 +1,809 @@
+#include "reg_compiler.h"
+#include "../ast/ast_parser.h"
+#include "../ast/ast_printer.h"
+#include "../ast/ast_resolve.h"
+#include "../utils/logger.h"
+#include "../utils/scope_map.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Code is first built as ir_t, one per instruction, with operands as
+ * virtual registers: [0, frame_size) the variables by slot, then one
+ * temporary per intermediate value. Constants are operands with
+ * IR_CONSTANT set. Jumps hold the ir index they land on. Once the function
+ * is done, allocate_registers maps the virtual registers to frame
+ * registers and lower_function writes the final rg_instr_t.
+ */
+
+#define IR_NONE UINT32_MAX
+#define IR_CONSTANT 0x80000000u
+
+typedef struct ir_t {
+    rg_op op;
+    uint32_t a, b, c;
+    uint32_t extra; // jump target, pool index, or first of the arguments
+} ir_t;
+
+// Operands of each op that are registers
+#define USES_A 1
+#define USES_B 2
+#define USES_C 4
+#define USES_ARGS 8
+
+static const uint8_t register_operands[RG_OP_COUNT] = {
+    [RG_MOVE] = USES_A | USES_B,
+    [RG_LOAD_NULL] = USES_A,
+    [RG_LOAD_TRUE] = USES_A,
+    [RG_LOAD_FALSE] = USES_A,
+    [RG_MARK_CONST] = USES_A,
+    [RG_GET_OUTER] = USES_A,
+    [RG_SET_OUTER] = USES_A,
+    [RG_GET_NATIVE] = USES_A,
+    [RG_ADD] = USES_A | USES_B | USES_C,
+    [RG_SUBTRACT] = USES_A | USES_B | USES_C,
+    [RG_MULTIPLY] = USES_A | USES_B | USES_C,
+    [RG_DIVIDE] = USES_A | USES_B | USES_C,
+    [RG_EQUALS] = USES_A | USES_B | USES_C,
+    [RG_NOT_EQUALS] = USES_A | USES_B | USES_C,
+    [RG_GREATER] = USES_A | USES_B | USES_C,
+    [RG_LESS] = USES_A | USES_B | USES_C,
+    [RG_GREATER_EQUAL] = USES_A | USES_B | USES_C,
+    [RG_LESS_EQUAL] = USES_A | USES_B | USES_C,
+    [RG_NEGATE] = USES_A | USES_B,
+    [RG_NOT] = USES_A | USES_B,
+    [RG_TRUTHY] = USES_A | USES_B,
+    [RG_JUMP_IF_FALSE] = USES_A,
+    [RG_JUMP_IF_TRUE] = USES_A,
+    [RG_CLOSURE] = USES_A,
+    [RG_CALL] = USES_A | USES_B | USES_ARGS,
+    [RG_RETURN] = USES_A,
+    [RG_ARRAY] = USES_A | USES_ARGS,
+    [RG_INDEX] = USES_A | USES_B | USES_C,
+    [RG_SET_INDEX] = USES_A | USES_B | USES_C,
+    [RG_GET_FIELD] = USES_A | USES_B,
+    [RG_SET_FIELD] = USES_A | USES_C,
+};
+
+typedef struct loop_t {
+    struct loop_t *outer;
+    size_t start;
+    size_t *stops;
+    size_t stops_count;
+    size_t stops_capacity;
+} loop_t;
+
+typedef struct function_builder_t {
+    ir_t *code;
+    size_t count;
+    size_t capacity;
+    uint32_t *args; // argument registers of CALL and ARRAY
+    size_t args_count;
+    size_t args_capacity;
+
+    uint32_t frame_size;
+    uint32_t param_count;
+    uint32_t vreg_count;     // variables, then temporaries
+    bool pinned;
+    const atom_t **slot_names;
+    bool *slot_const;
+    size_t *slot_end;        // ir index where the block of a variable ends
+
+    value_t *constants;
+    uint32_t constant_count;
+    uint32_t constant_capacity;
+    loop_t *loop;
+} function_builder_t;
+
+typedef struct compiler_t {
+    rg_module_t *module;
+    arena_t *arena; // of the tree, lazy bodies are parsed into it
+    scope_map_t atoms;
+    function_builder_t *function;
+} compiler_t;
+
+static void *grow(void *items, size_t *capacity, size_t item_size, size_t initial) {
+    *capacity = *capacity ? *capacity * 2 : initial;
+    items = realloc(items, *capacity * item_size);
+    if (!items)
+        elog("Error reallocation memory for register code");
+    return items;
+}
+
+static uint32_t atom_index(compiler_t *compiler, const atom_t *atom) {
+    uintptr_t index;
+    if (scope_lookup(&compiler->atoms, atom, &index))
+        return (uint32_t)index;
+
+    rg_module_t *module = compiler->module;
+    if (module->atoms_count == module->atoms_capacity)
+        module->atoms = (const atom_t **)grow((void *)module->atoms, &module->atoms_capacity, sizeof(atom_t *), 16);
+    index = module->atoms_count;
+    module->atoms[module->atoms_count++] = atom;
+    scope_bind(&compiler->atoms, atom, index);
+    return (uint32_t)index;
+}
+
+// Field names sit in a 16 bit operand
+static uint32_t field_index(compiler_t *compiler, const atom_t *atom) {
+    uint32_t index = atom_index(compiler, atom);
+    if (index > RG_REGISTER_MAX)
+        elog("Too many names for register code, at '%s'", atom->text);
+    return index;
+}
+
+// Equal numbers and the same string literal are the same word, they share
+// a constant register
+static uint32_t constant(compiler_t *compiler, value_t value) {
+    function_builder_t *function = compiler->function;
+    for (uint32_t i = 0; i < function->constant_count; i++) {
+        if (function->constants[i].bits == value.bits)
+            return IR_CONSTANT | i;
+    }
+
+    if (function->constant_count == function->constant_capacity) {
+        size_t capacity = function->constant_capacity;
+        function->constants = (value_t *)grow(function->constants, &capacity, sizeof(value_t), 8);
+        function->constant_capacity = (uint32_t)capacity;
+    }
+    function->constants[function->constant_count] = value;
+    return IR_CONSTANT | function->constant_count++;
+}
+
+static uint32_t new_temporary(compiler_t *compiler) {
+    if (compiler->function->vreg_count == IR_CONSTANT)
+        elog("Function is too large for register code");
+    return compiler->function->vreg_count++;
+}
+
+static size_t emit(compiler_t *compiler, rg_op op, uint32_t a, uint32_t b, uint32_t c, uint32_t extra) {
+    function_builder_t *function = compiler->function;
+    if (function->count == function->capacity)
+        function->code = (ir_t *)grow(function->code, &function->capacity, sizeof(ir_t), 64);
+    function->code[function->count] = (ir_t){ op, a, b, c, extra };
+    return function->count++;
+}
+
+static size_t emit_jump(compiler_t *compiler, rg_op op, uint32_t condition) {
+    return emit(compiler, op, condition, 0, 0, 0);
+}
+
+// Forward jumps are emitted with no target and patched to land here
+static void patch_jump(compiler_t *compiler, size_t at) {
+    compiler->function->code[at].extra = (uint32_t)compiler->function->count;
+}
+
+static bool is_variable(compiler_t *compiler, uint32_t reg) {
+    return reg < compiler->function->frame_size;
+}
+
+static void name_slot(compiler_t *compiler, uint32_t slot, const atom_t *name) {
+    function_builder_t *function = compiler->function;
+    if (slot >= function->frame_size)
+        elog("Slot %u of '%s' is out of the frame of %u slots", slot, name->text, function->frame_size);
+    function->slot_names[slot] = name;
+}
+
+// Whether evaluating node may assign a variable, a call may do it through
+// a closure
+static bool has_side_effects(ast_node *node) {
+    if (!node)
+        return false;
+    switch (node->type) {
+    case AST_ASSIGNMENT:
+    case AST_FUNCTION_CALL:
+    case AST_PRINT:
+    case AST_TAKE:
+        return true;
+    case AST_BINARY_OP:
+        return has_side_effects(node->binary_op.left) || has_side_effects(node->binary_op.right);
+    case AST_UNARY_OP:
+        return has_side_effects(node->unary_op.operand);
+    case AST_ARRAY:
+        for (size_t i = 0; i < node->array.element_count; i++)
+            if (has_side_effects(node->array.elements[i]))
+                return true;
+        return false;
+    case AST_ARRAY_ACCESS:
+        return has_side_effects(node->array_access.array) || has_side_effects(node->array_access.index);
+    case AST_PROPERTY_ACCESS:
+        return has_side_effects(node->property_access.object);
+    default:
+        return false;
+    }
+}
+
+static bool declares_functions(ast_node *node) {
+    if (!node)
+        return false;
+    switch (node->type) {
+    case AST_FUNCTION_DECLARATION:
+        return true;
+    case AST_BLOCK:
+        for (size_t i = 0; i < node->block.stmts->count; i++)
+            if (declares_functions((ast_node *)node->block.stmts->items[i]))
+                return true;
+        return false;
+    case AST_PROGRAM:
+        for (size_t i = 0; i < node->program.statement_count; i++)
+            if (declares_functions(node->program.statements[i]))
+                return true;
+        return false;
+    case AST_IF:
+        return declares_functions(node->if_statement.body);
+    case AST_IF_ELSE:
+        return declares_functions(node->if_else_statement.if_body) ||
+               declares_functions(node->if_else_statement.else_body);
+    case AST_LOOP:
+        return declares_functions(node->loop.body);
+    default:
+        return false;
+    }
+}
+
+static uint32_t compile_expression(compiler_t *compiler, ast_node *node, uint32_t want);
+static void compile_statement(compiler_t *compiler, ast_node *node);
+static uint32_t compile_function(compiler_t *compiler, ast_node *declaration, ast_node *body,
+                                 arr_t *params, uint32_t frame_size);
+
+// The register want, or a new temporary when the caller has none
+static uint32_t destination(compiler_t *compiler, uint32_t want) {
+    return want != IR_NONE ? want : new_temporary(compiler);
+}
+
+static uint32_t move_to(compiler_t *compiler, uint32_t reg, uint32_t want) {
+    if (want == IR_NONE || want == reg)
+        return reg;
+    emit(compiler, RG_MOVE, want, reg, 0, 0);
+    return want;
+}
+
+// A variable read as an operand is used in place. If what is evaluated
+// before the instruction runs may assign it, it is copied first, so the
+// operand keeps the value it had when it was read.
+static uint32_t operand(compiler_t *compiler, ast_node *node, ast_node **later, size_t later_count) {
+    uint32_t reg = compile_expression(compiler, node, IR_NONE);
+    if (!is_variable(compiler, reg))
+        return reg;
+    for (size_t i = 0; i < later_count; i++) {
+        if (has_side_effects(later[i])) {
+            uint32_t copy = new_temporary(compiler);
+            emit(compiler, RG_MOVE, copy, reg, 0, 0);
+            return copy;
+        }
+    }
+    return reg;
+}
+
+static uint32_t push_args(compiler_t *compiler, ast_node **nodes, size_t count) {
+    function_builder_t *function = compiler->function;
+    uint32_t *regs = (uint32_t *)malloc((count + 1) * sizeof(uint32_t));
+    if (!regs)
+        elog("Error allocation memory for arguments");
+    for (size_t i = 0; i < count; i++)
+        regs[i] = operand(compiler, nodes[i], nodes + i + 1, count - i - 1);
+
+    // Nested calls add their arguments meanwhile, these go after them
+    while (function->args_capacity < function->args_count + count)
+        function->args = (uint32_t *)grow(function->args, &function->args_capacity, sizeof(uint32_t), 16);
+    uint32_t first = (uint32_t)function->args_count;
+    memcpy(function->args + first, regs, count * sizeof(uint32_t));
+    function->args_count += count;
+    free(regs);
+    return first;
+}
+
+static uint32_t compile_variable(compiler_t *compiler, ast_node *node, uint32_t want) {
+    uint32_t depth = node->identifier.depth;
+    if (depth == 0)
+        return move_to(compiler, node->slot, want);
+
+    uint32_t to = destination(compiler, want);
+    if (depth == SCOPE_UNRESOLVED) {
+        emit(compiler, RG_GET_NATIVE, to, 0, 0, atom_index(compiler, node->identifier.name));
+        return to;
+    }
+    if (depth > RG_REGISTER_MAX || node->slot > RG_REGISTER_MAX)
+        elog("Variable '%s' is too far out for register code, %u frames up at slot %u",
+             node->identifier.name->text, depth, node->slot);
+    emit(compiler, RG_GET_OUTER, to, depth, node->slot, 0);
+    return to;
+}
+
+static uint32_t compile_assignment(compiler_t *compiler, ast_node *node, uint32_t want) {
+    ast_node *target = node->assignment.left;
+    ast_node *right = node->assignment.right;
+    switch (target->type) {
+    case AST_IDENTIFIER: {
+        uint32_t depth = target->identifier.depth;
+        if (depth == SCOPE_UNRESOLVED)
+            elog("Cannot assign to undeclared variable '%s'", target->identifier.name->text);
+        if (depth == 0) {
+            if (compiler->function->slot_const[target->slot])
+                elog("Cannot reassign to constant '%s'", target->identifier.name->text);
+            compile_expression(compiler, right, target->slot);
+            return move_to(compiler, target->slot, want);
+        }
+        if (depth > RG_REGISTER_MAX || target->slot > RG_REGISTER_MAX)
+            elog("Variable '%s' is too far out for register code, %u frames up at slot %u",
+                 target->identifier.name->text, depth, target->slot);
+        uint32_t value = compile_expression(compiler, right, want);
+        emit(compiler, RG_SET_OUTER, value, depth, target->slot, 0);
+        return value;
+    }
+    case AST_ARRAY_ACCESS: {
+        ast_node *rest[] = { target->array_access.index, right };
+        uint32_t array = operand(compiler, target->array_access.array, rest, 2);
+        uint32_t index = operand(compiler, target->array_access.index, rest + 1, 1);
+        // Not into want yet, it may be the array or the index
+        uint32_t value = compile_expression(compiler, right, IR_NONE);
+        emit(compiler, RG_SET_INDEX, array, index, value, 0);
+        return move_to(compiler, value, want);
+    }
+    case AST_PROPERTY_ACCESS: {
+        uint32_t object = operand(compiler, target->property_access.object, &right, 1);
+        uint32_t value = compile_expression(compiler, right, IR_NONE);
+        emit(compiler, RG_SET_FIELD, object, field_index(compiler, target->property_access.property), value, 0);
+        return move_to(compiler, value, want);
+    }
+    default:
+        elog("Can't assign to %s", ast_type_to_string(target->type));
+    }
+}
+
+// to = a && b is a, JUMP_IF_FALSE, TRUTHY to b, JUMP over LOAD_FALSE to;
+// || mirrors it
+static uint32_t compile_logical(compiler_t *compiler, ast_node *node, uint32_t want) {
+    bool is_and = node->binary_op.op == OP_AND;
+    uint32_t left = compile_expression(compiler, node->binary_op.left, IR_NONE);
+    uint32_t to = destination(compiler, want);
+    size_t decided = emit_jump(compiler, is_and ? RG_JUMP_IF_FALSE : RG_JUMP_IF_TRUE, left);
+
+    uint32_t right = compile_expression(compiler, node->binary_op.right, IR_NONE);
+    emit(compiler, RG_TRUTHY, to, right, 0, 0);
+    size_t end = emit_jump(compiler, RG_JUMP, 0);
+
+    patch_jump(compiler, decided);
+    emit(compiler, is_and ? RG_LOAD_FALSE : RG_LOAD_TRUE, to, 0, 0, 0);
+    patch_jump(compiler, end);
+    return to;
+}
+
+// Compiles node so its value ends in want, or anywhere when want is
+// IR_NONE, and returns the register holding it
+static uint32_t compile_expression(compiler_t *compiler, ast_node *node, uint32_t want) {
+    switch (node->type) {
+    case AST_NUMBER:
+        return move_to(compiler, constant(compiler, create_number_value(node->number.value)), want);
+    case AST_STRING:
+        return move_to(compiler, constant(compiler, create_string_value(&node->string.value)), want);
+    case AST_BOOLEAN: {
+        uint32_t to = destination(compiler, want);
+        emit(compiler, node->boolean.value ? RG_LOAD_TRUE : RG_LOAD_FALSE, to, 0, 0, 0);
+        return to;
+    }
+    case AST_NULL: {
+        uint32_t to = destination(compiler, want);
+        emit(compiler, RG_LOAD_NULL, to, 0, 0, 0);
+        return to;
+    }
+    case AST_IDENTIFIER:
+        return compile_variable(compiler, node, want);
+    case AST_ASSIGNMENT:
+        return compile_assignment(compiler, node, want);
+
+    case AST_BINARY_OP: {
+        if (node->binary_op.op == OP_AND || node->binary_op.op == OP_OR)
+            return compile_logical(compiler, node, want);
+        uint32_t left = operand(compiler, node->binary_op.left, &node->binary_op.right, 1);
+        uint32_t right = compile_expression(compiler, node->binary_op.right, IR_NONE);
+        uint32_t to = destination(compiler, want);
+        emit(compiler, (rg_op)(RG_ADD + node->binary_op.op), to, left, right, 0);
+        return to;
+    }
+    case AST_UNARY_OP: {
+        uint32_t value = compile_expression(compiler, node->unary_op.operand, IR_NONE);
+        uint32_t to = destination(compiler, want);
+        emit(compiler, node->unary_op.op == OP_NOT ? RG_NOT : RG_NEGATE, to, value, 0, 0);
+        return to;
+    }
+
+    case AST_FUNCTION_CALL:
+    case AST_PRINT:
+    case AST_TAKE: {
+        size_t count = node->function_call.argument_count;
+        if (count > RG_REGISTER_MAX)
+            elog("Call with %zu arguments is too large for register code", count);
+        uint32_t callee = operand(compiler, node->function_call.callee, node->function_call.arguments, count);
+        uint32_t first = push_args(compiler, node->function_call.arguments, count);
+        uint32_t to = destination(compiler, want);
+        emit(compiler, RG_CALL, to, callee, (uint32_t)count, first);
+        return to;
+    }
+
+    case AST_ARRAY: {
+        size_t count = node->array.element_count;
+        if (count > RG_REGISTER_MAX)
+            elog("Array of %zu elements is too large for register code", count);
+        uint32_t first = push_args(compiler, node->array.elements, count);
+        uint32_t to = destination(compiler, want);
+        emit(compiler, RG_ARRAY, to, 0, (uint32_t)count, first);
+        return to;
+    }
+    case AST_ARRAY_ACCESS: {
+        uint32_t array = operand(compiler, node->array_access.array, &node->array_access.index, 1);
+        uint32_t index = compile_expression(compiler, node->array_access.index, IR_NONE);
+        uint32_t to = destination(compiler, want);
+        emit(compiler, RG_INDEX, to, array, index, 0);
+        return to;
+    }
+    case AST_PROPERTY_ACCESS: {
+        uint32_t object = compile_expression(compiler, node->property_access.object, IR_NONE);
+        uint32_t to = destination(compiler, want);
+        emit(compiler, RG_GET_FIELD, to, object, field_index(compiler, node->property_access.property), 0);
+        return to;
+    }
+
+    default:
+        elog("%s is not an expression", ast_type_to_string(node->type));
+    }
+}
+
+// Variables declared in the list live until its end
+static void compile_list(compiler_t *compiler, ast_node **statements, size_t count) {
+    for (size_t i = 0; i < count; i++)
+        compile_statement(compiler, statements[i]);
+
+    function_builder_t *function = compiler->function;
+    for (size_t i = 0; i < count; i++) {
+        ast_type type = statements[i]->type;
+        if (type == AST_VAR_DECLARATION || type == AST_CONST_DECLARATION || type == AST_FUNCTION_DECLARATION)
+            function->slot_end[statements[i]->slot] = function->count;
+    }
+}
+
+static void compile_loop(compiler_t *compiler, ast_node *node) {
+    loop_t loop = { .outer = compiler->function->loop, .start = compiler->function->count };
+    compiler->function->loop = &loop;
+
+    size_t exit = SIZE_MAX;
+    if (node->loop.condition) {
+        uint32_t condition = compile_expression(compiler, node->loop.condition, IR_NONE);
+        exit = emit_jump(compiler, RG_JUMP_IF_FALSE, condition);
+    }
+    compile_statement(compiler, node->loop.body);
+    emit(compiler, RG_JUMP, 0, 0, 0, (uint32_t)loop.start);
+
+    if (exit != SIZE_MAX)
+        patch_jump(compiler, exit);
+    for (size_t i = 0; i < loop.stops_count; i++)
+        patch_jump(compiler, loop.stops[i]);
+
+    free(loop.stops);
+    compiler->function->loop = loop.outer;
+}
+
+static void compile_stop(compiler_t *compiler) {
+    loop_t *loop = compiler->function->loop;
+    if (!loop)
+        elog("'stop' outside of a loop");
+
+    if (loop->stops_count == loop->stops_capacity)
+        loop->stops = (size_t *)grow(loop->stops, &loop->stops_capacity, sizeof(size_t), 4);
+    loop->stops[loop->stops_count++] = emit_jump(compiler, RG_JUMP, 0);
+}
+
+static void compile_statement(compiler_t *compiler, ast_node *node) {
+    function_builder_t *function = compiler->function;
+    switch (node->type) {
+    case AST_VAR_DECLARATION:
+    case AST_CONST_DECLARATION:
+        name_slot(compiler, node->slot, node->var_declaration.name);
+        if (node->var_declaration.initializer)
+            compile_expression(compiler, node->var_declaration.initializer, node->slot);
+        else
+            emit(compiler, RG_LOAD_NULL, node->slot, 0, 0, 0);
+        if (node->type == AST_CONST_DECLARATION) {
+            function->slot_const[node->slot] = true;
+            // Only inner functions need to be told at runtime
+            if (function->pinned)
+                emit(compiler, RG_MARK_CONST, node->slot, 0, 0, 0);
+        }
+        return;
+
+    case AST_FUNCTION_DECLARATION: {
+        ast_node *body = function_body(node, compiler->arena);
+        uint32_t index = compile_function(compiler, node, body, node->function_declaration.parameters,
+                                          body->block.frame_size);
+        name_slot(compiler, node->slot, node->function_declaration.name);
+        emit(compiler, RG_CLOSURE, node->slot, 0, 0, index);
+        return;
+    }
+
+    case AST_IF: {
+        uint32_t condition = compile_expression(compiler, node->if_statement.condition, IR_NONE);
+        size_t skip = emit_jump(compiler, RG_JUMP_IF_FALSE, condition);
+        compile_statement(compiler, node->if_statement.body);
+        patch_jump(compiler, skip);
+        return;
+    }
+    case AST_IF_ELSE: {
+        uint32_t condition = compile_expression(compiler, node->if_else_statement.condition, IR_NONE);
+        size_t to_else = emit_jump(compiler, RG_JUMP_IF_FALSE, condition);
+        compile_statement(compiler, node->if_else_statement.if_body);
+        size_t to_end = emit_jump(compiler, RG_JUMP, 0);
+        patch_jump(compiler, to_else);
+        compile_statement(compiler, node->if_else_statement.else_body);
+        patch_jump(compiler, to_end);
+        return;
+    }
+    case AST_LOOP:
+        compile_loop(compiler, node);
+        return;
+    case AST_NEXT:
+        if (!function->loop)
+            elog("'next' outside of a loop");
+        emit(compiler, RG_JUMP, 0, 0, 0, (uint32_t)function->loop->start);
+        return;
+    case AST_STOP:
+        compile_stop(compiler);
+        return;
+
+    case AST_RETURN:
+        if (node->return_statement.value)
+            emit(compiler, RG_RETURN, compile_expression(compiler, node->return_statement.value, IR_NONE), 0, 0, 0);
+        else
+            emit(compiler, RG_RETURN_NULL, 0, 0, 0, 0);
+        return;
+
+    case AST_BLOCK:
+        compile_list(compiler, (ast_node **)node->block.stmts->items, node->block.stmts->count);
+        return;
+    case AST_LAZY_BLOCK:
+        elog("Lazy function body reached the register compiler unparsed");
+
+    default:
+        compile_expression(compiler, node, IR_NONE);
+        return;
+    }
+}
+
+typedef struct interval_t {
+    uint32_t vreg;
+    size_t start;
+    size_t end;
+} interval_t;
+
+static int compare_start(const void *a, const void *b) {
+    const interval_t *left = (const interval_t *)a, *right = (const interval_t *)b;
+    if (left->start != right->start)
+        return left->start < right->start ? -1 : 1;
+    return left->vreg < right->vreg ? -1 : left->vreg > right->vreg;
+}
+
+static void touch(interval_t *intervals, uint32_t reg, size_t at) {
+    if (reg & IR_CONSTANT)
+        return;
+    interval_t *interval = &intervals[reg];
+    if (interval->start == SIZE_MAX)
+        interval->start = at;
+    interval->end = at;
+}
+
+/*
+ * Linear scan: intervals in order of start, each takes the lowest
+ * register whose last interval ended before it starts. Fixed variables
+ * (parameters, or all of them when pinned) keep their slot and the scan
+ * hands out registers above them. Fills map, returns the register count.
+ */
+static uint32_t allocate_registers(function_builder_t *function, uint32_t *map) {
+    uint32_t vregs = function->vreg_count;
+    interval_t *intervals = (interval_t *)malloc((vregs + 1) * sizeof(interval_t));
+    if (!intervals)
+        elog("Error allocation memory for live intervals");
+    for (uint32_t i = 0; i < vregs; i++)
+        intervals[i] = (interval_t){ i, SIZE_MAX, 0 };
+
+    for (size_t at = 0; at < function->count; at++) {
+        ir_t *ir = &function->code[at];
+        uint8_t uses = register_operands[ir->op];
+        if (uses & USES_A)
+            touch(intervals, ir->a, at);
+        if (uses & USES_B)
+            touch(intervals, ir->b, at);
+        if (uses & USES_C)
+            touch(intervals, ir->c, at);
+        if (uses & USES_ARGS)
+            for (uint32_t i = 0; i < ir->c; i++)
+                touch(intervals, function->args[ir->extra + i], at);
+    }
+
+    uint32_t fixed = function->pinned ? function->frame_size : function->param_count;
+    size_t count = 0;
+    for (uint32_t i = 0; i < vregs; i++) {
+        map[i] = IR_NONE;
+        if (i < fixed) {
+            map[i] = i;
+            continue;
+        }
+        if (intervals[i].start == SIZE_MAX)
+            continue;
+        if (i < function->frame_size) {
+            size_t end = function->slot_end[i] == SIZE_MAX ? function->count : function->slot_end[i];
+            if (end > intervals[i].end)
+                intervals[i].end = end;
+        }
+        intervals[count++] = intervals[i];
+    }
+    qsort(intervals, count, sizeof(interval_t), compare_start);
+
+    // busy_until[r] is the end of the last interval given register fixed + r
+    size_t *busy_until = (size_t *)malloc((count + 1) * sizeof(size_t));
+    if (!busy_until)
+        elog("Error allocation memory for registers");
+    uint32_t used = 0;
+    for (size_t i = 0; i < count; i++) {
+        uint32_t reg = 0;
+        while (reg < used && busy_until[reg] >= intervals[i].start)
+            reg++;
+        if (reg == used)
+            used++;
+        busy_until[reg] = intervals[i].end;
+        map[intervals[i].vreg] = fixed + reg;
+    }
+
+    free(busy_until);
+    free(intervals);
+    return fixed + used;
+}
+
+static uint16_t physical(const uint32_t *map, uint32_t register_count, uint32_t reg) {
+    if (reg & IR_CONSTANT)
+        return (uint16_t)(register_count + (reg & ~IR_CONSTANT));
+    return (uint16_t)map[reg];
+}
+
+static void lower_function(function_builder_t *function, rg_function_t *record, const uint32_t *map) {
+    size_t *position = (size_t *)malloc((function->count + 1) * sizeof(size_t));
+    if (!position)
+        elog("Error allocation memory for code positions");
+    size_t words = 0;
+    for (size_t at = 0; at < function->count; at++) {
+        position[at] = words;
+        ir_t *ir = &function->code[at];
+        words += 1 + ((ir->op == RG_CALL || ir->op == RG_ARRAY) ? (ir->c + 3) / 4 : 0);
+    }
+    position[function->count] = words;
+    if (words > UINT32_MAX / 2)
+        elog("Function is too large for register code");
+
+    rg_instr_t *code = (rg_instr_t *)calloc(words ? words : 1, sizeof(rg_instr_t));
+    if (!code)
+        elog("Error allocation memory for register code");
+
+    uint32_t registers = record->register_count;
+    for (size_t at = 0; at < function->count; at++) {
+        ir_t *ir = &function->code[at];
+        uint8_t uses = register_operands[ir->op];
+        rg_instr_t *instr = &code[position[at]];
+        instr->op = (uint8_t)ir->op;
+        instr->a = (uses & USES_A) ? physical(map, registers, ir->a) : (uint16_t)ir->a;
+
+        switch (ir->op) {
+        case RG_JUMP:
+        case RG_JUMP_IF_FALSE:
+        case RG_JUMP_IF_TRUE:
+            instr->jump = (int32_t)((int64_t)position[ir->extra] - (int64_t)position[at] - 1);
+            break;
+        case RG_GET_NATIVE:
+        case RG_CLOSURE:
+            instr->index = ir->extra;
+            break;
+        default:
+            instr->b = (uses & USES_B) ? physical(map, registers, ir->b) : (uint16_t)ir->b;
+            instr->c = (uses & USES_C) ? physical(map, registers, ir->c) : (uint16_t)ir->c;
+            break;
+        }
+        if (uses & USES_ARGS)
+            for (uint32_t i = 0; i < ir->c; i++)
+                instr[1 + i / 4].args[i % 4] = physical(map, registers, function->args[ir->extra + i]);
+    }
+
+    record->code = code;
+    record->code_length = (uint32_t)words;
+    record->instruction_count = (uint32_t)function->count;
+    free(position);
+}
+
+// The record is reserved first, nested functions compiled meanwhile come
+// after it and its index stays valid
+static uint32_t compile_function(compiler_t *compiler, ast_node *declaration, ast_node *body,
+                                 arr_t *params, uint32_t frame_size) {
+    rg_module_t *module = compiler->module;
+    if (module->functions_count == module->functions_capacity)
+        module->functions = (rg_function_t *)grow(module->functions, &module->functions_capacity, sizeof(rg_function_t), 16);
+    uint32_t index = (uint32_t)module->functions_count++;
+    if (frame_size >= IR_CONSTANT)
+        elog("Function is too large for register code");
+
+    size_t param_count = params ? params->count : 0;
+    function_builder_t function = {
+        .frame_size = frame_size,
+        .param_count = (uint32_t)param_count,
+        .vreg_count = frame_size,
+        .pinned = declares_functions(body),
+    };
+    function.slot_names = (const atom_t **)calloc(frame_size + 1, sizeof(atom_t *));
+    function.slot_const = (bool *)calloc(frame_size + 1, sizeof(bool));
+    function.slot_end = (size_t *)malloc((frame_size + 1) * sizeof(size_t));
+    if (!function.slot_names || !function.slot_const || !function.slot_end)
+        elog("Error allocation memory for function slots");
+    for (uint32_t i = 0; i < frame_size; i++)
+        function.slot_end[i] = SIZE_MAX;
+
+    function_builder_t *outer = compiler->function;
+    compiler->function = &function;
+
+    for (size_t i = 0; i < param_count; i++) {
+        ast_node *param = (ast_node *)params->items[i];
+        if (param->slot != i)
+            elog("Parameter '%s' is not in slot %zu", param->identifier.name->text, i);
+        name_slot(compiler, param->slot, param->identifier.name);
+    }
+
+    if (body->type == AST_PROGRAM)
+        compile_list(compiler, body->program.statements, body->program.statement_count);
+    else
+        compile_statement(compiler, body);
+    emit(compiler, RG_RETURN_NULL, 0, 0, 0, 0);
+
+    uint32_t *map = (uint32_t *)malloc((function.vreg_count + 1) * sizeof(uint32_t));
+    if (!map)
+        elog("Error allocation memory for the register map");
+    uint32_t register_count = allocate_registers(&function, map);
+    if ((uint64_t)register_count + function.constant_count > (uint64_t)RG_REGISTER_MAX + 1)
+        elog("Function needs %u registers and %u constants, more than register code holds",
+             register_count, function.constant_count);
+
+    rg_function_t *record = &module->functions[index];
+    memset(record, 0, sizeof(*record));
+    record->name = declaration ? declaration->function_declaration.name : NULL;
+    record->param_count = (uint32_t)param_count;
+    record->frame_size = frame_size;
+    record->register_count = register_count;
+    record->constant_count = function.constant_count;
+    record->pinned = function.pinned;
+    record->constants = function.constants;
+    record->register_names = (const atom_t **)calloc(register_count + 1, sizeof(atom_t *));
+    if (!record->register_names)
+        elog("Error allocation memory for register names");
+    for (uint32_t slot = 0; slot < frame_size; slot++)
+        if (map[slot] != IR_NONE && !record->register_names[map[slot]])
+            record->register_names[map[slot]] = function.slot_names[slot];
+    lower_function(&function, record, map);
+
+    free(map);
+    free(function.code);
+    free(function.args);
+    free((void *)function.slot_names);
+    free(function.slot_const);
+    free(function.slot_end);
+    compiler->function = outer;
+    return index;
+}
+
+rg_module_t *rg_compile(ast_node *program, arena_t *arena) {
+    if (!program || !arena)
+        elog("Can't compile, NULL ptr on program or arena");
+    if (program->type != AST_PROGRAM)
+        elog("Can't compile %s, expected a program", ast_type_to_string(program->type));
+
+    resolve_scopes(program, arena);
+
+    compiler_t compiler = { .module = new_rg_module(), .arena = arena };
+    scope_map_init(&compiler.atoms);
+    compile_function(&compiler, NULL, program, NULL, program->program.frame_size);
+    scope_map_free(&compiler.atoms);
+    return compiler.module;
+}
@@ -0,0 +1,24 @@
+#ifndef REG_COMPILER_H
+#define REG_COMPILER_H
+
+#include "reg_code.h"
+#include "../ast/ast.h"
+#include "../utils/arena.h"
+
+/*
+ * Lowers a resolved program to three-address code for the register VM.
+ * Each function is first emitted with virtual registers: its variables
+ * by slot, then a fresh temporary per intermediate value, constants apart.
+ * A linear scan then packs them into as few registers as it can, by live
+ * interval (first to last use, a variable lives to the end of its block).
+ *
+ * Variables of a function that declares inner functions are pinned to
+ * their slot, closures reach them with GET_OUTER at (depth, slot); only
+ * temporaries are packed there. Parameters always keep their slot.
+ *
+ * Same rules as bc_compile, plus assigning to a const of the same
+ * function is reported at compile time.
+ */
+rg_module_t *rg_compile(ast_node *program, arena_t *arena);
+
+#endif
@@ -0,0 +1,294 @@
+#include "reg_vm.h"
+#include "../interp/runtime.h"
+#include "../utils/logger.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define NATIVE_ARGS_ON_STACK 16
+
+// Temporaries are written before they are read, and so are variables
+// unless an inner function may see them first
+static environment_t *enter(interp_t *interp, environment_t *parent, const rg_function_t *function) {
+    uint32_t cleared = function->pinned ? function->frame_size : function->param_count;
+    environment_t *frame = interp_take_frame_cleared(interp, parent,
+                                                     function->register_count + function->constant_count, cleared);
+    memcpy(frame->values + function->register_count, function->constants,
+           function->constant_count * sizeof(value_t));
+    return frame;
+}
+
+value_t rg_run(interp_t *interp, const rg_module_t *module) {
+    if (!interp || !module)
+        elog("Can't run register code, NULL ptr on interpreter or module");
+    if (module->functions_count == 0)
+        elog("Can't run register code, the module has no top level");
+
+    static void *const dispatch[RG_OP_COUNT] = {
+        [RG_MOVE] = &&op_move,
+        [RG_LOAD_NULL] = &&op_load_null,
+        [RG_LOAD_TRUE] = &&op_load_true,
+        [RG_LOAD_FALSE] = &&op_load_false,
+        [RG_MARK_CONST] = &&op_mark_const,
+        [RG_GET_OUTER] = &&op_get_outer,
+        [RG_SET_OUTER] = &&op_set_outer,
+        [RG_GET_NATIVE] = &&op_get_native,
+        [RG_ADD] = &&op_add,
+        [RG_SUBTRACT] = &&op_subtract,
+        [RG_MULTIPLY] = &&op_multiply,
+        [RG_DIVIDE] = &&op_divide,
+        [RG_EQUALS] = &&op_equals,
+        [RG_NOT_EQUALS] = &&op_not_equals,
+        [RG_GREATER] = &&op_greater,
+        [RG_LESS] = &&op_less,
+        [RG_GREATER_EQUAL] = &&op_greater_equal,
+        [RG_LESS_EQUAL] = &&op_less_equal,
+        [RG_NEGATE] = &&op_negate,
+        [RG_NOT] = &&op_not,
+        [RG_TRUTHY] = &&op_truthy,
+        [RG_JUMP] = &&op_jump,
+        [RG_JUMP_IF_FALSE] = &&op_jump_if_false,
+        [RG_JUMP_IF_TRUE] = &&op_jump_if_true,
+        [RG_CLOSURE] = &&op_closure,
+        [RG_CALL] = &&op_call,
+        [RG_RETURN] = &&op_return,
+        [RG_RETURN_NULL] = &&op_return_null,
+        [RG_ARRAY] = &&op_array,
+        [RG_INDEX] = &&op_index,
+        [RG_SET_INDEX] = &&op_set_index,
+        [RG_GET_FIELD] = &&op_get_field,
+        [RG_SET_FIELD] = &&op_set_field,
+    };
+
+    // Kept by the interpreter, a run that raises leaves it to the next one
+    if (!interp->rg_calls)
+        interp->rg_calls = (rg_call_t *)malloc(RG_MAX_CALL_DEPTH * sizeof(rg_call_t));
+    if (!interp->rg_calls)
+        elog("Error allocation memory for the VM call stack");
+    rg_call_t *calls = interp->rg_calls;
+
+    const rg_function_t *function = &module->functions[0];
+    environment_t *env = interp_reset_globals(interp, function->register_count + function->constant_count);
+    memcpy(env->values + function->register_count, function->constants,
+           function->constant_count * sizeof(value_t));
+
+    value_t *regs = env->values;
+    const rg_instr_t *ip = function->code;
+    size_t depth = 0;
+    value_t result;
+    rg_instr_t instr;
+
+#define NEXT() do { instr = *ip++; goto *dispatch[instr.op]; } while (0)
+#define A regs[instr.a]
+#define B regs[instr.b]
+#define C regs[instr.c]
+
+// Numbers are one word written, the rest goes to runtime.h
+#define BINARY(label, op, store) \
+    label: { \
+        value_t left = B, right = C; \
+        if (value_is_number(left) && value_is_number(right)) \
+            store(&A, value_as_number(left), value_as_number(right)); \
+        else \
+            A = value_binary_op(interp->heap, op, left, right); \
+        NEXT(); \
+    }
+#define ARITHMETIC(to, result) (*(to) = create_number_value(result))
+#define ADD(to, a, b) ARITHMETIC(to, (a) + (b))
+#define SUBTRACT(to, a, b) ARITHMETIC(to, (a) - (b))
+#define MULTIPLY(to, a, b) ARITHMETIC(to, (a) * (b))
+#define DIVIDE(to, a, b) ARITHMETIC(to, (a) / (b))
+#define COMPARE(to, result) (*(to) = create_boolean_value(result))
+#define GREATER(to, a, b) COMPARE(to, (a) > (b))
+#define LESS(to, a, b) COMPARE(to, (a) < (b))
+#define GREATER_EQUAL(to, a, b) COMPARE(to, (a) >= (b))
+#define LESS_EQUAL(to, a, b) COMPARE(to, (a) <= (b))
+
+    NEXT();
+
+op_move:
+    A = B;
+    NEXT();
+op_load_null:
+    A = create_null_value();
+    NEXT();
+op_load_true:
+    A = create_boolean_value(true);
+    NEXT();
+op_load_false:
+    A = create_boolean_value(false);
+    NEXT();
+op_mark_const:
+    env->constants[instr.a] = true;
+    env->keys[instr.a] = function->register_names[instr.a];
+    NEXT();
+op_get_outer:
+    A = env_get_slot(env, instr.b, instr.c);
+    NEXT();
+op_set_outer: {
+    environment_t *frame = env_frame(env, instr.b);
+    if (frame->constants[instr.c])
+        elog("Cannot reassign to constant '%s'", frame->keys[instr.c]->text);
+    frame->values[instr.c] = A;
+    NEXT();
+}
+op_get_native:
+    A = env_get(interp->natives, module->atoms[instr.index]);
+    NEXT();
+
+    BINARY(op_add, OP_ADD, ADD)
+    BINARY(op_subtract, OP_SUBTRACT, SUBTRACT)
+    BINARY(op_multiply, OP_MULTIPLY, MULTIPLY)
+    BINARY(op_divide, OP_DIVIDE, DIVIDE)
+    BINARY(op_greater, OP_GREATER, GREATER)
+    BINARY(op_less, OP_LESS, LESS)
+    BINARY(op_greater_equal, OP_GREATER_EQUAL, GREATER_EQUAL)
+    BINARY(op_less_equal, OP_LESS_EQUAL, LESS_EQUAL)
+
+op_equals:
+    A = create_boolean_value(values_equal(B, C));
+    NEXT();
+op_not_equals:
+    A = create_boolean_value(!values_equal(B, C));
+    NEXT();
+op_negate:
+    if (!value_is_number(B))
+        elog("Operator '-' can't take %s", value_type_name(value_type_of(B)));
+    A = create_number_value(-value_as_number(B));
+    NEXT();
+op_not:
+    A = create_boolean_value(!value_truthy(B));
+    NEXT();
+op_truthy:
+    A = create_boolean_value(value_truthy(B));
+    NEXT();
+
+op_jump:
+    ip += instr.jump;
+    NEXT();
+op_jump_if_false:
+    if (value_type_of(A) == VAL_BOOLEAN ? !value_as_boolean(A) : !value_truthy(A))
+        ip += instr.jump;
+    NEXT();
+op_jump_if_true:
+    if (value_type_of(A) == VAL_BOOLEAN ? value_as_boolean(A) : value_truthy(A))
+        ip += instr.jump;
+    NEXT();
+
+op_closure: {
+    A = create_function_value(interp->heap, NULL, &module->functions[instr.index], env);
+    env->captured = true;
+    NEXT();
+}
+
+op_call: {
+    const uint16_t *args = ip->args;
+    uint32_t argument_count = instr.c;
+    ip += (argument_count + 3) / 4;
+    value_t callee = B;
+
+    value_type type = value_type_of(callee);
+    if (type == VAL_NATIVE_FUNCTION) {
+        value_t on_stack[NATIVE_ARGS_ON_STACK];
+        value_t *values = on_stack;
+        if (argument_count > NATIVE_ARGS_ON_STACK) {
+            if (argument_count > interp->rg_arguments_capacity) {
+                free(interp->rg_arguments);
+                interp->rg_arguments_capacity = 0;
+                interp->rg_arguments = (value_t *)malloc(argument_count * sizeof(value_t));
+                if (!interp->rg_arguments)
+                    elog("Error allocation memory for native arguments");
+                interp->rg_arguments_capacity = argument_count;
+            }
+            values = interp->rg_arguments;
+        }
+        for (uint32_t i = 0; i < argument_count; i++)
+            values[i] = regs[args[i]];
+        A = value_as_native(callee)->function(interp->heap, values, argument_count);
+        NEXT();
+    }
+    if (type != VAL_FUNCTION)
+        elog("Can't call a %s", value_type_name(type));
+    const function_object_t *closure = value_as_function(callee);
+    if (!closure->code)
+        elog("Can't call a function of the tree walker from register code");
+
+    const rg_function_t *target = (const rg_function_t *)closure->code;
+    if (depth == RG_MAX_CALL_DEPTH)
+        elog("Call stack overflow in '%s', more than %d nested calls", target->name->text, RG_MAX_CALL_DEPTH);
+
+    // Missing arguments stay null, extra ones are dropped
+    environment_t *frame = enter(interp, closure->env, target);
+    uint32_t params = argument_count < target->param_count ? argument_count : target->param_count;
+    for (uint32_t i = 0; i < params; i++)
+        frame->values[i] = regs[args[i]];
+
+    calls[depth++] = (rg_call_t){ function, ip, env, instr.a };
+    function = target;
+    env = frame;
+    regs = frame->values;
+    ip = target->code;
+    NEXT();
+}
+
+op_return_null:
+    result = create_null_value();
+    goto leave;
+op_return:
+    result = A;
+leave:
+    if (depth == 0)
+        goto done;
+
+    interp_release_frame(interp, env);
+    depth--;
+    function = calls[depth].function;
+    ip = calls[depth].ip;
+    env = calls[depth].env;
+    regs = env->values;
+    regs[calls[depth].result] = result;
+    NEXT();
+
+op_array: {
+    const uint16_t *args = ip->args;
+    uint32_t count = instr.c;
+    ip += (count + 3) / 4;
+    value_t array = create_array_value(interp->heap, NULL, 0);
+    for (uint32_t i = 0; i < count; i++)
+        array_push(array, regs[args[i]]);
+    A = array;
+    NEXT();
+}
+op_index:
+    A = value_index(B, C);
+    NEXT();
+op_set_index:
+    value_set_index(A, B, C);
+    NEXT();
+op_get_field:
+    A = value_property(B, module->atoms[instr.c]);
+    NEXT();
+op_set_field:
+    set_struct_field(A, module->atoms[instr.b], C);
+    NEXT();
+
+done:
+    interp->result = result;
+    return result;
+
+#undef NEXT
+#undef A
+#undef B
+#undef C
+#undef BINARY
+#undef ARITHMETIC
+#undef ADD
+#undef SUBTRACT
+#undef MULTIPLY
+#undef DIVIDE
+#undef COMPARE
+#undef GREATER
+#undef LESS
+#undef GREATER_EQUAL
+#undef LESS_EQUAL
+}
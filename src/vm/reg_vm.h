@@ -0,0 +1,30 @@
+#ifndef REG_VM_H
+#define REG_VM_H
+
+#include "reg_code.h"
+#include "../envr/envr.h"
+#include "../interp/interp.h"
+
+/*
+ * Runs register code, the counterpart of the stack VM: one computed-goto
+ * loop, calls push an rg_call_t instead of recursing. There is no value
+ * stack, an instruction reads and writes registers of the current frame
+ * directly, frames are taken from the interpreter like the stack VM's and
+ * sized for the function's registers and constants. Function values point
+ * at the rg_function_t and only run here.
+ */
+
+#define RG_MAX_CALL_DEPTH 10000
+
+typedef struct rg_call_t {
+    const rg_function_t *function;
+    const rg_instr_t *ip;
+    environment_t *env;
+    uint16_t result; // register of the caller the call's value goes to
+} rg_call_t;
+
+// Runs function 0 in a fresh global frame of interp, returns the value of
+// a top-level return or null. The module must outlive values it created.
+value_t rg_run(interp_t *interp, const rg_module_t *module);
+
+#endif
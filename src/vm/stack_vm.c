@@ -0,0 +1,301 @@
+#include "stack_vm.h"
+#include "../interp/runtime.h"
+#include "../utils/logger.h"
+
+#include <stdlib.h>
+
+static const atom_t *slot_name(const bc_module_t *module, const bc_function_t *function, uint32_t slot) {
+    uint32_t name = module->slot_names[function->slot_names + slot];
+    return name == BC_NO_NAME ? atom_from_cstr("?") : module->atoms[name];
+}
+
+value_t vm_run(interp_t *interp, const bc_module_t *module) {
+    if (!interp || !module)
+        elog("Can't run bytecode, NULL ptr on interpreter or module");
+    if (module->functions_count == 0)
+        elog("Can't run bytecode, the module has no top level");
+
+    static void *const dispatch[BC_OP_COUNT] = {
+        [BC_NUMBER] = &&op_number,
+        [BC_STRING] = &&op_string,
+        [BC_TRUE] = &&op_true,
+        [BC_FALSE] = &&op_false,
+        [BC_NULL] = &&op_null,
+        [BC_POP] = &&op_pop,
+        [BC_GET_LOCAL] = &&op_get_local,
+        [BC_SET_LOCAL] = &&op_set_local,
+        [BC_DEFINE] = &&op_define,
+        [BC_DEFINE_CONST] = &&op_define_const,
+        [BC_GET_OUTER] = &&op_get_outer,
+        [BC_SET_OUTER] = &&op_set_outer,
+        [BC_GET_NATIVE] = &&op_get_native,
+        [BC_ADD] = &&op_add,
+        [BC_SUBTRACT] = &&op_subtract,
+        [BC_MULTIPLY] = &&op_multiply,
+        [BC_DIVIDE] = &&op_divide,
+        [BC_EQUALS] = &&op_equals,
+        [BC_NOT_EQUALS] = &&op_not_equals,
+        [BC_GREATER] = &&op_greater,
+        [BC_LESS] = &&op_less,
+        [BC_GREATER_EQUAL] = &&op_greater_equal,
+        [BC_LESS_EQUAL] = &&op_less_equal,
+        [BC_NEGATE] = &&op_negate,
+        [BC_NOT] = &&op_not,
+        [BC_TRUTHY] = &&op_truthy,
+        [BC_JUMP] = &&op_jump,
+        [BC_JUMP_IF_FALSE] = &&op_jump_if_false,
+        [BC_JUMP_IF_TRUE] = &&op_jump_if_true,
+        [BC_CLOSURE] = &&op_closure,
+        [BC_CALL] = &&op_call,
+        [BC_RETURN] = &&op_return,
+        [BC_RETURN_NULL] = &&op_return_null,
+        [BC_ARRAY] = &&op_array,
+        [BC_INDEX] = &&op_index,
+        [BC_SET_INDEX] = &&op_set_index,
+        [BC_GET_FIELD] = &&op_get_field,
+        [BC_SET_FIELD] = &&op_set_field,
+    };
+
+    // Kept by the interpreter, a run that raises leaves them to the next one
+    if (!interp->vm_stack)
+        interp->vm_stack = (value_t *)malloc(VM_STACK_SIZE * sizeof(value_t));
+    if (!interp->vm_calls)
+        interp->vm_calls = (vm_call_t *)malloc(VM_MAX_CALL_DEPTH * sizeof(vm_call_t));
+    if (!interp->vm_stack || !interp->vm_calls)
+        elog("Error allocation memory for the VM stacks");
+    value_t *stack = interp->vm_stack;
+    vm_call_t *calls = interp->vm_calls;
+
+    const bc_function_t *function = &module->functions[0];
+    if (function->max_stack > VM_STACK_SIZE)
+        elog("Top level needs %u stack values, the VM has %d", function->max_stack, VM_STACK_SIZE);
+
+    environment_t *env = interp_reset_globals(interp, function->frame_size);
+    const bc_instr_t *ip = module->code + function->code_start;
+    value_t *sp = stack;
+    size_t depth = 0;
+    value_t result;
+    bc_instr_t instr;
+
+#define NEXT() do { instr = *ip++; goto *dispatch[BC_OP(instr)]; } while (0)
+#define OPERAND BC_OPERAND(instr)
+
+// Numbers are combined in place of the left operand, one word written;
+// everything else goes through runtime.h
+#define BINARY(label, op, store) \
+    label: { \
+        value_t *left = sp - 2, *right = sp - 1; \
+        if (value_is_number(*left) && value_is_number(*right)) \
+            store(left, value_as_number(*left), value_as_number(*right)); \
+        else \
+            *left = value_binary_op(interp->heap, op, *left, *right); \
+        sp--; \
+        NEXT(); \
+    }
+#define ADD(to, a, b) (*(to) = create_number_value((a) + (b)))
+#define SUBTRACT(to, a, b) (*(to) = create_number_value((a) - (b)))
+#define MULTIPLY(to, a, b) (*(to) = create_number_value((a) * (b)))
+#define DIVIDE(to, a, b) (*(to) = create_number_value((a) / (b)))
+#define COMPARE(to, result) (*(to) = create_boolean_value(result))
+#define GREATER(to, a, b) COMPARE(to, (a) > (b))
+#define LESS(to, a, b) COMPARE(to, (a) < (b))
+#define GREATER_EQUAL(to, a, b) COMPARE(to, (a) >= (b))
+#define LESS_EQUAL(to, a, b) COMPARE(to, (a) <= (b))
+
+    NEXT();
+
+op_number:
+    *sp++ = create_number_value(module->numbers[OPERAND]);
+    NEXT();
+op_string:
+    *sp++ = create_string_value(&module->strings[OPERAND]);
+    NEXT();
+op_true:
+    *sp++ = create_boolean_value(true);
+    NEXT();
+op_false:
+    *sp++ = create_boolean_value(false);
+    NEXT();
+op_null:
+    *sp++ = create_null_value();
+    NEXT();
+op_pop:
+    sp--;
+    NEXT();
+
+op_get_local:
+    *sp++ = env->values[OPERAND];
+    NEXT();
+op_set_local:
+    if (env->constants[OPERAND])
+        elog("Cannot reassign to constant '%s'", slot_name(module, function, OPERAND)->text);
+    env->values[OPERAND] = sp[-1];
+    NEXT();
+op_define:
+    env->values[OPERAND] = *--sp;
+    env->constants[OPERAND] = false;
+    NEXT();
+op_define_const:
+    env->values[OPERAND] = *--sp;
+    env->keys[OPERAND] = slot_name(module, function, OPERAND);
+    env->constants[OPERAND] = true;
+    NEXT();
+op_get_outer:
+    *sp++ = env_get_slot(env, BC_OUTER_DEPTH(OPERAND), BC_OUTER_SLOT(OPERAND));
+    NEXT();
+op_set_outer: {
+    environment_t *frame = env_frame(env, BC_OUTER_DEPTH(OPERAND));
+    if (frame->constants[BC_OUTER_SLOT(OPERAND)])
+        elog("Cannot reassign to constant '%s'", frame->keys[BC_OUTER_SLOT(OPERAND)]->text);
+    frame->values[BC_OUTER_SLOT(OPERAND)] = sp[-1];
+    NEXT();
+}
+op_get_native:
+    *sp++ = env_get(interp->natives, module->atoms[OPERAND]);
+    NEXT();
+
+    BINARY(op_add, OP_ADD, ADD)
+    BINARY(op_subtract, OP_SUBTRACT, SUBTRACT)
+    BINARY(op_multiply, OP_MULTIPLY, MULTIPLY)
+    BINARY(op_divide, OP_DIVIDE, DIVIDE)
+    BINARY(op_greater, OP_GREATER, GREATER)
+    BINARY(op_less, OP_LESS, LESS)
+    BINARY(op_greater_equal, OP_GREATER_EQUAL, GREATER_EQUAL)
+    BINARY(op_less_equal, OP_LESS_EQUAL, LESS_EQUAL)
+
+op_equals:
+    sp[-2] = create_boolean_value(values_equal(sp[-2], sp[-1]));
+    sp--;
+    NEXT();
+op_not_equals:
+    sp[-2] = create_boolean_value(!values_equal(sp[-2], sp[-1]));
+    sp--;
+    NEXT();
+op_negate:
+    if (!value_is_number(sp[-1]))
+        elog("Operator '-' can't take %s", value_type_name(value_type_of(sp[-1])));
+    sp[-1] = create_number_value(-value_as_number(sp[-1]));
+    NEXT();
+op_not:
+    sp[-1] = create_boolean_value(!value_truthy(sp[-1]));
+    NEXT();
+op_truthy:
+    sp[-1] = create_boolean_value(value_truthy(sp[-1]));
+    NEXT();
+
+op_jump:
+    ip += BC_JUMP(instr);
+    NEXT();
+op_jump_if_false:
+    sp--;
+    if (value_type_of(*sp) == VAL_BOOLEAN ? !value_as_boolean(*sp) : !value_truthy(*sp))
+        ip += BC_JUMP(instr);
+    NEXT();
+op_jump_if_true:
+    sp--;
+    if (value_type_of(*sp) == VAL_BOOLEAN ? value_as_boolean(*sp) : value_truthy(*sp))
+        ip += BC_JUMP(instr);
+    NEXT();
+
+op_closure: {
+    value_t closure = create_function_value(interp->heap, NULL, &module->functions[OPERAND], env);
+    env->captured = true;
+    *sp++ = closure;
+    NEXT();
+}
+
+op_call: {
+    uint32_t argument_count = OPERAND;
+    value_t *callee = sp - argument_count - 1;
+
+    value_type type = value_type_of(*callee);
+    if (type == VAL_NATIVE_FUNCTION) {
+        *callee = value_as_native(*callee)->function(interp->heap, callee + 1, argument_count);
+        sp = callee + 1;
+        NEXT();
+    }
+    if (type != VAL_FUNCTION)
+        elog("Can't call a %s", value_type_name(type));
+    const function_object_t *closure = value_as_function(*callee);
+    if (!closure->code)
+        elog("Can't call a function of the tree walker from bytecode");
+
+    const bc_function_t *target = (const bc_function_t *)closure->code;
+    if (depth == VM_MAX_CALL_DEPTH)
+        elog("Call stack overflow in '%s', more than %d nested calls",
+             module->atoms[target->name]->text, VM_MAX_CALL_DEPTH);
+    if (target->max_stack > (size_t)(stack + VM_STACK_SIZE - callee))
+        elog("Value stack overflow in '%s'", module->atoms[target->name]->text);
+
+    // Missing arguments stay null, extra ones are dropped
+    environment_t *frame = interp_take_frame(interp, closure->env, target->frame_size);
+    uint32_t params = argument_count < target->param_count ? argument_count : target->param_count;
+    for (uint32_t i = 0; i < params; i++)
+        frame->values[i] = callee[1 + i];
+    sp = callee;
+
+    calls[depth++] = (vm_call_t){ function, ip, env };
+    function = target;
+    env = frame;
+    ip = module->code + target->code_start;
+    NEXT();
+}
+
+op_return_null:
+    *sp++ = create_null_value();
+    goto op_return;
+op_return:
+    result = *--sp;
+    if (depth == 0)
+        goto done;
+
+    interp_release_frame(interp, env);
+    depth--;
+    function = calls[depth].function;
+    ip = calls[depth].ip;
+    env = calls[depth].env;
+    *sp++ = result;
+    NEXT();
+
+op_array: {
+    uint32_t count = OPERAND;
+    sp -= count;
+    *sp = create_array_value(interp->heap, sp, count);
+    sp++;
+    NEXT();
+}
+op_index:
+    sp[-2] = value_index(sp[-2], sp[-1]);
+    sp--;
+    NEXT();
+op_set_index:
+    value_set_index(sp[-3], sp[-2], sp[-1]);
+    sp[-3] = sp[-1];
+    sp -= 2;
+    NEXT();
+op_get_field:
+    sp[-1] = value_property(sp[-1], module->atoms[OPERAND]);
+    NEXT();
+op_set_field:
+    set_struct_field(sp[-2], module->atoms[OPERAND], sp[-1]);
+    sp[-2] = sp[-1];
+    sp--;
+    NEXT();
+
+done:
+    interp->result = result;
+    return result;
+
+#undef NEXT
+#undef OPERAND
+#undef BINARY
+#undef ADD
+#undef SUBTRACT
+#undef MULTIPLY
+#undef DIVIDE
+#undef COMPARE
+#undef GREATER
+#undef LESS
+#undef GREATER_EQUAL
+#undef LESS_EQUAL
+}
@@ -0,0 +1,31 @@
+#ifndef STACK_VM_H
+#define STACK_VM_H
+
+#include "bytecode.h"
+#include "../envr/envr.h"
+#include "../interp/interp.h"
+
+/*
+ * Runs a bytecode module with a single dispatch loop, computed goto on the
+ * opcode byte, and no recursion: calls push a vm_call_t and continue in
+ * the callee's code. Temporaries live on one value stack, variables in
+ * environment_t frames taken from the interpreter, whose heap, natives and
+ * frame pool the VM shares, so values behave exactly as in the tree walker
+ * (see runtime.h). Function values of a module point at its bc_function_t,
+ * they can't be called by the tree walker and the other way round.
+ */
+
+#define VM_STACK_SIZE (1 << 16)
+#define VM_MAX_CALL_DEPTH 10000
+
+typedef struct vm_call_t {
+    const bc_function_t *function;
+    const bc_instr_t *ip;
+    environment_t *env;
+} vm_call_t;
+
+// Runs function 0 in a fresh global frame of interp, returns the value of
+// a top-level return or null. The module must outlive values it created.
+value_t vm_run(interp_t *interp, const bc_module_t *module);
+
+#endif